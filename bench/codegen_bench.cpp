@@ -0,0 +1,338 @@
+// 生成代码质量基准：把 bench/programs/ 下的每个程序在每个优化级别编译、汇编、链接并运行，
+// 检查输出与 <name>.expected 一致，报告静态指令数、.text 字节数、动态指令数和运行时间，
+// 并与检入的基线比较：动态指令数比基线多出 --threshold 以上即失败（退出码 1）。
+// scalar 是关掉向量循环（--simd=off）的 -O1，最后按程序列出 -O1 相对它的加速比。
+//
+// 动态指令数：perf stat -e instructions:u 可用时用 perf，否则用 --count-insns 插桩版本
+// （各基本块入口累加计数器，退出时打印到 stderr），两者对同一程序的结果基本一致。
+// 汇编与链接：PATH 中有 nasm 和 ld 时走 nasm -f elf64 + ld，否则（或 --builtin）用内置编码器。
+//
+//   codegen_bench [--programs DIR] [--baseline FILE] [--threshold PCT] [--reps N]
+//                 [--work DIR] [--no-perf] [--builtin] [--update-baseline]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "compiler.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// 参与比较的优化级别
+struct Level {
+    std::string name;
+    int opt;
+    bool size; // -Os
+    Simd simd;
+};
+
+const std::vector<Level> kLevels = {{"O0", 0, false, Simd::Auto}, {"O1", 1, false, Simd::Auto},
+                                    {"Os", 1, true, Simd::Auto}, {"scalar", 1, false, Simd::Off}};
+
+struct Config {
+    fs::path programs{CODEGEN_PROGRAMS_DIR};
+    fs::path baseline{CODEGEN_BASELINE};
+    fs::path work{fs::temp_directory_path() / "codegen_bench"};
+    double threshold{3.0}; // 百分比
+    int reps{5};
+    bool perf{true};
+    bool builtin{false};
+    bool update{false};
+};
+
+struct Sample {
+    std::size_t staticInstrs{0};
+    std::uint64_t textBytes{0}; // 内置编码器得到的 .text 大小
+    std::uint64_t dynamicInstrs{0};
+    double seconds{0}; // 各轮中最快的一次
+};
+
+// 基线：<program>/<level> -> (静态指令数, 动态指令数)
+using Baseline = std::map<std::string, std::pair<std::size_t, std::uint64_t> >;
+
+std::string read_file(const fs::path &path) {
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream s;
+    s << in.rdbuf();
+    return s.str();
+}
+
+// 运行 argv，stdout / stderr 重定向到文件；返回退出码，被信号终止时返回 128 + 信号
+int run(const std::vector<std::string> &argv, const fs::path &out, const fs::path &err) {
+    const pid_t pid = fork();
+    if (pid < 0)
+        throw std::runtime_error("fork failed");
+    if (pid == 0) {
+        const int o = open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        const int e = open(err.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (o < 0 || e < 0)
+            _exit(127);
+        dup2(o, STDOUT_FILENO);
+        dup2(e, STDERR_FILENO);
+        std::vector<char *> args;
+        for (auto &a: argv)
+            args.push_back(const_cast<char *>(a.c_str()));
+        args.push_back(nullptr);
+        execvp(args[0], args.data());
+        _exit(127);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+bool have_tool(const std::string &name, const fs::path &work) {
+    return run({"sh", "-c", "command -v " + name}, work / "probe.out", work / "probe.err") == 0;
+}
+
+// perf stat -x, 的输出形如 "12345,,instructions:u,..."；不支持时计数字段为 <not supported>
+bool parse_perf(const std::string &text, std::uint64_t &count) {
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line))
+        if (line.find("instructions") != std::string::npos) {
+            const auto comma = line.find(',');
+            const auto field = line.substr(0, comma);
+            if (field.empty() || field.find_first_not_of("0123456789") != std::string::npos)
+                return false;
+            count = std::strtoull(field.c_str(), nullptr, 10);
+            return true;
+        }
+    return false;
+}
+
+bool perf_works(const fs::path &work) {
+    if (!have_tool("perf", work))
+        return false;
+    run({"perf", "stat", "-x,", "-e", "instructions:u", "--", "true"}, work / "probe.out", work / "probe.err");
+    std::uint64_t count = 0;
+    return parse_perf(read_file(work / "probe.err"), count);
+}
+
+// 编译并生成可执行文件 exe；返回统计（静态指令数与各节大小）
+CompileStats build(const std::string &source, const Level &level, const bool countInsns, const bool viaNasm,
+                   const fs::path &exe) {
+    Options options;
+    options.emit = viaNasm ? EmitKind::Asm : EmitKind::Executable;
+    options.optLevel = level.opt;
+    options.optimizeSize = level.size;
+    options.simd = level.simd;
+    options.countInstructions = countInsns;
+    options.stats = true;
+    const auto result = compile(source, options);
+    if (!result.ok)
+        throw std::runtime_error("compile error: " + result.error);
+
+    if (viaNasm) {
+        const auto asmPath = fs::path(exe).concat(".asm"), objPath = fs::path(exe).concat(".o");
+        std::ofstream(asmPath, std::ios::binary) << result.assembly;
+        const auto log = fs::path(exe).concat(".log");
+        if (run({"nasm", "-f", "elf64", asmPath.string(), "-o", objPath.string()}, log, log) != 0)
+            throw std::runtime_error("nasm failed: " + read_file(log));
+        if (run({"ld", objPath.string(), "-o", exe.string()}, log, log) != 0)
+            throw std::runtime_error("ld failed: " + read_file(log));
+    } else {
+        std::ofstream out(exe, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(result.binary.data()),
+                  static_cast<std::streamsize>(result.binary.size()));
+        out.close();
+        fs::permissions(exe, fs::perms::owner_all, fs::perm_options::add);
+    }
+    return result.stats;
+}
+
+Sample measure(const fs::path &program, const Level &level, const Config &cfg, const bool usePerf,
+               const bool viaNasm, const std::string &tag) {
+    const auto source = read_file(program);
+    const auto expected = read_file(fs::path(program).replace_extension(".expected"));
+    const auto exe = cfg.work / tag;
+    const auto out = cfg.work / (tag + ".out"), err = cfg.work / (tag + ".err");
+
+    auto check_output = [&](const char *what) {
+        if (read_file(out) != expected)
+            throw std::runtime_error(std::string(what) + " output differs from " +
+                                     fs::path(program).replace_extension(".expected").string());
+    };
+
+    Sample s;
+    const auto stats = build(source, level, false, viaNasm, exe);
+    s.staticInstrs = stats.machineInstrs;
+    s.textBytes = stats.textBytes;
+    for (int r = 0; r < cfg.reps; ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        const int code = run({exe.string()}, out, err);
+        const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (code != 0)
+            throw std::runtime_error("program exited with status " + std::to_string(code));
+        if (r == 0 || secs < s.seconds)
+            s.seconds = secs;
+    }
+    check_output("program");
+
+    if (usePerf) {
+        run({"perf", "stat", "-x,", "-e", "instructions:u", "--", exe.string()}, out, err);
+        if (!parse_perf(read_file(err), s.dynamicInstrs))
+            throw std::runtime_error("cannot parse perf output: " + read_file(err));
+    } else {
+        const auto counted = fs::path(exe).concat(".count");
+        build(source, level, true, viaNasm, counted);
+        if (run({counted.string()}, out, err) != 0)
+            throw std::runtime_error("instrumented program failed");
+        check_output("instrumented program");
+        s.dynamicInstrs = std::strtoull(read_file(err).c_str(), nullptr, 10);
+    }
+    return s;
+}
+
+Baseline read_baseline(const fs::path &path) {
+    Baseline b;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string program, level;
+        std::size_t st = 0;
+        std::uint64_t dyn = 0;
+        if (!(fields >> program) || program[0] == '#')
+            continue;
+        if (!(fields >> level >> st >> dyn))
+            throw std::runtime_error(path.string() + ": malformed line: " + line);
+        b[program + "/" + level] = {st, dyn};
+    }
+    return b;
+}
+
+void write_baseline(const fs::path &path, const std::map<std::string, Sample> &results) {
+    std::ofstream out(path);
+    out << "# codegen_bench baseline, regenerate with: codegen_bench --update-baseline\n"
+        << "# program level static_instructions dynamic_instructions\n";
+    for (auto &[key, s]: results) {
+        const auto slash = key.find('/');
+        out << key.substr(0, slash) << " " << key.substr(slash + 1) << " "
+            << s.staticInstrs << " " << s.dynamicInstrs << "\n";
+    }
+    if (!out)
+        throw std::runtime_error("Cannot write " + path.string());
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Config cfg;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--programs" && i + 1 < argc)
+                cfg.programs = argv[++i];
+            else if (arg == "--baseline" && i + 1 < argc)
+                cfg.baseline = argv[++i];
+            else if (arg == "--threshold" && i + 1 < argc)
+                cfg.threshold = std::atof(argv[++i]);
+            else if (arg == "--reps" && i + 1 < argc)
+                cfg.reps = std::max(1, std::atoi(argv[++i]));
+            else if (arg == "--work" && i + 1 < argc)
+                cfg.work = argv[++i];
+            else if (arg == "--no-perf")
+                cfg.perf = false;
+            else if (arg == "--builtin")
+                cfg.builtin = true;
+            else if (arg == "--update-baseline")
+                cfg.update = true;
+            else
+                throw std::invalid_argument("Unknown option: " + arg);
+        }
+        fs::create_directories(cfg.work);
+
+        std::vector<fs::path> programs;
+        for (auto &entry: fs::directory_iterator(cfg.programs))
+            if (entry.path().extension() == ".txt")
+                programs.push_back(entry.path());
+        std::sort(programs.begin(), programs.end());
+        if (programs.empty())
+            throw std::runtime_error("no programs in " + cfg.programs.string());
+
+        const bool usePerf = cfg.perf && perf_works(cfg.work);
+        const bool viaNasm = !cfg.builtin && have_tool("nasm", cfg.work) && have_tool("ld", cfg.work);
+        const auto baseline = cfg.update ? Baseline{} : read_baseline(cfg.baseline);
+        std::printf("toolchain: %s, dynamic counts: %s, threshold: %.1f%%\n\n",
+                    viaNasm ? "nasm + ld" : "built-in ELF writer",
+                    usePerf ? "perf stat instructions:u" : "instrumented (--count-insns)", cfg.threshold);
+        std::printf("  %-16s %-6s %10s %8s %14s %11s %14s %9s\n",
+                    "program", "level", "static", ".text", "dynamic", "time (ms)", "baseline", "delta");
+
+        std::map<std::string, Sample> results;
+        int failures = 0;
+        for (auto &program: programs) {
+            const auto name = program.stem().string();
+            for (auto &level: kLevels) {
+                const auto key = name + "/" + level.name;
+                Sample s;
+                try {
+                    s = measure(program, level, cfg, usePerf, viaNasm, name + "-" + level.name);
+                } catch (const std::exception &e) {
+                    std::printf("  %-16s %-6s FAILED: %s\n", name.c_str(), level.name.c_str(), e.what());
+                    ++failures;
+                    continue;
+                }
+                results[key] = s;
+
+                std::printf("  %-16s %-6s %10zu %8llu %14llu %11.3f", name.c_str(), level.name.c_str(),
+                            s.staticInstrs, static_cast<unsigned long long>(s.textBytes),
+                            static_cast<unsigned long long>(s.dynamicInstrs), s.seconds * 1e3);
+                const auto it = baseline.find(key);
+                if (it == baseline.end()) {
+                    std::printf(" %14s\n", cfg.update ? "" : "(new)");
+                    continue;
+                }
+                const auto base = it->second.second;
+                const double delta = base ? 100.0 * (static_cast<double>(s.dynamicInstrs) - base) / base : 0.0;
+                const bool regressed = delta > cfg.threshold;
+                std::printf(" %14llu %+8.2f%%%s\n", static_cast<unsigned long long>(base), delta,
+                            regressed ? "  << REGRESSION" : "");
+                if (regressed)
+                    ++failures;
+            }
+        }
+
+        // 向量循环的收益：同一程序 scalar 与 -O1 的动态指令数和时间之比（只列出有向量循环的程序）
+        std::printf("\n  %-16s %14s %10s\n", "O1 vs scalar", "dynamic", "time");
+        for (auto &program: programs) {
+            const auto name = program.stem().string();
+            const auto vec = results.find(name + "/O1"), scalar = results.find(name + "/scalar");
+            if (vec == results.end() || scalar == results.end() || vec->second.dynamicInstrs == 0 ||
+                vec->second.dynamicInstrs == scalar->second.dynamicInstrs || vec->second.seconds <= 0)
+                continue;
+            std::printf("  %-16s %13.2fx %9.2fx\n", name.c_str(),
+                        static_cast<double>(scalar->second.dynamicInstrs) / vec->second.dynamicInstrs,
+                        scalar->second.seconds / vec->second.seconds);
+        }
+
+        if (cfg.update) {
+            write_baseline(cfg.baseline, results);
+            std::printf("\nbaseline written to %s\n", cfg.baseline.string().c_str());
+        }
+        if (failures > 0) {
+            std::printf("\n%d failure(s)\n", failures);
+            return 1;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
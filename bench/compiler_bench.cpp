@@ -0,0 +1,161 @@
+// 编译器吞吐量基准：对每种合成程序、每个规模，用 compile(--stats) 得到各阶段耗时，
+// 报告 lines/s、bytes/s，以及规模扩大时每行耗时的增长（用来发现超线性的阶段）。
+//
+//   compiler_bench [--shape NAME|all] [--sizes 2000,8000,32000] [--seed N] [--reps N] [--json]
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "compiler.hpp"
+#include "generator.hpp"
+
+namespace {
+
+// 规模扩大 k 倍时，某阶段的耗时增长超过 k * kSuperLinear 倍就标记出来
+constexpr double kSuperLinear = 2.0;
+
+struct Measurement {
+    std::size_t lines{0};
+    std::size_t bytes{0};
+    std::vector<std::pair<std::string, double> > phases; // 各轮中最快的一次
+    double total{0};
+};
+
+Measurement measure(const std::string &source, const std::size_t lines, const int reps) {
+    Options options;
+    options.emit = EmitKind::Object; // 包含编码与 ELF 输出
+    options.stats = true;
+
+    Measurement m;
+    m.lines = lines;
+    m.bytes = source.size();
+    for (int r = 0; r < reps; ++r) {
+        auto input = SourceInput::from_string(source);
+        const auto result = compile(input, options);
+        if (!result.ok)
+            throw std::runtime_error("generated program failed to compile: " + result.error);
+
+        // 同名阶段（同一个 pass 跑两次）已在 CompileStats 中合并
+        double total = 0;
+        for (auto &p: result.stats.phases)
+            total += p.second;
+        if (r == 0 || total < m.total) {
+            m.phases = result.stats.phases;
+            m.total = total;
+        }
+    }
+    m.phases.emplace_back("total", m.total);
+    return m;
+}
+
+std::vector<std::size_t> parse_sizes(const std::string &text) {
+    std::vector<std::size_t> sizes;
+    std::stringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ','))
+        sizes.push_back(std::strtoul(item.c_str(), nullptr, 10));
+    return sizes;
+}
+
+void print_table(const char *shape, const std::vector<Measurement> &runs) {
+    std::printf("== %s ==\n", shape);
+    std::printf("  %-36s", "phase \\ lines");
+    for (auto &m: runs)
+        std::printf(" %14zu", m.lines);
+    std::printf("  %s\n", "growth/line");
+
+    for (std::size_t p = 0; p < runs.front().phases.size(); ++p) {
+        const auto &name = runs.front().phases[p].first;
+        std::printf("  %-36s", name.c_str());
+        for (auto &m: runs)
+            std::printf(" %11.3f ms", m.phases[p].second * 1e3);
+
+        // 相邻两个规模之间每行耗时的最大增长倍数；1.0 表示线性
+        double worst = 0;
+        for (std::size_t i = 1; i < runs.size(); ++i) {
+            const double a = runs[i - 1].phases[p].second / static_cast<double>(runs[i - 1].lines);
+            const double b = runs[i].phases[p].second / static_cast<double>(runs[i].lines);
+            if (a > 1e-9)
+                worst = std::max(worst, b / a);
+        }
+        std::printf("  %6.2fx%s\n", worst, worst > kSuperLinear ? "  << super-linear?" : "");
+    }
+
+    std::printf("  %-36s", "lines/s");
+    for (auto &m: runs)
+        std::printf(" %14.0f", m.lines / m.total);
+    std::printf("\n  %-36s", "MB/s");
+    for (auto &m: runs)
+        std::printf(" %14.2f", m.bytes / m.total / (1 << 20));
+    std::printf("\n\n");
+}
+
+void print_json(const std::map<std::string, std::vector<Measurement> > &all) {
+    std::cout << "{\n";
+    std::size_t n = 0;
+    for (auto &[shape, runs]: all) {
+        std::cout << "  \"" << shape << "\": [";
+        for (std::size_t i = 0; i < runs.size(); ++i) {
+            const auto &m = runs[i];
+            std::cout << (i ? "," : "") << "\n    {\"lines\": " << m.lines << ", \"bytes\": " << m.bytes
+                    << ", \"lines_per_s\": " << m.lines / m.total << ", \"phases\": {";
+            for (std::size_t p = 0; p < m.phases.size(); ++p)
+                std::cout << (p ? ", " : "") << "\"" << m.phases[p].first << "\": " << m.phases[p].second;
+            std::cout << "}}";
+        }
+        std::cout << "\n  ]" << (++n < all.size() ? "," : "") << "\n";
+    }
+    std::cout << "}\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::vector<Shape> shapes = all_shapes();
+    std::vector<std::size_t> sizes = {2000, 8000, 32000};
+    std::uint64_t seed = 1;
+    int reps = 3;
+    bool json = false;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--shape" && i + 1 < argc) {
+                const std::string name = argv[++i];
+                shapes = name == "all" ? all_shapes() : std::vector<Shape>{parse_shape(name)};
+            } else if (arg == "--sizes" && i + 1 < argc)
+                sizes = parse_sizes(argv[++i]);
+            else if (arg == "--seed" && i + 1 < argc)
+                seed = std::strtoull(argv[++i], nullptr, 10);
+            else if (arg == "--reps" && i + 1 < argc)
+                reps = std::max(1, std::atoi(argv[++i]));
+            else if (arg == "--json")
+                json = true;
+            else
+                throw std::invalid_argument("Unknown option: " + arg);
+        }
+        if (sizes.empty())
+            throw std::invalid_argument("--sizes is empty");
+        std::sort(sizes.begin(), sizes.end());
+
+        std::map<std::string, std::vector<Measurement> > all;
+        for (const auto shape: shapes) {
+            std::vector<Measurement> runs;
+            for (const auto size: sizes)
+                runs.push_back(measure(generate_program(shape, size, seed), size, reps));
+            if (!json)
+                print_table(shape_name(shape), runs);
+            all[shape_name(shape)] = std::move(runs);
+        }
+        if (json)
+            print_json(all);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
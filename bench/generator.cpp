@@ -0,0 +1,257 @@
+#include "generator.hpp"
+
+#include <stdexcept>
+
+namespace {
+
+// splitmix64：输出只取决于种子，不依赖标准库实现
+class Rng {
+public:
+    explicit Rng(const std::uint64_t seed) : state(seed) {
+    }
+
+    std::uint64_t next() {
+        std::uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // [0, n)
+    std::size_t below(const std::size_t n) { return static_cast<std::size_t>(next() % n); }
+
+    std::string num(const std::size_t n) { return std::to_string(below(n)); }
+
+    // 非零常量，用作除数
+    std::string divisor() { return std::to_string(1 + below(9)); }
+
+private:
+    std::uint64_t state;
+};
+
+class Generator {
+public:
+    Generator(const std::size_t lines, const std::uint64_t seed) : target(lines), rng(seed) {
+    }
+
+    std::string run(const Shape shape) {
+        declare_base();
+        while (lines < target) {
+            switch (shape) {
+                case Shape::StraightLine: straight(); break;
+                case Shape::Nested: nested(1 + rng.below(48)); break;
+                case Shape::ManyVariables: many_variables(); break;
+                case Shape::LongStrings: long_string(); break;
+                case Shape::WideExpressions: assign(var(), wide(16 + rng.below(48))); break;
+                case Shape::DeepExpressions: assign(var(), deep(16 + rng.below(48))); break;
+                case Shape::Mixed: mixed(); break;
+                case Shape::Comments: comments(); break;
+                case Shape::Identifiers: identifiers(); break;
+            }
+        }
+        line("print(v0);");
+        return std::move(out);
+    }
+
+private:
+    static constexpr std::size_t kBaseVars = 16;
+
+    void line(const std::string &text) {
+        out.append(indent * 4, ' ');
+        out += text;
+        out += '\n';
+        ++lines;
+    }
+
+    std::string var() { return "v" + rng.num(kBaseVars); }
+
+    void declare_base() {
+        std::string decl = "int v0";
+        for (std::size_t i = 1; i < kBaseVars; ++i)
+            decl += ", v" + std::to_string(i);
+        line(decl + ";");
+        for (std::size_t i = 0; i < kBaseVars; ++i)
+            line("v" + std::to_string(i) + " = " + rng.num(100) + ";");
+        line("string msg = \"value: \";");
+    }
+
+    void assign(const std::string &target, const std::string &expr) { line(target + " = " + expr + ";"); }
+
+    std::string operand() { return rng.below(3) == 0 ? rng.num(1000) : var(); }
+
+    // a op b，除法只用非零常量
+    std::string binary(const std::string &a) {
+        switch (rng.below(4)) {
+            case 0: return a + " + " + operand();
+            case 1: return a + " - " + operand();
+            case 2: return a + " * " + operand();
+            default: return a + " / " + rng.divisor();
+        }
+    }
+
+    std::string wide(const std::size_t ops) {
+        std::string e = operand();
+        for (std::size_t i = 0; i < ops; ++i)
+            e = binary(e);
+        return e;
+    }
+
+    std::string deep(const std::size_t depth) {
+        std::string e = operand();
+        for (std::size_t i = 0; i < depth; ++i)
+            e = "(" + binary(e) + ")";
+        return e;
+    }
+
+    std::string condition() {
+        static const char *const ops[] = {"<", "<=", ">", ">=", "==", "!="};
+        return var() + " " + ops[rng.below(6)] + " " + rng.num(100);
+    }
+
+    void straight() {
+        assign(var(), binary(binary(operand())));
+        if (rng.below(16) == 0)
+            line("print(" + var() + ");");
+    }
+
+    // 嵌套 depth 层；while 循环体第一条语句让循环变量递增，保证循环有界
+    void nested(const std::size_t depth) {
+        if (depth == 0 || lines >= target) {
+            straight();
+            return;
+        }
+        if (rng.below(2) == 0) {
+            line("if (" + condition() + ") {");
+            ++indent;
+            nested(depth - 1);
+            --indent;
+            if (rng.below(2) == 0) {
+                line("} else {");
+                ++indent;
+                straight();
+                --indent;
+            }
+            line("}");
+        } else {
+            const auto v = var();
+            line("while (" + v + " < " + rng.num(100) + ") {");
+            ++indent;
+            assign(v, v + " + 1");
+            nested(depth - 1);
+            --indent;
+            line("}");
+        }
+    }
+
+    void many_variables() {
+        // 每 16 个变量一条声明，然后用最近声明过的变量做运算
+        std::string decl = "int";
+        for (std::size_t i = 0; i < 16; ++i)
+            decl += (i ? ", x" : " x") + std::to_string(declared + i);
+        line(decl + ";");
+        declared += 16;
+        for (std::size_t i = 0; i < 8; ++i) {
+            auto x = [this] { return "x" + std::to_string(rng.below(declared)); };
+            line(x() + " = " + x() + " + " + x() + ";");
+        }
+    }
+
+    void long_string() {
+        static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ 0123456789 .,:;!?-+*/=<>()";
+        std::string s;
+        const auto len = 200 + rng.below(1800);
+        for (std::size_t i = 0; i < len; ++i)
+            s += alphabet[rng.below(sizeof alphabet - 1)];
+        if (rng.below(2) == 0)
+            line("prints(\"" + s + "\");");
+        else
+            line("string s" + std::to_string(lines) + " = \"" + s + "\";");
+    }
+
+    // 块注释里有 *、**、/ 和看起来像注释开头的 "/*"，然后是行注释和一条语句
+    void comments() {
+        static const char *const words[] = {"loop", "*", "counter", "**", "a/b", "/*", "value", "***", "note"};
+        const auto rows = 2 + rng.below(8);
+        line("/*");
+        for (std::size_t r = 0; r < rows; ++r) {
+            std::string text = " *";
+            for (std::size_t w = 0; w < 8 + rng.below(8); ++w)
+                text += std::string(" ") + words[rng.below(sizeof words / sizeof *words)];
+            line(text);
+        }
+        line(" **/");
+        line(rng.below(2) == 0 ? "// " + std::to_string(lines) + ": line comment" : "# shell-style comment");
+        straight();
+    }
+
+    // 关键字开头的长名字：扫描器要一直读到名字结束才知道不是关键字
+    void identifiers() {
+        static const char *const stems[] = {"if", "else", "while", "int", "print", "prints", "string", "return", "value"};
+        const auto name = [this] {
+            std::string n = stems[rng.below(sizeof stems / sizeof *stems)];
+            for (std::size_t i = 0; i < 3 + rng.below(4); ++i)
+                n += "_" + std::string(stems[rng.below(sizeof stems / sizeof *stems)]);
+            return n + std::to_string(rng.below(64));
+        };
+        const auto a = name(), b = name(), c = name();
+        line("int " + a + ", " + b + ", " + c + ";");
+        line(a + " = " + var() + ";");
+        line(b + " = " + a + " + " + rng.num(100) + ";");
+        line(c + " = " + a + " * " + b + " - " + var() + ";");
+        line(var() + " = " + c + " / " + rng.divisor() + ";");
+    }
+
+    void mixed() {
+        switch (rng.below(6)) {
+            case 0: straight(); break;
+            case 1: nested(1 + rng.below(6)); break;
+            case 2: assign(var(), wide(8)); break;
+            case 3: assign(var(), deep(8)); break;
+            case 4: line("print(msg + " + var() + ");"); break;
+            default: line("prints(\"line " + std::to_string(lines) + "\");"); break;
+        }
+    }
+
+    std::size_t target;
+    Rng rng;
+    std::string out;
+    std::size_t lines{0};
+    std::size_t indent{0};
+    std::size_t declared{0};
+};
+
+} // namespace
+
+const char *shape_name(const Shape shape) {
+    switch (shape) {
+        case Shape::StraightLine: return "straight";
+        case Shape::Nested: return "nested";
+        case Shape::ManyVariables: return "many-vars";
+        case Shape::LongStrings: return "long-strings";
+        case Shape::WideExpressions: return "wide-expr";
+        case Shape::DeepExpressions: return "deep-expr";
+        case Shape::Mixed: return "mixed";
+        case Shape::Comments: return "comments";
+        case Shape::Identifiers: return "identifiers";
+    }
+    return "?";
+}
+
+const std::vector<Shape> &all_shapes() {
+    static const std::vector<Shape> shapes = {
+        Shape::StraightLine, Shape::Nested, Shape::ManyVariables, Shape::LongStrings,
+        Shape::WideExpressions, Shape::DeepExpressions, Shape::Mixed, Shape::Comments, Shape::Identifiers
+    };
+    return shapes;
+}
+
+Shape parse_shape(const std::string &name) {
+    for (const auto s: all_shapes())
+        if (name == shape_name(s))
+            return s;
+    throw std::invalid_argument("Unknown shape: " + name);
+}
+
+std::string generate_program(const Shape shape, const std::size_t lines, const std::uint64_t seed) {
+    return Generator(lines, seed).run(shape);
+}
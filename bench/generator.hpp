@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 基准测试用的合成程序生成器。相同的 (shape, size, seed) 总是生成相同的程序；
+// 生成的程序都能通过编译，循环都有界，除数都是非零常量。
+enum class Shape {
+    StraightLine, // 超长的顺序赋值
+    Nested, // 深层嵌套的 if / while
+    ManyVariables, // 成千上万个变量
+    LongStrings, // 很长的字符串字面量
+    WideExpressions, // 一条表达式里几十个运算符
+    DeepExpressions, // 括号嵌套很深的表达式
+    Mixed, // 以上各种语句混合
+    Comments, // 大段的块注释与行注释，中间夹着少量语句（扫描器基准）
+    Identifiers // 很长的变量名，其中不少以关键字开头（扫描器基准）
+};
+
+const char *shape_name(Shape shape);
+
+// 名字（shape_name 的返回值）到 Shape；未知名字抛出 std::invalid_argument
+Shape parse_shape(const std::string &name);
+
+const std::vector<Shape> &all_shapes();
+
+// 生成大约 lines 行源码
+std::string generate_program(Shape shape, std::size_t lines, std::uint64_t seed);
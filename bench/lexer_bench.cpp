@@ -0,0 +1,70 @@
+// 扫描器吞吐量基准：只做词法分析（count_tokens），以及词法 + 语法分析（parse_program）。
+//
+//   lexer_bench [--size MB] [--reps N] [file...]
+//
+// 不给文件时生成一个约 --size MB 的合成程序（默认 16 MB）。
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "frontend.hpp"
+#include "generator.hpp"
+#include "source.hpp"
+
+// 混合形状的合成程序，按第一千行的平均行长估算需要的行数
+static std::string synthetic_program(const std::size_t bytes) {
+    const auto sample = generate_program(Shape::Mixed, 1000, 1);
+    const auto lines = std::max<std::size_t>(1000, bytes / (sample.size() / 1000 + 1));
+    return generate_program(Shape::Mixed, lines, 1);
+}
+
+int main(int argc, char **argv) {
+    std::size_t megabytes = 16;
+    int reps = 5;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc)
+            megabytes = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--reps" && i + 1 < argc)
+            reps = std::max(1, std::atoi(argv[++i]));
+        else
+            files.push_back(arg);
+    }
+
+    std::vector<std::pair<std::string, std::string> > inputs; // 名称, 源码
+    if (files.empty())
+        inputs.emplace_back("synthetic", synthetic_program(megabytes << 20));
+    for (auto &f: files) {
+        auto in = SourceInput::open(f);
+        inputs.emplace_back(f, std::string(in.text()));
+    }
+
+    using clock = std::chrono::steady_clock;
+    std::cout << std::fixed << std::setprecision(1);
+    for (auto &[name, text]: inputs) {
+        // 每一轮都用新的 SourceInput，取最快的一轮
+        std::size_t tokens = 0;
+        double lexBest = 1e30, parseBest = 1e30;
+        for (int r = 0; r < reps; ++r) {
+            auto in = SourceInput::from_string(text);
+            auto t0 = clock::now();
+            tokens = count_tokens(in);
+            lexBest = std::min(lexBest, std::chrono::duration<double>(clock::now() - t0).count());
+
+            auto in2 = SourceInput::from_string(text);
+            t0 = clock::now();
+            (void) parse_program(in2);
+            parseBest = std::min(parseBest, std::chrono::duration<double>(clock::now() - t0).count());
+        }
+
+        const double mb = static_cast<double>(text.size()) / (1 << 20);
+        std::cout << name << ": " << tokens << " tokens, " << mb << " MB\n"
+                  << "  lex:         " << tokens / lexBest / 1e6 << " Mtokens/s, " << mb / lexBest << " MB/s\n"
+                  << "  lex + parse: " << tokens / parseBest / 1e6 << " Mtokens/s, " << mb / parseBest << " MB/s\n";
+    }
+    return 0;
+}
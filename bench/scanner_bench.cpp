@@ -0,0 +1,105 @@
+// 扫描器表格布局基准：同一个 scanner.l 分别按 compressed（flex 默认）、full（-Cf）、fast（-CF）生成，
+// 在同样的输入上只做词法分析，比较吞吐量。三种布局的 token 数必须相同。
+//
+//   scanner_bench [--size MB] [--reps N] [--shape NAME|all] [file...]
+//
+// 不给文件时为每种形状生成一个约 --size MB 的合成程序（默认 16 MB），
+// 默认形状是注释多的 comments、长名字多的 identifiers 与混合的 mixed。
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "frontend.hpp"
+#include "generator.hpp"
+#include "source.hpp"
+
+// bench/scanner_layout.cpp，每种布局一份
+std::size_t compressed_count_tokens(SourceInput &input);
+std::size_t full_count_tokens(SourceInput &input);
+std::size_t fast_count_tokens(SourceInput &input);
+
+namespace {
+
+struct Layout {
+    const char *name;
+    std::size_t (*count)(SourceInput &);
+};
+
+const Layout kLayouts[] = {
+    {"compressed", compressed_count_tokens},
+    {"full (-Cf)", full_count_tokens},
+    {"fast (-CF)", fast_count_tokens},
+};
+
+std::string synthetic_program(const Shape shape, const std::size_t bytes) {
+    const auto sample = generate_program(shape, 1000, 1);
+    const auto lines = std::max<std::size_t>(1000, bytes / (sample.size() / 1000 + 1));
+    return generate_program(shape, lines, 1);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::size_t megabytes = 16;
+    int reps = 5;
+    std::vector<Shape> shapes = {Shape::Comments, Shape::Identifiers, Shape::Mixed};
+    std::vector<std::string> files;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--size" && i + 1 < argc)
+                megabytes = std::strtoul(argv[++i], nullptr, 10);
+            else if (arg == "--reps" && i + 1 < argc)
+                reps = std::max(1, std::atoi(argv[++i]));
+            else if (arg == "--shape" && i + 1 < argc) {
+                const std::string name = argv[++i];
+                shapes = name == "all" ? all_shapes() : std::vector<Shape>{parse_shape(name)};
+            } else
+                files.push_back(arg);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << "\n";
+        return 2;
+    }
+
+    std::vector<std::pair<std::string, std::string> > inputs; // 名称, 源码
+    if (files.empty())
+        for (const auto s: shapes)
+            inputs.emplace_back(shape_name(s), synthetic_program(s, megabytes << 20));
+    for (auto &f: files) {
+        auto in = SourceInput::open(f);
+        inputs.emplace_back(f, std::string(in.text()));
+    }
+
+    using clock = std::chrono::steady_clock;
+    std::cout << std::fixed << std::setprecision(1);
+    bool ok = true;
+    for (auto &[name, text]: inputs) {
+        const double mb = static_cast<double>(text.size()) / (1 << 20);
+        auto reference = SourceInput::from_string(text);
+        const auto expected = count_tokens(reference); // compiler_core 里按 SCANNER_TABLES 生成的扫描器
+        std::cout << name << ": " << expected << " tokens, " << mb << " MB\n";
+        for (const auto &layout: kLayouts) {
+            // 每一轮都用新的 SourceInput，取最快的一轮
+            std::size_t tokens = 0;
+            double best = 1e30;
+            for (int r = 0; r < reps; ++r) {
+                auto in = SourceInput::from_string(text);
+                const auto t0 = clock::now();
+                tokens = layout.count(in);
+                best = std::min(best, std::chrono::duration<double>(clock::now() - t0).count());
+            }
+            std::cout << "  " << std::left << std::setw(12) << layout.name << std::right
+                      << std::setw(8) << tokens / best / 1e6 << " Mtokens/s" << std::setw(8) << mb / best << " MB/s";
+            if (tokens != expected) {
+                std::cout << "  MISMATCH: " << tokens << " tokens";
+                ok = false;
+            }
+            std::cout << "\n";
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+// scanner_bench 的一种表格布局：CMake 用 -P<布局>_ 把 scanner.l 再生成一份，
+// 这里把它包装成 <布局>_count_tokens()，与 frontend.cpp 的 count_tokens() 做同样的事。
+// SCANNER_LAYOUT 是布局名（compressed / full / fast）。
+#include "frontend.hpp"
+#include "parser.tab.hpp"
+
+#define PASTE_(a, b) a##_##b
+#define PASTE(a, b) PASTE_(a, b)
+#define FLEX(name) PASTE(SCANNER_LAYOUT, name) // yylex -> <布局>_lex，yy_scan_buffer -> <布局>__scan_buffer
+
+struct yy_buffer_state;
+
+int FLEX(lex_init_extra)(ScanContext *extra, yyscan_t *scanner);
+int FLEX(lex)(YYSTYPE *yylval_param, yyscan_t yyscanner);
+int FLEX(lex_destroy)(yyscan_t scanner);
+yy_buffer_state *FLEX(_scan_buffer)(char *base, std::size_t size, yyscan_t scanner);
+void FLEX(_delete_buffer)(yy_buffer_state *b, yyscan_t scanner);
+
+std::size_t FLEX(count_tokens)(SourceInput &input) {
+    StringPool strings;
+    ScanContext ctx{&input, &strings};
+    yyscan_t scanner = nullptr;
+    FLEX(lex_init_extra)(&ctx, &scanner);
+    // 与 Scanner 不同，出错（未结束的注释等）时不释放：基准程序随即退出
+    auto *buf = FLEX(_scan_buffer)(input.buffer(), input.size() + 2, scanner);
+    YYSTYPE value;
+    std::size_t n = 0;
+    while (FLEX(lex)(&value, scanner) != 0)
+        ++n;
+    FLEX(_delete_buffer)(buf, scanner);
+    FLEX(lex_destroy)(scanner);
+    return n;
+}
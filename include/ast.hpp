@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
@@ -14,7 +15,7 @@ struct NumberNode final : Node {
     explicit NumberNode(Token t) : tok(std::move(t)) {
     }
 
-    [[nodiscard]] std::string getValue() const { return tok.value; }
+    [[nodiscard]] std::string getValue() const { return std::string(tok.value); }
 };
 
 struct IdentifierNode final : Node {
@@ -23,7 +24,13 @@ struct IdentifierNode final : Node {
     explicit IdentifierNode(Token t) : tok(std::move(t)) {
     }
 
-    [[nodiscard]] std::string getValue() const { return tok.value; }
+    [[nodiscard]] std::string getValue() const { return std::string(tok.value); }
+};
+
+// a[i]：取数组元素
+struct IndexNode final : Node {
+    Token array;
+    std::shared_ptr<Node> index;
 };
 
 struct BinOpNode final : Node {
@@ -35,12 +42,51 @@ struct BinOpNode final : Node {
 struct Statement final : Node {
     std::shared_ptr<Node> left;
     std::shared_ptr<Node> right; // may be null
+
+    ~Statement() override;
 };
 
+// "statements: statements statement" 生成的语句序列是一条很深的左链（每条语句一层）。
+// 析构时沿左链逐个断开再释放，避免几十万行的程序在析构时递归栈溢出。
+inline Statement::~Statement() {
+    auto next = std::move(left);
+    while (next && next.use_count() == 1) {
+        const auto st = std::dynamic_pointer_cast<Statement>(next);
+        if (!st)
+            break;
+        next = std::move(st->left); // st 释放时 left 已为空，不再递归
+    }
+}
+
+// 按源码顺序列出语句序列中的语句，沿左链迭代而不是递归。
+// 结果中的元素仍可能是 Statement（嵌套的块、"int x = e;" 这样的组合），递归深度只取决于嵌套层数。
+inline std::vector<std::shared_ptr<Node> > statement_list(const std::shared_ptr<Node> &n) {
+    std::vector<const Statement *> chain;
+    const Node *bottom = n.get();
+    std::shared_ptr<Node> first = n;
+    while (const auto *st = dynamic_cast<const Statement *>(bottom)) {
+        chain.push_back(st);
+        first = st->left;
+        bottom = st->left.get();
+    }
+
+    std::vector<std::shared_ptr<Node> > out;
+    if (first)
+        out.push_back(first);
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+        if ((*it)->right)
+            out.push_back((*it)->right);
+    return out;
+}
+
+// left_expression comparison right_expression；lhs 非空时是复合条件：comparison 为 "&&" / "||" / "!"，
+// 由 lhs 与 rhs（"!" 只有 lhs）组成，两个表达式不用。comparison.line 总是条件所在的行
 struct Condition final : Node {
     std::shared_ptr<Node> left_expression;
     Token comparison;
     std::shared_ptr<Node> right_expression;
+    std::shared_ptr<Condition> lhs;
+    std::shared_ptr<Condition> rhs;
 };
 
 struct IfStatement final : Node {
@@ -58,16 +104,20 @@ struct PrintStatement final : Node {
     std::string type; // "string" or "int"
     std::shared_ptr<Node> intExpr; // used if type=="int"
     std::string strValue; // used if type=="string"
+    int line{0};
 };
 
 struct Assignment final : Node {
     Token identifier;
+    std::shared_ptr<Node> index; // a[i] = e 的下标；普通赋值为 null
     std::shared_ptr<Node> expression;
 };
 
 struct Declaration final : Node {
     Token declaration_type; // token of type Int or StringKw
     std::vector<Token> identifiers; // VAR tokens
+    std::int64_t length{0}; // int a[N]; 的元素个数，0 表示不是数组
+    bool initialized{false}; // int x = e; / string s = "..."：紧跟着的赋值给出初值
 };
 
 struct StringNode final : Node {
@@ -76,5 +126,25 @@ struct StringNode final : Node {
     explicit StringNode(Token t) : tok(std::move(t)) {
     }
 
-    [[nodiscard]] std::string getValue() const { return tok.value; }
+    [[nodiscard]] std::string getValue() const { return std::string(tok.value); }
+};
+
+// f(a, b)：调用过程。作为表达式时取返回值，作为语句时丢弃
+struct CallNode final : Node {
+    Token name; // 与变量一样带 V 前缀
+    std::vector<std::shared_ptr<Node> > args;
+};
+
+// return e;（return; 返回 0）
+struct ReturnStatement final : Node {
+    std::shared_ptr<Node> value; // may be null
+    int line{0};
+};
+
+// int f(int a, int b) { ... }：只能出现在顶层，先定义后调用（可以递归调用自己）。
+// 参数和过程体里声明的变量是局部的，其它名字指全局变量；没有执行 return 就结束时返回 0
+struct ProcedureNode final : Node {
+    Token name;
+    std::vector<Token> params;
+    std::shared_ptr<Node> body; // may be null
 };
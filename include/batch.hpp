@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "compiler.hpp"
+
+// 批量编译：每个输入文件一个任务，在工作窃取线程池上并行执行
+// （前端、优化、代码生成以及输出文件的写入都在任务内完成）。
+
+struct BatchJob {
+    std::string input;
+    std::string output;
+};
+
+struct BatchFileResult {
+    bool ok{false};
+    std::string error;
+    std::size_t bytes{0};
+    std::size_t lines{0};
+    CompileStats stats; // Options::stats 时有效（失败的文件为空）
+};
+
+struct BatchSummary {
+    std::vector<BatchFileResult> files; // 与输入顺序一一对应，与线程调度无关
+    std::size_t failed{0};
+    std::size_t bytes{0};
+    std::size_t lines{0};
+    double seconds{0};
+    CompileStats stats; // 各文件统计之和
+};
+
+// 输入文件对应的默认输出路径：outDir（为空则与输入同目录）下的同名文件，扩展名按输出类型替换
+std::string default_output(const std::string &input, EmitKind emit, const std::string &outDir);
+
+// 清单文件：每行 "输入 [输出]"，# 开头为注释；相对路径相对于清单文件所在目录
+std::vector<BatchJob> read_manifest(const std::string &path, EmitKind emit, const std::string &outDir);
+
+// threads == 0 时使用全部硬件线程
+BatchSummary compile_batch(const std::vector<BatchJob> &jobs, const Options &options, unsigned threads);
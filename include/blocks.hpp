@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ir.hpp"
+
+// IR 的基本块视图，供块布局、循环展开、if-conversion 等需要控制流图的变换使用。
+// 先用 label_blocks() 让每个基本块都以标签开头，split_blocks() 再按标签切开，
+// 变换完成后用 join_blocks() 拼回线性 IR。
+struct IRBlock {
+    std::string label;
+    std::vector<std::shared_ptr<IRInstr> > body; // 不含开头的标签和末尾的跳转
+    std::shared_ptr<CompareCodeIR> branch; // 末尾的条件跳转，没有则为空
+    std::string next; // 条件不成立 / 没有条件跳转时的后继；空表示程序结束（或者 body 以 RETURN 结尾）
+    int line{0}; // 开头标签的源码行（IRInstr::line）
+    int jumpLine{0}; // 末尾无条件跳转的源码行，没有跳转时为 0
+};
+
+// 在没有标签的块开头（程序入口、跳转之后）插入 LB<n> 标签，编号接在已有的 LB 标签之后
+InterCodeArray label_blocks(const InterCodeArray &code);
+
+// 要求 code 已经过 label_blocks()
+std::vector<IRBlock> split_blocks(const InterCodeArray &code);
+
+// 只有一条 JMP 的块被绕过：引用它的跳转直接指向最终目标，之后没有引用的这种块被删除
+void thread_jumps(std::vector<IRBlock> &blocks);
+
+// 按 blocks 的顺序拼成线性 IR：后继正好是下一块时省掉 JMP，
+// 条件跳转的目标正好是下一块时把条件取反；没有跳转引用的标签不再输出
+InterCodeArray join_blocks(const std::vector<IRBlock> &blocks);
+
+// 自然循环：回边 u -> h（h 支配 u）加上能不经过 h 到达 u 的块，同一个头的回边合并为一个循环
+struct LoopInfo {
+    std::vector<std::size_t> depth; // 块所在循环的嵌套层数
+    std::vector<std::size_t> innermost; // 块所在最内层循环的头；不在循环里时为 blocks.size()
+};
+
+// 与块的排列顺序无关，块布局之后同样适用；从入口不可达的块不属于任何循环
+LoopInfo find_loops(const std::vector<IRBlock> &blocks);
+
+// "<" -> ">="，"==" -> "!=" ……
+std::string negate_comparison(const std::string &op);
+
+// 块的执行次数，来自 profile 实测或 estimate_weights() 的静态估计
+struct BlockWeights {
+    std::vector<std::uint64_t> count; // 块 i 的执行次数
+    std::vector<std::uint64_t> taken; // 块 i 末尾的条件跳转成立的次数
+    std::vector<bool> cold; // 冷块：整条链都是冷块时放到最后
+};
+
+// 没有 profile 时的静态估计：
+//   - 向后的跳转（回边）成立，离开循环的跳转不成立，循环头按 8 次迭代计；
+//   - "==" 多半不成立（Ball-Larus 的 opcode 启发）；
+//   - 其余按源码顺序的下一块（fallthrough）优先。
+// 只能经由概率不超过 1/8 的边、或从冷块到达的块是冷块
+BlockWeights estimate_weights(const std::vector<IRBlock> &blocks);
+
+// 链式块布局（Pettis-Hansen）：按边的执行次数从大到小，把后继块接在前驱块的后面，
+// 使最热的边成为顺序执行；次数相同时先接回边，循环因此被轮转为"体在前、条件在后"。
+// 入口块保持在最前，全是冷块的链放到最后，其余的链保持原来的相对顺序。
+std::vector<IRBlock> layout_blocks(const std::vector<IRBlock> &blocks, const BlockWeights &weights);
+
+// -O1 的最后一个 pass：按 estimate_weights() 的估计做 layout_blocks()
+InterCodeArray static_block_layout(const InterCodeArray &code);
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Options;
+
+// 磁盘上的编译缓存（类似 ccache）。
+// 键是 SHA-256(缓存格式版本, 编译器本身的标识, 影响输出的选项, profile 内容, 源码字节)，
+// 值是最终输出（NASM 文本或 ELF 字节）。命中时 compile() 直接返回缓存内容，不运行扫描器、语法分析和优化。
+//
+// 目录布局：DIR/ab/abcdef...（键的前两位作为子目录）。
+//  - 写入先写到同目录下的临时文件再 rename()，并发的编译进程只会看到完整的条目；
+//  - 命中时更新条目的 mtime，超过大小上限时按 mtime 从旧到新删除（LRU），删到上限的 90%。
+// 同一个 CompileCache 可以被多个线程共用（批量编译）。
+class CompileCache final {
+public:
+    static constexpr std::uint64_t kDefaultMaxBytes = 256ULL << 20;
+
+    explicit CompileCache(std::string dir, std::uint64_t maxBytes = kDefaultMaxBytes);
+
+    // 源码与选项对应的键（64 位十六进制）。读取 --profile-use 文件失败时抛出 std::runtime_error
+    [[nodiscard]] static std::string key(std::string_view source, const Options &options);
+
+    // 未命中或条目损坏时返回 std::nullopt
+    [[nodiscard]] std::optional<std::vector<std::uint8_t> > lookup(const std::string &key) const;
+
+    // 写入失败（磁盘满、没有权限）只会让缓存失效，不影响编译结果
+    void store(const std::string &key, const std::vector<std::uint8_t> &data);
+
+    [[nodiscard]] const std::string &dir() const { return dir_; }
+
+    // 扫描整个目录得到的条目总字节数
+    [[nodiscard]] std::uint64_t disk_usage() const;
+
+private:
+    [[nodiscard]] std::string entry_path(const std::string &key) const;
+
+    void evict();
+
+    std::string dir_;
+    std::uint64_t maxBytes_;
+    std::mutex mutex_;
+    std::optional<std::uint64_t> usage_; // 第一次 store() 时扫描目录，之后累加
+};
@@ -1,19 +1,131 @@
 #pragma once
 #include "ir.hpp"
+#include "isel.hpp"
+#include "x86.hpp"
+#include <map>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+
+struct CodegenOptions {
+    // 插桩：每个基本块入口把块内指令条数加到计数器上，
+    // 程序退出前把执行过的指令总数（不含插桩本身）以十进制打印到 stderr
+    bool countInstructions{false};
+
+    // 非 0 时，循环头（向后跳转的目标）前插入 align，对齐到这么多字节
+    std::uint32_t loopAlignment{0};
+
+    // --instrument：每个标签一个计数器，每条条件跳转两个（成立次数、方向改变次数，见 pgo.hpp），
+    // 程序退出时连同文件头写入 profilePath；为空表示不插桩
+    std::string profilePath;
+    std::uint64_t profileChecksum{0};
+
+    // -Os：指令选择按编码长度取舍，push imm / pop 装入小常数；相同的指令尾部交叉跳转、相同的块合并；
+    // 输出系统调用共用一段辅助函数，_print_num / _print_string 用最短的写法
+    bool optimizeSize{false};
+
+    // -g：IR 上的源码行号变成 Line 伪指令（NASM 的 %line，内置编码器写 DWARF 行号表），
+    // 每个循环头加一个具名标签 loop_line_<行号>，perf report / annotate 据此把热点归到源码。
+    // sourceName 是行号所指的源文件
+    bool debugLines{false};
+    std::string sourceName;
+
+    // --simd：VectorLoop 用哪一套指令。Auto 在第一次进入向量循环时用 CPUID 检测一次，有 AVX2 就走 AVX2；
+    // Off 时忽略 VectorLoop，只剩标量循环。-Os 同样不生成向量循环
+    Simd simd{Simd::Auto};
+};
 
 class CodeGenerator final {
 public:
     CodeGenerator(const InterCodeArray &arr,
                   const std::unordered_map<std::string, std::string> &identifiers,
                   const std::unordered_map<std::string, std::string> &constants,
-                  const std::unordered_map<std::string, std::string> &tempmap);
+                  const std::unordered_map<std::string, std::string> &tempmap,
+                  const CodegenOptions &options = {});
+
+    // 流式输出（compile_stream()）：没有完整的 IR，代码由 stream_chunk() 逐段给出，
+    // 每段立即打印成 NASM 文本。不支持插桩（countInstructions / profilePath）
+    explicit CodeGenerator(const CodegenOptions &options);
+
+    // 文件开头：各段的声明（带对齐属性）与 _start
+    void stream_begin(x86::NasmWriter &out);
+
+    // 一段 IR（一条顶层语句）的指令，以及它第一次用到的变量槽位和它的字符串常量。
+    // arrays 是这一段声明的数组，由 stream_end() 统一分配。
+    // variables 非空时（并行区域，每个区域一个 CodeGenerator）不在这一段分配变量槽位，
+    // 而是把这一段用到的变量按第一次出现的顺序追加进去，由 stream_end() 统一分配
+    void stream_chunk(const InterCodeArray &chunk,
+                      const std::unordered_map<std::string, std::string> &constants,
+                      const std::map<std::string, std::int64_t> &arrays,
+                      x86::NasmWriter &out, std::vector<std::string> *variables = nullptr);
+
+    // stream_chunk() 生成过的各段用到的辅助函数、缓冲区、数组和指令条数。
+    // --watch 为每条顶层语句留一份，不必保留整个 CodeGenerator
+    struct StreamState {
+        bool printNum = false;
+        bool printString = false;
+        bool newline = false;
+        bool strLen = false;
+        bool write = false;
+        bool writev = false;
+        std::size_t writeIovs = 0;
+        std::size_t writeInts = 0;
+        bool vector = false;
+        bool detect = false;
+        std::map<std::string, std::int64_t> arrays;
+        std::size_t instructions = 0;
+    };
+
+    [[nodiscard]] StreamState stream_state() const;
+
+    // 并入另一个区域的 CodeGenerator 用到的辅助函数、缓冲区和指令条数，在 stream_end() 之前调用
+    void merge(const CodeGenerator &region);
+
+    void merge(const StreamState &state);
+
+    // 程序结尾、用到的辅助函数及其缓冲区，以及 variables 中各变量的槽位
+    void stream_end(x86::NasmWriter &out, const std::vector<std::string> &variables = {});
+
+    // NASM 文本（调试用），需要再经过 nasm + ld
+    std::string assembly();
+
+    // 同上，但文本由 NasmWriter 分块交给 sink，内存里不保留整个文件
+    void assembly(const x86::NasmWriter::Sink &sink);
+
+    // 内置编码器直接生成 ELF64 可重定位目标文件 / 静态可执行文件
+    std::vector<std::uint8_t> object();
+
+    std::vector<std::uint8_t> executable();
 
     void writeAsm(const std::string &path);
 
+    // 内置编码器直接输出 ELF64 可重定位目标文件
+    void writeObject(const std::string &path);
+
+    // 内置编码器直接输出静态可执行文件
+    void writeExecutable(const std::string &path);
+
+    // 生成的机器指令条数（静态，不含标签、对齐与插桩）
+    std::size_t instruction_count();
+
+    // 内置编码器得到的各节大小（字节），--stats 用来比较 -Os 与默认模式
+    struct SectionSizes {
+        std::uint64_t text;
+        std::uint64_t data; // .rodata + .data
+        std::uint64_t bss;
+    };
+
+    SectionSizes section_sizes();
+
 private:
-    void pr(const std::string &s);
+    const x86::Module &module();
+
+    // 换一个新的 Module（流式输出每段一个）
+    void new_module();
+
+    // 编码结果只算一次，section_sizes() 与 object() / executable() 共用
+    const x86::Object &encoded();
 
     void gen_variables();
 
@@ -21,7 +133,13 @@ private:
 
     void gen_end();
 
-    void gen_code();
+    void scan_helpers(const InterCodeArray &code);
+
+    void gen_code(const InterCodeArray &code);
+
+    void gen_helpers();
+
+    void gen_small_helpers();
 
     void gen_assignment(const AssignmentCode &a);
 
@@ -29,24 +147,107 @@ private:
 
     void gen_label(const LabelCode &l);
 
+    void gen_loop_name(std::uint32_t line);
+
     void gen_compare(const CompareCodeIR &c);
 
     void gen_print(const PrintCodeIR &p);
 
+    void gen_select(const SelectCode &s);
+
+    void gen_write(const WriteCode &w);
+
+    void gen_vector_loop(const VectorLoopCode &v);
+
+    void gen_vector_path(const VectorLoopCode &v, x86::Width w, const std::string &tag, x86::SymbolId done);
+
+    // 过程：调用按 System V 的约定传参（见 ir.hpp 的 CallCode），过程体有自己的栈帧
+    void gen_call(const CallCode &c);
+
+    void gen_return(const ReturnCode &r);
+
+    void gen_epilogue();
+
+    void gen_procedure(const ProcedureCode &p);
+
+    // IR 标签对应的符号，过程体里的加上 labelScope 前缀
+    x86::SymbolId label_symbol(const std::string &label);
+
+    void gen_detect_simd_function();
+
+    void gen_profile_increment(std::size_t counter);
+
+    void gen_profile_direction(std::size_t counter, std::size_t branch, bool taken);
+
+    void gen_profile_stubs();
+
+    void gen_write_profile_function();
+
     void gen_print_newline();
 
-    void gen_print_num_function();
+    void gen_print_num_function(const std::string &name, int fd, const std::string &local);
+
+    void gen_report_function();
+
+    void align_loop_headers();
+
+    void merge_tails();
+
+    bool cross_jump();
+
+    bool bypass_jumps();
+
+    void instrument_instruction_count();
 
     void gen_print_string_function();
 
-    static std::string handleVar(const std::string &a, const std::unordered_map<std::string, std::string> &tempmap);
+    void gen_format_num_function();
+
+    void gen_str_len_function();
+
+    x86::Operand handleVar(const std::string &a);
 
 private:
     const InterCodeArray &arr;
     std::unordered_map<std::string, std::string> ids;
     std::unordered_map<std::string, std::string> consts;
     std::unordered_map<std::string, std::string> tempmap;
-    std::string out;
+    CodegenOptions options;
+    x86::Module mod;
+    isel::Selector sel; // 赋值、比较和取值的指令选择
+    std::size_t instructions = 0;
+    std::size_t profileCounters = 0;
+    std::size_t profileBranches = 0; // 条件跳转个数，每条在 __pgo_last 里记录上一次的方向
+
+    struct EdgeStub {
+        x86::SymbolId stub;
+        x86::SymbolId target;
+        std::size_t counter; // 成立次数；方向改变次数在 counter + 1
+        std::size_t branch;
+    };
+
+    std::vector<EdgeStub> edgeStubs;
+    bool generated = false;
+    bool streaming = false;
     bool need_print_num = false;
     bool need_print_string = false;
+    bool need_newline = false; // prints("...") 之后的换行
+    bool need_str_len = false;
+    bool need_write = false; // -Os：单段常量的 WriteCode 与换行经过 _write_stdout
+    bool need_writev = false; // -Os：其它 WriteCode 经过 _writev_stdout
+    std::size_t tailLabels = 0; // cross_jump() 新建的标签
+    std::unique_ptr<x86::Object> object_;
+    std::size_t writeIovs = 0; // WriteCode 中最多的段数，__iov 按它分配
+    std::size_t writeInts = 0; // WriteCode 中最多的整数段数，每段在 __wbuf 里占 24 字节
+    bool need_vector = false; // 向量循环：归约用的 __vtmp 与下标向量的 __lanes
+    bool need_detect = false; // --simd=auto：_detect_simd 与记录结果的 __simd_level
+    std::map<std::string, std::int64_t> streamedArrays; // 流式输出中声明过的数组，stream_end() 分配
+    std::unordered_set<std::string> streamedVars; // 流式输出中已经分配过槽位的变量
+    std::uint32_t lastLine = 0; // -g：最近一条 Line 伪指令的行号
+    std::unordered_set<std::string> loopNames; // 已经用过的 loop_line_* 名字（流式输出跨段去重）
+    std::unordered_set<x86::SymbolId> loopSymbols; // 当前 Module 里的 loop_line_* 标签
+    std::vector<std::shared_ptr<const ProcedureCode> > procedures; // 顶层代码里的过程，在 gen_end() 之后生成
+    std::unordered_set<std::string> generatedProcedures;
+    std::unordered_map<std::string, std::int64_t> frame; // 正在生成的过程的栈帧：名字 -> 相对 rbp 的偏移
+    std::string labelScope; // 过程体里是 "<过程符号>."，各过程的标签互不冲突；顶层为空
 };
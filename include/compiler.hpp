@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ast.hpp"
+#include "ir.hpp"
+#include "source.hpp"
+#include "stats.hpp"
+
+class CompileCache;
+struct CodegenOptions;
+
+// 编译器的库接口：源码 -> NASM 文本 / ELF。
+// compile() 不使用任何全局状态，多个线程可以同时调用。
+
+enum class EmitKind {
+    Asm, // NASM 文本
+    Object, // ELF64 可重定位目标文件
+    Executable, // ELF64 静态可执行文件
+    IR // 优化后的 IR，二进制格式（见 irfile.hpp），可以交给 compile_ir() 继续编译
+};
+
+struct Options {
+    EmitKind emit{EmitKind::Asm};
+    bool keepAst{false}; // 在 Result::ast 中保留 AST
+    bool keepIr{false}; // 在 Result::ir 中保留优化后的 IR
+    bool stats{false}; // 填写 Result::stats（各阶段耗时、分配次数、计数器）
+    int optLevel{1}; // -O0：不做 IR 优化；-O1：运行 optimization_passes()
+    bool optimizeSize{false}; // -Os：optLevel 为 1，代码生成以长度为先（见 CodegenOptions::optimizeSize）
+    bool countInstructions{false}; // 见 CodegenOptions::countInstructions
+    bool debugInfo{false}; // -g：源码行号与 loop_line_* 符号（见 CodegenOptions::debugLines）
+    Simd simd{Simd::Auto}; // --simd：向量循环的指令集（见 CodegenOptions::simd）
+    std::string sourceName; // -g 的行号所指的源文件；compile_batch() 为每个输入填上它的路径
+    std::string instrument; // 非空：PGO 插桩，生成的程序退出时把计数器写入这个文件（见 pgo.hpp）
+    std::vector<std::string> profileUse; // 用这些计数器文件（计数相加）做 PGO
+    // 非空：先查磁盘缓存（见 cache.hpp），命中时不做任何编译工作。
+    // keepAst / keepIr 和流式输入（没有完整源码可以计算键）不使用缓存
+    std::shared_ptr<CompileCache> cache;
+    // 流式编译（见 compile_stream()）：只支持 EmitKind::Asm，不使用缓存，忽略 keepAst / keepIr
+    bool stream{false};
+    // 单个大文件的并行编译：顶层语句切成若干区域，各区域独立生成 IR、运行 local_passes()（-O1 时）
+    // 并生成 NASM 文本，再按顺序拼接。切分只取决于 AST，输出与线程数无关。
+    // 只支持 EmitKind::Asm，不能与插桩、PGO 或 debugInfo 一起使用，忽略 keepIr
+    bool regions{false};
+    unsigned threads{1}; // regions 使用的线程数，0 表示 std::thread::hardware_concurrency()
+};
+
+struct Result {
+    bool ok{false};
+    std::string error; // ok == false 时的错误信息
+    std::string assembly; // EmitKind::Asm
+    std::vector<std::uint8_t> binary; // EmitKind::Object / Executable / IR
+    std::shared_ptr<Node> ast;
+    std::shared_ptr<StringPool> strings; // ast 中 Token 文本的存储，与 ast 一起保留
+    GeneratedIR ir;
+    CompileStats stats; // Options::stats 为 true 时有效
+};
+
+// 汇编文本的接收者，每次收到 x86::NasmWriter 攒满的一块
+using AsmSink = std::function<void(std::string_view)>;
+
+// 直接在 input 的缓冲区（mmap 映射的文件）上扫描，或从流中分块读取
+Result compile(SourceInput &input, const Options &options = {});
+
+// 同上，但 EmitKind::Asm 的文本边生成边交给 asmSink，不在内存里拼出整个文件，Result::assembly 为空。
+// 其它输出类型与上面相同
+Result compile(SourceInput &input, const Options &options, const AsmSink &asmSink);
+
+Result compile(std::string_view source, const Options &options = {});
+
+// 流式编译：语法分析每归约出一条顶层语句，就生成它的 IR、运行 local_passes()（-O1 时）、
+// 翻译成 NASM 文本交给 sink，然后释放这条语句的全部数据。内存占用只与最大的一条顶层语句以及
+// 变量个数有关，与输入大小无关（input 应当用 SourceInput::open_streaming() 打开）。
+// 只支持 EmitKind::Asm，不能与插桩或 PGO 一起使用；Result::assembly 为空
+Result compile_stream(SourceInput &input, const Options &options, const AsmSink &sink);
+
+// -O 级别对应的 pass 名字序列（optimization_passes() 加上 fuse_prints）
+std::vector<std::string> pass_pipeline(int optLevel);
+
+// 可以在 compile_ir() 的 pass 列表中使用的名字
+std::vector<std::string> pass_names();
+
+// options 对应的代码生成选项（-O 级别、-Os、-g、--simd）
+CodegenOptions codegen_options(const Options &options);
+
+// opt 模式：从已有的 IR（例如 irfile::File::to_ir() 读回的）开始，依次运行 passes，
+// 然后按 options.emit 输出。未知的 pass 名字报错
+Result compile_ir(GeneratedIR ir, const std::vector<std::string> &passes, const Options &options = {});
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "x86.hpp"
+
+// ELF64 输出：把 x86::encode() 的结果写成可重定位目标文件或静态可执行文件
+namespace elf {
+
+// ET_REL：.text / .rodata / .data / .bss + .rela.text，可以交给 ld 链接
+std::vector<std::uint8_t> object_file(const x86::Object &obj);
+
+// ET_EXEC：重定位在这里直接解析，入口为 _start，不需要 ld
+std::vector<std::uint8_t> executable_file(const x86::Object &obj);
+
+} // namespace elf
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "ast.hpp"
+#include "source.hpp"
+#include "tokens.hpp"
+
+using StatementHandler = std::function<void(const std::shared_ptr<Node> &)>;
+
+struct ScanContext;
+
+// 一条顶层语句与它在输入中的字节范围 [begin, end)：从第一个 token 的开头到最后一个 token 的结尾
+struct TopLevelStatement {
+    std::shared_ptr<Node> node;
+    std::size_t begin{0};
+    std::size_t end{0};
+};
+
+// 一次解析的全部状态，由 Bison 的 %parse-param 传给语法动作
+struct ParseContext {
+    std::shared_ptr<Node> root; // 解析完成后的 AST 根（流式解析时为空）
+    StatementHandler onStatement; // 非空：每条顶层语句归约后交给它，不连进 root
+    StringPool *strings{nullptr}; // onStatement 返回后清空，只保留向前看 token 的文本
+    std::size_t tokens{0}; // 扫描器返回的 token 数
+    bool timeScanner{false}; // 为 true 时累计扫描器耗时（每个 token 读两次时钟，只在 --stats 时打开）
+    double scanSeconds{0};
+    // 非空：顶层语句连同字节范围依次放进这里，不连进 root（见 parse_top_level()）。
+    // 范围取自扫描器记下的位置（scan），下面几个是记录用的中间状态
+    std::vector<TopLevelStatement> *statements{nullptr};
+    ScanContext *scan{nullptr};
+    std::size_t tokenBegin{0}; // 最近读入的 token 的范围
+    std::size_t tokenEnd{0};
+    std::size_t previousEnd{0}; // 它前面那个 token 的结尾
+    std::size_t statementBegin{static_cast<std::size_t>(-1)}; // 下一条顶层语句的开头，-1：就是下一个读入的 token
+};
+
+// 扫描器的 yyextra：输入来源 + 本次解析的字符串池
+struct ScanContext {
+    SourceInput *input{nullptr};
+    StringPool *strings{nullptr};
+    int openedAt{0}; // 正在扫描的块注释 / 字符串从哪一行开始，没有结束时报错用
+    std::size_t offset{0}; // 已经扫描过的字节数
+    std::size_t tokenStart{0}; // 最近返回的 token 从第几个字节开始
+};
+
+// 解析结果。AST 里 Token::value 指向 strings 中的文本，使用 AST 期间要保持 strings 存活。
+struct ParsedProgram {
+    std::shared_ptr<Node> root;
+    std::shared_ptr<StringPool> strings;
+    std::size_t tokens{0};
+    double scanSeconds{0}; // 只在 timeScanner 时有效，已包含在解析的总耗时中
+};
+
+// 词法 + 语法分析。可重入：每次调用都有独立的 Flex / Bison 状态，可以多线程同时使用。
+// 语法错误或未知字符抛出 std::runtime_error。
+ParsedProgram parse_program(SourceInput &input, bool timeScanner = false);
+
+// 流式解析：每条顶层语句一归约就交给 onStatement，处理完即释放，字符串池也随之清空，
+// 内存只与最大的一条顶层语句有关。返回值的 root 为空
+ParsedProgram parse_statements(SourceInput &input, const StatementHandler &onStatement, bool timeScanner = false);
+
+// 拷贝一次源码后解析
+ParsedProgram parse_program(std::string_view source);
+
+// parse_top_level() 的结果：各条顶层语句的 AST 与范围（相对于 text 的开头），Token 文本在 strings 中
+struct ParsedStatements {
+    std::vector<TopLevelStatement> statements;
+    std::shared_ptr<StringPool> strings;
+};
+
+// 解析一段源码，行号从 firstLine 开始，按顺序返回顶层语句及其字节范围。
+// --watch 的增量编译（见 watch.hpp）用它只重新解析改动过的那几条语句
+ParsedStatements parse_top_level(std::string_view text, int firstLine = 1);
+
+// 只做词法分析，返回 token 数量（不含文件结束），用于测量扫描器吞吐量
+std::size_t count_tokens(SourceInput &input);
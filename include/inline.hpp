@@ -0,0 +1,19 @@
+#pragma once
+#include "ir.hpp"
+
+// 过程内联与常量实参特化，optimization_passes() 的第一个 pass。
+//
+// 过程先定义后调用，只可能直接递归调用自己，所以按定义的顺序自底向上处理：
+// 处理一个过程体（最后是顶层代码）时，它调用的过程都已经处理完。每个调用点按代价模型决定：
+//   - 大小是过程体的 IR 指令数（不含标签），调用的开销是传参、call 和取返回值；
+//   - 递归的过程不内联；
+//   - 速度优先：过程足够小（kAlwaysInline）、只剩这一个调用点、
+//     或者调用在循环里且过程不太大（kLoopInline）时内联，每段代码的增长有上限；
+//   - 长度优先（-Os）：只在内联后不比调用长，或者只剩这一个调用点（过程本身随之删除）时内联。
+// 内联进来的临时变量、局部变量和标签加上 _i<k> 后缀，不会与调用方或另一份内联重名；
+// 没有被赋值的参数直接换成实参，其余参数先复制。
+//
+// 没有内联、但带着整数字面量实参的调用点做特化：复制一份过程（F<名字>.s<k>），
+// 把这些参数换成字面量后折叠常量运算和条件跳转，变小了才保留，相同的实参共用一份；
+// 特化后的过程足够小时再按上面的规则内联。最后删除不再被调用的过程。
+InterCodeArray inline_procedures(const InterCodeArray &code, bool optimizeSize);
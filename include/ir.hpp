@@ -1,7 +1,10 @@
 #pragma once
+#include <cstdint>
+#include <map>
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
 #include "ast.hpp"
 
@@ -10,7 +13,15 @@ enum class IRKind {
     Jump,
     Label,
     Compare,
-    Print
+    Print,
+    Select,
+    Write,
+    Load,
+    Store,
+    VectorLoop,
+    Call,
+    Return,
+    Procedure
 };
 
 enum class PrintKind {
@@ -23,6 +34,8 @@ struct IRInstr {
     virtual ~IRInstr() = default;
 
     [[nodiscard]] virtual IRKind kind() const = 0;
+
+    int line{0}; // 生成它的语句在源码中的行号（Token::line），0 表示不对应哪一行
 };
 
 struct AssignmentCode final : IRInstr {
@@ -58,40 +71,224 @@ struct PrintCodeIR final : IRInstr {
     [[nodiscard]] IRKind kind() const override { return IRKind::Print; }
 };
 
+// var = (left operation right) ? ifTrue : ifFalse
+// 由 PGO 的 if-conversion 生成（见 pgo.hpp），代码生成为 cmov
+struct SelectCode final : IRInstr {
+    std::string var;
+    std::string left;
+    std::string operation;
+    std::string right;
+    std::string ifTrue;
+    std::string ifFalse;
+    [[nodiscard]] IRKind kind() const override { return IRKind::Select; }
+};
+
+// 一次输出中的一段：String 为字符串常量 S<n>（长度编译期已知）或存着字符串地址的变量，
+// Int 为运行时才知道的整数（不带换行）
+struct WritePiece {
+    PrintKind kind;
+    std::string value;
+};
+
+// 由 fuse_prints() 把相邻的 PRINT 合并而成：只有一段常量时生成一次 write，
+// 否则就地填好 iovec 后生成一次 writev
+struct WriteCode final : IRInstr {
+    std::vector<WritePiece> pieces;
+    [[nodiscard]] IRKind kind() const override { return IRKind::Write; }
+};
+
+// var = array[index]；数组是 int a[N]; 声明的 V 变量，index 为变量、临时变量或整数字面量
+struct LoadCode final : IRInstr {
+    std::string var;
+    std::string array;
+    std::string index;
+    [[nodiscard]] IRKind kind() const override { return IRKind::Load; }
+};
+
+// array[index] = value
+struct StoreCode final : IRInstr {
+    std::string array;
+    std::string index;
+    std::string value;
+    [[nodiscard]] IRKind kind() const override { return IRKind::Store; }
+};
+
+// 由 vectorize_loops() 插在计数循环的入口之前（见 vectorize.hpp）：
+// 当 index operation bound 成立且剩余的次数够一整组时，用 SIMD 一次执行 body 的若干次迭代，
+// 结束后 index 停在第一个没做的下标上，剩下的次数由后面原样保留的标量循环完成。
+// body 是循环体去掉末尾 index = index + 1 之后的指令（与标量循环共用），
+// 只含 Load / Store / Assignment；label 是标量循环的入口标签，用作生成的标签的前缀
+struct VectorLoopCode final : IRInstr {
+    std::string label;
+    std::string index;
+    std::string operation; // "<" 或 "<="
+    std::string bound;
+    std::vector<std::shared_ptr<IRInstr> > body;
+    [[nodiscard]] IRKind kind() const override { return IRKind::VectorLoop; }
+};
+
+// var = proc(args)；var 为空时丢弃返回值。proc 是过程的符号 F<名字>，
+// 实参按 System V 的约定依次放进 rdi / rsi / rdx / rcx / r8 / r9，返回值在 rax
+struct CallCode final : IRInstr {
+    std::string var;
+    std::string proc;
+    std::vector<std::string> args;
+    [[nodiscard]] IRKind kind() const override { return IRKind::Call; }
+};
+
+// 从所在的过程返回 value
+struct ReturnCode final : IRInstr {
+    std::string value;
+    [[nodiscard]] IRKind kind() const override { return IRKind::Return; }
+};
+
+// 过程的参数都在寄存器里传递，最多这么多个
+constexpr std::size_t kMaxParams = 6;
+
+// VectorLoopCode 的代码生成：Auto 在运行时用 CPUID 选择 AVX2 或 SSE2，
+// Sse2 / Avx2 固定使用一种，Off 不生成向量代码（全部迭代由标量循环完成）
+enum class Simd {
+    Auto,
+    Sse2,
+    Avx2,
+    Off
+};
+
 struct InterCodeArray final {
     std::vector<std::shared_ptr<IRInstr> > code;
     void append(const std::shared_ptr<IRInstr> &n) { code.push_back(n); }
 };
 
+// 过程定义，留在顶层代码中定义它的位置，代码生成时放到程序之外（流式输出时就地跳过）。
+// 参数与局部变量名为 V<过程名>.<变量名>，body 里的临时变量和标签与程序其余部分不重名；
+// body 末尾没有 RETURN 时返回 0。优化 pass 对顶层代码和每个过程体分别运行
+struct ProcedureCode final : IRInstr {
+    std::string name; // F<名字>
+    std::vector<std::string> params;
+    InterCodeArray body;
+    [[nodiscard]] IRKind kind() const override { return IRKind::Procedure; }
+};
+
 struct GeneratedIR final {
     InterCodeArray code;
     std::unordered_map<std::string, std::string> identifiers;
     std::unordered_map<std::string, std::string> constants;
+    // 这段 IR 声明的数组及其元素个数。identifiers 里的类型是 "int[N]"；流式编译时 identifiers 为空，
+    // 代码生成靠它知道每段新声明的数组要分配多大
+    std::map<std::string, std::int64_t> arrays;
+};
+
+// "int[N]" 的 N；其它类型返回 0
+std::int64_t array_length(const std::string &type);
+
+// 过程在 identifiers 里记作 F<名字> : "proc(N)"，N 是参数个数；不是过程时返回 -1
+int procedure_arity(const std::string &type);
+
+// 优化 pass：输入一段 IR，返回优化后的 IR
+struct IRPass {
+    const char *name;
+    InterCodeArray (*run)(const InterCodeArray &);
 };
 
+// IntermediateCodeGen::get() 依次执行的 pass
+const std::vector<IRPass> &optimization_passes();
+
+// 只看一段 IR 内部、不依赖其余部分的 pass，可以在流式编译中逐条顶层语句运行：
+// 一条顶层语句的 IR 只跳转到自己内部的标签，临时变量也不会在语句之外使用
+const std::vector<IRPass> &local_passes();
+
+// 把 n 中（包括 if / while 内部）的变量声明和过程的签名按顺序记入 identifiers，与 IR 生成时的效果相同
+// （过程体里的声明是局部的，不记入）
+void record_declarations(const std::shared_ptr<Node> &n, std::unordered_map<std::string, std::string> &identifiers);
+
+// optimization_passes() 中的单个 pass，只处理给定的这一段 IR（不进入过程体）
+InterCodeArray fold_const_conditions(const InterCodeArray &in);
+
+InterCodeArray eliminate_unreachable_blocks(const InterCodeArray &in);
+
+InterCodeArray remove_trivial_jumps(const InterCodeArray &in);
+
+InterCodeArray cleanup_labels(const InterCodeArray &in);
+
+// remove_dead_assignments 的两半。分段编译（--watch）时各段分别收集读取，汇总之后再各自删除：
+// collect_reads() 把 in（包括过程体）读到的名字加入 read，
+// drop_dead_assignments() 去掉结果不在 read 中的赋值、选择和取值，调用只丢掉返回值
+void collect_reads(const InterCodeArray &in, std::unordered_set<std::string> &read);
+
+InterCodeArray drop_dead_assignments(const InterCodeArray &in, const std::unordered_set<std::string> &read);
+
+// 在 optimization_passes() 之后运行：把相邻的 PRINT 合并成 WriteCode。常量字符串在编译期拼接，
+// 值已知的整数在编译期格式化；需要新增字符串常量，所以不是 IRPass
+void fuse_prints(GeneratedIR &ir);
+
 class IntermediateCodeGen final {
 public:
     explicit IntermediateCodeGen(const std::shared_ptr<Node> &root);
 
+    // 优化前的 IR
+    GeneratedIR raw() const;
+
+    // 执行 optimization_passes() 之后的 IR
     GeneratedIR get() const;
 
+    // 流式模式（root 为空）：翻译一条顶层语句，返回它的 IR 和它新增的字符串常量，然后清空。
+    // T / L / S 的编号与声明过的变量在调用之间保留，语句内部的临时变量用完即删。
+    // 返回值的 identifiers 为空（代码生成不需要它，每条语句拷贝一次变量表的代价与文件大小成正比）
+    GeneratedIR take_statement(const std::shared_ptr<Node> &statement);
+
+    // 流式模式中不重新翻译的一条顶层语句（--watch 沿用它上一次的 IR）：只记下它的声明
+    // （record_declarations() 的结果），后面的语句照样能用到
+    void declare(const std::unordered_map<std::string, std::string> &declarations);
+
+    // 并行区域（见 compile() 的 Options::regions）：只翻译 statements 这一段顶层语句，
+    // T / L / S 的名字都带上 prefix（T<prefix><n>），不同区域的名字互不冲突；
+    // identifiers 是这个区域之前声明过的变量（见 record_declarations()）
+    IntermediateCodeGen(const std::vector<std::shared_ptr<Node> > &statements,
+                        std::unordered_map<std::string, std::string> identifiers, std::string prefix);
+
 private:
     std::string exec_expr(const std::shared_ptr<Node> &n);
 
+    // left op right：两边都是字面量时在编译期算出，否则生成一条赋值，返回结果
+    std::string exec_binary(const std::string &left, const std::string &op, const std::string &right);
+
     void exec_assignment(const std::shared_ptr<Assignment> &a);
 
+    // 声明过的数组的元素个数，不是数组时为 0
+    std::int64_t array_of(const std::string &name) const;
+
+    // array[index] 的下标：检查 array 是数组、字面量下标不越界，返回下标的值
+    std::string exec_index(const std::string &array, const std::shared_ptr<Node> &index, int at);
+
     void exec_if(const std::shared_ptr<IfStatement> &i);
 
     void exec_while(const std::shared_ptr<WhileStatement> &w);
 
     void exec_condition(const std::shared_ptr<Condition> &c);
 
+    // 短路求值的条件直接翻译成条件跳转链，不产生布尔值：
+    // exec_branch() 在 c 成立时跳到 ifTrue、否则跳到 ifFalse，末尾总是一条 JMP；
+    // exec_jump_if() 在 c 的值等于 sense 时跳到 target，否则顺序执行下去
+    void exec_branch(const std::shared_ptr<Condition> &c, const std::string &ifTrue, const std::string &ifFalse);
+
+    void exec_jump_if(const std::shared_ptr<Condition> &c, bool sense, const std::string &target);
+
     void exec_print(const std::shared_ptr<PrintStatement> &p);
 
     void exec_declaration(const std::shared_ptr<Declaration> &d);
 
     void exec_statement(const std::shared_ptr<Node> &n);
 
+    void exec_procedure(const std::shared_ptr<ProcedureNode> &p);
+
+    // value 为 false 时是调用语句，丢弃返回值，返回空串
+    std::string exec_call(const std::shared_ptr<CallNode> &c, bool value);
+
+    void exec_return(const std::shared_ptr<ReturnStatement> &r);
+
+    // 源码里的变量名在当前过程中指的变量：局部变量换成 V<过程名>.<变量名>，其它不变
+    std::string resolve(const std::string &name) const;
+
     std::string nextTemp();
 
     std::string nextLabel();
@@ -100,12 +297,20 @@ private:
 
     std::string nextStringSym();
 
+    // 追加一条 IR，行号取当前语句的
+    void emit(std::shared_ptr<IRInstr> ins);
+
 private:
     std::shared_ptr<Node> root;
     InterCodeArray arr;
     std::unordered_map<std::string, std::string> identifiers;
     std::unordered_map<std::string, std::string> constants;
+    std::map<std::string, std::int64_t> arrays; // 本段 IR 声明的数组（见 GeneratedIR::arrays）
+    std::string prefix;
     int tCounter{1};
     int lCounter{1};
     int sCounter{1};
+    int line{0}; // 正在翻译的语句的行号
+    std::string procedure; // 正在翻译的过程名（不带前缀），顶层为空
+    std::unordered_map<std::string, bool> locals; // 这个过程的局部变量（源码名） -> 是否是参数
 };
@@ -0,0 +1,125 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ir.hpp"
+
+// GeneratedIR 的二进制格式（.ir），供 --emit=ir 与 --opt 使用。
+//
+// 整个文件是几张定长记录表加一块字符串数据，全部 8 字节对齐、小端：
+//   Header
+//   Instr[instrCount]        每条指令 32 字节，操作数是字符串表的下标
+//   Piece[pieceCount]        WriteCode 的各段、调用的实参与过程的参数，Instr 里记录起始下标与个数
+//   StringRef[stringCount]   (offset, size)，指向字符串数据
+//   Pair[identCount]         identifiers：(名字, 类型)，按名字排序
+//   Pair[constCount]         constants：(S<n>, 内容)，按名字排序
+//   字符串数据               所有字符串去重后依次存放，各以 '\0' 结尾
+//
+// 文件 mmap 之后直接按下标访问，不需要逐条解析；同样的 IR 总是得到逐字节相同的文件。
+namespace irfile {
+
+constexpr char kMagic[8] = {'C', 'F', 'N', 'I', 'R', '\0', '\0', '\0'};
+constexpr std::uint32_t kVersion = 1;
+
+struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t instrSize; // sizeof(Instr)，记录格式改变时也能发现
+    std::uint64_t fileSize;
+    std::uint64_t instrCount, instrOffset;
+    std::uint64_t pieceCount, pieceOffset;
+    std::uint64_t stringCount, stringOffset;
+    std::uint64_t identCount, identOffset;
+    std::uint64_t constCount, constOffset;
+    std::uint64_t dataSize, dataOffset;
+};
+
+// 操作数按 IR 结构体中字段的声明顺序存放：
+//   Assignment: var left op right    Compare: left operation right jump
+//   Select: var left operation right ifTrue ifFalse
+//   Jump: dist    Label: label    Print: value
+//   Write: ops[0] = 第一段在 Piece 表中的下标，ops[1] = 段数
+//   Load: var array index    Store: array index value
+//   VectorLoop: label index operation bound，ops[4] = 循环体的条数，循环体的记录紧跟在它后面
+//   Call: var proc，ops[2] / ops[3] = 实参在 Piece 表中的起始下标 / 个数    Return: value
+//   Procedure: name，ops[1] / ops[2] = 参数在 Piece 表中的起始下标 / 个数，
+//              ops[3] = 过程体的记录数（包括其中 VectorLoop 的循环体），过程体的记录紧跟在它后面
+struct Instr {
+    std::uint8_t kind; // IRKind
+    std::uint8_t printKind; // Print
+    std::uint8_t newline; // Print
+    std::uint8_t reserved;
+    std::uint32_t ops[6];
+    std::uint32_t line; // IRInstr::line（旧文件里这里是保留的 0，即没有行号）
+};
+
+struct Piece {
+    std::uint32_t kind; // PrintKind
+    std::uint32_t value;
+};
+
+struct StringRef {
+    std::uint32_t offset;
+    std::uint32_t size;
+};
+
+struct Pair {
+    std::uint32_t key;
+    std::uint32_t value;
+};
+
+static_assert(sizeof(Header) == 120 && sizeof(Instr) == 32, "irfile records must not contain padding");
+
+std::vector<std::uint8_t> serialize(const GeneratedIR &ir);
+
+// 只读视图。open() 把文件 mmap 进来；from_bytes() 接管一段内存（例如编译缓存里读出的条目）。
+// 打开时只检查文件头和各张表的范围；下标在访问时检查。格式不对时抛出 std::runtime_error
+class File final {
+public:
+    static File open(const std::string &path);
+
+    static File from_bytes(std::vector<std::uint8_t> bytes);
+
+    File(File &&other) noexcept;
+
+    File &operator=(File &&other) noexcept;
+
+    File(const File &) = delete;
+
+    File &operator=(const File &) = delete;
+
+    ~File();
+
+    [[nodiscard]] std::size_t size() const { return header().instrCount; }
+
+    [[nodiscard]] const Instr &instr(std::size_t i) const;
+
+    [[nodiscard]] std::string_view string(std::uint32_t id) const;
+
+    // 第 i 条指令的第 k 个操作数
+    [[nodiscard]] std::string_view operand(std::size_t i, unsigned k) const { return string(instr(i).ops[k]); }
+
+    // 物化成优化 pass 使用的 GeneratedIR
+    [[nodiscard]] GeneratedIR to_ir() const;
+
+private:
+    File() = default;
+
+    void validate(const std::string &name) const;
+
+    [[nodiscard]] const Header &header() const { return *reinterpret_cast<const Header *>(data_); }
+
+    template<typename T>
+    [[nodiscard]] const T *table(std::uint64_t offset) const { return reinterpret_cast<const T *>(data_ + offset); }
+
+    void release();
+
+    const std::uint8_t *data_{nullptr};
+    std::size_t size_{0};
+    std::size_t mapped_{0}; // mmap 的长度；0 表示 data_ 指向 owned_
+    std::vector<std::uint8_t> owned_;
+};
+
+} // namespace irfile
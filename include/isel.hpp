@@ -0,0 +1,110 @@
+#pragma once
+#include "ir.hpp"
+#include "x86.hpp"
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// 指令选择。只被用到一次、而且紧接着的下一条 IR 就用到它的临时变量不写回 .bss，
+// 而是作为子树并进使用它的那条 IR，组成一棵表达式树；
+// 每棵树按规则列出所有可用的 x86-64 写法（add qword [x], imm / inc / lea / cmp qword [x], imm /
+// test r, r / xor r32, r32 ……），按代价表逐条累计代价，取最便宜的一种。
+namespace isel {
+
+// 默认（-O1）以延迟为先，-Os 以编码长度为先
+enum class Goal { Speed, Size };
+
+// 代价表的一行：一条指令的延迟（周期）、编码长度与条数
+struct Cost {
+    unsigned latency;
+    unsigned bytes;
+    unsigned insns;
+};
+
+// 延迟查表（按操作码与操作数形式）；长度由内置编码器算出，与 nasm -Ox 一致
+Cost cost(const x86::Instr &i);
+
+// 一段指令的代价合成一个数，越小越好。Speed：延迟优先，其次条数，最后是长度；Size：长度优先
+unsigned score(const std::vector<x86::Instr> &seq, Goal goal = Goal::Speed);
+
+// 会并进下一条 IR 的临时变量（即不需要 .bss 槽位的）
+std::unordered_set<std::string> fold_temps(const InterCodeArray &code);
+
+class Selector final {
+public:
+    // 把 IR 里的操作数名字解析成叶子（立即数、[变量] 或字符串地址）
+    using Resolve = std::function<x86::Operand(const std::string &)>;
+
+    Selector(x86::Module &mod, Resolve resolve, Goal goal = Goal::Speed);
+
+    // 开始翻译一段新的 IR（整个程序，或流式输出的一段），folded 来自 fold_temps()
+    void reset(std::unordered_set<std::string> folded);
+
+    [[nodiscard]] bool folded(const std::string &name) const { return folded_.count(name) != 0; }
+
+    // var = left op right；var 会被并进下一条时只记下这棵树，不生成代码
+    void assign(const AssignmentCode &a);
+
+    // var = array[index]；var 会被并进下一条时同样只记下这棵树
+    void load_element(const LoadCode &l);
+
+    // array[index] = value
+    void store_element(const StoreCode &s);
+
+    // 比较 left 和 right 并设置标志位，返回随后的 jcc 应使用的条件（操作数可能被交换）
+    [[nodiscard]] x86::Cond compare(const std::string &left, const std::string &right, x86::Cond cond);
+
+    // 把 IR 的值（可能是挂起的表达式树，只能放进 rax）放进寄存器 r
+    void load(x86::Reg r, const std::string &value);
+
+    // 寄存器赋值；0 用 xor r32, r32（不能放在比较和条件跳转之间，它会改写标志位），
+    // 字符串地址用 lea r32, [S1]，-Os 时其它小常数用 push imm8 / pop r
+    void load(x86::Reg r, const x86::Operand &value);
+
+private:
+    using Seq = std::vector<x86::Instr>;
+
+    struct Node {
+        x86::Op op{x86::Op::Mov}; // Mov 表示叶子
+        x86::Operand leaf;
+        int left{-1};
+        int right{-1};
+        x86::SymbolId array{x86::NoSymbol}; // 数组元素 array[left]（op 为 Mov）
+    };
+
+    int node(const std::string &name);
+
+    int tree(const AssignmentCode &a);
+
+    [[nodiscard]] bool is_leaf(int n) const {
+        return nodes_[n].op == x86::Op::Mov && nodes_[n].array == x86::NoSymbol;
+    }
+
+    // 树 t 的值存进 dst；address 是 dst 用到的变址寄存器的装入，放在求值之后、写入之前。
+    // index 是装进变址寄存器的值，用来认出 a[i] = a[i] op y 这样的读-改-写
+    void store_tree(const x86::Operand &dst, int t, const Seq &address = {}, const x86::Operand &index = {});
+
+    // 节点 n 读的正是 dst（同一个变量，或者下标相同的同一个数组元素）
+    [[nodiscard]] bool reads(int n, const x86::Operand &dst, const x86::Operand &index) const;
+
+    [[nodiscard]] Seq eval(int n) const;
+
+    void load_into(Seq &seq, x86::Reg r, const x86::Operand &value) const;
+
+    void apply(Seq &seq, x86::Op op, const x86::Operand &src) const;
+
+    void keep(Seq &best, bool &have, Seq candidate) const;
+
+    void emit(const Seq &seq);
+
+    x86::Module &mod_;
+    Resolve resolve_;
+    Goal goal_;
+    std::unordered_set<std::string> folded_;
+    std::vector<Node> nodes_;
+    int pending_{-1}; // 等着并进下一条的树
+    std::string pendingName_;
+};
+
+} // namespace isel
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "blocks.hpp"
+#include "ir.hpp"
+
+// Profile-guided optimization。
+//
+// --instrument：在 label_blocks() 之后的 IR 上按 IR 顺序分配计数器，编号从 0 开始依次递增：
+// 每个标签（基本块入口）一个；每条条件跳转两个——跳转成立的次数，以及方向与上一次
+// 执行不同的次数（相当于"按上次方向预测"的预测器猜错的次数，用来衡量分支是否可预测）。
+// 生成的程序退出时把计数器写入文件：
+//
+//   "NASMPROF" | u64 版本 | u64 IR 校验和 | u64 计数器个数 n | n × u64 计数器（均为小端）
+//
+// --profile-use：对同一份源码、同样的优化级别重新编译时读回计数器，
+// 校验和不同（源码或编译器变了）时报错，然后运行 profile_passes()。
+
+constexpr std::uint64_t kProfileVersion = 1;
+constexpr std::size_t kProfileHeaderSize = 32;
+
+// label_blocks() 之后的 IR 的指纹（FNV-1a），计数器文件与程序是否对应以此为准
+std::uint64_t ir_checksum(const InterCodeArray &code);
+
+// 计数器个数：标签数 + 2 × 条件跳转数
+std::size_t profile_counter_count(const InterCodeArray &code);
+
+// 计数器文件的文件头，后面紧跟 n 个计数器
+std::string profile_header(std::uint64_t checksum, std::size_t counters);
+
+struct Profile {
+    std::unordered_map<std::string, std::uint64_t> count; // 块标签 -> 执行次数
+    std::unordered_map<std::string, std::uint64_t> taken; // 以条件跳转结束的块 -> 跳转成立的次数
+    std::unordered_map<std::string, std::uint64_t> flips; // 以条件跳转结束的块 -> 方向改变的次数
+};
+
+// 读取并累加若干个计数器文件（同一程序的多次运行），按编号对应回 code 中的块。
+// 文件损坏或与 code 不对应时抛出 std::runtime_error。
+Profile load_profile(const std::vector<std::string> &paths, const InterCodeArray &code);
+
+// 使用 profile 的变换，在基本块上进行；identifiers 用于登记新建的临时变量
+struct ProfilePass {
+    const char *name;
+    void (*run)(std::vector<IRBlock> &blocks, Profile &profile,
+                std::unordered_map<std::string, std::string> &identifiers);
+};
+
+// 依次为：thread_jumps、if_convert、unroll_loops、layout_blocks
+const std::vector<ProfilePass> &profile_passes();
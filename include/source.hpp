@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// 编译器的输入。Flex 直接在这里的内存上扫描，源码在进入词法分析之前不再拷贝：
+//  - 普通文件：mmap 映射，映射末尾紧跟 yy_scan_buffer() 要求的两个 '\0' 哨兵；
+//  - 标准输入、管道等不能映射的输入：由扫描器的 YY_INPUT 调用 read() 分块读取，
+//    内存占用与输入大小无关；
+//  - 内存中的字符串：拷贝一次并补上哨兵（与原来的 yy_scan_bytes 相同）。
+class SourceInput final {
+public:
+    // path 为 "-" 时读取标准输入。打不开时抛出 std::runtime_error。
+    static SourceInput open(const std::string &path);
+
+    // 不映射，普通文件也通过 read() 分块读取：流式编译（--stream）时内存占用与文件大小无关
+    static SourceInput open_streaming(const std::string &path);
+
+    static SourceInput from_string(std::string_view text);
+
+    SourceInput(SourceInput &&other) noexcept;
+
+    SourceInput &operator=(SourceInput &&other) noexcept;
+
+    SourceInput(const SourceInput &) = delete;
+
+    SourceInput &operator=(const SourceInput &) = delete;
+
+    ~SourceInput();
+
+    // 流式输入没有完整的缓冲区，只能通过 read() 读取
+    [[nodiscard]] bool streaming() const { return data_ == nullptr; }
+
+    // 可交给 yy_scan_buffer() 的缓冲区，长度为 size() + 2（含两个哨兵）。
+    // Flex 会临时改写 yytext 之后的一个字节，所以缓冲区是可写的（映射为 MAP_PRIVATE）。
+    [[nodiscard]] char *buffer() const { return data_; }
+
+    [[nodiscard]] std::string_view text() const { return {data_, data_ ? size_ : 0}; }
+
+    // 源码字节数 / 行数；流式输入为目前已经读取的部分
+    [[nodiscard]] std::size_t size() const { return size_; }
+
+    [[nodiscard]] std::size_t lines() const;
+
+    // YY_INPUT：最多读取 max 字节，到达末尾返回 0
+    std::size_t read(char *buf, std::size_t max);
+
+private:
+    SourceInput() = default;
+
+    void release();
+
+    char *data_{nullptr};
+    std::size_t size_{0};
+    std::size_t mapped_{0}; // mmap 的长度；0 表示 data_ 指向 owned_
+    std::unique_ptr<char[]> owned_;
+    int fd_{-1};
+    bool ownsFd_{false};
+    std::size_t streamedLines_{0};
+};
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// --stats 报告：各阶段耗时、内存与计数器（类似 -ftime-report）
+struct CompileStats {
+    // 阶段名 -> 墙钟时间（秒），按执行顺序；优化 pass 以 "pass:<名字>" 记录
+    std::vector<std::pair<std::string, double> > phases;
+    std::size_t files{0}; // 汇总了几次编译
+    std::size_t tokens{0};
+    std::size_t astNodes{0};
+    std::size_t irBefore{0}; // 优化前的 IR 指令数
+    std::size_t irAfter{0}; // 优化后的 IR 指令数
+    std::size_t machineInstrs{0}; // 生成的机器指令数（静态）
+    std::uint64_t textBytes{0}; // 编码后的 .text 大小（流式输出与并行区域不编码，为 0）
+    std::uint64_t dataBytes{0}; // .rodata + .data
+    std::uint64_t bssBytes{0};
+    std::uint64_t allocations{0}; // operator new 次数
+    std::uint64_t allocatedBytes{0};
+    long peakRssKb{0}; // 进程的峰值常驻内存
+    std::size_t cacheHits{0}; // 编译缓存（--cache-dir）
+    std::size_t cacheMisses{0};
+
+    // 同名阶段累加
+    void add_phase(const std::string &name, double seconds);
+
+    // 批量编译时把各个文件的统计加在一起（阶段耗时为各线程之和）
+    void merge(const CompileStats &other);
+};
+
+// 当前线程到目前为止的 operator new 次数 / 字节数，用差值得到一段代码的分配量
+struct AllocCounters {
+    std::uint64_t count{0};
+    std::uint64_t bytes{0};
+};
+
+AllocCounters thread_alloc_counters();
+
+long peak_rss_kb();
+
+std::string stats_table(const CompileStats &stats);
+
+std::string stats_json(const CompileStats &stats);
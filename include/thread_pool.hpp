@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 工作窃取线程池：每个工作线程有自己的双端队列，从队尾取自己的任务，
+// 空闲时从其他线程的队头窃取。任务里再 submit 的子任务会进入当前线程自己的队列。
+class ThreadPool final {
+public:
+    // threads == 0 时使用 std::thread::hardware_concurrency()
+    explicit ThreadPool(unsigned threads = 0);
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool();
+
+    void submit(std::function<void()> task);
+
+    // 等待所有已提交的任务完成；调用线程也会参与执行。
+    // 任务抛出的第一个异常在这里重新抛出。不能在本线程池的任务内部调用。
+    void wait();
+
+    [[nodiscard]] unsigned size() const { return static_cast<unsigned>(queues.size()); }
+
+private:
+    using Task = std::function<void()>;
+
+    struct Queue {
+        std::mutex m;
+        std::deque<Task> tasks;
+    };
+
+    bool take(unsigned self, Task &task);
+
+    void execute(Task &task);
+
+    void run(unsigned index);
+
+    std::vector<std::unique_ptr<Queue> > queues;
+    std::vector<std::thread> workers;
+
+    std::mutex m;
+    std::condition_variable wake; // 有新任务或需要退出
+    std::condition_variable idle; // pending 降为 0
+    std::atomic<std::size_t> queued{0}; // 还在队列里的任务
+    std::atomic<std::size_t> pending{0}; // 已提交但未执行完的任务
+    std::atomic<unsigned> nextQueue{0};
+    bool stopping{false};
+    std::exception_ptr error;
+};
@@ -1,5 +1,8 @@
 #pragma once
+#include <deque>
 #include <string>
+#include <string_view>
+#include <unordered_set>
 #include <vector>
 #include <stdexcept>
 
@@ -26,12 +29,47 @@ enum class TokenType {
     End
 };
 
+// Token 只保存文本的视图：标识符、字面量的文本在 StringPool 中，
+// 运算符、关键字等固定文本指向字符串常量
 struct Token {
     TokenType type{TokenType::End};
-    std::string value;
+    std::string_view value;
     int line{0};
 };
 
+// 一次解析的字符串驻留池：相同的文本只保存一份，返回的 string_view 在池的生命周期内有效
+class StringPool {
+public:
+    std::string_view intern(const std::string_view text) {
+        if (const auto it = index.find(text); it != index.end())
+            return *it;
+        // deque 追加元素不会移动已有的 string，视图保持有效
+        const std::string_view stored = storage.emplace_back(text);
+        index.insert(stored);
+        return stored;
+    }
+
+    // 等价于 intern(prefix + text)，拼接用的缓冲区重复使用
+    std::string_view intern(const std::string_view prefix, const std::string_view text) {
+        scratch.assign(prefix);
+        scratch.append(text);
+        return intern(std::string_view(scratch));
+    }
+
+    [[nodiscard]] std::size_t size() const { return storage.size(); }
+
+    // 之前返回的 string_view 全部失效（流式解析在每条顶层语句之后调用）
+    void clear() {
+        index.clear();
+        storage.clear();
+    }
+
+private:
+    std::deque<std::string> storage;
+    std::unordered_set<std::string_view> index;
+    std::string scratch;
+};
+
 class TokenArray {
 public:
     void push(const Token &t) { tokens.push_back(t); }
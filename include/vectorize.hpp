@@ -0,0 +1,21 @@
+#pragma once
+#include "ir.hpp"
+
+// 数组上的计数循环的向量化。IR 生成的 while 循环形如
+//
+//   L_start: CMP i < B -> L_body      (也可以是 <=，或者 B > i / B >= i)
+//            JMP L_end
+//   L_body:  <直线代码：Load / Store / Assignment>
+//            i = i + 1
+//            JMP L_start
+//
+// 当循环体的每次迭代互不依赖时，在 L_start 之前插入一条 VectorLoopCode（见 ir.hpp），
+// 代码生成把它变成一次处理 2 个（SSE2）或 4 个（AVX2）元素的循环，
+// 剩下不够一组的迭代仍由原来的标量循环完成。条件：
+//   - 循环只能从上面顺序进入（L_start 只被回边引用），B 是字面量或循环体里不写的变量；
+//   - 数组的下标都正好是 i，i 本身也可以作为值参与运算；
+//   - 运算只有 + 和 -（64 位整数的向量乘法在 AVX-512 之前没有，除法都没有）；
+//   - 写入的变量除了临时变量，只能是 s = s + x / s = x + s / s = s - x 形式的归约，
+//     且 s 在循环体里没有别的读取；
+//   - 同时需要的向量寄存器不超过 16 个。
+InterCodeArray vectorize_loops(const InterCodeArray &in);
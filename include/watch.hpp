@@ -0,0 +1,112 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "compiler.hpp"
+
+// --watch：源文件每次保存之后重新编译，只重做改动波及的部分。
+//
+// IncrementalCompiler 记住上一次成功解析的源码，按顶层语句切成段，每段保留 AST、
+// IR（-O1 时已经过 local_passes()）和生成的 NASM 文本。update() 收到新的源码后：
+// 1. 与上一份源码比较出改动的字节范围，只重新扫描、解析与它相交的那几条语句所在的一段文本，
+//    其余的段原样保留，后面的段按长度差和行数差平移。这一段单独解析不了时（例如改动打开了一个
+//    没有结束的注释）整个文件重新解析，字节范围和内容都没变的段仍然沿用；
+// 2. 只为新解析出来的段生成 IR。改动增删了声明时，用到这些名字的段也重新生成；
+// 3. 全程序的 pass 只在需要时重做：remove_dead_assignments 拆成逐段的两半，各段的读取汇总成计数，
+//    只有写入的变量从有人读变成没人读（或者反过来）的段才重新生成代码。程序里有过程（内联要看到
+//    所有调用）或者选项要求整个程序一起编译（-g、非 asm 输出、插桩、PGO）时，把各段的 IR
+//    拼起来走一遍 compile_ir()。
+// 其余情况与 --regions 一样不做 layout_blocks 和 fuse_prints：输出与完整编译等价，但不逐字节相同。
+class IncrementalCompiler final {
+public:
+    explicit IncrementalCompiler(Options options);
+
+    ~IncrementalCompiler();
+
+    IncrementalCompiler(const IncrementalCompiler &) = delete;
+
+    IncrementalCompiler &operator=(const IncrementalCompiler &) = delete;
+
+    // 最近一次 update() 做了多少工作
+    struct Stats {
+        std::size_t statements = 0; // 顶层语句总数
+        std::size_t reparsed = 0; // 重新解析的语句
+        std::size_t regenerated = 0; // 重新生成 IR 的语句
+        std::size_t recompiled = 0; // 重新生成代码的语句
+        bool fullParse = false; // 改动的范围不能单独解析，整个文件重新解析了一遍
+        bool wholeProgram = false; // 各段的 IR 拼起来走了一遍 compile_ir()
+        double seconds = 0;
+    };
+
+    // 编译新的源码。语法错误时保留上一次成功解析的状态，下一次 update() 仍与它比较
+    Result update(std::string source);
+
+    [[nodiscard]] const Stats &stats() const { return stats_; }
+
+private:
+    struct Segment;
+
+    // 重新解析改动波及的语句，返回被替换掉的旧段；语法错误时抛出异常，状态不变
+    std::vector<Segment> reparse(const std::string &source);
+
+    // 为新的段和声明变化波及的段生成 IR，记下所有段的声明
+    void generate(const std::vector<Segment> &removed);
+
+    // 段的读取计入（sign 为 1）或移出（-1）readers_，记下读者数在 0 与非 0 之间变化的变量
+    void count_reads(Segment &segment, int sign);
+
+    // 段的变量计入或移出 users_
+    void count_variables(const Segment &segment, int sign);
+
+    void compile_segment(Segment &segment, const CodegenOptions &cgOptions);
+
+    // 是否要把整个程序的 IR 拼起来编译（见上面的说明）
+    [[nodiscard]] bool whole_program() const;
+
+    // 各段的 NASM 文本拼成整个程序
+    void assemble(Result &result);
+
+    // 各段的 IR 拼起来从头运行 pass 流水线并生成代码
+    void compile_whole(Result &result);
+
+    Options options_;
+    std::string source_;
+    bool parsed_ = false;
+    std::vector<Segment> segments_;
+    std::size_t changeAt_ = 0; // 这次 update() 替换掉的段从哪里开始，之前的段看到的声明不变
+    std::unordered_map<std::string, std::string> declared_; // 所有段的声明，按顺序后面的覆盖前面的
+    std::size_t generators_ = 0; // 重新生成 IR 的 IntermediateCodeGen 个数，名字的前缀 w<n>_ 互不相同
+    std::size_t procedures_ = 0; // 定义过程的段数
+    std::unordered_map<std::string, std::size_t> readers_; // 变量 -> 读它的段数
+    std::unordered_set<std::string> flipped_; // 这次 update() 中读者数在 0 与非 0 之间变化过的变量
+    std::unordered_map<std::string, std::size_t> users_; // 变量 -> 用到它（需要槽位）的段数
+    std::vector<std::string> variables_; // users_ 中的变量，按第一次出现的顺序
+    bool unusedVariables_ = false; // variables_ 里有已经没人用的变量，拼接前去掉
+    Stats stats_;
+};
+
+// 用 inotify 等待一个文件被改写。监视的是它所在的目录，编辑器先写临时文件再改名的保存方式也能收到
+class FileWatcher final {
+public:
+    explicit FileWatcher(const std::string &path);
+
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher &) = delete;
+
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    // 阻塞到文件下一次写完关闭（IN_CLOSE_WRITE）或者被换成新文件（IN_MOVED_TO），
+    // 之后 debounceMs 毫秒内接连到来的事件合并成这一次
+    void wait(int debounceMs = 20);
+
+private:
+    // 读出当前所有事件，返回其中有没有这个文件的
+    bool drain();
+
+    int fd_ = -1;
+    std::string name_; // 目录中的文件名
+};
@@ -0,0 +1,349 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// x86-64 机器指令层。
+// CodeGenerator 把 IR 翻译成 Module，之后既可以打印成 NASM 文本（调试用），
+// 也可以由 encode() 直接编码成机器码，再交给 elf.hpp 写成 .o / 可执行文件。
+namespace x86 {
+
+// 宽度为 Xmm / Ymm 的寄存器操作数按编号表示 xmm0..xmm15 / ymm0..ymm15
+enum class Reg : std::uint8_t {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+    None = 0xFF
+};
+
+enum class Width : std::uint8_t {
+    Byte = 1,
+    Dword = 4,
+    Qword = 8,
+    Xmm = 16, // SSE2 的 128 位寄存器
+    Ymm = 32 // AVX2 的 256 位寄存器：向量指令用 VEX.256 编码，打印成 v 开头的三操作数写法
+};
+
+// 取值即 Jcc 编码中的条件码
+enum class Cond : std::uint8_t {
+    O = 0x0, NO = 0x1, B = 0x2, AE = 0x3, E = 0x4, NE = 0x5, BE = 0x6, A = 0x7,
+    S = 0x8, NS = 0x9, P = 0xA, NP = 0xB, L = 0xC, GE = 0xD, LE = 0xE, G = 0xF
+};
+
+using SymbolId = std::int32_t;
+constexpr SymbolId NoSymbol = -1;
+
+struct Operand {
+    enum class Kind : std::uint8_t {
+        None,
+        Reg, // 寄存器
+        Imm, // 立即数
+        Mem, // [base + index*scale + sym + disp]
+        Addr // 符号地址本身作为立即数，如 mov rax, S1
+    };
+
+    Kind kind{Kind::None};
+    Width width{Width::Qword};
+    Reg reg{Reg::None}; // Reg: 寄存器；Mem: 基址寄存器
+    Reg index{Reg::None}; // Mem: 变址寄存器
+    std::uint8_t scale{1};
+    std::int64_t value{0}; // Imm: 立即数；Mem / Addr: 偏移
+    SymbolId sym{NoSymbol}; // Mem / Addr: 偏移相对的符号
+};
+
+// xmm / ymm 寄存器
+inline Operand vreg(const int n, const Width w) {
+    Operand o;
+    o.kind = Operand::Kind::Reg;
+    o.reg = static_cast<Reg>(n);
+    o.width = w;
+    return o;
+}
+
+inline Operand reg(const Reg r, const Width w = Width::Qword) {
+    Operand o;
+    o.kind = Operand::Kind::Reg;
+    o.reg = r;
+    o.width = w;
+    return o;
+}
+
+inline Operand imm(const std::int64_t v) {
+    Operand o;
+    o.kind = Operand::Kind::Imm;
+    o.value = v;
+    return o;
+}
+
+// [sym + disp]
+inline Operand mem(const SymbolId s, const std::int64_t disp = 0, const Width w = Width::Qword) {
+    Operand o;
+    o.kind = Operand::Kind::Mem;
+    o.sym = s;
+    o.value = disp;
+    o.width = w;
+    return o;
+}
+
+// [base + disp]
+inline Operand mem(const Reg base, const std::int64_t disp = 0, const Width w = Width::Qword) {
+    Operand o;
+    o.kind = Operand::Kind::Mem;
+    o.reg = base;
+    o.value = disp;
+    o.width = w;
+    return o;
+}
+
+// [base + index*scale]
+inline Operand mem(const Reg base, const Reg index, const std::uint8_t scale, const Width w = Width::Qword) {
+    Operand o;
+    o.kind = Operand::Kind::Mem;
+    o.reg = base;
+    o.index = index;
+    o.scale = scale;
+    o.width = w;
+    return o;
+}
+
+// [sym + index*scale + disp]：数组元素
+inline Operand mem(const SymbolId s, const Reg index, const std::uint8_t scale, const std::int64_t disp = 0,
+                   const Width w = Width::Qword) {
+    Operand o;
+    o.kind = Operand::Kind::Mem;
+    o.sym = s;
+    o.index = index;
+    o.scale = scale;
+    o.value = disp;
+    o.width = w;
+    return o;
+}
+
+inline Operand addr(const SymbolId s) {
+    Operand o;
+    o.kind = Operand::Kind::Addr;
+    o.sym = s;
+    return o;
+}
+
+enum class Op : std::uint8_t {
+    Mov,
+    Add,
+    Sub,
+    And,
+    Or,
+    Xor,
+    Cmp,
+    Test,
+    Imul,
+    Idiv,
+    Div,
+    Cqo,
+    Neg,
+    Inc,
+    Dec,
+    Lea,
+    Cmov, // cmovcc，条件在 Instr::cond
+    Push,
+    Pop,
+    Pushf, // pushfq
+    Popf, // popfq
+    Jmp,
+    Jcc,
+    Call,
+    Ret,
+    Syscall,
+    // 向量指令（64 位整数 lane）。操作数是 Xmm 时为 SSE2 编码，Ymm 时为 AVX2（VEX.256）；
+    // Paddq / Psubq / Pxor 是两操作数的 dst = dst op src，Ymm 时打印成 vpaddq dst, dst, src
+    Movdqu, // 不要求对齐的整块读写
+    Movdqa, // 寄存器之间复制
+    Movq, // xmm 与 64 位通用寄存器 / 内存之间
+    Paddq,
+    Psubq,
+    Pxor,
+    Punpcklqdq, // 低 64 位复制到高 64 位（与自己）：SSE2 的广播
+    Vpbroadcastq, // AVX2 的广播
+    Vzeroupper, // 离开 AVX 代码前清掉 ymm 的高半部分，避免之后的 SSE 指令付出状态切换的代价
+    Cpuid,
+    Xgetbv,
+    Label,
+    Align,
+    Line // 之后的指令来自源码的第 Instr::line 行（不占字节，见 Module::sourceName）
+};
+
+// 标签、对齐和行号不是机器指令
+inline bool pseudo(const Op op) {
+    return op == Op::Label || op == Op::Align || op == Op::Line;
+}
+
+struct Instr {
+    Op op{Op::Ret};
+    Cond cond{Cond::E}; // 仅 Jcc / Cmov 使用
+    Operand dst;
+    Operand src;
+    SymbolId target{NoSymbol}; // Jmp / Jcc / Call 的目标，Label 定义的符号
+    std::uint32_t align{0}; // 仅 Align 使用
+    std::uint32_t line{0}; // 仅 Line 使用
+};
+
+inline bool operator==(const Operand &a, const Operand &b) {
+    return a.kind == b.kind && a.width == b.width && a.reg == b.reg && a.index == b.index &&
+           a.scale == b.scale && a.value == b.value && a.sym == b.sym;
+}
+
+inline bool operator==(const Instr &a, const Instr &b) {
+    return a.op == b.op && a.cond == b.cond && a.dst == b.dst && a.src == b.src &&
+           a.target == b.target && a.align == b.align && a.line == b.line;
+}
+
+struct DataItem {
+    SymbolId sym;
+    std::string bytes;
+    std::uint32_t align{0}; // 非 0 时先补 0 对齐到这么多字节
+};
+
+struct BssItem {
+    SymbolId sym;
+    std::uint32_t size;
+    std::uint32_t align{0}; // 非 0 时先对齐到这么多字节
+};
+
+// .data / .rodata / .bss 的节对齐，DataItem / BssItem 的 align 不能超过它
+constexpr std::uint32_t kDataSectionAlign = 64;
+
+class Module final {
+public:
+    // 符号名 -> 编号；同名返回同一个编号
+    SymbolId symbol(const std::string &name);
+
+    [[nodiscard]] const std::string &name(SymbolId id) const { return names[id]; }
+    [[nodiscard]] std::size_t symbolCount() const { return names.size(); }
+
+    void ins(Op op, const Operand &dst = {}, const Operand &src = {});
+
+    void jmp(SymbolId target);
+
+    void jcc(Cond c, SymbolId target);
+
+    void cmov(Cond c, const Operand &dst, const Operand &src);
+
+    void call(SymbolId target);
+
+    void label(SymbolId s);
+
+    void line(std::uint32_t n);
+
+    std::vector<BssItem> bss;
+    std::vector<DataItem> data;
+    std::vector<DataItem> rodata;
+    std::vector<Instr> text;
+    std::vector<SymbolId> globals;
+    std::string sourceName; // Line 伪指令所指的源文件：NASM 的 %line 与 DWARF 行号表里的文件名
+
+private:
+    std::vector<std::string> names;
+    std::unordered_map<std::string, SymbolId> ids;
+};
+
+// NASM 文本的输出器：助记符和操作数直接格式化进一块复用的缓冲区，攒够 kFlushBytes 就整块交给 sink，
+// 不产生临时字符串。整数自己转换成十进制；符号的内存操作数写法（"[name]"）按 SymbolId 缓存，
+// 同一个 Module 里每个符号只拼一次
+class NasmWriter final {
+public:
+    using Sink = std::function<void(std::string_view)>;
+
+    static constexpr std::size_t kFlushBytes = std::size_t{1} << 16;
+
+    explicit NasmWriter(Sink sink);
+
+    NasmWriter(const NasmWriter &) = delete;
+
+    NasmWriter &operator=(const NasmWriter &) = delete;
+
+    // 打印为 NASM 语法（nasm -f elf64 可直接汇编）。
+    // fragment：流式输出中的一段，只打印非空的段，section 指令不带属性（属性以开头那一段的声明为准）
+    void write(const Module &m, bool fragment = false);
+
+    // 已经格式化好的文本（例如并行区域各自的输出）按顺序原样输出；大块直接交给 sink，不经过缓冲区
+    void append(std::string_view text);
+
+    // 把缓冲区里剩下的文本交给 sink；输出结束时必须调用
+    void flush();
+
+private:
+    void put(char c) { buf_.push_back(c); }
+
+    void put(std::string_view s) { buf_.append(s.data(), s.size()); }
+
+    void put_int(std::int64_t v);
+
+    void end_line();
+
+    void put_operand(const Module &m, const Operand &o, bool sized);
+
+    void put_db(const std::string &bytes);
+
+    std::string_view mem_spelling(const Module &m, SymbolId id);
+
+    Sink sink_;
+    std::string buf_;
+    std::string spellings_; // 所有缓存的写法依次存放
+    std::vector<std::pair<std::uint32_t, std::uint32_t> > spelling_; // SymbolId -> (偏移, 长度)，长度 0 表示还没有
+};
+
+// 整个 Module 的 NASM 文本
+std::string to_nasm(const Module &m);
+
+// -------------------- 机器码 --------------------
+
+enum class Section : std::uint8_t {
+    Undef,
+    Text,
+    Rodata,
+    Data,
+    Bss
+};
+
+enum class RelocKind : std::uint8_t {
+    Abs64, // 8 字节绝对地址（mov r64, imm64）
+    Abs32S // 4 字节符号扩展绝对地址（[disp32]）
+};
+
+// 行号表的一行：从 .text 的这个偏移开始的指令来自源码的这一行
+struct LineRow {
+    std::uint64_t offset;
+    std::uint32_t line;
+};
+
+struct Relocation {
+    std::uint64_t offset; // .text 内偏移
+    RelocKind kind;
+    SymbolId sym;
+    std::int64_t addend;
+};
+
+struct Object {
+    std::vector<std::uint8_t> text;
+    std::vector<std::uint8_t> rodata;
+    std::vector<std::uint8_t> data;
+    std::uint64_t bssSize{0};
+    std::vector<Relocation> relocs; // 全部位于 .text
+    std::vector<LineRow> lines; // 按偏移递增；非空时 elf.hpp 写出 DWARF 行号表
+    std::string sourceName;
+    // 按 SymbolId 索引
+    std::vector<std::string> symName; // ELF 中的名字（.local 标签带上所属的全局标签前缀）
+    std::vector<Section> symSection;
+    std::vector<std::uint64_t> symOffset;
+    std::vector<bool> symGlobal;
+};
+
+// 编码：标签由编码器自己解析，跳转按 NASM 的方式优先使用短跳转
+Object encode(const Module &m);
+
+// 一条定长指令（不是跳转、调用、标签或对齐）的编码长度，指令选择用它比较各种写法
+std::size_t encoded_size(const Instr &i);
+
+} // namespace x86
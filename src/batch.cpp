@@ -0,0 +1,180 @@
+#include "batch.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+static const char *extension(const EmitKind emit) {
+    switch (emit) {
+        case EmitKind::Asm: return ".asm";
+        case EmitKind::Object: return ".o";
+        case EmitKind::Executable: return "";
+        case EmitKind::IR: return ".ir";
+    }
+    return "";
+}
+
+std::string default_output(const std::string &input, const EmitKind emit, const std::string &outDir) {
+    fs::path out = outDir.empty() ? fs::path(input).parent_path() : fs::path(outDir);
+    fs::path name = fs::path(input).filename();
+    name.replace_extension(extension(emit));
+    return (out / name).string();
+}
+
+std::vector<BatchJob> read_manifest(const std::string &path, const EmitKind emit, const std::string &outDir) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("Cannot open manifest " + path);
+
+    const auto base = fs::path(path).parent_path();
+    auto resolve = [&base](const std::string &p) {
+        return fs::path(p).is_absolute() ? p : (base / p).string();
+    };
+
+    std::vector<BatchJob> jobs;
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(in, line)) {
+        ++lineNo;
+        std::istringstream fields(line);
+        std::string input, output, extra;
+        if (!(fields >> input) || input[0] == '#')
+            continue;
+        fields >> output;
+        if (fields >> extra)
+            throw std::runtime_error(path + ":" + std::to_string(lineNo) + ": expected \"input [output]\"");
+
+        BatchJob job;
+        job.input = resolve(input);
+        job.output = output.empty() ? default_output(job.input, emit, outDir) : resolve(output);
+        jobs.push_back(std::move(job));
+    }
+    return jobs;
+}
+
+// 汇编文本边生成边写入输出文件（每次一整块，见 x86::NasmWriter），失败时删掉写了一半的文件
+static void compile_asm(const BatchJob &job, const Options &options, SourceInput &input, BatchFileResult &r) {
+    std::ofstream out(job.output, std::ios::binary);
+    auto result = compile(input, options, [&out](const std::string_view text) {
+        out.write(text.data(), static_cast<std::streamsize>(text.size()));
+    });
+    out.close();
+    r.bytes = input.size();
+    r.lines = input.lines();
+    if (result.ok && !out) {
+        result.ok = false;
+        result.error = "Cannot write " + job.output;
+    }
+    if (!result.ok) {
+        std::error_code ec;
+        fs::remove(job.output, ec);
+        r.error = result.error;
+        return;
+    }
+    if (options.stats)
+        r.stats = std::move(result.stats);
+    r.ok = true;
+}
+
+static void compile_one(const BatchJob &job, Options options, BatchFileResult &r) {
+    if (options.debugInfo)
+        options.sourceName = job.input == "-" ? "<stdin>" : job.input;
+    std::optional<SourceInput> input;
+    try {
+        input.emplace(options.stream ? SourceInput::open_streaming(job.input) : SourceInput::open(job.input));
+    } catch (const std::exception &e) {
+        r.error = e.what();
+        return;
+    }
+    if (options.emit == EmitKind::Asm) {
+        compile_asm(job, options, *input, r);
+        return;
+    }
+
+    auto result = compile(*input, options);
+    r.bytes = input->size();
+    r.lines = input->lines();
+    if (!result.ok) {
+        r.error = result.error;
+        return;
+    }
+
+    const auto writeStart = std::chrono::steady_clock::now();
+    std::ofstream out(job.output, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(result.binary.data()),
+              static_cast<std::streamsize>(result.binary.size()));
+    out.close();
+    if (!out) {
+        r.error = "Cannot write " + job.output;
+        return;
+    }
+    if (options.emit == EmitKind::Executable)
+        fs::permissions(job.output,
+                        fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec,
+                        fs::perm_options::add);
+    if (options.stats) {
+        result.stats.add_phase("write", std::chrono::duration<double>(
+                                   std::chrono::steady_clock::now() - writeStart).count());
+        r.stats = std::move(result.stats);
+    }
+    r.ok = true;
+}
+
+BatchSummary compile_batch(const std::vector<BatchJob> &jobs, const Options &options, const unsigned threads) {
+    // 两个任务写同一个输出文件时结果取决于调度顺序，直接拒绝；也不能覆盖输入
+    auto normal = [](const std::string &p) { return fs::absolute(p).lexically_normal().string(); };
+    std::unordered_set<std::string> inputs, outputs;
+    for (auto &job: jobs)
+        inputs.insert(normal(job.input));
+    for (auto &job: jobs) {
+        const auto out = normal(job.output);
+        if (!outputs.insert(out).second)
+            throw std::runtime_error("Duplicate output path " + job.output);
+        if (inputs.count(out))
+            throw std::runtime_error("Output " + job.output + " would overwrite an input file");
+    }
+    // 输出目录在启动任务前串行创建
+    for (auto &job: jobs) {
+        const auto dir = fs::path(job.output).parent_path();
+        if (!dir.empty())
+            fs::create_directories(dir);
+    }
+
+    BatchSummary summary;
+    summary.files.resize(jobs.size());
+
+    // 只有一个输入时，线程留给文件内部的并行区域（Options::regions）；否则按文件并行
+    Options fileOptions = options;
+    fileOptions.threads = jobs.size() == 1 ? threads : 1;
+
+    const auto start = std::chrono::steady_clock::now();
+    {
+        // 任务只有 jobs.size() 个，多出来的线程用不上
+        const unsigned hardware = threads ? threads : std::thread::hardware_concurrency();
+        ThreadPool pool(static_cast<unsigned>(std::min<std::size_t>(hardware, jobs.size())));
+        for (std::size_t i = 0; i < jobs.size(); ++i)
+            pool.submit([&jobs, &fileOptions, &summary, i] { compile_one(jobs[i], fileOptions, summary.files[i]); });
+        pool.wait();
+    }
+    summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (auto &f: summary.files) {
+        summary.bytes += f.bytes;
+        summary.lines += f.lines;
+        summary.stats.merge(f.stats);
+        if (!f.ok)
+            ++summary.failed;
+    }
+    if (options.stats)
+        summary.stats.peakRssKb = peak_rss_kb();
+    return summary;
+}
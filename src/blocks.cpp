@@ -0,0 +1,542 @@
+#include "blocks.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+// 程序结束处的标签：不在最后的块需要跳到程序结尾时才输出
+static const std::string kExitLabel = "L_exit";
+
+static std::shared_ptr<LabelCode> make_label(const std::string &l, const int line) {
+    auto x = std::make_shared<LabelCode>();
+    x->label = l;
+    x->line = line;
+    return x;
+}
+
+static std::shared_ptr<JumpCode> make_jump(const std::string &d, const int line) {
+    auto j = std::make_shared<JumpCode>();
+    j->dist = d;
+    j->line = line;
+    return j;
+}
+
+static std::shared_ptr<CompareCodeIR> retarget(const CompareCodeIR &c, const std::string &op, const std::string &jump) {
+    auto r = std::make_shared<CompareCodeIR>(c);
+    r->operation = op;
+    r->jump = jump;
+    return r;
+}
+
+LoopInfo find_loops(const std::vector<IRBlock> &blocks) {
+    const std::size_t n = blocks.size();
+    LoopInfo info;
+    info.depth.assign(n, 0);
+    info.innermost.assign(n, n);
+    if (n == 0)
+        return info;
+
+    std::unordered_map<std::string, std::size_t> index;
+    for (std::size_t i = 0; i < n; ++i)
+        index[blocks[i].label] = i;
+    std::vector<std::vector<std::size_t> > succ(n), pred(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        auto edge = [&](const std::string &l) {
+            if (const auto it = index.find(l); it != index.end()) {
+                succ[i].push_back(it->second);
+                pred[it->second].push_back(i);
+            }
+        };
+        if (blocks[i].branch)
+            edge(blocks[i].branch->jump);
+        edge(blocks[i].next);
+    }
+
+    // 逆后序（非递归 DFS）
+    constexpr auto none = static_cast<std::size_t>(-1);
+    std::vector<std::size_t> rpo, order(n, none);
+    {
+        std::vector<bool> seen(n, false);
+        std::vector<std::pair<std::size_t, std::size_t> > stack{{0, 0}};
+        seen[0] = true;
+        while (!stack.empty()) {
+            auto &[b, k] = stack.back();
+            if (k < succ[b].size()) {
+                const auto s = succ[b][k++];
+                if (!seen[s]) {
+                    seen[s] = true;
+                    stack.emplace_back(s, 0);
+                }
+            } else {
+                rpo.push_back(b);
+                stack.pop_back();
+            }
+        }
+        std::reverse(rpo.begin(), rpo.end());
+        for (std::size_t k = 0; k < rpo.size(); ++k)
+            order[rpo[k]] = k;
+    }
+
+    // 直接支配者（Cooper-Harvey-Kennedy 迭代算法）
+    std::vector<std::size_t> idom(n, none);
+    idom[0] = 0;
+    auto intersect = [&](std::size_t a, std::size_t b) {
+        while (a != b) {
+            while (order[a] > order[b]) a = idom[a];
+            while (order[b] > order[a]) b = idom[b];
+        }
+        return a;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (std::size_t k = 1; k < rpo.size(); ++k) {
+            const auto b = rpo[k];
+            std::size_t d = none;
+            for (const auto p: pred[b])
+                if (idom[p] != none)
+                    d = d == none ? p : intersect(p, d);
+            if (d != idom[b]) {
+                idom[b] = d;
+                changed = true;
+            }
+        }
+    }
+    // 支配树上的先序 / 后序编号：h 支配 b 当且仅当 b 的区间落在 h 的区间里。
+    // 沿 idom 链往上走在很长的直线代码上是平方级的
+    std::vector<std::size_t> enter(n, 0), leave(n, 0);
+    {
+        std::vector<std::vector<std::size_t> > children(n);
+        for (std::size_t k = 1; k < rpo.size(); ++k)
+            children[idom[rpo[k]]].push_back(rpo[k]);
+        std::size_t clock = 0;
+        std::vector<std::pair<std::size_t, std::size_t> > stack{{0, 0}};
+        enter[0] = clock++;
+        while (!stack.empty()) {
+            auto &[b, k] = stack.back();
+            if (k < children[b].size()) {
+                const auto c = children[b][k++];
+                enter[c] = clock++;
+                stack.emplace_back(c, 0);
+            } else {
+                leave[b] = clock++;
+                stack.pop_back();
+            }
+        }
+    }
+    auto dominates = [&](const std::size_t h, const std::size_t b) {
+        return enter[h] <= enter[b] && leave[b] <= leave[h];
+    };
+
+    // 每个循环头的循环体：从各条回边的起点沿前驱往回走，走到头为止
+    std::vector<std::vector<std::size_t> > bodies;
+    std::vector<bool> inBody(n, false);
+    for (const auto h: rpo) {
+        std::vector<std::size_t> body{h}, work;
+        for (const auto p: pred[h])
+            if (order[p] != none && dominates(h, p))
+                work.push_back(p);
+        if (work.empty())
+            continue;
+        inBody[h] = true;
+        while (!work.empty()) {
+            const auto b = work.back();
+            work.pop_back();
+            if (inBody[b])
+                continue;
+            inBody[b] = true;
+            body.push_back(b);
+            for (const auto p: pred[b])
+                if (order[p] != none)
+                    work.push_back(p);
+        }
+        for (const auto b: body)
+            inBody[b] = false;
+        bodies.push_back(std::move(body));
+    }
+
+    // 从大到小处理，小的（内层的）循环最后覆盖 innermost
+    std::stable_sort(bodies.begin(), bodies.end(), [](const std::vector<std::size_t> &a, const std::vector<std::size_t> &b) {
+        return a.size() > b.size();
+    });
+    for (auto &body: bodies)
+        for (const auto b: body) {
+            ++info.depth[b];
+            info.innermost[b] = body.front();
+        }
+    return info;
+}
+
+std::string negate_comparison(const std::string &op) {
+    if (op == "<") return ">=";
+    if (op == ">=") return "<";
+    if (op == ">") return "<=";
+    if (op == "<=") return ">";
+    if (op == "==") return "!=";
+    if (op == "!=") return "==";
+    throw std::runtime_error("unsupported comparison: " + op);
+}
+
+InterCodeArray label_blocks(const InterCodeArray &code) {
+    // 已经做过一次（-O1 的块布局之后 PGO 再做）时，留下的 LB 标签不能重名
+    unsigned long n = 0;
+    for (auto &ins: code.code)
+        if (ins->kind() == IRKind::Label) {
+            const auto &l = std::static_pointer_cast<LabelCode>(ins)->label;
+            if (l.size() > 2 && l.compare(0, 2, "LB") == 0 &&
+                std::all_of(l.begin() + 2, l.end(), [](const char c) { return c >= '0' && c <= '9'; }))
+                n = std::max(n, std::stoul(l.substr(2)) + 1);
+        }
+
+    InterCodeArray out;
+    bool blockStart = true; // 程序入口
+    for (auto &ins: code.code) {
+        if (blockStart && ins->kind() != IRKind::Label)
+            out.append(make_label("LB" + std::to_string(n++), ins->line));
+        out.append(ins);
+        blockStart = ins->kind() == IRKind::Jump || ins->kind() == IRKind::Compare || ins->kind() == IRKind::Return;
+    }
+    return out;
+}
+
+std::vector<IRBlock> split_blocks(const InterCodeArray &code) {
+    std::vector<IRBlock> blocks;
+    std::vector<bool> jumps; // 块是否以无条件 JMP 结束
+    for (auto &ins: code.code) {
+        if (ins->kind() == IRKind::Label) {
+            IRBlock b;
+            b.label = std::static_pointer_cast<LabelCode>(ins)->label;
+            b.line = ins->line;
+            blocks.push_back(std::move(b));
+            jumps.push_back(false);
+            continue;
+        }
+        if (blocks.empty())
+            throw std::logic_error("split_blocks: IR must start with a label (run label_blocks first)");
+        switch (ins->kind()) {
+            case IRKind::Jump:
+                blocks.back().next = std::static_pointer_cast<JumpCode>(ins)->dist;
+                blocks.back().jumpLine = ins->line;
+                jumps.back() = true;
+                break;
+            case IRKind::Compare:
+                blocks.back().branch = std::static_pointer_cast<CompareCodeIR>(ins);
+                break;
+            case IRKind::Return:
+                // 留在块里，块没有后继
+                blocks.back().body.push_back(ins);
+                jumps.back() = true;
+                break;
+            default:
+                blocks.back().body.push_back(ins);
+        }
+    }
+    for (std::size_t i = 0; i < blocks.size(); ++i)
+        if (!jumps[i])
+            blocks[i].next = i + 1 < blocks.size() ? blocks[i + 1].label : "";
+    return blocks;
+}
+
+void thread_jumps(std::vector<IRBlock> &blocks) {
+    std::unordered_map<std::string, std::string> forward;
+    for (auto &b: blocks)
+        if (b.body.empty() && !b.branch && !b.next.empty() && b.next != b.label)
+            forward[b.label] = b.next;
+    if (forward.empty())
+        return;
+
+    auto resolve = [&forward](std::string l) {
+        // 最多走 forward.size() 步，JMP 成环（死循环）时停下
+        for (std::size_t hops = 0; hops < forward.size(); ++hops) {
+            const auto it = forward.find(l);
+            if (it == forward.end())
+                break;
+            l = it->second;
+        }
+        return l;
+    };
+
+    std::unordered_set<std::string> referenced;
+    for (auto &b: blocks) {
+        if (!b.next.empty())
+            b.next = resolve(b.next);
+        if (b.branch) {
+            if (auto target = resolve(b.branch->jump); target != b.branch->jump)
+                b.branch = retarget(*b.branch, b.branch->operation, target);
+            referenced.insert(b.branch->jump);
+        }
+        referenced.insert(b.next);
+    }
+
+    std::vector<IRBlock> kept;
+    kept.reserve(blocks.size());
+    for (std::size_t i = 0; i < blocks.size(); ++i)
+        if (i == 0 || !forward.count(blocks[i].label) || referenced.count(blocks[i].label))
+            kept.push_back(std::move(blocks[i]));
+    blocks = std::move(kept);
+}
+
+InterCodeArray join_blocks(const std::vector<IRBlock> &blocks) {
+    // 上一次 join_blocks() 留下的出口标签已经成了普通的块，换一个名字
+    std::unordered_set<std::string> labels;
+    for (auto &b: blocks)
+        labels.insert(b.label);
+    std::string exitLabel = kExitLabel;
+    for (int k = 1; labels.count(exitLabel); ++k)
+        exitLabel = kExitLabel + std::to_string(k);
+
+    InterCodeArray linear;
+    bool needExit = false;
+    auto target = [&needExit, &exitLabel](const std::string &l) {
+        if (!l.empty())
+            return l;
+        needExit = true;
+        return exitLabel;
+    };
+
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+        const auto &b = blocks[i];
+        const std::string following = i + 1 < blocks.size() ? blocks[i + 1].label : "";
+        linear.append(make_label(b.label, b.line));
+        for (auto &ins: b.body)
+            linear.append(ins);
+
+        if (b.branch) {
+            if (b.next == following) {
+                linear.append(b.branch);
+            } else if (b.branch->jump == following) {
+                // 跳转目标就在下面：条件取反，跳到原来的顺序后继
+                linear.append(retarget(*b.branch, negate_comparison(b.branch->operation), target(b.next)));
+            } else {
+                linear.append(b.branch);
+                linear.append(make_jump(target(b.next), b.jumpLine));
+            }
+        } else if (b.next != following && (b.body.empty() || b.body.back()->kind() != IRKind::Return)) {
+            linear.append(make_jump(target(b.next), b.jumpLine));
+        }
+    }
+    if (needExit)
+        linear.append(make_label(exitLabel, 0));
+
+    // 去掉没有跳转引用的标签
+    std::unordered_set<std::string> used;
+    for (auto &ins: linear.code) {
+        if (ins->kind() == IRKind::Jump)
+            used.insert(std::static_pointer_cast<JumpCode>(ins)->dist);
+        else if (ins->kind() == IRKind::Compare)
+            used.insert(std::static_pointer_cast<CompareCodeIR>(ins)->jump);
+    }
+    InterCodeArray out;
+    for (auto &ins: linear.code)
+        if (ins->kind() != IRKind::Label || used.count(std::static_pointer_cast<LabelCode>(ins)->label))
+            out.append(ins);
+    return out;
+}
+
+// 概率以 1/8 为单位
+constexpr std::uint64_t kLikely = 7, kUnlikely = 1, kFallthrough = 5, kEighths = 8;
+constexpr std::uint64_t kLoopTrips = 8; // 循环头的执行次数 = 进入次数 × 8
+constexpr std::uint64_t kEntryCount = 1u << 16; // 入口块的估计次数（留出整除的精度）
+
+static std::uint64_t saturating_mul(const std::uint64_t a, const std::uint64_t b) {
+    constexpr auto limit = std::uint64_t{1} << 62;
+    return a > limit / b ? limit : a * b;
+}
+
+BlockWeights estimate_weights(const std::vector<IRBlock> &blocks) {
+    const std::size_t n = blocks.size();
+    BlockWeights w;
+    w.count.assign(n, 0);
+    w.taken.assign(n, 0);
+    w.cold.assign(n, false);
+    if (n == 0)
+        return w;
+
+    std::unordered_map<std::string, std::size_t> index;
+    for (std::size_t i = 0; i < n; ++i)
+        index[blocks[i].label] = i;
+    auto find = [&](const std::string &l) {
+        const auto it = index.find(l);
+        return it == index.end() ? n : it->second;
+    };
+
+    // 回边 i -> h（h <= i）圈出循环 [h, i]；结构化的源码生成的 IR 中循环体是连续的
+    std::vector<std::pair<std::size_t, std::size_t> > loops;
+    std::vector<bool> header(n, false);
+    for (std::size_t i = 0; i < n; ++i) {
+        auto back = [&](const std::string &l) {
+            if (const auto h = find(l); h <= i) {
+                loops.emplace_back(h, i);
+                header[h] = true;
+            }
+        };
+        if (blocks[i].branch)
+            back(blocks[i].branch->jump);
+        back(blocks[i].next);
+    }
+    auto leaves_loop = [&](const std::size_t from, const std::size_t to) {
+        return std::any_of(loops.begin(), loops.end(), [&](const std::pair<std::size_t, std::size_t> &lp) {
+            return lp.first <= from && from <= lp.second && (to < lp.first || to > lp.second);
+        });
+    };
+
+    // 按 IR 顺序传播：前向边在目标之前处理完，回边只体现为循环头的 × 8
+    std::vector<std::uint64_t> inflow(n, 0);
+    std::vector<bool> hotEdgeIn(n, false); // 是否有来自热块、概率大于 1/8 的前向边
+    inflow[0] = kEntryCount;
+    hotEdgeIn[0] = true;
+    for (std::size_t i = 0; i < n; ++i) {
+        const auto &b = blocks[i];
+        w.count[i] = header[i] ? saturating_mul(inflow[i], kLoopTrips) : inflow[i];
+        w.cold[i] = !hotEdgeIn[i];
+
+        auto flow = [&](const std::string &l, const std::uint64_t eighths) {
+            const auto t = find(l);
+            if (t == n || t <= i)
+                return;
+            inflow[t] += w.count[i] / kEighths * eighths;
+            if (!w.cold[i] && eighths > kUnlikely)
+                hotEdgeIn[t] = true;
+        };
+        if (!b.branch) {
+            flow(b.next, kEighths);
+            continue;
+        }
+
+        const auto t = find(b.branch->jump), f = find(b.next);
+        std::uint64_t p;
+        if (t <= i)
+            p = kLikely;
+        else if (f <= i)
+            p = kUnlikely;
+        else if (leaves_loop(i, t) != leaves_loop(i, f))
+            p = leaves_loop(i, t) ? kUnlikely : kLikely;
+        else if (b.branch->operation == "==")
+            p = kUnlikely;
+        else if (b.branch->operation == "!=")
+            p = kLikely;
+        else if (t == i + 1)
+            p = kFallthrough;
+        else if (f == i + 1)
+            p = kEighths - kFallthrough;
+        else
+            p = kEighths / 2;
+        w.taken[i] = w.count[i] / kEighths * p;
+        flow(b.branch->jump, p);
+        flow(b.next, kEighths - p);
+    }
+    return w;
+}
+
+// 按 order 排列时跳转的代价：执行一次 JMP 计 2（一条指令 + 一次取指重定向），
+// 一次成立的条件跳转计 1。与 join_blocks() 的输出方式一致
+static std::uint64_t layout_cost(const std::vector<IRBlock> &blocks, const BlockWeights &weights,
+                                 const std::vector<std::size_t> &order) {
+    std::uint64_t cost = 0;
+    for (std::size_t k = 0; k < order.size(); ++k) {
+        const auto &b = blocks[order[k]];
+        const auto count = weights.count[order[k]];
+        const std::string following = k + 1 < order.size() ? blocks[order[k + 1]].label : "";
+        if (!b.branch) {
+            if (b.next != following)
+                cost += 2 * count;
+            continue;
+        }
+        const auto taken = std::min(weights.taken[order[k]], count);
+        if (b.next == following)
+            cost += taken;
+        else if (b.branch->jump == following)
+            cost += count - taken;
+        else
+            cost += taken + 2 * (count - taken);
+    }
+    return cost;
+}
+
+std::vector<IRBlock> layout_blocks(const std::vector<IRBlock> &blocks, const BlockWeights &weights) {
+    const auto &count = weights.count;
+    const auto &taken = weights.taken;
+    const std::size_t n = blocks.size();
+    if (n < 2)
+        return blocks;
+
+    std::unordered_map<std::string, std::size_t> index;
+    for (std::size_t i = 0; i < n; ++i)
+        index[blocks[i].label] = i;
+
+    struct Edge {
+        std::size_t from, to;
+        std::uint64_t weight;
+        bool back;
+    };
+    std::vector<Edge> edges;
+    for (std::size_t i = 0; i < n; ++i) {
+        auto add = [&](const std::string &label, const std::uint64_t w) {
+            if (const auto it = index.find(label); it != index.end() && w > 0)
+                edges.push_back({i, it->second, w, it->second <= i});
+        };
+        if (blocks[i].branch) {
+            const auto t = std::min(taken[i], count[i]);
+            add(blocks[i].branch->jump, t);
+            add(blocks[i].next, count[i] - t);
+        } else {
+            add(blocks[i].next, count[i]);
+        }
+    }
+    std::stable_sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) {
+        return a.weight != b.weight ? a.weight > b.weight : a.back && !b.back;
+    });
+
+    // 每个块起初自成一条链；边的两端分别是某条链的尾和另一条链的头时把两条链接起来
+    std::vector<std::vector<std::size_t> > chains(n);
+    std::vector<std::size_t> chainOf(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        chains[i] = {i};
+        chainOf[i] = i;
+    }
+    for (auto &e: edges) {
+        const auto a = chainOf[e.from], b = chainOf[e.to];
+        if (e.to == 0 || a == b || chains[a].back() != e.from || chains[b].front() != e.to)
+            continue;
+        for (const auto x: chains[b]) {
+            chains[a].push_back(x);
+            chainOf[x] = a;
+        }
+        chains[b].clear();
+    }
+
+    std::vector<std::size_t> chainOrder;
+    for (std::size_t c = 0; c < n; ++c)
+        if (!chains[c].empty() && c != chainOf[0])
+            chainOrder.push_back(c);
+    auto cold = [&](const std::size_t c) {
+        return std::all_of(chains[c].begin(), chains[c].end(), [&](const std::size_t i) { return weights.cold[i]; });
+    };
+    std::stable_sort(chainOrder.begin(), chainOrder.end(), [&](const std::size_t a, const std::size_t b) {
+        return !cold(a) && cold(b);
+    });
+    chainOrder.insert(chainOrder.begin(), chainOf[0]);
+
+    std::vector<std::size_t> order, original(n);
+    for (const auto c: chainOrder)
+        order.insert(order.end(), chains[c].begin(), chains[c].end());
+    for (std::size_t i = 0; i < n; ++i)
+        original[i] = i;
+    // 链按边的权重贪心合并，循环被切开的位置不一定最好（切在无条件跳转上要多执行一条 JMP）；
+    // 不比原来的顺序好时保持原样
+    if (layout_cost(blocks, weights, order) > layout_cost(blocks, weights, original))
+        return blocks;
+
+    std::vector<IRBlock> out;
+    out.reserve(n);
+    for (const auto i: order)
+        out.push_back(blocks[i]);
+    return out;
+}
+
+InterCodeArray static_block_layout(const InterCodeArray &code) {
+    auto blocks = split_blocks(label_blocks(code));
+    // 短路条件的跳转链里常有只剩一条 JMP 的块（&& 的左边不成立时跳到的出口），先绕过
+    thread_jumps(blocks);
+    return join_blocks(layout_blocks(blocks, estimate_weights(blocks)));
+}
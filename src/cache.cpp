@@ -0,0 +1,267 @@
+#include "cache.hpp"
+#include "compiler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// 条目格式或键的组成改变时加一，旧条目自然不再命中
+constexpr std::uint64_t kCacheFormat = 1;
+constexpr char kEntryMagic[8] = {'C', 'F', 'N', 'C', 'A', 'C', 'H', 'E'};
+constexpr std::size_t kEntryHeader = sizeof kEntryMagic + 8;
+
+// -------------------- SHA-256 --------------------
+
+namespace {
+class Sha256 {
+public:
+    void update(const void *data, std::size_t n) {
+        auto p = static_cast<const unsigned char *>(data);
+        total_ += n;
+        while (n > 0) {
+            const std::size_t take = std::min(n, sizeof block_ - used_);
+            std::memcpy(block_ + used_, p, take);
+            used_ += take;
+            p += take;
+            n -= take;
+            if (used_ == sizeof block_) {
+                compress();
+                used_ = 0;
+            }
+        }
+    }
+
+    // 变长字段前面写长度，避免 ("ab", "c") 与 ("a", "bc") 得到相同的键
+    void field(const std::string_view s) {
+        const std::uint64_t n = s.size();
+        update(&n, sizeof n);
+        update(s.data(), s.size());
+    }
+
+    std::string hex() {
+        const std::uint64_t bits = total_ * 8;
+        const unsigned char pad = 0x80;
+        update(&pad, 1);
+        const unsigned char zero = 0;
+        while (used_ != 56)
+            update(&zero, 1);
+        for (int i = 7; i >= 0; --i) {
+            const auto b = static_cast<unsigned char>(bits >> (8 * i));
+            update(&b, 1);
+        }
+        static const char digits[] = "0123456789abcdef";
+        std::string out;
+        for (const std::uint32_t w: h_)
+            for (int i = 28; i >= 0; i -= 4)
+                out += digits[(w >> i) & 0xF];
+        return out;
+    }
+
+private:
+    static std::uint32_t rotr(const std::uint32_t x, const int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress() {
+        static constexpr std::uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+        std::uint32_t w[64];
+        for (int i = 0; i < 16; ++i)
+            w[i] = static_cast<std::uint32_t>(block_[4 * i]) << 24 | static_cast<std::uint32_t>(block_[4 * i + 1]) << 16 |
+                   static_cast<std::uint32_t>(block_[4 * i + 2]) << 8 | block_[4 * i + 3];
+        for (int i = 16; i < 64; ++i) {
+            const auto s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const auto s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        auto [a, b, c, d, e, f, g, h] = h_;
+        for (int i = 0; i < 64; ++i) {
+            const auto t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            const auto t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        const std::array<std::uint32_t, 8> add{a, b, c, d, e, f, g, h};
+        for (int i = 0; i < 8; ++i)
+            h_[i] += add[i];
+    }
+
+    std::array<std::uint32_t, 8> h_{
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    unsigned char block_[64]{};
+    std::size_t used_{0};
+    std::uint64_t total_{0};
+};
+}
+
+// 编译器本身的标识：正在运行的可执行文件的大小与修改时间（与 ccache 默认的 compiler_check 相同）。
+// 重新构建编译器后旧条目不再命中
+static std::string compiler_identity() {
+    static const std::string id = [] {
+        struct stat st{};
+        if (::stat("/proc/self/exe", &st) != 0)
+            return std::string("unknown");
+        return std::to_string(st.st_size) + ":" + std::to_string(st.st_mtim.tv_sec) + "." +
+               std::to_string(st.st_mtim.tv_nsec);
+    }();
+    return id;
+}
+
+static std::string read_file(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Cannot open profile " + path);
+    std::ostringstream data;
+    data << in.rdbuf();
+    return data.str();
+}
+
+// -------------------- CompileCache --------------------
+
+CompileCache::CompileCache(std::string dir, const std::uint64_t maxBytes)
+    : dir_(std::move(dir)), maxBytes_(maxBytes) {
+    fs::create_directories(dir_);
+}
+
+std::string CompileCache::key(const std::string_view source, const Options &options) {
+    Sha256 h;
+    h.field(std::to_string(kCacheFormat));
+    h.field(compiler_identity());
+    // 只有影响输出字节的选项进入键；keepAst / keepIr / stats 不改变输出
+    h.field(std::to_string(static_cast<int>(options.emit)));
+    h.field(std::to_string(options.optLevel));
+    h.field(options.optimizeSize ? "size" : "");
+    h.field(options.countInstructions ? "count" : "");
+    h.field(options.debugInfo ? "debug:" + options.sourceName : ""); // 文件名写在 %line / 行号表里
+    h.field(options.regions ? "regions" : "");
+    h.field(std::to_string(static_cast<int>(options.simd)));
+    h.field(options.instrument); // 路径写在生成的程序里
+    for (auto &path: options.profileUse)
+        h.field(read_file(path));
+    h.field(source);
+    return h.hex();
+}
+
+std::string CompileCache::entry_path(const std::string &key) const {
+    return (fs::path(dir_) / key.substr(0, 2) / key).string();
+}
+
+std::optional<std::vector<std::uint8_t> > CompileCache::lookup(const std::string &key) const {
+    const auto path = entry_path(key);
+    std::ifstream in(path, std::ios::binary);
+    std::error_code ec;
+    const auto fileSize = fs::file_size(path, ec);
+    if (!in || ec || fileSize < kEntryHeader)
+        return std::nullopt;
+    char header[kEntryHeader];
+    if (!in.read(header, sizeof header) || std::memcmp(header, kEntryMagic, sizeof kEntryMagic) != 0)
+        return std::nullopt;
+    std::uint64_t size;
+    std::memcpy(&size, header + sizeof kEntryMagic, sizeof size);
+    if (size != fileSize - kEntryHeader)
+        return std::nullopt; // 被截断或者不是本程序写的文件
+    std::vector<std::uint8_t> data(size);
+    if (!in.read(reinterpret_cast<char *>(data.data()), static_cast<std::streamsize>(size)))
+        return std::nullopt;
+    // LRU：命中的条目变成最新的。条目可能刚被另一个进程淘汰，忽略错误
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    return data;
+}
+
+void CompileCache::store(const std::string &key, const std::vector<std::uint8_t> &data) {
+    static std::atomic<std::uint64_t> serial{0};
+    const auto path = entry_path(key);
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+
+    // 临时文件名在进程和线程之间唯一，rename() 在同一文件系统内是原子的
+    const auto tmp = path + ".tmp." + std::to_string(::getpid()) + "." + std::to_string(serial++);
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        const std::uint64_t size = data.size();
+        out.write(kEntryMagic, sizeof kEntryMagic);
+        out.write(reinterpret_cast<const char *>(&size), sizeof size);
+        out.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+        out.close();
+        if (!out) {
+            fs::remove(tmp, ec);
+            return;
+        }
+    }
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!usage_)
+        usage_ = disk_usage();
+    else
+        *usage_ += kEntryHeader + data.size();
+    if (*usage_ > maxBytes_)
+        evict();
+}
+
+std::uint64_t CompileCache::disk_usage() const {
+    std::uint64_t total = 0;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec))
+        if (it->is_regular_file(ec))
+            total += it->file_size(ec);
+    return total;
+}
+
+void CompileCache::evict() {
+    struct Entry {
+        fs::file_time_type used;
+        std::uint64_t size;
+        fs::path path;
+    };
+    std::vector<Entry> entries;
+    std::uint64_t total = 0;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec))
+            continue;
+        const auto size = it->file_size(ec);
+        const auto used = it->last_write_time(ec);
+        if (ec)
+            continue; // 被并发的进程删掉了
+        entries.push_back(Entry{used, size, it->path()});
+        total += size;
+    }
+    // 其它进程也可能在淘汰；删除不存在的文件不算错误
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.used < b.used; });
+    const std::uint64_t target = maxBytes_ / 10 * 9;
+    for (auto &e: entries) {
+        if (total <= target)
+            break;
+        fs::remove(e.path, ec);
+        total -= e.size;
+    }
+    usage_ = total;
+}
@@ -1,36 +1,55 @@
 #include "codegen.hpp"
+#include "blocks.hpp"
+#include "elf.hpp"
+#include "pgo.hpp"
+#include <algorithm>
 #include <fstream>
+#include <stdexcept>
+#include <sys/stat.h>
 
-static std::string op_to_asm(const std::string &op) {
-    if (op == "+") return "add";
-    if (op == "-") return "sub";
-    if (op == "*") return "imul";
-    if (op == "&") return "and";
-    if (op == "|") return "or";
-    if (op == "^") return "xor";
-    return "";
+using x86::Cond;
+using x86::Op;
+using x86::Reg;
+using x86::Width;
+using x86::imm;
+using x86::mem;
+using x86::reg;
+
+// _format_num 的输出缓冲：int64 的十进制最多 20 个字符
+constexpr std::int64_t kNumText = 24;
+
+static const InterCodeArray &empty_ir() {
+    static const InterCodeArray empty;
+    return empty;
 }
 
-static std::string cmp_to_jmp(const std::string &c) {
-    if (c == "<") return "jl";
-    if (c == "<=") return "jle";
-    if (c == ">") return "jg";
-    if (c == ">=") return "jge";
-    if (c == "==") return "je";
-    if (c == "!=") return "jne";
-    return "";
+static Cond cmp_to_jmp(const std::string &c) {
+    if (c == "<") return Cond::L;
+    if (c == "<=") return Cond::LE;
+    if (c == ">") return Cond::G;
+    if (c == ">=") return Cond::GE;
+    if (c == "==") return Cond::E;
+    if (c == "!=") return Cond::NE;
+    throw std::runtime_error("unsupported comparison: " + c);
 }
 
 CodeGenerator::CodeGenerator(const InterCodeArray &arr,
                              const std::unordered_map<std::string, std::string> &identifiers,
                              const std::unordered_map<std::string, std::string> &constants,
-                             const std::unordered_map<std::string, std::string> &tempmap)
-    : arr(arr), ids(identifiers), consts(constants), tempmap(tempmap), need_print_num(false), need_print_string(false) {
+                             const std::unordered_map<std::string, std::string> &tempmap,
+                             const CodegenOptions &options)
+    : arr(arr), ids(identifiers), consts(constants), tempmap(tempmap), options(options),
+      sel(mod, [this](const std::string &a) { return handleVar(a); },
+          options.optimizeSize ? isel::Goal::Size : isel::Goal::Speed),
+      need_print_num(false), need_print_string(false) {
+    mod.sourceName = options.sourceName;
 }
 
-void CodeGenerator::pr(const std::string &s) {
-    out.append(s);
-    out.push_back('\n');
+CodeGenerator::CodeGenerator(const CodegenOptions &options)
+    : CodeGenerator(empty_ir(), {}, {}, {}, options) {
+    streaming = true;
+    if (options.countInstructions || !options.profilePath.empty())
+        throw std::runtime_error("instrumentation is not available in streaming mode");
 }
 
 static bool is_int_literal(const std::string &s) {
@@ -44,115 +63,607 @@ static bool is_int_literal(const std::string &s) {
     return true;
 }
 
-std::string CodeGenerator::handleVar(const std::string &a,
-                                     const std::unordered_map<std::string, std::string> &tempmap) {
+x86::Operand CodeGenerator::handleVar(const std::string &a) {
     std::string x = a;
     if (const auto it = tempmap.find(x); it != tempmap.end()) x = it->second; // temp remap
 
-    if (is_int_literal(x)) return x; // immediate number
+    if (is_int_literal(x)) return imm(std::stoll(x)); // immediate number
 
-    // 常量一般像 S1 / S2...（你也可以按 consts map 判断，但这里只有 tempmap 参数，所以用命名约定）
-    if (!x.empty() && x[0] == 'S') return x; // address label, e.g., S1
+    // 常量一般像 S1 / S2...（按命名约定判断）：取的是地址本身
+    if (!x.empty() && x[0] == 'S') return x86::addr(mod.symbol(x)); // address label, e.g., S1
+
+    // 过程体里的参数、局部变量和临时变量在栈帧里
+    if (const auto it = frame.find(x); it != frame.end()) return mem(Reg::RBP, it->second);
 
     // 其他一律当作 bss 里的 8-byte 槽位（变量/临时）
-    return "[" + x + "]";
+    return mem(mod.symbol(x));
+}
+
+// IR 指令的操作数（变量、临时变量、字符串常量或立即数），按出现的顺序
+static std::vector<const std::string *> operands(const IRInstr &ins) {
+    switch (ins.kind()) {
+        case IRKind::Assignment: {
+            const auto &a = static_cast<const AssignmentCode &>(ins);
+            return {&a.var, &a.left, &a.right};
+        }
+        case IRKind::Compare: {
+            const auto &c = static_cast<const CompareCodeIR &>(ins);
+            return {&c.left, &c.right};
+        }
+        case IRKind::Print:
+            return {&static_cast<const PrintCodeIR &>(ins).value};
+        case IRKind::Select: {
+            const auto &s = static_cast<const SelectCode &>(ins);
+            return {&s.var, &s.left, &s.right, &s.ifTrue, &s.ifFalse};
+        }
+        case IRKind::Write: {
+            std::vector<const std::string *> values;
+            for (auto &piece: static_cast<const WriteCode &>(ins).pieces)
+                values.push_back(&piece.value);
+            return values;
+        }
+        case IRKind::Load: {
+            const auto &l = static_cast<const LoadCode &>(ins);
+            return {&l.var, &l.index};
+        }
+        case IRKind::Store: {
+            const auto &s = static_cast<const StoreCode &>(ins);
+            return {&s.index, &s.value};
+        }
+        case IRKind::VectorLoop: {
+            // 循环体就是后面标量循环的那几条，它们的操作数在那里分配
+            const auto &v = static_cast<const VectorLoopCode &>(ins);
+            return {&v.index, &v.bound};
+        }
+        case IRKind::Call: {
+            const auto &c = static_cast<const CallCode &>(ins);
+            std::vector<const std::string *> values{&c.var};
+            for (auto &a: c.args)
+                values.push_back(&a);
+            return values;
+        }
+        case IRKind::Return:
+            return {&static_cast<const ReturnCode &>(ins).value};
+        default:
+            return {};
+    }
+}
+
+// 过程自己的参数、局部变量（V<过程名>.<变量名>）和临时变量，放在它的栈帧里
+static bool frame_local(const std::string &x) {
+    return !x.empty() && (x[0] == 'T' || (x[0] == 'V' && x.find('.') != std::string::npos));
 }
 
+// 代码里的过程定义
+static std::vector<const ProcedureCode *> procedures_of(const InterCodeArray &code) {
+    std::vector<const ProcedureCode *> procs;
+    for (auto &ins: code.code)
+        if (ins->kind() == IRKind::Procedure)
+            procs.push_back(static_cast<const ProcedureCode *>(ins.get()));
+    return procs;
+}
+
+// IR 指令访问的数组（不是槽位，在 .bss 里按数组大小分配）
+static const std::string *array_operand(const IRInstr &ins) {
+    if (ins.kind() == IRKind::Load)
+        return &static_cast<const LoadCode &>(ins).array;
+    if (ins.kind() == IRKind::Store)
+        return &static_cast<const StoreCode &>(ins).array;
+    return nullptr;
+}
+
+static bool vector_loops(const CodegenOptions &options) {
+    return options.simd != Simd::Off && !options.optimizeSize;
+}
+
+// __lanes：下标向量的初值 {0, 1, 2, 3}（SSE2 用前两个），之后是每组的增量 {2, 2} 与 {4, 4, 4, 4}
+constexpr std::int64_t kLaneStep = 32;
+
+static std::string lane_offsets() {
+    const char values[] = {0, 1, 2, 3, 2, 2, 4, 4, 4, 4};
+    std::string bytes(8 * sizeof values, '\0');
+    for (std::size_t k = 0; k < sizeof values; ++k)
+        bytes[8 * k] = values[k];
+    return bytes;
+}
+
+// 只为 IR 里还在使用的变量 / 临时变量分配 .bss 槽位，顺序只取决于 IR：
+// 按所在的最内层循环分组，同一个循环里用到的槽位排在一起并从缓存行开头开始，
+// 循环越深越靠前；不在循环里的排在最后，组内按第一次出现的顺序。
+// 字符串常量同样按第一次使用的顺序放进 .rodata。
 void CodeGenerator::gen_variables() {
-    pr("section .bss");
-    // Only emit print helper buffers if we actually print numbers
-    if (need_print_num) {
-        pr("\tdigitSpace resb 100");
-        pr("\tdigitSpacePos resb 8\n");
+    auto blocks = split_blocks(label_blocks(arr));
+    const auto loops = find_loops(blocks);
+
+    struct Slot {
+        std::string name;
+        std::size_t depth = 0; // 引用处最深的循环嵌套层数
+        std::size_t loop = 0; // 那一处最内层循环的头
+        std::size_t first = 0;
+    };
+    std::vector<Slot> slots;
+    std::unordered_map<std::string, std::size_t> slotIndex;
+    std::vector<std::string> strings;
+    std::size_t position = 0;
+    for (std::size_t b = 0; b < blocks.size(); ++b) {
+        if (blocks[b].branch)
+            blocks[b].body.push_back(blocks[b].branch);
+        const auto depth = loops.depth[b], loop = loops.innermost[b];
+        for (auto &ins: blocks[b].body)
+            for (const auto *operand: operands(*ins)) {
+                if (sel.folded(*operand))
+                    continue; // 值留在寄存器里，不需要槽位
+                auto x = *operand;
+                if (const auto it = tempmap.find(x); it != tempmap.end()) x = it->second;
+                if (x.empty() || is_int_literal(x))
+                    continue;
+                if (x[0] == 'S') {
+                    if (std::find(strings.begin(), strings.end(), x) == strings.end())
+                        strings.push_back(x);
+                    continue;
+                }
+                auto [it, inserted] = slotIndex.emplace(x, slots.size());
+                if (inserted)
+                    slots.push_back({x, 0, 0, position++});
+                if (auto &s = slots[it->second]; depth > s.depth) {
+                    s.depth = depth;
+                    s.loop = loop;
+                }
+            }
     }
-    for (auto &[fst, snd]: ids) {
-        pr("\t" + fst + " resb 8");
+    // 过程体里的全局变量和字符串常量（过程可能在任何地方被调用，不按循环分组）
+    const auto procs = procedures_of(arr);
+    for (const auto *p: procs)
+        for (auto &ins: p->body.code)
+            for (const auto *operand: operands(*ins)) {
+                const auto &x = *operand;
+                if (x.empty() || is_int_literal(x) || frame_local(x))
+                    continue;
+                if (x[0] == 'S') {
+                    if (std::find(strings.begin(), strings.end(), x) == strings.end())
+                        strings.push_back(x);
+                } else if (slotIndex.emplace(x, slots.size()).second) {
+                    slots.push_back({x, 0, 0, position++});
+                }
+            }
+    std::sort(slots.begin(), slots.end(), [](const Slot &a, const Slot &b) {
+        if (a.depth != b.depth) return a.depth > b.depth;
+        if (a.loop != b.loop) return a.loop < b.loop;
+        return a.first < b.first;
+    });
+
+    for (std::size_t k = 0; k < slots.size(); ++k) {
+        const bool newGroup = k == 0 || slots[k].depth != slots[k - 1].depth || slots[k].loop != slots[k - 1].loop;
+        mod.bss.push_back({mod.symbol(slots[k].name), 8, newGroup && slots[k].depth > 0 ? x86::kDataSectionAlign : 0});
+    }
+    // 数组按第一次访问的顺序排在槽位之后，每个都从缓存行开头开始
+    std::vector<const IRInstr *> accesses;
+    for (auto &ins: arr.code)
+        accesses.push_back(ins.get());
+    for (const auto *p: procs)
+        for (auto &ins: p->body.code)
+            accesses.push_back(ins.get());
+    std::unordered_set<std::string> arrays;
+    for (const auto *ins: accesses)
+        if (const auto *a = array_operand(*ins); a && arrays.insert(*a).second) {
+            if (slotIndex.count(*a))
+                throw std::runtime_error("variable " + a->substr(1) + " is used both as an array and as a scalar");
+            const auto it = ids.find(*a);
+            const auto length = it == ids.end() ? 0 : array_length(it->second);
+            if (length == 0)
+                throw std::runtime_error("undeclared array: " + a->substr(1));
+            mod.bss.push_back({mod.symbol(*a), static_cast<std::uint32_t>(8 * length), x86::kDataSectionAlign});
+        }
+    // Only emit print helper buffers if we actually print numbers
+    if (need_print_num || options.countInstructions)
+        mod.bss.push_back({mod.symbol("digitSpace"), 100, x86::kDataSectionAlign});
+    if (options.countInstructions)
+        mod.bss.push_back({mod.symbol("__insn_count"), 8});
+    if (writeIovs > 1)
+        mod.bss.push_back({mod.symbol("__iov"), static_cast<std::uint32_t>(16 * writeIovs), x86::kDataSectionAlign});
+    if (writeInts > 0)
+        mod.bss.push_back({mod.symbol("__wbuf"), static_cast<std::uint32_t>(kNumText * writeInts)});
+    if (need_vector)
+        mod.bss.push_back({mod.symbol("__vtmp"), 32, x86::kDataSectionAlign});
+    if (need_detect)
+        mod.bss.push_back({mod.symbol("__simd_level"), 8});
+
+    if (need_newline)
+        mod.rodata.push_back({mod.symbol("nl"), "\n"});
+    if (need_vector)
+        mod.rodata.push_back({mod.symbol("__lanes"), lane_offsets(), 32});
+    for (auto &s: strings) {
+        const auto it = consts.find(s);
+        if (it == consts.end())
+            throw std::runtime_error("undefined string constant: " + s);
+        mod.rodata.push_back({mod.symbol(s), it->second + '\0'});
     }
 }
 
 void CodeGenerator::gen_start() {
-    pr("section .data");
-    pr("\tnl db 10");
-
-    for (auto &[fst, snd]: consts) {
-        std::string s;
-        s.push_back('\t');
-        s.append(fst);
-        s.append(" db \"");
-        s.append(snd);
-        s.append("\", 0");
-        pr(s);
-    }
-    pr("section .text");
-    pr("\tglobal _start\n");
-    pr("_start:");
+    const auto start = mod.symbol("_start");
+    mod.globals.push_back(start);
+    mod.label(start);
 }
 
 void CodeGenerator::gen_end() {
-    pr("\tmov rax, 60");
-    pr("\tmov rdi, 0");
-    pr("\tsyscall\n");
+    if (!options.profilePath.empty())
+        mod.call(mod.symbol("_write_profile"));
+    if (options.countInstructions)
+        mod.call(mod.symbol("_report_insns"));
+    sel.load(Reg::RAX, imm(60)); // sys_exit
+    sel.load(Reg::RDI, imm(0));
+    mod.ins(Op::Syscall);
 }
 
 void CodeGenerator::gen_assignment(const AssignmentCode &a) {
-    // ⚠️ 按 ir.hpp 替换字段名：
-    // a.dst, a.src1, a.op, a.src2
-    // 约定：a.op 为空 => dst = src1
+    // 按代价表挑写法（见 isel.hpp）：mov qword [x], imm / add qword [x], imm / inc / lea ……，
+    // 最坏情况是 mov rax, left; op rax, right; mov [var], rax
+    sel.assign(a);
+}
 
-    const std::string dst = a.var; // 目标槽位名（不要加[]）
-    const std::string s1 = handleVar(a.left, tempmap);
+x86::SymbolId CodeGenerator::label_symbol(const std::string &label) {
+    return mod.symbol(labelScope + label);
+}
 
-    if (a.op.empty()) {
-        // dst = src1
-        pr("\tmov rax, " + s1);
+void CodeGenerator::gen_jump(const JumpCode &j) {
+    mod.jmp(label_symbol(j.dist));
+}
 
-        // 如果 src1 是字符串常量 label（S1），这里 mov rax, S1 会把地址放进 rax
-        // 再 mov [dst], rax 即可（msg = S1）
-        pr("\tmov [" + dst + "], rax");
-        return;
+void CodeGenerator::gen_label(const LabelCode &l) {
+    mod.label(label_symbol(l.label));
+}
+
+// -g：按 IR 的块顺序，每段连续的、属于同一个最内层循环的块开头放一个标签 loop_line_<循环头的行号>，
+// perf report 据此把样本按循环分开（否则都落在 _start 或某个 L<n> 上）。返回每块开头的行号，0 表示不放
+static std::vector<std::uint32_t> loop_runs(const InterCodeArray &code) {
+    const auto blocks = split_blocks(label_blocks(code));
+    const auto loops = find_loops(blocks);
+    std::vector<std::uint32_t> runs(blocks.size(), 0);
+    for (std::size_t b = 0; b < blocks.size(); ++b) {
+        const auto h = loops.innermost[b];
+        if (h == blocks.size() || (b > 0 && loops.innermost[b - 1] == h))
+            continue;
+        const auto line = blocks[h].line > 0 ? blocks[h].line : blocks[h].branch ? blocks[h].branch->line : 0;
+        runs[b] = static_cast<std::uint32_t>(line);
     }
+    return runs;
+}
 
-    const std::string s2 = handleVar(a.right, tempmap);
-    const std::string op = op_to_asm(a.op);
+// 同一行上的第二段（或第二个循环）依次加后缀 _2、_3 ……
+void CodeGenerator::gen_loop_name(const std::uint32_t line) {
+    const auto base = "loop_line_" + std::to_string(line);
+    auto name = base;
+    for (int k = 2; !loopNames.insert(name).second; ++k)
+        name = base + "_" + std::to_string(k);
+    const auto sym = mod.symbol(name);
+    mod.label(sym);
+    loopSymbols.insert(sym);
+}
 
-    // rax = src1
-    pr("\tmov rax, " + s1);
+void CodeGenerator::gen_compare(const CompareCodeIR &c) {
+    // cmp qword [x], imm / test rax, rax / mov rax, lhs; cmp rax, rhs ……，两边可能交换
+    const auto cond = sel.compare(c.left, c.right, cmp_to_jmp(c.operation));
 
-    // rax = rax (op) src2
-    // 对于 imul，两操作数形式：imul rax, <src>
-    pr("\t" + op + " rax, " + s2);
+    // 过程体不插桩：profile 的计数器按顶层代码的标签编号
+    if (options.profilePath.empty() || !labelScope.empty()) {
+        mod.jcc(cond, label_symbol(c.jump));
+        return;
+    }
+    // 跳转成立的边先到计数桩（放在程序末尾），计数后再跳到真正的目标；
+    // 不成立的一边在 jcc 之后就地记录方向
+    const auto stub = mod.symbol("__pgo_edge" + std::to_string(profileCounters));
+    edgeStubs.push_back({stub, mod.symbol(c.jump), profileCounters, profileBranches});
+    mod.jcc(cond, stub);
+    gen_profile_direction(profileCounters, profileBranches, false);
+    profileCounters += 2;
+    ++profileBranches;
+}
 
-    // store back
-    pr("\tmov [" + dst + "], rax");
+void CodeGenerator::gen_select(const SelectCode &s) {
+    // var = (left op right) ? ifTrue : ifFalse，不用分支：
+    // rax = ifFalse，条件成立时 cmov 换成 ifTrue（cmov 的源操作数不能是立即数）
+    auto ifTrue = handleVar(s.ifTrue);
+    if (ifTrue.kind != x86::Operand::Kind::Mem) {
+        sel.load(Reg::RCX, ifTrue);
+        ifTrue = reg(Reg::RCX);
+    }
+    sel.load(Reg::RAX, handleVar(s.ifFalse));
+    sel.load(Reg::RDX, handleVar(s.left));
+    mod.ins(Op::Cmp, reg(Reg::RDX), handleVar(s.right));
+    mod.cmov(cmp_to_jmp(s.operation), reg(Reg::RAX), ifTrue);
+    mod.ins(Op::Mov, handleVar(s.var), reg(Reg::RAX));
 }
 
-void CodeGenerator::gen_jump(const JumpCode &j) {
-    // 假设字段名叫 j.dist
-    pr("\tjmp " + j.dist);
+// 一段常量时直接 write；否则逐段填好 __iov，再一次 writev(1, __iov, n)。
+// 整数由 _format_num 写进 __wbuf 中各自的 24 字节，字符串变量由 _str_len 求长度。
+// -Os 时系统调用本身放在 _write_stdout / _writev_stdout 里，每处只剩装参数和 call
+void CodeGenerator::gen_write(const WriteCode &w) {
+    auto constant_length = [this](const std::string &sym) {
+        return static_cast<std::int64_t>(consts.at(sym).size());
+    };
+    const auto &first = w.pieces.front();
+    if (w.pieces.size() == 1 && first.kind == PrintKind::String && consts.count(first.value)) {
+        if (options.optimizeSize) {
+            sel.load(Reg::RSI, handleVar(first.value));
+            sel.load(Reg::RDX, imm(constant_length(first.value)));
+            mod.call(mod.symbol("_write_stdout"));
+            return;
+        }
+        mod.ins(Op::Mov, reg(Reg::RAX), imm(1)); // sys_write
+        mod.ins(Op::Mov, reg(Reg::RDI), imm(1)); // stdout
+        mod.ins(Op::Mov, reg(Reg::RSI), handleVar(first.value));
+        mod.ins(Op::Mov, reg(Reg::RDX), imm(constant_length(first.value)));
+        mod.ins(Op::Syscall);
+        return;
+    }
+
+    const auto iov = mod.symbol("__iov");
+    std::int64_t ints = 0;
+    for (std::size_t i = 0; i < w.pieces.size(); ++i) {
+        const auto &piece = w.pieces[i];
+        const auto base = mem(iov, static_cast<std::int64_t>(16 * i)), len = mem(iov, static_cast<std::int64_t>(16 * i + 8));
+        if (options.optimizeSize && piece.kind == PrintKind::String && consts.count(piece.value)) {
+            mod.ins(Op::Mov, base, handleVar(piece.value)); // mov qword [__iov+16i], S1
+            mod.ins(Op::Mov, len, imm(constant_length(piece.value)));
+            continue;
+        }
+        sel.load(Reg::RAX, piece.value);
+        if (piece.kind == PrintKind::Int) {
+            mod.ins(Op::Lea, reg(Reg::RDI), mem(mod.symbol("__wbuf"), kNumText * ++ints));
+            mod.call(mod.symbol("_format_num"));
+        } else if (!consts.count(piece.value)) {
+            mod.call(mod.symbol("_str_len"));
+        }
+        mod.ins(Op::Mov, base, reg(Reg::RAX));
+        if (piece.kind == PrintKind::String && consts.count(piece.value))
+            mod.ins(Op::Mov, len, imm(constant_length(piece.value)));
+        else
+            mod.ins(Op::Mov, len, reg(Reg::RDX));
+    }
+    if (options.optimizeSize) {
+        sel.load(Reg::RDX, imm(static_cast<std::int64_t>(w.pieces.size())));
+        mod.call(mod.symbol("_writev_stdout"));
+        return;
+    }
+    mod.ins(Op::Mov, reg(Reg::RAX), imm(20)); // sys_writev
+    mod.ins(Op::Mov, reg(Reg::RDI), imm(1)); // stdout
+    mod.ins(Op::Mov, reg(Reg::RSI), x86::addr(iov));
+    mod.ins(Op::Mov, reg(Reg::RDX), imm(static_cast<std::int64_t>(w.pieces.size())));
+    mod.ins(Op::Syscall);
 }
 
-void CodeGenerator::gen_label(const LabelCode &l) {
-    // 假设字段名叫 l.label
-    pr(l.label + ":");
+// 向量循环（见 vectorize.hpp）放在原来的标量循环前面：按整组 lanes 次迭代执行，把 i 推进到剩下不足一组的位置，
+// 余下的迭代仍由紧跟着的标量循环完成。--simd=auto 时两套代码都生成，按 _detect_simd 的结果选一套
+void CodeGenerator::gen_vector_loop(const VectorLoopCode &v) {
+    if (!vector_loops(options))
+        return;
+    const auto done = label_symbol(v.label + "_vdone");
+    switch (options.simd) {
+        case Simd::Sse2:
+            gen_vector_path(v, Width::Xmm, "_sse", done);
+            break;
+        case Simd::Avx2:
+            gen_vector_path(v, Width::Ymm, "_avx", done);
+            break;
+        default: {
+            // __simd_level：0 还没检测，1 SSE2，2 AVX2
+            const auto known = label_symbol(v.label + "_vlevel");
+            const auto avx = label_symbol(v.label + "_vavx");
+            mod.ins(Op::Mov, reg(Reg::RAX), mem(mod.symbol("__simd_level")));
+            mod.ins(Op::Test, reg(Reg::RAX), reg(Reg::RAX));
+            mod.jcc(Cond::NE, known);
+            mod.call(mod.symbol("_detect_simd"));
+            mod.label(known);
+            mod.ins(Op::Cmp, reg(Reg::RAX), imm(2));
+            mod.jcc(Cond::E, avx);
+            gen_vector_path(v, Width::Xmm, "_sse", done);
+            mod.jmp(done);
+            mod.label(avx);
+            gen_vector_path(v, Width::Ymm, "_avx", done);
+            break;
+        }
+    }
+    mod.label(done);
 }
 
-void CodeGenerator::gen_compare(const CompareCodeIR &c) {
+// 一套向量代码，w 为 Xmm（SSE2，每组 2 个元素）或 Ymm（AVX2，每组 4 个）。
+// rcx = i，rdx = 剩余迭代数 - lanes；循环不变量与字面量先广播进各自的寄存器，归约各用一个累加寄存器，
+// 循环体里的临时变量在最后一次使用后归还寄存器。i 本身作为值时用下标向量 {i, i+1, ...}，每组加上 lanes
+void CodeGenerator::gen_vector_path(const VectorLoopCode &v, const Width w, const std::string &tag,
+                                    const x86::SymbolId done) {
+    const std::int64_t lanes = static_cast<std::int64_t>(w) / 8;
+    const bool avx = w == Width::Ymm;
+    const auto vtmp = mod.symbol("__vtmp");
+    auto vr = [w](const int n) { return x86::vreg(n, w); };
+
+    mod.ins(Op::Mov, reg(Reg::RCX), handleVar(v.index));
+    sel.load(Reg::RDX, handleVar(v.bound));
+    mod.ins(Op::Sub, reg(Reg::RDX), reg(Reg::RCX));
+    mod.ins(Op::Sub, reg(Reg::RDX), imm(v.operation == "<=" ? lanes - 1 : lanes));
+    mod.jcc(Cond::L, done);
+
+    std::vector<int> free;
+    for (int n = 15; n >= 0; --n)
+        free.push_back(n);
+    auto take = [&free] {
+        const int n = free.back();
+        free.pop_back();
+        return n;
+    };
+    // src 是 8 字节的内存操作数
+    auto broadcast = [&](const int n, const x86::Operand &src) {
+        if (avx) {
+            mod.ins(Op::Vpbroadcastq, vr(n), src);
+        } else {
+            mod.ins(Op::Movq, vr(n), src);
+            mod.ins(Op::Punpcklqdq, vr(n), vr(n));
+        }
+    };
+
+    std::unordered_set<std::string> reductions;
+    std::unordered_map<std::string, std::size_t> last; // 临时变量 -> 最后一次使用（或定义）的位置
+    for (std::size_t k = 0; k < v.body.size(); ++k) {
+        const auto &ins = *v.body[k];
+        if (ins.kind() == IRKind::Assignment && static_cast<const AssignmentCode &>(ins).var[0] == 'V')
+            reductions.insert(static_cast<const AssignmentCode &>(ins).var);
+        for (const auto *x: operands(ins))
+            if (!x->empty() && (*x)[0] == 'T')
+                last[*x] = k;
+    }
+
+    // 循环体读的值（Load 的下标总是 i，不算）
+    auto values = [&reductions](const IRInstr &ins) -> std::vector<const std::string *> {
+        if (ins.kind() == IRKind::Store)
+            return {&static_cast<const StoreCode &>(ins).value};
+        if (ins.kind() != IRKind::Assignment)
+            return {};
+        const auto &a = static_cast<const AssignmentCode &>(ins);
+        if (reductions.count(a.var))
+            return {a.left == a.var ? &a.right : &a.left};
+        return {&a.left, &a.right};
+    };
+
+    // 循环不变量、字面量和下标向量
+    std::unordered_map<std::string, int> regs;
+    bool indexVector = false;
+    for (auto &ins: v.body)
+        for (const auto *x: values(*ins)) {
+            if (x->empty() || (*x)[0] == 'T' || regs.count(*x))
+                continue;
+            const int n = take();
+            regs[*x] = n;
+            if (*x == v.index) {
+                broadcast(n, handleVar(*x));
+                mod.ins(Op::Paddq, vr(n), mem(mod.symbol("__lanes"), 0, w));
+                indexVector = true;
+                continue;
+            }
+            const auto src = handleVar(*x);
+            if (src.kind == x86::Operand::Kind::Imm && src.value == 0) {
+                mod.ins(Op::Pxor, vr(n), vr(n));
+            } else if (src.kind == x86::Operand::Kind::Imm) {
+                if (src.value >= INT32_MIN && src.value <= INT32_MAX) {
+                    mod.ins(Op::Mov, mem(vtmp), src);
+                } else {
+                    mod.ins(Op::Mov, reg(Reg::RAX), src);
+                    mod.ins(Op::Mov, mem(vtmp), reg(Reg::RAX));
+                }
+                broadcast(n, mem(vtmp));
+            } else {
+                broadcast(n, src);
+            }
+        }
+    std::vector<std::pair<std::string, int> > accumulators;
+    for (auto &ins: v.body)
+        if (ins->kind() == IRKind::Assignment) {
+            const auto &var = static_cast<const AssignmentCode &>(*ins).var;
+            if (reductions.count(var) && !regs.count(var)) {
+                regs[var] = take();
+                accumulators.emplace_back(var, regs[var]);
+                mod.ins(Op::Pxor, vr(regs[var]), vr(regs[var]));
+            }
+        }
+
+    const auto loop = label_symbol(v.label + "_vloop" + tag);
+    mod.label(loop);
+    for (std::size_t k = 0; k < v.body.size(); ++k) {
+        const auto &ins = *v.body[k];
+        switch (ins.kind()) {
+            case IRKind::Load: {
+                const auto &l = static_cast<const LoadCode &>(ins);
+                regs[l.var] = take();
+                mod.ins(Op::Movdqu, vr(regs[l.var]), mem(mod.symbol(l.array), Reg::RCX, 8, 0, w));
+                break;
+            }
+            case IRKind::Store: {
+                const auto &st = static_cast<const StoreCode &>(ins);
+                mod.ins(Op::Movdqu, mem(mod.symbol(st.array), Reg::RCX, 8, 0, w), vr(regs.at(st.value)));
+                break;
+            }
+            default: {
+                const auto &a = static_cast<const AssignmentCode &>(ins);
+                const auto op = a.op == "-" ? Op::Psubq : Op::Paddq;
+                if (reductions.count(a.var)) {
+                    const auto &x = a.left == a.var ? a.right : a.left;
+                    mod.ins(op, vr(regs.at(a.var)), vr(regs.at(x)));
+                    break;
+                }
+                // 左边的临时变量到这里就不再用了，直接在它的寄存器里算
+                int n;
+                if (a.left[0] == 'T' && last[a.left] == k && a.left != a.right) {
+                    n = regs.at(a.left);
+                    regs.erase(a.left);
+                } else {
+                    n = take();
+                    mod.ins(Op::Movdqa, vr(n), vr(regs.at(a.left)));
+                }
+                if (!a.op.empty())
+                    mod.ins(op, vr(n), vr(regs.at(a.right)));
+                regs[a.var] = n;
+                break;
+            }
+        }
+        for (const auto *x: operands(ins))
+            if (!x->empty() && (*x)[0] == 'T' && last[*x] == k && regs.count(*x)) {
+                free.push_back(regs[*x]);
+                regs.erase(*x);
+            }
+    }
+    if (indexVector)
+        mod.ins(Op::Paddq, vr(regs.at(v.index)), mem(mod.symbol("__lanes"), kLaneStep + (avx ? 16 : 0), w));
+    mod.ins(Op::Add, reg(Reg::RCX), imm(lanes));
+    mod.ins(Op::Sub, reg(Reg::RDX), imm(lanes));
+    mod.jcc(Cond::GE, loop);
+    mod.ins(Op::Mov, handleVar(v.index), reg(Reg::RCX));
 
-    const std::string lhs = handleVar(c.left, tempmap);
-    const std::string rhs = handleVar(c.right, tempmap);
-    const std::string jcc = cmp_to_jmp(c.operation);
+    // 各 lane 的部分和经 __vtmp 相加，再加到变量上
+    for (auto &[var, n]: accumulators) {
+        mod.ins(Op::Movdqu, mem(vtmp, 0, w), vr(n));
+        mod.ins(Op::Mov, reg(Reg::RAX), mem(vtmp));
+        for (std::int64_t lane = 1; lane < lanes; ++lane)
+            mod.ins(Op::Add, reg(Reg::RAX), mem(vtmp, 8 * lane));
+        mod.ins(Op::Add, handleVar(var), reg(Reg::RAX));
+    }
+    if (avx)
+        mod.ins(Op::Vzeroupper);
+}
 
-    // lhs 可能是 [Va] 或立即数。cmp 的第一个操作数不能是立即数，所以用 rax 做中转：
-    pr("\tmov rax, " + lhs);
-    pr("\tcmp rax, " + rhs);
-    pr("\t" + jcc + " " + c.jump);
+// _detect_simd：CPUID 报告 AVX2、OSXSAVE 和 AVX，并且 XCR0 表明操作系统保存 xmm / ymm 状态时为 2，否则为 1
+// （x86-64 都有 SSE2）。结果写进 __simd_level 并在 rax 返回；改写 rcx / rdx
+void CodeGenerator::gen_detect_simd_function() {
+    const auto level = mod.symbol("__simd_level");
+    const auto done = mod.symbol(".ds_done");
+    mod.label(mod.symbol("_detect_simd"));
+    mod.ins(Op::Push, reg(Reg::RBX));
+    mod.ins(Op::Mov, mem(level), imm(1));
+    mod.ins(Op::Mov, reg(Reg::RAX), imm(1));
+    mod.ins(Op::Cpuid);
+    mod.ins(Op::And, reg(Reg::RCX), imm(0x18000000)); // OSXSAVE | AVX
+    mod.ins(Op::Cmp, reg(Reg::RCX), imm(0x18000000));
+    mod.jcc(Cond::NE, done);
+    mod.ins(Op::Xor, reg(Reg::RCX), reg(Reg::RCX));
+    mod.ins(Op::Xgetbv);
+    mod.ins(Op::And, reg(Reg::RAX), imm(6)); // XCR0：SSE 与 AVX 状态
+    mod.ins(Op::Cmp, reg(Reg::RAX), imm(6));
+    mod.jcc(Cond::NE, done);
+    mod.ins(Op::Mov, reg(Reg::RAX), imm(7));
+    mod.ins(Op::Xor, reg(Reg::RCX), reg(Reg::RCX));
+    mod.ins(Op::Cpuid);
+    mod.ins(Op::And, reg(Reg::RBX), imm(0x20)); // leaf 7 ebx 第 5 位：AVX2
+    mod.jcc(Cond::E, done);
+    mod.ins(Op::Mov, mem(level), imm(2));
+    mod.label(done);
+    mod.ins(Op::Mov, reg(Reg::RAX), mem(level));
+    mod.ins(Op::Pop, reg(Reg::RBX));
+    mod.ins(Op::Ret);
 }
 
 void CodeGenerator::gen_print(const PrintCodeIR &p) {
     if (p.printKind == PrintKind::String) {
         // rax = address of string (S1 or [Vmsg])
-        pr("\tmov rax, " + handleVar(p.value, tempmap));
-        pr("\tcall _print_string");
+        sel.load(Reg::RAX, p.value);
+        mod.call(mod.symbol("_print_string"));
 
         if (p.newline)
             gen_print_newline();
@@ -160,14 +671,31 @@ void CodeGenerator::gen_print(const PrintCodeIR &p) {
         return;
     }
 
-    // PrintKind::Int
-    pr("\tmov rax, " + handleVar(p.value, tempmap));
-    pr("\tcall _print_num"); // _print_num already prints '\n'
+    // PrintKind::Int（可能是并进来的表达式树）
+    sel.load(Reg::RAX, p.value);
+    mod.call(mod.symbol("_print_num")); // _print_num already prints '\n'
 }
 
 
-void CodeGenerator::gen_code() {
-    for (auto &ins: arr.code) {
+void CodeGenerator::gen_code(const InterCodeArray &code) {
+    std::vector<std::uint32_t> loops;
+    if (options.debugLines)
+        loops = loop_runs(code);
+    std::size_t block = 0;
+    bool blockStart = true; // 与 label_blocks() 的分块相同
+    for (auto &ins: code.code) {
+        if (options.debugLines && (blockStart || ins->kind() == IRKind::Label)) {
+            if (loops[block] > 0)
+                gen_loop_name(loops[block]);
+            ++block;
+        }
+        blockStart = ins->kind() == IRKind::Jump || ins->kind() == IRKind::Compare || ins->kind() == IRKind::Return;
+        // 行号跟在标签后面，标签本身不换行
+        if (options.debugLines && ins->kind() != IRKind::Label && ins->line > 0 &&
+            static_cast<std::uint32_t>(ins->line) != lastLine) {
+            lastLine = static_cast<std::uint32_t>(ins->line);
+            mod.line(lastLine);
+        }
         switch (ins->kind()) {
             case IRKind::Assignment:
                 gen_assignment(*std::static_pointer_cast<AssignmentCode>(ins));
@@ -177,6 +705,8 @@ void CodeGenerator::gen_code() {
                 break;
             case IRKind::Label:
                 gen_label(*std::static_pointer_cast<LabelCode>(ins));
+                if (!options.profilePath.empty() && labelScope.empty())
+                    gen_profile_increment(profileCounters++);
                 break;
             case IRKind::Compare:
                 gen_compare(*std::static_pointer_cast<CompareCodeIR>(ins));
@@ -184,127 +714,971 @@ void CodeGenerator::gen_code() {
             case IRKind::Print:
                 gen_print(*std::static_pointer_cast<PrintCodeIR>(ins));
                 break;
+            case IRKind::Select:
+                gen_select(*std::static_pointer_cast<SelectCode>(ins));
+                break;
+            case IRKind::Write:
+                gen_write(*std::static_pointer_cast<WriteCode>(ins));
+                break;
+            case IRKind::Load:
+                sel.load_element(*std::static_pointer_cast<LoadCode>(ins));
+                break;
+            case IRKind::Store:
+                sel.store_element(*std::static_pointer_cast<StoreCode>(ins));
+                break;
+            case IRKind::VectorLoop:
+                gen_vector_loop(*std::static_pointer_cast<VectorLoopCode>(ins));
+                break;
+            case IRKind::Call:
+                gen_call(*std::static_pointer_cast<CallCode>(ins));
+                break;
+            case IRKind::Return:
+                gen_return(*std::static_pointer_cast<ReturnCode>(ins));
+                break;
+            case IRKind::Procedure: {
+                const auto p = std::static_pointer_cast<ProcedureCode>(ins);
+                if (!streaming) {
+                    procedures.push_back(p); // 放在程序的退出代码之后
+                    break;
+                }
+                // 流式输出没有"程序之后"，就地生成，顺序执行时跳过
+                const auto skip = mod.symbol(p->name + ".skip");
+                mod.jmp(skip);
+                gen_procedure(*p);
+                mod.label(skip);
+                sel.reset(isel::fold_temps(code));
+                break;
+            }
         }
     }
 }
 
-void CodeGenerator::writeAsm(const std::string &path) {
-    out.clear();
+// System V 的整数参数寄存器
+static constexpr Reg kArgRegs[kMaxParams] = {Reg::RDI, Reg::RSI, Reg::RDX, Reg::RCX, Reg::R8, Reg::R9};
+
+void CodeGenerator::gen_call(const CallCode &c) {
+    for (std::size_t k = 0; k < c.args.size(); ++k)
+        sel.load(kArgRegs[k], c.args[k]);
+    mod.call(mod.symbol(c.proc));
+    if (!c.var.empty())
+        mod.ins(Op::Mov, handleVar(c.var), reg(Reg::RAX));
+}
+
+void CodeGenerator::gen_return(const ReturnCode &r) {
+    sel.load(Reg::RAX, r.value);
+    gen_epilogue();
+}
+
+void CodeGenerator::gen_epilogue() {
+    if (!frame.empty()) {
+        mod.ins(Op::Mov, reg(Reg::RSP), reg(Reg::RBP));
+        mod.ins(Op::Pop, reg(Reg::RBP));
+    }
+    mod.ins(Op::Ret);
+}
+
+// 栈帧：参数按顺序在 [rbp-8]、[rbp-16] ……，之后是过程体里的局部变量和没有并进下一条的临时变量。
+// 全局变量仍在 .bss 里；一个槽位都不用时连 rbp 都不设
+void CodeGenerator::gen_procedure(const ProcedureCode &p) {
+    if (!generatedProcedures.insert(p.name).second)
+        return; // 同一个过程只生成一次（循环展开可能复制了定义）
+    sel.reset(isel::fold_temps(p.body));
+    frame.clear();
+    auto slot = [this](const std::string &x) {
+        frame.emplace(x, -8 * static_cast<std::int64_t>(frame.size() + 1));
+    };
+    for (auto &param: p.params)
+        slot(param);
+    for (auto &ins: p.body.code)
+        for (const auto *operand: operands(*ins))
+            if (frame_local(*operand) && !sel.folded(*operand))
+                slot(*operand);
+
+    labelScope = p.name + ".";
+    mod.label(mod.symbol(p.name));
+    if (!frame.empty()) {
+        const auto size = static_cast<std::int64_t>(8 * frame.size() + 15) / 16 * 16;
+        mod.ins(Op::Push, reg(Reg::RBP));
+        mod.ins(Op::Mov, reg(Reg::RBP), reg(Reg::RSP));
+        mod.ins(Op::Sub, reg(Reg::RSP), imm(size));
+        for (std::size_t k = 0; k < p.params.size(); ++k)
+            mod.ins(Op::Mov, handleVar(p.params[k]), reg(kArgRegs[k]));
+    }
+    gen_code(p.body);
+    // 没有执行 return 就走到结尾：返回 0
+    if (p.body.code.empty() || p.body.code.back()->kind() != IRKind::Return) {
+        sel.load(Reg::RAX, imm(0));
+        gen_epilogue();
+    }
+    labelScope.clear();
+    frame.clear();
+}
+
+const x86::Module &CodeGenerator::module() {
+    if (generated)
+        return mod;
+
+    scan_helpers(arr);
+    sel.reset(isel::fold_temps(arr));
+    gen_variables();
+    gen_start();
+    gen_code(arr);
+    gen_end();
+    for (auto &p: procedures)
+        gen_procedure(*p);
+    if (options.debugLines)
+        mod.line(0); // 之后的辅助函数不对应源码
+    if (options.optimizeSize)
+        merge_tails();
+    gen_helpers();
+    if (options.loopAlignment)
+        align_loop_headers();
+
+    for (auto &i: mod.text)
+        if (!x86::pseudo(i.op))
+            ++instructions;
+    if (options.countInstructions) {
+        instrument_instruction_count();
+        gen_report_function();
+    }
+    if (!options.profilePath.empty()) {
+        gen_profile_stubs();
+        gen_write_profile_function();
+    }
+
+    generated = true;
+    return mod;
+}
 
-    // Pre-scan IR to determine which helpers are needed (before gen_variables)
-    for (auto &ins: arr.code) {
+// 确定需要哪些辅助函数和缓冲区（在 gen_variables 之前）
+void CodeGenerator::scan_helpers(const InterCodeArray &code) {
+    for (auto &ins: code.code) {
         if (ins->kind() == IRKind::Print) {
             if (const auto print_ins = std::static_pointer_cast<PrintCodeIR>(ins);
-                print_ins->printKind == PrintKind::String)
+                print_ins->printKind == PrintKind::String) {
                 need_print_string = true;
-            else
+                need_newline = need_newline || print_ins->newline;
+                need_write = need_write || print_ins->newline;
+            } else
                 need_print_num = true;
+        } else if (ins->kind() == IRKind::Write) {
+            const auto &w = static_cast<const WriteCode &>(*ins);
+            std::size_t ints = 0;
+            for (auto &piece: w.pieces) {
+                ints += piece.kind == PrintKind::Int;
+                need_str_len = need_str_len || (piece.kind == PrintKind::String && !consts.count(piece.value));
+            }
+            const auto &first = w.pieces.front();
+            if (w.pieces.size() == 1 && first.kind == PrintKind::String && consts.count(first.value))
+                need_write = true;
+            else
+                need_writev = true;
+            if (w.pieces.size() > 1 || ints > 0 || need_str_len)
+                writeIovs = std::max(writeIovs, w.pieces.size());
+            writeInts = std::max(writeInts, ints);
+        } else if (ins->kind() == IRKind::VectorLoop && vector_loops(options)) {
+            need_vector = true;
+            need_detect = need_detect || options.simd == Simd::Auto;
+        } else if (ins->kind() == IRKind::Procedure) {
+            scan_helpers(static_cast<const ProcedureCode &>(*ins).body);
         }
     }
+}
 
-    gen_variables();
-    gen_start();
-    gen_code();
-    gen_end();
+void CodeGenerator::gen_helpers() {
+    if (options.optimizeSize) {
+        gen_small_helpers();
+        return;
+    }
     if (need_print_num)
-        gen_print_num_function();
+        gen_print_num_function("_print_num", 1, ".pn_");
     if (need_print_string)
         gen_print_string_function();
+    if (writeInts > 0)
+        gen_format_num_function();
+    if (need_str_len)
+        gen_str_len_function();
+    if (need_detect)
+        gen_detect_simd_function();
+}
+
+// -------------------- 流式输出 --------------------
+// 每段都用一个新的 Module，符号表只与这一段的大小有关；变量在第一次用到的那一段分配槽位，
+// 临时变量和字符串常量只属于一条语句，直接跟在这一段后面
+
+void CodeGenerator::new_module() {
+    mod = x86::Module();
+    mod.sourceName = options.sourceName;
+    loopSymbols.clear();
+}
+
+void CodeGenerator::stream_begin(x86::NasmWriter &out) {
+    new_module();
+    gen_start();
+    out.write(mod);
+}
+
+void CodeGenerator::stream_chunk(const InterCodeArray &chunk,
+                                 const std::unordered_map<std::string, std::string> &constants,
+                                 const std::map<std::string, std::int64_t> &arrays,
+                                 x86::NasmWriter &out, std::vector<std::string> *variables) {
+    new_module();
+    consts = constants;
+    streamedArrays.insert(arrays.begin(), arrays.end());
+    scan_helpers(chunk);
+    sel.reset(isel::fold_temps(chunk));
+
+    std::unordered_set<std::string> local;
+    std::vector<const std::string *> used;
+    for (auto &ins: chunk.code) {
+        for (const auto *operand: operands(*ins))
+            if (!sel.folded(*operand))
+                used.push_back(operand);
+        // 过程体里只有全局变量和字符串常量需要在这里分配
+        if (ins->kind() == IRKind::Procedure)
+            for (auto &b: static_cast<const ProcedureCode &>(*ins).body.code)
+                for (const auto *operand: operands(*b))
+                    if (!frame_local(*operand))
+                        used.push_back(operand);
+    }
+    for (const auto *operand: used) {
+        const auto &x = *operand;
+        if (x.empty() || is_int_literal(x))
+            continue;
+        if (x[0] == 'S') {
+            const auto it = consts.find(x);
+            if (it == consts.end())
+                throw std::runtime_error("undefined string constant: " + x);
+            if (local.insert(x).second)
+                mod.rodata.push_back({mod.symbol(x), it->second + '\0'});
+        } else if (x[0] != 'T' && variables) {
+            if (local.insert(x).second)
+                variables->push_back(x);
+        } else if (x[0] == 'T' ? local.insert(x).second : streamedVars.insert(x).second) {
+            mod.bss.push_back({mod.symbol(x), 8});
+        }
+    }
+
+    gen_code(chunk);
+    if (options.loopAlignment)
+        align_loop_headers();
+    for (auto &i: mod.text)
+        if (!x86::pseudo(i.op))
+            ++instructions;
+    out.write(mod, true);
+}
+
+CodeGenerator::StreamState CodeGenerator::stream_state() const {
+    StreamState state;
+    state.printNum = need_print_num;
+    state.printString = need_print_string;
+    state.newline = need_newline;
+    state.strLen = need_str_len;
+    state.write = need_write;
+    state.writev = need_writev;
+    state.writeIovs = writeIovs;
+    state.writeInts = writeInts;
+    state.vector = need_vector;
+    state.detect = need_detect;
+    state.arrays = streamedArrays;
+    state.instructions = instructions;
+    return state;
+}
+
+void CodeGenerator::merge(const CodeGenerator &region) {
+    merge(region.stream_state());
+}
+
+void CodeGenerator::merge(const StreamState &state) {
+    need_print_num = need_print_num || state.printNum;
+    need_print_string = need_print_string || state.printString;
+    need_newline = need_newline || state.newline;
+    need_str_len = need_str_len || state.strLen;
+    need_write = need_write || state.write;
+    need_writev = need_writev || state.writev;
+    writeIovs = std::max(writeIovs, state.writeIovs);
+    writeInts = std::max(writeInts, state.writeInts);
+    need_vector = need_vector || state.vector;
+    need_detect = need_detect || state.detect;
+    streamedArrays.insert(state.arrays.begin(), state.arrays.end());
+    instructions += state.instructions;
+}
+
+void CodeGenerator::stream_end(x86::NasmWriter &out, const std::vector<std::string> &variables) {
+    new_module();
+    for (auto &v: variables)
+        if (streamedVars.insert(v).second)
+            mod.bss.push_back({mod.symbol(v), 8});
+    for (auto &[name, length]: streamedArrays) {
+        if (streamedVars.count(name))
+            throw std::runtime_error("variable " + name.substr(1) + " is used both as an array and as a scalar");
+        mod.bss.push_back({mod.symbol(name), static_cast<std::uint32_t>(8 * length), x86::kDataSectionAlign});
+    }
+    gen_end();
+    if (options.debugLines)
+        mod.line(0);
+    gen_helpers();
+    if (need_print_num)
+        mod.bss.push_back({mod.symbol("digitSpace"), 100, x86::kDataSectionAlign});
+    if (writeIovs > 1)
+        mod.bss.push_back({mod.symbol("__iov"), static_cast<std::uint32_t>(16 * writeIovs), x86::kDataSectionAlign});
+    if (writeInts > 0)
+        mod.bss.push_back({mod.symbol("__wbuf"), static_cast<std::uint32_t>(kNumText * writeInts)});
+    if (need_vector)
+        mod.bss.push_back({mod.symbol("__vtmp"), 32, x86::kDataSectionAlign});
+    if (need_detect)
+        mod.bss.push_back({mod.symbol("__simd_level"), 8});
+    if (need_newline)
+        mod.rodata.push_back({mod.symbol("nl"), "\n"});
+    if (need_vector)
+        mod.rodata.push_back({mod.symbol("__lanes"), lane_offsets(), 32});
+    for (auto &i: mod.text)
+        if (!x86::pseudo(i.op))
+            ++instructions;
+    out.write(mod, true);
+}
+
+std::string CodeGenerator::assembly() {
+    return x86::to_nasm(module());
+}
+
+void CodeGenerator::assembly(const x86::NasmWriter::Sink &sink) {
+    x86::NasmWriter out(sink);
+    out.write(module());
+    out.flush();
+}
+
+std::size_t CodeGenerator::instruction_count() {
+    if (!streaming)
+        module();
+    return instructions;
+}
+
+const x86::Object &CodeGenerator::encoded() {
+    if (!object_)
+        object_ = std::make_unique<x86::Object>(x86::encode(module()));
+    return *object_;
+}
+
+CodeGenerator::SectionSizes CodeGenerator::section_sizes() {
+    const auto &obj = encoded();
+    return {obj.text.size(), obj.rodata.size() + obj.data.size(), obj.bssSize};
+}
+
+std::vector<std::uint8_t> CodeGenerator::object() {
+    return elf::object_file(encoded());
+}
+
+std::vector<std::uint8_t> CodeGenerator::executable() {
+    return elf::executable_file(encoded());
+}
+
+void CodeGenerator::writeAsm(const std::string &path) {
     std::ofstream f(path, std::ios::binary);
-    f << out;
+    assembly([&f](const std::string_view text) { f.write(text.data(), static_cast<std::streamsize>(text.size())); });
     f.close();
 }
 
+static void write_bytes(const std::string &path, const std::vector<std::uint8_t> &bytes) {
+    std::ofstream f(path, std::ios::binary);
+    if (!f)
+        throw std::runtime_error("Cannot open " + path);
+    f.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+}
+
+void CodeGenerator::writeObject(const std::string &path) {
+    write_bytes(path, object());
+}
+
+void CodeGenerator::writeExecutable(const std::string &path) {
+    write_bytes(path, executable());
+    chmod(path.c_str(), 0755);
+}
+
+
+// name: 函数名；fd: 写到哪个文件描述符；local: 局部标签前缀（同一个 Module 里不能重名）
+void CodeGenerator::gen_print_num_function(const std::string &name, const int fd, const std::string &local) {
+    const auto digitSpace = mod.symbol("digitSpace");
+    const auto convert = mod.symbol(local + "convert");
+    const auto loop = mod.symbol(local + "loop");
+    const auto afterDigits = mod.symbol(local + "after_digits");
+    const auto write = mod.symbol(local + "write");
 
-void CodeGenerator::gen_print_num_function() {
-    pr("");
-    pr("_print_num:");
-    pr("\t; rax = signed integer to print");
-    pr("\tpush rbx");
-    pr("\tpush rcx");
-    pr("\tpush rdx");
-    pr("\tpush rsi");
+    // rax = signed integer to print
+    mod.label(mod.symbol(name));
+    mod.ins(Op::Push, reg(Reg::RBX));
+    mod.ins(Op::Push, reg(Reg::RCX));
+    mod.ins(Op::Push, reg(Reg::RDX));
+    mod.ins(Op::Push, reg(Reg::RSI));
 
-    pr("\tmov rbx, 10");
+    mod.ins(Op::Mov, reg(Reg::RBX), imm(10));
 
     // rcx points to end-1 (we keep newline at last byte)
-    pr("\tlea rcx, [digitSpace+99]");
-    pr("\tmov byte [rcx], 10"); // '\n'
-    pr("\tdec rcx");
+    mod.ins(Op::Lea, reg(Reg::RCX), mem(digitSpace, 99));
+    mod.ins(Op::Mov, mem(Reg::RCX, 0, Width::Byte), imm(10)); // '\n'
+    mod.ins(Op::Dec, reg(Reg::RCX));
 
     // sign handling
-    pr("\txor r8, r8"); // r8 = 0 means non-negative
-    pr("\tcmp rax, 0");
-    pr("\tjge .pn_convert");
-    pr("\tneg rax");
-    pr("\tmov r8, 1"); // negative
-    pr(".pn_convert:");
+    mod.ins(Op::Xor, reg(Reg::R8), reg(Reg::R8)); // r8 = 0 means non-negative
+    mod.ins(Op::Cmp, reg(Reg::RAX), imm(0));
+    mod.jcc(Cond::GE, convert);
+    mod.ins(Op::Neg, reg(Reg::RAX));
+    mod.ins(Op::Mov, reg(Reg::R8), imm(1)); // negative
+    mod.label(convert);
 
     // handle 0 explicitly
-    pr("\tcmp rax, 0");
-    pr("\tjne .pn_loop");
-    pr("\tmov byte [rcx], '0'");
-    pr("\tdec rcx");
-    pr("\tjmp .pn_after_digits");
-
-    pr(".pn_loop:");
-    pr("\txor rdx, rdx");
-    pr("\tdiv rbx"); // rax=quotient, rdx=remainder
-    pr("\tadd dl, '0'");
-    pr("\tmov [rcx], dl");
-    pr("\tdec rcx");
-    pr("\tcmp rax, 0");
-    pr("\tjne .pn_loop");
-
-    pr(".pn_after_digits:");
-    pr("\tcmp r8, 1");
-    pr("\tjne .pn_write");
-    pr("\tmov byte [rcx], '-'");
-    pr("\tdec rcx");
-
-    pr(".pn_write:");
+    mod.ins(Op::Cmp, reg(Reg::RAX), imm(0));
+    mod.jcc(Cond::NE, loop);
+    mod.ins(Op::Mov, mem(Reg::RCX, 0, Width::Byte), imm('0'));
+    mod.ins(Op::Dec, reg(Reg::RCX));
+    mod.jmp(afterDigits);
+
+    mod.label(loop);
+    mod.ins(Op::Xor, reg(Reg::RDX), reg(Reg::RDX));
+    mod.ins(Op::Div, reg(Reg::RBX)); // rax=quotient, rdx=remainder
+    mod.ins(Op::Add, reg(Reg::RDX, Width::Byte), imm('0'));
+    mod.ins(Op::Mov, mem(Reg::RCX, 0, Width::Byte), reg(Reg::RDX, Width::Byte));
+    mod.ins(Op::Dec, reg(Reg::RCX));
+    mod.ins(Op::Cmp, reg(Reg::RAX), imm(0));
+    mod.jcc(Cond::NE, loop);
+
+    mod.label(afterDigits);
+    mod.ins(Op::Cmp, reg(Reg::R8), imm(1));
+    mod.jcc(Cond::NE, write);
+    mod.ins(Op::Mov, mem(Reg::RCX, 0, Width::Byte), imm('-'));
+    mod.ins(Op::Dec, reg(Reg::RCX));
+
+    mod.label(write);
     // rsi = start pointer
-    pr("\tlea rsi, [rcx+1]");
+    mod.ins(Op::Lea, reg(Reg::RSI), mem(Reg::RCX, 1));
     // rdx = length = (digitSpace+100) - rsi
-    pr("\tlea rdx, [digitSpace+100]");
-    pr("\tsub rdx, rsi");
+    mod.ins(Op::Lea, reg(Reg::RDX), mem(digitSpace, 100));
+    mod.ins(Op::Sub, reg(Reg::RDX), reg(Reg::RSI));
 
-    pr("\tmov rax, 1"); // sys_write
-    pr("\tmov rdi, 1"); // stdout
-    pr("\tsyscall");
+    mod.ins(Op::Mov, reg(Reg::RAX), imm(1)); // sys_write
+    mod.ins(Op::Mov, reg(Reg::RDI), imm(fd));
+    mod.ins(Op::Syscall);
 
-    pr("\tpop rsi");
-    pr("\tpop rdx");
-    pr("\tpop rcx");
-    pr("\tpop rbx");
-    pr("\tret");
+    mod.ins(Op::Pop, reg(Reg::RSI));
+    mod.ins(Op::Pop, reg(Reg::RDX));
+    mod.ins(Op::Pop, reg(Reg::RCX));
+    mod.ins(Op::Pop, reg(Reg::RBX));
+    mod.ins(Op::Ret);
 }
 
 void CodeGenerator::gen_print_string_function() {
-    pr("");
-    pr("_print_string:");
-    pr("\t; rax = address of 0-terminated string");
-    pr("\tpush rbx");
-    pr("\tmov rbx, rax");
-    pr("\txor rdx, rdx"); // len = 0
-    pr(".ps_len_loop:");
-    pr("\tcmp byte [rbx+rdx], 0");
-    pr("\tje .ps_len_done");
-    pr("\tinc rdx");
-    pr("\tjmp .ps_len_loop");
-    pr(".ps_len_done:");
-    pr("\tmov rax, 1"); // sys_write
-    pr("\tmov rdi, 1"); // fd=stdout
-    pr("\tmov rsi, rbx"); // buf
-    pr("\tsyscall");
-    pr("\tpop rbx");
-    pr("\tret");
+    const auto lenLoop = mod.symbol(".ps_len_loop");
+    const auto lenDone = mod.symbol(".ps_len_done");
+
+    // rax = address of 0-terminated string
+    mod.label(mod.symbol("_print_string"));
+    mod.ins(Op::Push, reg(Reg::RBX));
+    mod.ins(Op::Mov, reg(Reg::RBX), reg(Reg::RAX));
+    mod.ins(Op::Xor, reg(Reg::RDX), reg(Reg::RDX)); // len = 0
+    mod.label(lenLoop);
+    mod.ins(Op::Cmp, mem(Reg::RBX, Reg::RDX, 1, Width::Byte), imm(0));
+    mod.jcc(Cond::E, lenDone);
+    mod.ins(Op::Inc, reg(Reg::RDX));
+    mod.jmp(lenLoop);
+    mod.label(lenDone);
+    mod.ins(Op::Mov, reg(Reg::RAX), imm(1)); // sys_write
+    mod.ins(Op::Mov, reg(Reg::RDI), imm(1)); // fd=stdout
+    mod.ins(Op::Mov, reg(Reg::RSI), reg(Reg::RBX)); // buf
+    mod.ins(Op::Syscall);
+    mod.ins(Op::Pop, reg(Reg::RBX));
+    mod.ins(Op::Ret);
+}
+
+// rax = 有符号整数，rdi = 缓冲区末尾（不含）。从后往前写十进制数字，不带换行；
+// 返回 rax = 第一个字符，rdx = 长度。用到 rcx / rsi / r8
+void CodeGenerator::gen_format_num_function() {
+    const auto loop = mod.symbol(".fn_loop");
+    const auto done = mod.symbol(".fn_done");
+    mod.label(mod.symbol("_format_num"));
+    mod.ins(Op::Mov, reg(Reg::RSI), reg(Reg::RDI));
+    mod.ins(Op::Mov, reg(Reg::RCX), imm(10));
+    mod.ins(Op::Mov, reg(Reg::R8), reg(Reg::RAX)); // 保留符号
+    mod.ins(Op::Cmp, reg(Reg::RAX), imm(0));
+    mod.jcc(Cond::GE, loop);
+    mod.ins(Op::Neg, reg(Reg::RAX)); // 按无符号数除，-2^63 也正确
+    mod.label(loop);
+    mod.ins(Op::Xor, reg(Reg::RDX), reg(Reg::RDX));
+    mod.ins(Op::Div, reg(Reg::RCX));
+    mod.ins(Op::Add, reg(Reg::RDX, Width::Byte), imm('0'));
+    mod.ins(Op::Dec, reg(Reg::RSI));
+    mod.ins(Op::Mov, mem(Reg::RSI, 0, Width::Byte), reg(Reg::RDX, Width::Byte));
+    mod.ins(Op::Cmp, reg(Reg::RAX), imm(0));
+    mod.jcc(Cond::NE, loop);
+    mod.ins(Op::Cmp, reg(Reg::R8), imm(0));
+    mod.jcc(Cond::GE, done);
+    mod.ins(Op::Dec, reg(Reg::RSI));
+    mod.ins(Op::Mov, mem(Reg::RSI, 0, Width::Byte), imm('-'));
+    mod.label(done);
+    mod.ins(Op::Mov, reg(Reg::RDX), reg(Reg::RDI));
+    mod.ins(Op::Sub, reg(Reg::RDX), reg(Reg::RSI));
+    mod.ins(Op::Mov, reg(Reg::RAX), reg(Reg::RSI));
+    mod.ins(Op::Ret);
+}
+
+// rax = 以 0 结尾的字符串，返回 rdx = 长度，rax 不变
+void CodeGenerator::gen_str_len_function() {
+    const auto loop = mod.symbol(".sl_loop");
+    const auto done = mod.symbol(".sl_done");
+    mod.label(mod.symbol("_str_len"));
+    mod.ins(Op::Xor, reg(Reg::RDX), reg(Reg::RDX));
+    mod.label(loop);
+    mod.ins(Op::Cmp, mem(Reg::RAX, Reg::RDX, 1, Width::Byte), imm(0));
+    mod.jcc(Cond::E, done);
+    mod.ins(Op::Inc, reg(Reg::RDX));
+    mod.jmp(loop);
+    mod.label(done);
+    mod.ins(Op::Ret);
+}
+
+// -------------------- -Os 的辅助函数 --------------------
+// 地址都在低 2GB（与 [disp32] 寻址同样的前提），指针运算用 32 位寄存器；
+// _print_num / _print_string 求出缓冲区和长度后尾跳转到 _write_stdout，系统调用全程序只有两处
+
+void CodeGenerator::gen_small_helpers() {
+    if (need_print_num) {
+        // rax = 有符号整数；数字由 _format_num 写在 digitSpace 末尾的换行之前
+        mod.label(mod.symbol("_print_num"));
+        mod.ins(Op::Lea, reg(Reg::RDI, Width::Dword), mem(mod.symbol("digitSpace"), 99));
+        mod.ins(Op::Mov, mem(Reg::RDI, 0, Width::Byte), imm(10)); // '\n'
+        mod.call(mod.symbol("_format_num"));
+        mod.ins(Op::Mov, reg(Reg::RSI, Width::Dword), reg(Reg::RAX, Width::Dword));
+        mod.ins(Op::Inc, reg(Reg::RDX, Width::Dword)); // 连同换行
+        mod.jmp(mod.symbol("_write_stdout"));
+    }
+    if (need_print_string) {
+        // rax = 以 0 结尾的字符串
+        mod.label(mod.symbol("_print_string"));
+        mod.call(mod.symbol("_str_len"));
+        mod.ins(Op::Mov, reg(Reg::RSI, Width::Dword), reg(Reg::RAX, Width::Dword));
+        mod.jmp(mod.symbol("_write_stdout"));
+    }
+    if (need_print_num || writeInts > 0) {
+        // 与 gen_format_num_function() 的约定相同
+        const auto loop = mod.symbol(".fn_loop");
+        const auto done = mod.symbol(".fn_done");
+        mod.label(mod.symbol("_format_num"));
+        mod.ins(Op::Mov, reg(Reg::RSI, Width::Dword), reg(Reg::RDI, Width::Dword));
+        sel.load(Reg::RCX, imm(10));
+        mod.ins(Op::Mov, reg(Reg::R8), reg(Reg::RAX)); // 保留符号
+        mod.ins(Op::Test, reg(Reg::RAX), reg(Reg::RAX));
+        mod.jcc(Cond::NS, loop);
+        mod.ins(Op::Neg, reg(Reg::RAX)); // 按无符号数除，-2^63 也正确
+        mod.label(loop);
+        mod.ins(Op::Xor, reg(Reg::RDX, Width::Dword), reg(Reg::RDX, Width::Dword));
+        mod.ins(Op::Div, reg(Reg::RCX));
+        mod.ins(Op::Add, reg(Reg::RDX, Width::Byte), imm('0'));
+        mod.ins(Op::Dec, reg(Reg::RSI, Width::Dword));
+        mod.ins(Op::Mov, mem(Reg::RSI, 0, Width::Byte), reg(Reg::RDX, Width::Byte));
+        mod.ins(Op::Test, reg(Reg::RAX), reg(Reg::RAX));
+        mod.jcc(Cond::NE, loop);
+        mod.ins(Op::Test, reg(Reg::R8), reg(Reg::R8));
+        mod.jcc(Cond::NS, done);
+        mod.ins(Op::Dec, reg(Reg::RSI, Width::Dword));
+        mod.ins(Op::Mov, mem(Reg::RSI, 0, Width::Byte), imm('-'));
+        mod.label(done);
+        mod.ins(Op::Mov, reg(Reg::RDX, Width::Dword), reg(Reg::RDI, Width::Dword));
+        mod.ins(Op::Sub, reg(Reg::RDX, Width::Dword), reg(Reg::RSI, Width::Dword));
+        mod.ins(Op::Mov, reg(Reg::RAX, Width::Dword), reg(Reg::RSI, Width::Dword));
+        mod.ins(Op::Ret);
+    }
+    if (need_print_string || need_str_len) {
+        // 与 gen_str_len_function() 的约定相同；rdx 从 -1 开始，循环里只有一个跳转
+        const auto loop = mod.symbol(".sl_loop");
+        mod.label(mod.symbol("_str_len"));
+        mod.ins(Op::Or, reg(Reg::RDX, Width::Dword), imm(-1));
+        mod.label(loop);
+        mod.ins(Op::Inc, reg(Reg::RDX, Width::Dword));
+        mod.ins(Op::Cmp, mem(Reg::RAX, Reg::RDX, 1, Width::Byte), imm(0));
+        mod.jcc(Cond::NE, loop);
+        mod.ins(Op::Ret);
+    }
+    if (need_print_num || need_print_string || need_write) {
+        // rsi = 缓冲区，rdx = 长度
+        mod.label(mod.symbol("_write_stdout"));
+        sel.load(Reg::RAX, imm(1)); // sys_write
+        mod.ins(Op::Mov, reg(Reg::RDI, Width::Dword), reg(Reg::RAX, Width::Dword)); // stdout
+        mod.ins(Op::Syscall);
+        mod.ins(Op::Ret);
+    }
+    if (need_writev) {
+        // rdx = __iov 里的段数
+        mod.label(mod.symbol("_writev_stdout"));
+        sel.load(Reg::RSI, x86::addr(mod.symbol("__iov")));
+        sel.load(Reg::RAX, imm(20)); // sys_writev
+        sel.load(Reg::RDI, imm(1)); // stdout
+        mod.ins(Op::Syscall);
+        mod.ins(Op::Ret);
+    }
 }
 
 void CodeGenerator::gen_print_newline() {
-    pr("\tmov rax, 1"); // sys_write
-    pr("\tmov rdi, 1"); // stdout
-    pr("\tmov rsi, nl"); // buf
-    pr("\tmov rdx, 1"); // len
-    pr("\tsyscall");
+    if (options.optimizeSize) {
+        sel.load(Reg::RSI, x86::addr(mod.symbol("nl")));
+        sel.load(Reg::RDX, imm(1));
+        mod.call(mod.symbol("_write_stdout"));
+        return;
+    }
+    mod.ins(Op::Mov, reg(Reg::RAX), imm(1)); // sys_write
+    mod.ins(Op::Mov, reg(Reg::RDI), imm(1)); // stdout
+    mod.ins(Op::Mov, reg(Reg::RSI), x86::addr(mod.symbol("nl"))); // buf
+    mod.ins(Op::Mov, reg(Reg::RDX), imm(1)); // len
+    mod.ins(Op::Syscall);
+}
+
+// -------------------- 指令计数插桩 --------------------
+
+static bool ends_block(const Op op) {
+    return op == Op::Jmp || op == Op::Jcc || op == Op::Ret;
+}
+
+static bool writes_flags(const Op op) {
+    switch (op) {
+        case Op::Add:
+        case Op::Sub:
+        case Op::And:
+        case Op::Or:
+        case Op::Xor:
+        case Op::Cmp:
+        case Op::Test:
+        case Op::Imul:
+        case Op::Idiv:
+        case Op::Div:
+        case Op::Neg:
+        case Op::Inc:
+        case Op::Dec:
+        case Op::Call: // 被调函数不保证保留标志位
+        case Op::Popf:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// 基本块以标签开始，以 jmp / jcc / ret 结束；call 总会返回，不切分。
+// 向后跳转的目标即循环头，在它前面插入 align：循环体从 16 字节边界开始，
+// 取指 / 解码按块进行时每次迭代少跨一个边界。填充是 nop，所以只对齐前面是 JMP / RET
+// 的循环头（块布局把循环轮转成"体在前、条件在后"后正是这样），填充永远不会被执行。
+// -g 时循环的名字（loop_line_*）紧挨在循环头前面，align 放在名字之前
+void CodeGenerator::align_loop_headers() {
+    std::unordered_map<x86::SymbolId, std::size_t> position;
+    std::vector<bool> header(mod.text.size(), false);
+    for (std::size_t i = 0; i < mod.text.size(); ++i) {
+        const auto &ins = mod.text[i];
+        if (ins.op == Op::Label)
+            position[ins.target] = i;
+        else if (ins.op == Op::Jmp || ins.op == Op::Jcc)
+            if (const auto it = position.find(ins.target); it != position.end())
+                header[it->second] = true;
+    }
+    std::vector<bool> align(mod.text.size(), false);
+    for (std::size_t i = 0; i < mod.text.size(); ++i) {
+        if (!header[i])
+            continue;
+        std::size_t k = i;
+        while (k > 0 && (mod.text[k - 1].op == Op::Label || mod.text[k - 1].op == Op::Line))
+            --k;
+        if (k == 0 || (mod.text[k - 1].op != Op::Jmp && mod.text[k - 1].op != Op::Ret))
+            continue;
+        k = i;
+        while (k > 0 && mod.text[k - 1].op == Op::Label && loopSymbols.count(mod.text[k - 1].target))
+            --k;
+        align[k] = true;
+    }
+
+    std::vector<x86::Instr> text;
+    text.reserve(mod.text.size());
+    for (std::size_t i = 0; i < mod.text.size(); ++i) {
+        if (align[i]) {
+            x86::Instr a;
+            a.op = Op::Align;
+            a.align = options.loopAlignment;
+            text.push_back(a);
+        }
+        text.push_back(mod.text[i]);
+    }
+    mod.text = std::move(text);
+}
+
+// -------------------- -Os：交叉跳转与块合并 --------------------
+
+// 交叉跳转：落入同一个标签的那一块与以 jmp 到它结尾的各块，跳转之前相同的指令只保留一份，
+// 其它各处删掉这段公共尾部，jmp 改到保留的那份开头（新标签 LT<n>）。
+// 整块相同的块因此只剩下一条 jmp，接着由 bypass_jumps() 绕过并删除。重复到没有变化为止
+void CodeGenerator::merge_tails() {
+    bool changed = true;
+    while (changed) {
+        changed = cross_jump();
+        changed = bypass_jumps() || changed;
+    }
+}
+
+// 可以并进公共尾部的指令：标签（有人跳进来）、对齐与块的出口都不行
+static bool shareable(const x86::Instr &i) {
+    return i.op != Op::Label && i.op != Op::Align && i.op != Op::Jmp && i.op != Op::Ret;
+}
+
+// 跳过紧挨在 p 之前的行号：比较公共尾部时不看它们，-g 不改变生成的代码
+static std::size_t skip_lines(const std::vector<x86::Instr> &text, std::size_t p) {
+    while (p > 0 && text[p - 1].op == Op::Line)
+        --p;
+    return p;
+}
+
+bool CodeGenerator::cross_jump() {
+    auto &text = mod.text;
+    std::unordered_map<x86::SymbolId, std::vector<std::size_t> > jumps; // 目标 -> 各条 jmp 的位置
+    for (std::size_t i = 0; i < text.size(); ++i)
+        if (text[i].op == Op::Jmp)
+            jumps[text[i].target].push_back(i);
+
+    std::vector<bool> dead(text.size(), false);
+    std::vector<x86::SymbolId> entry(text.size() + 1, x86::NoSymbol); // 插在这条指令之前的新标签
+    bool changed = false;
+    for (std::size_t l = 0; l < text.size(); ++l) {
+        if (text[l].op != Op::Label)
+            continue;
+        const auto it = jumps.find(text[l].target);
+        if (it == jumps.end())
+            continue;
+        const auto &sites = it->second;
+        // 保留的那份：落入这个标签的块，没有时是第一条 jmp 所在的块
+        std::size_t keep = l, first = 0;
+        if (const auto before = skip_lines(text, l); before == 0 || !shareable(text[before - 1]))
+            keep = sites[first++];
+        for (auto k = first; k < sites.size(); ++k) {
+            const auto j = sites[k];
+            auto a = j, b = keep; // 公共尾部在两边的开头
+            for (;;) {
+                const auto pa = skip_lines(text, a), pb = skip_lines(text, b);
+                if (pa == 0 || pb == 0 || !shareable(text[pa - 1]) || !shareable(text[pb - 1]) ||
+                    !(text[pa - 1] == text[pb - 1]) || dead[pa - 1] || dead[pb - 1])
+                    break;
+                a = pa - 1;
+                b = pb - 1;
+            }
+            if (a == j)
+                continue;
+            for (auto m = a; m < j; ++m)
+                dead[m] = true;
+            auto &label = entry[b];
+            if (label == x86::NoSymbol)
+                label = mod.symbol("LT" + std::to_string(tailLabels++));
+            text[j].target = label;
+            changed = true;
+        }
+    }
+    if (!changed)
+        return false;
+
+    std::vector<x86::Instr> out;
+    out.reserve(text.size());
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        if (entry[i] != x86::NoSymbol) {
+            x86::Instr label;
+            label.op = Op::Label;
+            label.target = entry[i];
+            out.push_back(label);
+        }
+        if (!dead[i])
+            out.push_back(text[i]);
+    }
+    text = std::move(out);
+    return true;
+}
+
+// 只有一条 jmp 的块：跳到它的 jmp / jcc 直接改到最终目标；不会被落入、也不再被引用的这种块删除。
+// 紧跟着目标标签的 jmp 也删除
+bool CodeGenerator::bypass_jumps() {
+    auto &text = mod.text;
+    std::unordered_map<x86::SymbolId, x86::SymbolId> forward; // 标签 -> 它后面那条 jmp 的目标
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        if (text[i].op != Op::Label)
+            continue;
+        auto k = i;
+        while (k < text.size() && (text[k].op == Op::Label || text[k].op == Op::Line))
+            ++k;
+        if (k < text.size() && text[k].op == Op::Jmp && text[k].target != text[i].target)
+            forward[text[i].target] = text[k].target;
+    }
+    auto resolve = [&forward](x86::SymbolId t) {
+        for (std::size_t hops = 0; hops <= forward.size(); ++hops) { // 跳转成环时停下
+            const auto it = forward.find(t);
+            if (it == forward.end())
+                break;
+            t = it->second;
+        }
+        return t;
+    };
+
+    bool changed = false;
+    std::unordered_set<x86::SymbolId> referenced(mod.globals.begin(), mod.globals.end());
+    for (auto &i: text) {
+        if (i.op == Op::Jmp || i.op == Op::Jcc) {
+            if (const auto t = resolve(i.target); t != i.target) {
+                i.target = t;
+                changed = true;
+            }
+        }
+        if (i.op == Op::Jmp || i.op == Op::Jcc || i.op == Op::Call)
+            referenced.insert(i.target);
+        referenced.insert(i.dst.sym);
+        referenced.insert(i.src.sym);
+    }
+
+    std::vector<x86::Instr> out;
+    out.reserve(text.size());
+    std::size_t i = 0;
+    while (i < text.size()) {
+        if (text[i].op == Op::Jmp) {
+            // jmp 后面紧跟着的标签里有它的目标
+            auto k = i + 1;
+            bool next = false;
+            for (; k < text.size() && (text[k].op == Op::Label || text[k].op == Op::Line); ++k)
+                next = next || (text[k].op == Op::Label && text[k].target == text[i].target);
+            if (next) {
+                changed = true;
+                ++i;
+                continue;
+            }
+        }
+        if (const auto last = skip_lines(out, out.size());
+            text[i].op == Op::Label && last > 0 && (out[last - 1].op == Op::Jmp || out[last - 1].op == Op::Ret)) {
+            auto k = i;
+            bool used = false;
+            for (; k < text.size() && (text[k].op == Op::Label || text[k].op == Op::Line); ++k)
+                used = used || (text[k].op == Op::Label && referenced.count(text[k].target));
+            if (!used && k < text.size() && text[k].op == Op::Jmp) {
+                changed = true;
+                i = k + 1;
+                continue;
+            }
+        }
+        out.push_back(text[i++]);
+    }
+    text = std::move(out);
+    return changed;
+}
+
+// 按字段名构造一条指令（不经过 mod.ins()，插进已经生成好的指令序列里）
+static x86::Instr make_instr(const Op op, const x86::Operand &dst = {}, const x86::Operand &src = {}) {
+    x86::Instr i;
+    i.op = op;
+    i.dst = dst;
+    i.src = src;
+    return i;
+}
+
+// 在每个块开头插入 add qword [__insn_count], <块内指令数>。
+// add 会改写标志位：块内在第一条写标志位的指令之前就有 jcc 时（标志位从上一块流入），
+// 用 pushfq / popfq 包起来（cmov 同样读标志位）。_report_insns / _write_profile 的调用本身不计入。
+void CodeGenerator::instrument_instruction_count() {
+    const auto counter = mod.symbol("__insn_count");
+    const auto report = mod.symbol("_report_insns");
+    const auto writeProfile = mod.symbol("_write_profile");
+    std::vector<x86::Instr> out;
+    out.reserve(mod.text.size() * 2);
+
+    std::size_t i = 0;
+    while (i < mod.text.size()) {
+        // 标签、对齐与行号原样保留，计数放在它们之后
+        while (i < mod.text.size() && x86::pseudo(mod.text[i].op))
+            out.push_back(mod.text[i++]);
+        std::size_t end = i;
+        std::int64_t count = 0;
+        bool flagsLive = false, flagsKnown = false;
+        while (end < mod.text.size() && mod.text[end].op != Op::Label && mod.text[end].op != Op::Align) {
+            const auto &ins = mod.text[end++];
+            if (ins.op != Op::Line && !(ins.op == Op::Call && (ins.target == report || ins.target == writeProfile)))
+                ++count;
+            if (!flagsKnown && (ins.op == Op::Jcc || ins.op == Op::Cmov))
+                flagsLive = flagsKnown = true;
+            else if (writes_flags(ins.op))
+                flagsKnown = true;
+            if (ends_block(ins.op))
+                break;
+        }
+        if (count > 0) {
+            if (flagsLive)
+                out.push_back(make_instr(Op::Pushf));
+            out.push_back(make_instr(Op::Add, mem(counter), imm(count)));
+            if (flagsLive)
+                out.push_back(make_instr(Op::Popf));
+        }
+        out.insert(out.end(), mod.text.begin() + static_cast<std::ptrdiff_t>(i),
+                   mod.text.begin() + static_cast<std::ptrdiff_t>(end));
+        i = end;
+    }
+    mod.text = std::move(out);
+}
+
+// _report_insns：把计数器打印到 stderr，由 gen_end() 在退出前调用；自身不插桩
+void CodeGenerator::gen_report_function() {
+    mod.label(mod.symbol("_report_insns"));
+    mod.ins(Op::Mov, reg(Reg::RAX), mem(mod.symbol("__insn_count")));
+    // 落入下面的 _print_num_stderr
+    gen_print_num_function("_print_num_stderr", 2, ".pe_");
+}
+
+// -------------------- PGO 插桩 --------------------
+
+// 计数器放在 .data 的最前面（8 字节对齐），文件头之后
+void CodeGenerator::gen_profile_increment(const std::size_t counter) {
+    mod.ins(Op::Add, mem(mod.symbol("__profile"), static_cast<std::int64_t>(kProfileHeaderSize + 8 * counter)),
+            imm(1));
+}
+
+// 方向与上一次不同时 counter + 1 处的计数加一：flips += last ^ taken; last = taken。
+// 只在 IR 基本块边界上使用，此时没有活跃的寄存器，rax 可以随便用
+void CodeGenerator::gen_profile_direction(const std::size_t counter, const std::size_t branch, const bool taken) {
+    const auto last = mem(mod.symbol("__pgo_last"), static_cast<std::int64_t>(8 * branch));
+    mod.ins(Op::Mov, reg(Reg::RAX), last);
+    if (taken)
+        mod.ins(Op::Xor, reg(Reg::RAX), imm(1));
+    mod.ins(Op::Add, mem(mod.symbol("__profile"), static_cast<std::int64_t>(kProfileHeaderSize + 8 * (counter + 1))),
+            reg(Reg::RAX));
+    mod.ins(Op::Mov, last, imm(taken ? 1 : 0));
+}
+
+void CodeGenerator::gen_profile_stubs() {
+    for (auto &e: edgeStubs) {
+        mod.label(e.stub);
+        gen_profile_increment(e.counter);
+        gen_profile_direction(e.counter, e.branch, true);
+        mod.jmp(e.target);
+    }
+    if (profileBranches > 0)
+        mod.bss.push_back({mod.symbol("__pgo_last"), static_cast<std::uint32_t>(8 * profileBranches)});
+    mod.data.insert(mod.data.begin(), x86::DataItem{
+                        mod.symbol("__profile"),
+                        profile_header(options.profileChecksum, profileCounters) +
+                        std::string(8 * profileCounters, '\0')
+                    });
+    mod.rodata.push_back({mod.symbol("__profile_path"), options.profilePath + '\0'});
+}
+
+// _write_profile：open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)，把文件头和计数器一次写出
+void CodeGenerator::gen_write_profile_function() {
+    const auto done = mod.symbol(".wp_done");
+    mod.label(mod.symbol("_write_profile"));
+    mod.ins(Op::Mov, reg(Reg::RAX), imm(2)); // sys_open
+    mod.ins(Op::Mov, reg(Reg::RDI), x86::addr(mod.symbol("__profile_path")));
+    mod.ins(Op::Mov, reg(Reg::RSI), imm(01 | 0100 | 01000));
+    mod.ins(Op::Mov, reg(Reg::RDX), imm(0644));
+    mod.ins(Op::Syscall);
+    mod.ins(Op::Cmp, reg(Reg::RAX), imm(0));
+    mod.jcc(Cond::L, done); // 打不开就放弃，不影响程序的退出码
+    mod.ins(Op::Mov, reg(Reg::RDI), reg(Reg::RAX));
+    mod.ins(Op::Mov, reg(Reg::RAX), imm(1)); // sys_write
+    mod.ins(Op::Mov, reg(Reg::RSI), x86::addr(mod.symbol("__profile")));
+    mod.ins(Op::Mov, reg(Reg::RDX), imm(static_cast<std::int64_t>(kProfileHeaderSize + 8 * profileCounters)));
+    mod.ins(Op::Syscall);
+    mod.ins(Op::Mov, reg(Reg::RAX), imm(3)); // sys_close，rdi 仍是 fd
+    mod.ins(Op::Syscall);
+    mod.label(done);
+    mod.ins(Op::Ret);
 }
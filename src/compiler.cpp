@@ -0,0 +1,584 @@
+#include "compiler.hpp"
+#include "cache.hpp"
+#include "codegen.hpp"
+#include "frontend.hpp"
+#include "inline.hpp"
+#include "irfile.hpp"
+#include "pgo.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(const Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static std::size_t count_nodes(const std::shared_ptr<Node> &n) {
+    if (!n)
+        return 0;
+    if (dynamic_cast<const Statement *>(n.get())) {
+        // 语句序列是很深的左链，沿左链迭代
+        std::size_t total = 0;
+        const Node *cur = n.get();
+        std::shared_ptr<Node> bottom = n;
+        while (const auto *st = dynamic_cast<const Statement *>(cur)) {
+            total += 1 + count_nodes(st->right);
+            bottom = st->left;
+            cur = bottom.get();
+        }
+        return total + count_nodes(bottom);
+    }
+    if (const auto bin = std::dynamic_pointer_cast<BinOpNode>(n))
+        return 1 + count_nodes(bin->left) + count_nodes(bin->right);
+    if (const auto c = std::dynamic_pointer_cast<Condition>(n))
+        return 1 + count_nodes(c->left_expression) + count_nodes(c->right_expression) + count_nodes(c->lhs) +
+               count_nodes(c->rhs);
+    if (const auto i = std::dynamic_pointer_cast<IfStatement>(n))
+        return 1 + count_nodes(i->if_condition) + count_nodes(i->if_body) + count_nodes(i->else_body);
+    if (const auto w = std::dynamic_pointer_cast<WhileStatement>(n))
+        return 1 + count_nodes(w->condition) + count_nodes(w->body);
+    if (const auto p = std::dynamic_pointer_cast<PrintStatement>(n))
+        return 1 + count_nodes(p->intExpr);
+    if (const auto a = std::dynamic_pointer_cast<Assignment>(n))
+        return 1 + count_nodes(a->index) + count_nodes(a->expression);
+    if (const auto x = std::dynamic_pointer_cast<IndexNode>(n))
+        return 1 + count_nodes(x->index);
+    if (const auto call = std::dynamic_pointer_cast<CallNode>(n)) {
+        std::size_t total = 1;
+        for (auto &a: call->args)
+            total += count_nodes(a);
+        return total;
+    }
+    if (const auto r = std::dynamic_pointer_cast<ReturnStatement>(n))
+        return 1 + count_nodes(r->value);
+    if (const auto p = std::dynamic_pointer_cast<ProcedureNode>(n))
+        return 1 + count_nodes(p->body);
+    return 1; // 叶子：数字、标识符、字符串、声明
+}
+
+std::vector<std::string> pass_pipeline(const int optLevel) {
+    std::vector<std::string> names;
+    if (optLevel > 0) {
+        for (auto &pass: optimization_passes())
+            names.emplace_back(pass.name);
+        names.emplace_back("fuse_prints");
+    }
+    return names;
+}
+
+std::vector<std::string> pass_names() {
+    std::vector<std::string> names;
+    for (auto &name: pass_pipeline(1))
+        if (std::find(names.begin(), names.end(), name) == names.end())
+            names.push_back(name);
+    return names;
+}
+
+// fuse_prints 要新增字符串常量，不是 IRPass，按名字单独处理
+static void run_pass(GeneratedIR &gen, const std::string &name) {
+    if (name == "fuse_prints") {
+        fuse_prints(gen);
+        return;
+    }
+    auto &passes = optimization_passes();
+    const auto it = std::find_if(passes.begin(), passes.end(),
+                                 [&name](const IRPass &p) { return name == p.name; });
+    if (it == passes.end())
+        throw std::runtime_error("unknown pass: " + name);
+    gen.code = it->run(gen.code);
+}
+
+// -O 级别决定的代码生成选项。循环头对齐的填充只会让代码变长，-Os 不做
+CodegenOptions codegen_options(const Options &options) {
+    CodegenOptions cgOptions;
+    cgOptions.optimizeSize = options.optimizeSize;
+    cgOptions.debugLines = options.debugInfo;
+    cgOptions.sourceName = options.sourceName;
+    cgOptions.simd = options.simd;
+    if (options.optLevel > 0 && !options.optimizeSize)
+        cgOptions.loopAlignment = 16;
+    return cgOptions;
+}
+
+// 前端之后的公共部分：pass 流水线、PGO、代码生成（或者写出 IR）
+// asmSink 非空时汇编文本边生成边交给它，不放进 Result::assembly
+static void compile_backend(GeneratedIR gen, const std::vector<std::string> &passes,
+                            const Options &options, Result &result, const AsmSink *asmSink = nullptr) {
+    CompileStats &stats = result.stats;
+    for (auto &name: passes) {
+        const auto start = Clock::now();
+        // -Os 的内联只在不变长时进行（见 inline.hpp）
+        if (options.optimizeSize && name == "inline_procedures")
+            gen.code = inline_procedures(gen.code, true);
+        else
+            run_pass(gen, name);
+        if (options.stats)
+            stats.add_phase("pass:" + name, seconds_since(start));
+    }
+
+    // PGO：插桩和使用 profile 的两次编译都先给每个基本块加上标签，计数器按标签编号
+    if (!options.instrument.empty() && !options.profileUse.empty())
+        throw std::runtime_error("--instrument and --profile-use cannot be combined");
+    if (!options.instrument.empty() && options.emit == EmitKind::IR)
+        throw std::runtime_error("--instrument requires --emit=asm, obj or exe");
+    if (!options.instrument.empty() || !options.profileUse.empty())
+        gen.code = label_blocks(gen.code);
+    if (!options.profileUse.empty()) {
+        auto start = Clock::now();
+        auto profile = load_profile(options.profileUse, gen.code);
+        auto blocks = split_blocks(gen.code);
+        if (options.stats)
+            stats.add_phase("pgo:load_profile", seconds_since(start));
+        for (auto &pass: profile_passes()) {
+            // 循环展开用长度换速度，-Os 不做
+            if (options.optimizeSize && std::string_view(pass.name) == "unroll_loops")
+                continue;
+            start = Clock::now();
+            pass.run(blocks, profile, gen.identifiers);
+            if (options.stats)
+                stats.add_phase(std::string("pgo:") + pass.name, seconds_since(start));
+        }
+        gen.code = join_blocks(blocks);
+    }
+    if (options.stats)
+        stats.irAfter = gen.code.code.size();
+
+    const auto start = Clock::now();
+    if (options.emit == EmitKind::IR) {
+        result.binary = irfile::serialize(gen);
+        if (options.stats)
+            stats.add_phase("write_ir", seconds_since(start));
+    } else {
+        auto cgOptions = codegen_options(options);
+        cgOptions.countInstructions = options.countInstructions;
+        if (!options.instrument.empty()) {
+            cgOptions.profilePath = options.instrument;
+            cgOptions.profileChecksum = ir_checksum(gen.code);
+        }
+        CodeGenerator codegen(gen.code, gen.identifiers, gen.constants, {}, cgOptions);
+        double written = 0; // 交给 asmSink 的耗时，记为 write，不算在 codegen 里
+        switch (options.emit) {
+            case EmitKind::Asm:
+                if (asmSink) {
+                    codegen.assembly([asmSink, &written](const std::string_view text) {
+                        const auto t = Clock::now();
+                        (*asmSink)(text);
+                        written += seconds_since(t);
+                    });
+                } else {
+                    result.assembly = codegen.assembly();
+                }
+                break;
+            case EmitKind::Object:
+                result.binary = codegen.object();
+                break;
+            case EmitKind::Executable:
+                result.binary = codegen.executable();
+                break;
+            case EmitKind::IR:
+                break;
+        }
+        if (options.stats) {
+            stats.add_phase("codegen", seconds_since(start) - written);
+            if (asmSink)
+                stats.add_phase("write", written);
+            stats.machineInstrs = codegen.instruction_count();
+            const auto sizes = codegen.section_sizes();
+            stats.textBytes = sizes.text;
+            stats.dataBytes = sizes.data;
+            stats.bssBytes = sizes.bss;
+        }
+    }
+
+    if (options.keepIr)
+        result.ir = std::move(gen);
+    result.ok = true;
+}
+
+// 错误处理与分配统计，两个入口共用
+template<typename Body>
+static Result run_compile(const Options &options, Body body) {
+    Result result;
+    CompileStats &stats = result.stats;
+    const auto allocStart = thread_alloc_counters();
+    try {
+        body(result);
+    } catch (const std::exception &e) {
+        result.ok = false;
+        result.error = e.what();
+    }
+    if (options.stats) {
+        const auto allocEnd = thread_alloc_counters();
+        stats.files = 1;
+        stats.allocations += allocEnd.count - allocStart.count;
+        stats.allocatedBytes += allocEnd.bytes - allocStart.bytes;
+        stats.peakRssKb = peak_rss_kb();
+    }
+    return result;
+}
+
+static Result compile_uncached(SourceInput &input, const Options &options, const AsmSink *asmSink) {
+    return run_compile(options, [&input, &options, asmSink](Result &result) {
+        CompileStats &stats = result.stats;
+        auto start = Clock::now();
+        auto program = parse_program(input, options.stats);
+        if (options.stats) {
+            // 扫描与语法分析交替进行，扫描器的耗时在取 token 时单独累计
+            stats.add_phase("scan", program.scanSeconds);
+            stats.add_phase("parse", seconds_since(start) - program.scanSeconds);
+            stats.tokens = program.tokens;
+            stats.astNodes = count_nodes(program.root);
+        }
+
+        start = Clock::now();
+        IntermediateCodeGen irgen(program.root);
+        auto gen = irgen.raw();
+        if (options.stats) {
+            stats.add_phase("irgen", seconds_since(start));
+            stats.irBefore = gen.code.code.size();
+        }
+
+        if (options.keepAst) {
+            result.ast = program.root;
+            result.strings = program.strings;
+        }
+        compile_backend(std::move(gen), pass_pipeline(options.optLevel), options, result, asmSink);
+    });
+}
+
+Result compile_ir(GeneratedIR ir, const std::vector<std::string> &passes, const Options &options) {
+    return run_compile(options, [&ir, &passes, &options](Result &result) {
+        if (options.stats)
+            result.stats.irBefore = ir.code.code.size();
+        compile_backend(std::move(ir), passes, options, result);
+    });
+}
+
+// 区域切分的粒度：先按固定条数把顶层语句分块，再把相邻的块合并成至少 kRegionNodes 个 AST 节点的区域
+// （最后一个除外）。两者都只看 AST，切分结果与线程数无关
+constexpr std::size_t kChunkStatements = 64;
+constexpr std::size_t kRegionNodes = 4096;
+
+// threads == 1 时直接在当前线程上按顺序执行
+template<typename Fn>
+static void parallel_for(std::unique_ptr<ThreadPool> &pool, const std::size_t n, Fn fn) {
+    if (!pool) {
+        for (std::size_t i = 0; i < n; ++i)
+            fn(i);
+        return;
+    }
+    for (std::size_t i = 0; i < n; ++i)
+        pool->submit([&fn, i] { fn(i); });
+    pool->wait();
+}
+
+// Options::regions：解析之后把顶层语句按顺序切成区域，每个区域在线程池上独立完成
+// IR 生成、local_passes() 和代码生成（名字带区域前缀 r<i>_，互不冲突），最后按区域顺序拼接
+static Result compile_regions(SourceInput &input, const Options &options, const AsmSink *asmSink) {
+    return run_compile(options, [&input, &options, asmSink](Result &result) {
+        if (options.emit != EmitKind::Asm)
+            throw std::runtime_error("--regions only supports --emit=asm");
+        if (!options.instrument.empty() || !options.profileUse.empty() || options.countInstructions)
+            throw std::runtime_error("--regions cannot be combined with instrumentation or PGO");
+        if (options.debugInfo)
+            throw std::runtime_error("--regions cannot be combined with -g");
+
+        CompileStats &stats = result.stats;
+        auto start = Clock::now();
+        auto program = parse_program(input, options.stats);
+        if (options.stats) {
+            stats.add_phase("scan", program.scanSeconds);
+            stats.add_phase("parse", seconds_since(start) - program.scanSeconds);
+            stats.tokens = program.tokens;
+        }
+
+        // 各块的节点数和声明并行统计；同一块内后面的声明覆盖前面的，按块的顺序合并即与顺序执行相同
+        start = Clock::now();
+        const auto statements = statement_list(program.root);
+        struct Chunk {
+            std::size_t nodes = 0;
+            std::unordered_map<std::string, std::string> declarations;
+        };
+        std::vector<Chunk> chunks((statements.size() + kChunkStatements - 1) / kChunkStatements);
+
+        // 区域不会比块多，线程数不超过块数
+        std::unique_ptr<ThreadPool> pool;
+        const unsigned hardware = options.threads ? options.threads : std::thread::hardware_concurrency();
+        if (options.threads != 1 && chunks.size() > 1)
+            pool = std::make_unique<ThreadPool>(static_cast<unsigned>(std::min<std::size_t>(hardware, chunks.size())));
+        const auto caller = std::this_thread::get_id();
+        parallel_for(pool, chunks.size(), [&](const std::size_t c) {
+            const auto end = std::min(statements.size(), (c + 1) * kChunkStatements);
+            for (std::size_t i = c * kChunkStatements; i < end; ++i) {
+                chunks[c].nodes += count_nodes(statements[i]);
+                record_declarations(statements[i], chunks[c].declarations);
+            }
+        });
+
+        struct Region {
+            std::size_t first = 0, last = 0; // statements[first, last)
+            std::unordered_map<std::string, std::string> identifiers; // 区域开始时已声明的变量
+            std::unique_ptr<CodeGenerator> codegen;
+            std::string text;
+            std::vector<std::string> variables;
+            std::string error;
+            CompileStats stats;
+        };
+        std::vector<Region> regions;
+        std::unordered_map<std::string, std::string> declared;
+        std::size_t nodes = kRegionNodes;
+        for (std::size_t c = 0; c < chunks.size(); ++c) {
+            if (nodes >= kRegionNodes) {
+                regions.emplace_back();
+                regions.back().first = c * kChunkStatements;
+                regions.back().identifiers = declared;
+                nodes = 0;
+            }
+            nodes += chunks[c].nodes;
+            regions.back().last = std::min(statements.size(), (c + 1) * kChunkStatements);
+            for (auto &[name, type]: chunks[c].declarations)
+                declared[name] = type;
+            if (options.stats)
+                stats.astNodes += chunks[c].nodes;
+        }
+        chunks.clear();
+        if (options.stats)
+            stats.add_phase("regions", seconds_since(start));
+
+        const auto cgOptions = codegen_options(options);
+        parallel_for(pool, regions.size(), [&](const std::size_t index) {
+            Region &r = regions[index];
+            CompileStats &rs = r.stats;
+            const auto allocStart = thread_alloc_counters();
+            auto timed = [&](const std::string &phase, auto &&body) {
+                const auto t = Clock::now();
+                body();
+                if (options.stats)
+                    rs.add_phase(phase, seconds_since(t));
+            };
+            try {
+                GeneratedIR gen;
+                timed("irgen", [&] {
+                    const std::vector<std::shared_ptr<Node> > part(statements.begin() + r.first,
+                                                                  statements.begin() + r.last);
+                    IntermediateCodeGen irgen(part, std::move(r.identifiers), "r" + std::to_string(index) + "_");
+                    gen = irgen.raw();
+                });
+                rs.irBefore = gen.code.code.size();
+                if (options.optLevel > 0)
+                    for (auto &pass: local_passes())
+                        timed(std::string("pass:") + pass.name, [&] { gen.code = pass.run(gen.code); });
+                rs.irAfter = gen.code.code.size();
+                timed("codegen", [&] {
+                    r.codegen = std::make_unique<CodeGenerator>(cgOptions);
+                    x86::NasmWriter out([&r](const std::string_view text) { r.text.append(text); });
+                    r.codegen->stream_chunk(gen.code, gen.constants, gen.arrays, out, &r.variables);
+                    out.flush();
+                });
+            } catch (const std::exception &e) {
+                r.error = e.what();
+            }
+            // 在调用线程上执行的区域已经计入 run_compile() 的分配统计
+            if (std::this_thread::get_id() != caller) {
+                const auto allocEnd = thread_alloc_counters();
+                rs.allocations = allocEnd.count - allocStart.count;
+                rs.allocatedBytes = allocEnd.bytes - allocStart.bytes;
+            }
+        });
+
+        // 按区域顺序报告第一个错误，与线程的调度无关
+        for (auto &r: regions)
+            if (!r.error.empty())
+                throw std::runtime_error(r.error);
+
+        start = Clock::now();
+        double written = 0;
+        x86::NasmWriter out([&](const std::string_view text) {
+            const auto t = Clock::now();
+            if (asmSink)
+                (*asmSink)(text);
+            else
+                result.assembly.append(text);
+            written += seconds_since(t);
+        });
+        CodeGenerator codegen(cgOptions);
+        codegen.stream_begin(out);
+        std::vector<std::string> variables;
+        for (auto &r: regions) {
+            codegen.merge(*r.codegen);
+            out.append(r.text);
+            variables.insert(variables.end(), r.variables.begin(), r.variables.end());
+            r.codegen.reset();
+            std::string().swap(r.text);
+        }
+        codegen.stream_end(out, variables);
+        out.flush();
+        if (options.stats) {
+            for (auto &r: regions)
+                stats.merge(r.stats);
+            stats.add_phase("codegen", seconds_since(start) - written);
+            stats.add_phase("write", written);
+            stats.machineInstrs = codegen.instruction_count();
+        }
+        if (options.keepAst) {
+            result.ast = program.root;
+            result.strings = program.strings;
+        }
+        result.ok = true;
+    });
+}
+
+// 缓存的值就是 Result::assembly / Result::binary 的字节
+static std::vector<std::uint8_t> output_bytes(const Result &result, const EmitKind emit) {
+    if (emit == EmitKind::Asm)
+        return {result.assembly.begin(), result.assembly.end()};
+    return result.binary;
+}
+
+Result compile_stream(SourceInput &input, const Options &options, const AsmSink &sink) {
+    return run_compile(options, [&](Result &result) {
+        if (options.emit != EmitKind::Asm)
+            throw std::runtime_error("--stream only supports --emit=asm");
+        if (!options.instrument.empty() || !options.profileUse.empty() || options.countInstructions)
+            throw std::runtime_error("--stream cannot be combined with instrumentation or PGO");
+
+        CompileStats &stats = result.stats;
+        const auto cgOptions = codegen_options(options);
+        CodeGenerator codegen(cgOptions);
+        IntermediateCodeGen irgen(nullptr);
+
+        // 文本攒满一块才交给 sink；sink 的耗时记为 write，从调用它的 codegen 中扣除
+        double written = 0;
+        x86::NasmWriter out([&sink, &written](const std::string_view text) {
+            const auto t = Clock::now();
+            sink(text);
+            written += seconds_since(t);
+        });
+        codegen.stream_begin(out);
+
+        double inner = 0; // 回调里各阶段的耗时，从解析的总耗时中扣除
+        auto timed = [&](const std::string &phase, auto &&work) {
+            const auto start = Clock::now();
+            const double writtenBefore = written;
+            work();
+            if (options.stats) {
+                const double s = seconds_since(start) - (written - writtenBefore);
+                stats.add_phase(phase, s);
+                inner += s;
+            }
+        };
+        const auto start = Clock::now();
+        const double writtenBefore = written;
+        const auto program = parse_statements(input, [&](const std::shared_ptr<Node> &statement) {
+            GeneratedIR gen;
+            timed("irgen", [&] { gen = irgen.take_statement(statement); });
+            if (options.stats) {
+                stats.astNodes += count_nodes(statement);
+                stats.irBefore += gen.code.code.size();
+            }
+            if (options.optLevel > 0)
+                for (auto &pass: local_passes())
+                    timed(std::string("pass:") + pass.name, [&] { gen.code = pass.run(gen.code); });
+            if (options.stats)
+                stats.irAfter += gen.code.code.size();
+            timed("codegen", [&] { codegen.stream_chunk(gen.code, gen.constants, gen.arrays, out); });
+        }, options.stats);
+        const double parseWritten = written - writtenBefore;
+        timed("codegen", [&] {
+            codegen.stream_end(out);
+            out.flush();
+        });
+        if (options.stats) {
+            stats.add_phase("write", written);
+            stats.add_phase("scan", program.scanSeconds);
+            stats.add_phase("parse", seconds_since(start) - program.scanSeconds - inner - parseWritten);
+            stats.tokens = program.tokens;
+            stats.machineInstrs = codegen.instruction_count();
+        }
+        result.ok = true;
+    });
+}
+
+// asmSink 为空时汇编文本放进 Result::assembly
+static Result compile_to(SourceInput &input, const Options &options, const AsmSink *asmSink) {
+    if (options.stream) {
+        if (asmSink)
+            return compile_stream(input, options, *asmSink);
+        std::string assembly;
+        auto result = compile_stream(input, options, [&assembly](const std::string_view text) { assembly.append(text); });
+        result.assembly = std::move(assembly);
+        return result;
+    }
+    // 缓存需要完整的输出字节，查缓存时不边生成边输出
+    const auto uncached = [&input, &options](const AsmSink *sink) {
+        return options.regions ? compile_regions(input, options, sink) : compile_uncached(input, options, sink);
+    };
+    if (!options.cache || input.streaming() || options.keepAst || options.keepIr)
+        return uncached(asmSink);
+
+    // 命中或编译完成之后，Asm 输出再整块交给 asmSink
+    const auto deliver = [asmSink, &options](Result &result) {
+        if (asmSink && result.ok && options.emit == EmitKind::Asm) {
+            (*asmSink)(result.assembly);
+            std::string().swap(result.assembly);
+        }
+    };
+    auto start = Clock::now();
+    std::string key;
+    try {
+        key = CompileCache::key(input.text(), options);
+    } catch (const std::exception &e) {
+        Result result;
+        result.error = e.what();
+        return result;
+    }
+    if (auto hit = options.cache->lookup(key)) {
+        Result result;
+        if (options.emit == EmitKind::Asm)
+            result.assembly.assign(hit->begin(), hit->end());
+        else
+            result.binary = std::move(*hit);
+        result.ok = true;
+        if (options.stats) {
+            result.stats.add_phase("cache:lookup", seconds_since(start));
+            result.stats.files = 1;
+            result.stats.cacheHits = 1;
+            result.stats.peakRssKb = peak_rss_kb();
+        }
+        deliver(result);
+        return result;
+    }
+    const double lookupSeconds = seconds_since(start);
+
+    auto result = uncached(nullptr);
+    if (result.ok) {
+        start = Clock::now();
+        options.cache->store(key, output_bytes(result, options.emit));
+        if (options.stats)
+            result.stats.add_phase("cache:store", seconds_since(start));
+    }
+    if (options.stats) {
+        result.stats.add_phase("cache:lookup", lookupSeconds);
+        result.stats.cacheMisses = 1;
+    }
+    deliver(result);
+    return result;
+}
+
+Result compile(SourceInput &input, const Options &options) {
+    return compile_to(input, options, nullptr);
+}
+
+Result compile(SourceInput &input, const Options &options, const AsmSink &asmSink) {
+    return compile_to(input, options, &asmSink);
+}
+
+Result compile(const std::string_view source, const Options &options) {
+    auto input = SourceInput::from_string(source);
+    return compile(input, options);
+}
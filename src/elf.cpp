@@ -0,0 +1,523 @@
+#include "elf.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+
+namespace elf {
+namespace {
+
+// ---- 规范里的常量（只列出用到的） ----
+constexpr std::uint16_t ET_REL = 1;
+constexpr std::uint16_t ET_EXEC = 2;
+constexpr std::uint16_t EM_X86_64 = 62;
+
+constexpr std::uint32_t SHT_PROGBITS = 1;
+constexpr std::uint32_t SHT_SYMTAB = 2;
+constexpr std::uint32_t SHT_STRTAB = 3;
+constexpr std::uint32_t SHT_RELA = 4;
+constexpr std::uint32_t SHT_NOBITS = 8;
+
+constexpr std::uint64_t SHF_WRITE = 1;
+constexpr std::uint64_t SHF_ALLOC = 2;
+constexpr std::uint64_t SHF_EXECINSTR = 4;
+constexpr std::uint64_t SHF_INFO_LINK = 0x40;
+
+constexpr std::uint32_t PT_LOAD = 1;
+constexpr std::uint32_t PF_X = 1;
+constexpr std::uint32_t PF_W = 2;
+constexpr std::uint32_t PF_R = 4;
+
+constexpr std::uint8_t STB_LOCAL = 0;
+constexpr std::uint8_t STB_GLOBAL = 1;
+constexpr std::uint8_t STT_NOTYPE = 0;
+constexpr std::uint8_t STT_SECTION = 3;
+
+constexpr std::uint32_t R_X86_64_64 = 1;
+constexpr std::uint32_t R_X86_64_32 = 10;
+constexpr std::uint32_t R_X86_64_32S = 11;
+
+// DWARF 4（只列出用到的）
+constexpr std::uint8_t DW_TAG_compile_unit = 0x11;
+constexpr std::uint8_t DW_CHILDREN_no = 0;
+constexpr std::uint8_t DW_AT_name = 0x03, DW_AT_stmt_list = 0x10, DW_AT_low_pc = 0x11, DW_AT_high_pc = 0x12,
+                       DW_AT_producer = 0x25;
+constexpr std::uint8_t DW_FORM_addr = 0x01, DW_FORM_data8 = 0x07, DW_FORM_string = 0x08,
+                       DW_FORM_sec_offset = 0x17;
+constexpr std::uint8_t DW_LNS_copy = 1, DW_LNS_advance_pc = 2, DW_LNS_advance_line = 3;
+constexpr std::uint8_t DW_LNE_end_sequence = 1, DW_LNE_set_address = 2;
+
+constexpr std::uint64_t kBaseAddr = 0x400000;
+constexpr std::uint64_t kPage = 0x1000;
+constexpr std::uint64_t kSectionAlign = 16;
+constexpr std::uint64_t kDataAlign = x86::kDataSectionAlign; // .rodata / .data / .bss：热数据按缓存行对齐
+
+// 固定的节区编号；调试信息的几节只在有行号表（-g）时写出，排在最后
+enum : std::uint16_t {
+    SEC_NULL, SEC_TEXT, SEC_RODATA, SEC_DATA, SEC_BSS, SEC_SYMTAB, SEC_STRTAB, SEC_RELA, SEC_SHSTRTAB,
+    SEC_DEBUG_ABBREV, SEC_DEBUG_INFO, SEC_DEBUG_LINE, SEC_RELA_DEBUG_INFO, SEC_RELA_DEBUG_LINE, SEC_COUNT
+};
+
+constexpr std::uint16_t kPlainSections = SEC_SHSTRTAB + 1;
+constexpr std::uint16_t kDebugSections = SEC_COUNT;
+
+struct Ehdr {
+    unsigned char ident[16];
+    std::uint16_t type, machine;
+    std::uint32_t version;
+    std::uint64_t entry, phoff, shoff;
+    std::uint32_t flags;
+    std::uint16_t ehsize, phentsize, phnum, shentsize, shnum, shstrndx;
+};
+
+struct Phdr {
+    std::uint32_t type, flags;
+    std::uint64_t offset, vaddr, paddr, filesz, memsz, align;
+};
+
+struct Shdr {
+    std::uint32_t name, type;
+    std::uint64_t flags, addr, offset, size;
+    std::uint32_t link, info;
+    std::uint64_t addralign, entsize;
+};
+
+struct Sym {
+    std::uint32_t name;
+    unsigned char info, other;
+    std::uint16_t shndx;
+    std::uint64_t value, size;
+};
+
+struct Rela {
+    std::uint64_t offset, info;
+    std::int64_t addend;
+};
+
+static_assert(sizeof(Ehdr) == 64 && sizeof(Phdr) == 56 && sizeof(Shdr) == 64);
+static_assert(sizeof(Sym) == 24 && sizeof(Rela) == 24);
+
+std::uint64_t align_up(const std::uint64_t v, const std::uint64_t a) { return (v + a - 1) / a * a; }
+
+template<typename T>
+void append(std::vector<std::uint8_t> &out, const T &v) {
+    const auto *p = reinterpret_cast<const std::uint8_t *>(&v);
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+void pad_to(std::vector<std::uint8_t> &out, const std::uint64_t off) {
+    if (out.size() > off) throw std::runtime_error("elf: layout overlap");
+    out.resize(off, 0);
+}
+
+class StrTab {
+public:
+    StrTab() { data.push_back('\0'); }
+
+    std::uint32_t add(const std::string &s) {
+        const auto off = static_cast<std::uint32_t>(data.size());
+        data.append(s);
+        data.push_back('\0');
+        return off;
+    }
+
+    std::string data;
+};
+
+std::uint16_t section_index(const x86::Section s) {
+    switch (s) {
+        case x86::Section::Text: return SEC_TEXT;
+        case x86::Section::Rodata: return SEC_RODATA;
+        case x86::Section::Data: return SEC_DATA;
+        case x86::Section::Bss: return SEC_BSS;
+        default: return 0;
+    }
+}
+
+// 符号表：段符号 + 所有局部标签 + 全局标签（ELF 要求局部在前）。
+// 段符号的下标与节区编号相同；有调试信息时 .debug_abbrev / .debug_line 的段符号紧随其后
+struct SymbolTable {
+    std::vector<Sym> syms;
+    StrTab names;
+    std::uint32_t firstGlobal{0};
+    std::uint32_t abbrevSym{0}, lineSym{0};
+
+    SymbolTable(const x86::Object &obj, const std::uint64_t sectionAddr[SEC_COUNT]) {
+        syms.push_back(Sym{});
+        for (const std::uint16_t sec: {SEC_TEXT, SEC_RODATA, SEC_DATA, SEC_BSS}) {
+            Sym s{};
+            s.info = STB_LOCAL << 4 | STT_SECTION;
+            s.shndx = sec;
+            s.value = sectionAddr[sec];
+            syms.push_back(s);
+        }
+        if (!obj.lines.empty()) {
+            for (const std::uint16_t sec: {SEC_DEBUG_ABBREV, SEC_DEBUG_LINE}) {
+                (sec == SEC_DEBUG_ABBREV ? abbrevSym : lineSym) = static_cast<std::uint32_t>(syms.size());
+                Sym s{};
+                s.info = STB_LOCAL << 4 | STT_SECTION;
+                s.shndx = sec;
+                syms.push_back(s);
+            }
+        }
+        for (const bool global: {false, true}) {
+            if (global) firstGlobal = static_cast<std::uint32_t>(syms.size());
+            for (std::size_t i = 0; i < obj.symName.size(); ++i) {
+                if (obj.symGlobal[i] != global || obj.symSection[i] == x86::Section::Undef)
+                    continue;
+                Sym s{};
+                s.name = names.add(obj.symName[i]);
+                s.info = static_cast<unsigned char>((global ? STB_GLOBAL : STB_LOCAL) << 4 | STT_NOTYPE);
+                s.shndx = section_index(obj.symSection[i]);
+                s.value = sectionAddr[s.shndx] + obj.symOffset[i];
+                syms.push_back(s);
+            }
+        }
+    }
+};
+
+Shdr section(const std::uint32_t name, const std::uint32_t type, const std::uint64_t flags, const std::uint64_t addr,
+             const std::uint64_t offset, const std::uint64_t size, const std::uint64_t align) {
+    Shdr s{};
+    s.name = name;
+    s.type = type;
+    s.flags = flags;
+    s.addr = addr;
+    s.offset = offset;
+    s.size = size;
+    s.addralign = align;
+    return s;
+}
+
+void uleb(std::vector<std::uint8_t> &out, std::uint64_t v) {
+    do {
+        std::uint8_t b = v & 0x7f;
+        v >>= 7;
+        out.push_back(v ? b | 0x80 : b);
+    } while (v);
+}
+
+void sleb(std::vector<std::uint8_t> &out, std::int64_t v) {
+    for (;;) {
+        const std::uint8_t b = v & 0x7f;
+        v >>= 7; // 算术右移
+        if ((v == 0 && !(b & 0x40)) || (v == -1 && (b & 0x40))) {
+            out.push_back(b);
+            return;
+        }
+        out.push_back(b | 0x80);
+    }
+}
+
+void cstring(std::vector<std::uint8_t> &out, const std::string &s) {
+    out.insert(out.end(), s.begin(), s.end());
+    out.push_back(0);
+}
+
+template<typename T>
+void patch(std::vector<std::uint8_t> &out, const std::uint64_t offset, const T v) {
+    std::memcpy(out.data() + offset, &v, sizeof v);
+}
+
+// DWARF 4 调试信息：一个编译单元（整个 .text）和它的行号程序，gdb / addr2line / perf annotate 据此把地址对应到源码行。
+// textAddr 是 .text 的地址；.o 里写 0，由 .rela.debug_* 补上（各个 *Fixup 是需要重定位的位置）
+struct Dwarf {
+    std::vector<std::uint8_t> abbrev, info, line;
+    std::uint64_t abbrevFixup{0}, stmtListFixup{0}, lowPcFixup{0}; // .debug_info 内
+    std::uint64_t addressFixup{0}; // .debug_line 内
+
+    Dwarf(const x86::Object &obj, const std::uint64_t textAddr) {
+        abbrev = {1, DW_TAG_compile_unit, DW_CHILDREN_no,
+                  DW_AT_producer, DW_FORM_string, DW_AT_name, DW_FORM_string, DW_AT_stmt_list, DW_FORM_sec_offset,
+                  DW_AT_low_pc, DW_FORM_addr, DW_AT_high_pc, DW_FORM_data8, 0, 0, 0};
+
+        append(info, std::uint32_t{0}); // unit_length，最后回填
+        append(info, std::uint16_t{4});
+        abbrevFixup = info.size();
+        append(info, std::uint32_t{0});
+        info.push_back(8); // address_size
+        uleb(info, 1);
+        cstring(info, "CompilerForNASMCpp");
+        cstring(info, obj.sourceName);
+        stmtListFixup = info.size();
+        append(info, std::uint32_t{0});
+        lowPcFixup = info.size();
+        append(info, textAddr);
+        append(info, static_cast<std::uint64_t>(obj.text.size()));
+        patch(info, 0, static_cast<std::uint32_t>(info.size() - 4));
+
+        append(line, std::uint32_t{0}); // unit_length
+        append(line, std::uint16_t{4});
+        append(line, std::uint32_t{0}); // header_length
+        const auto headerStart = line.size();
+        // minimum_instruction_length, maximum_operations_per_instruction, default_is_stmt,
+        // line_base, line_range, opcode_base, standard_opcode_lengths[1..12]
+        line.insert(line.end(), {1, 1, 1, static_cast<std::uint8_t>(-5), 14, 13,
+                                 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1});
+        line.push_back(0); // include_directories 为空
+        cstring(line, obj.sourceName);
+        line.insert(line.end(), {0, 0, 0}); // 目录下标、修改时间、长度
+        line.push_back(0);
+        patch(line, 6, static_cast<std::uint32_t>(line.size() - headerStart));
+
+        line.insert(line.end(), {0, 9, DW_LNE_set_address});
+        addressFixup = line.size();
+        append(line, textAddr);
+        std::uint64_t address = 0;
+        std::int64_t current = 1;
+        for (auto &row: obj.lines) {
+            if (row.offset > address) {
+                line.push_back(DW_LNS_advance_pc);
+                uleb(line, row.offset - address);
+                address = row.offset;
+            }
+            if (row.line != current) {
+                line.push_back(DW_LNS_advance_line);
+                sleb(line, static_cast<std::int64_t>(row.line) - current);
+                current = row.line;
+            }
+            line.push_back(DW_LNS_copy);
+        }
+        if (obj.text.size() > address) {
+            line.push_back(DW_LNS_advance_pc);
+            uleb(line, obj.text.size() - address);
+        }
+        line.insert(line.end(), {0, 1, DW_LNE_end_sequence});
+        patch(line, 0, static_cast<std::uint32_t>(line.size() - 4));
+    }
+};
+
+Ehdr header(const std::uint16_t type) {
+    Ehdr h{};
+    const unsigned char ident[16] = {0x7f, 'E', 'L', 'F', 2 /*64 位*/, 1 /*小端*/, 1 /*版本*/, 0 /*SysV*/};
+    std::memcpy(h.ident, ident, sizeof ident);
+    h.type = type;
+    h.machine = EM_X86_64;
+    h.version = 1;
+    h.ehsize = sizeof(Ehdr);
+    h.shentsize = sizeof(Shdr);
+    h.shnum = kPlainSections;
+    h.shstrndx = SEC_SHSTRTAB;
+    return h;
+}
+
+// 写出 [.debug_*] / .symtab / .strtab / [.rela.text] / .shstrtab / [.rela.debug_*] 以及节区头表。
+// debugRelas 为空时（可执行文件）两个 .rela.debug_* 节也是空的
+void write_tail(std::vector<std::uint8_t> &out, Shdr shdrs[SEC_COUNT], const SymbolTable &st,
+                const std::vector<Rela> &relas, const Dwarf *debug = nullptr,
+                const std::vector<Rela> &infoRelas = {}, const std::vector<Rela> &lineRelas = {}) {
+    const std::uint16_t count = debug ? kDebugSections : kPlainSections;
+    StrTab shstr;
+    const char *names[SEC_COUNT] = {
+        "", ".text", ".rodata", ".data", ".bss", ".symtab", ".strtab", ".rela.text", ".shstrtab",
+        ".debug_abbrev", ".debug_info", ".debug_line", ".rela.debug_info", ".rela.debug_line"
+    };
+    for (int i = 1; i < count; ++i) shdrs[i].name = shstr.add(names[i]);
+
+    if (debug) {
+        for (const auto &[sec, bytes]: {std::pair{SEC_DEBUG_ABBREV, &debug->abbrev},
+                                        std::pair{SEC_DEBUG_INFO, &debug->info},
+                                        std::pair{SEC_DEBUG_LINE, &debug->line}}) {
+            shdrs[sec] = section(shdrs[sec].name, SHT_PROGBITS, 0, 0, out.size(), bytes->size(), 1);
+            out.insert(out.end(), bytes->begin(), bytes->end());
+        }
+    }
+
+    pad_to(out, align_up(out.size(), 8));
+    shdrs[SEC_SYMTAB].type = SHT_SYMTAB;
+    shdrs[SEC_SYMTAB].offset = out.size();
+    for (auto &s: st.syms) append(out, s);
+    shdrs[SEC_SYMTAB].size = st.syms.size() * sizeof(Sym);
+    shdrs[SEC_SYMTAB].link = SEC_STRTAB;
+    shdrs[SEC_SYMTAB].info = st.firstGlobal;
+    shdrs[SEC_SYMTAB].addralign = 8;
+    shdrs[SEC_SYMTAB].entsize = sizeof(Sym);
+
+    shdrs[SEC_STRTAB].type = SHT_STRTAB;
+    shdrs[SEC_STRTAB].offset = out.size();
+    out.insert(out.end(), st.names.data.begin(), st.names.data.end());
+    shdrs[SEC_STRTAB].size = st.names.data.size();
+    shdrs[SEC_STRTAB].addralign = 1;
+
+    pad_to(out, align_up(out.size(), 8));
+    shdrs[SEC_RELA].type = SHT_RELA;
+    shdrs[SEC_RELA].flags = SHF_INFO_LINK;
+    shdrs[SEC_RELA].offset = out.size();
+    for (auto &r: relas) append(out, r);
+    shdrs[SEC_RELA].size = relas.size() * sizeof(Rela);
+    shdrs[SEC_RELA].link = SEC_SYMTAB;
+    shdrs[SEC_RELA].info = SEC_TEXT;
+    shdrs[SEC_RELA].addralign = 8;
+    shdrs[SEC_RELA].entsize = sizeof(Rela);
+
+    shdrs[SEC_SHSTRTAB].type = SHT_STRTAB;
+    shdrs[SEC_SHSTRTAB].offset = out.size();
+    out.insert(out.end(), shstr.data.begin(), shstr.data.end());
+    shdrs[SEC_SHSTRTAB].size = shstr.data.size();
+    shdrs[SEC_SHSTRTAB].addralign = 1;
+
+    if (debug) {
+        for (const auto &[sec, target, list]: {std::tuple{SEC_RELA_DEBUG_INFO, SEC_DEBUG_INFO, &infoRelas},
+                                               std::tuple{SEC_RELA_DEBUG_LINE, SEC_DEBUG_LINE, &lineRelas}}) {
+            pad_to(out, align_up(out.size(), 8));
+            shdrs[sec] = section(shdrs[sec].name, SHT_RELA, SHF_INFO_LINK, 0, out.size(), list->size() * sizeof(Rela), 8);
+            for (auto &r: *list) append(out, r);
+            shdrs[sec].link = SEC_SYMTAB;
+            shdrs[sec].info = target;
+            shdrs[sec].entsize = sizeof(Rela);
+        }
+    }
+
+    pad_to(out, align_up(out.size(), 8));
+    auto *eh = reinterpret_cast<Ehdr *>(out.data());
+    eh->shoff = out.size();
+    eh->shnum = count;
+    for (int i = 0; i < count; ++i) append(out, shdrs[i]);
+}
+
+} // namespace
+
+std::vector<std::uint8_t> object_file(const x86::Object &obj) {
+    std::vector<std::uint8_t> out;
+    append(out, header(ET_REL));
+
+    const std::uint64_t zero[SEC_COUNT] = {};
+    Shdr shdrs[SEC_COUNT] = {};
+
+    pad_to(out, align_up(out.size(), kSectionAlign));
+    shdrs[SEC_TEXT] = section(0, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 0, out.size(), obj.text.size(),
+                              kSectionAlign);
+    out.insert(out.end(), obj.text.begin(), obj.text.end());
+
+    pad_to(out, align_up(out.size(), kDataAlign));
+    shdrs[SEC_RODATA] = section(0, SHT_PROGBITS, SHF_ALLOC, 0, out.size(), obj.rodata.size(), kDataAlign);
+    out.insert(out.end(), obj.rodata.begin(), obj.rodata.end());
+
+    pad_to(out, align_up(out.size(), kDataAlign));
+    shdrs[SEC_DATA] = section(0, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 0, out.size(), obj.data.size(), kDataAlign);
+    out.insert(out.end(), obj.data.begin(), obj.data.end());
+
+    shdrs[SEC_BSS] = section(0, SHT_NOBITS, SHF_ALLOC | SHF_WRITE, 0, out.size(), obj.bssSize, kDataAlign);
+
+    const SymbolTable st(obj, zero);
+
+    // 与 NASM 一样，重定位都挂在段符号上，符号偏移放进 addend
+    std::vector<Rela> relas;
+    relas.reserve(obj.relocs.size());
+    for (auto &r: obj.relocs) {
+        const auto sec = section_index(obj.symSection[r.sym]);
+        if (sec == 0)
+            throw std::runtime_error("elf: undefined symbol " + obj.symName[r.sym]);
+        const std::uint32_t type = r.kind == x86::RelocKind::Abs64 ? R_X86_64_64 : R_X86_64_32S;
+        relas.push_back(Rela{
+            r.offset, static_cast<std::uint64_t>(sec) << 32 | type,
+            static_cast<std::int64_t>(obj.symOffset[r.sym]) + r.addend
+        });
+    }
+
+    if (obj.lines.empty()) {
+        write_tail(out, shdrs, st, relas);
+        return out;
+    }
+    const Dwarf debug(obj, 0);
+    auto rela = [](const std::uint64_t offset, const std::uint32_t sym, const std::uint32_t type) {
+        return Rela{offset, static_cast<std::uint64_t>(sym) << 32 | type, 0};
+    };
+    write_tail(out, shdrs, st, relas, &debug,
+               {rela(debug.abbrevFixup, st.abbrevSym, R_X86_64_32), rela(debug.stmtListFixup, st.lineSym, R_X86_64_32),
+                rela(debug.lowPcFixup, SEC_TEXT, R_X86_64_64)},
+               {rela(debug.addressFixup, SEC_TEXT, R_X86_64_64)});
+    return out;
+}
+
+std::vector<std::uint8_t> executable_file(const x86::Object &obj) {
+    // 布局：[头部][.text 在 0x1000][.rodata 在下一页（只读，为空时没有这个段）][.data 在下一页][.bss 紧跟 .data]
+    const std::uint64_t textOff = kPage;
+    const std::uint64_t rodataOff = align_up(textOff + obj.text.size(), kPage);
+    const std::uint64_t dataOff = align_up(rodataOff + obj.rodata.size(), kPage);
+
+    std::uint64_t addr[SEC_COUNT] = {};
+    addr[SEC_TEXT] = kBaseAddr + textOff;
+    addr[SEC_RODATA] = kBaseAddr + rodataOff;
+    addr[SEC_DATA] = kBaseAddr + dataOff;
+    addr[SEC_BSS] = align_up(addr[SEC_DATA] + obj.data.size(), kDataAlign);
+
+    auto symAddr = [&](const x86::SymbolId s) {
+        const auto sec = section_index(obj.symSection[s]);
+        if (sec == 0)
+            throw std::runtime_error("elf: undefined symbol " + obj.symName[s]);
+        return addr[sec] + obj.symOffset[s];
+    };
+
+    // ---- 解析重定位 ----
+    std::vector<std::uint8_t> text = obj.text;
+    for (auto &r: obj.relocs) {
+        const auto v = static_cast<std::int64_t>(symAddr(r.sym)) + r.addend;
+        if (r.kind == x86::RelocKind::Abs64) {
+            std::memcpy(&text[r.offset], &v, 8);
+        } else {
+            if (v < INT32_MIN || v > INT32_MAX)
+                throw std::runtime_error("elf: address out of 32-bit range");
+            const auto v32 = static_cast<std::int32_t>(v);
+            std::memcpy(&text[r.offset], &v32, 4);
+        }
+    }
+
+    std::uint64_t entry = addr[SEC_TEXT];
+    for (std::size_t i = 0; i < obj.symName.size(); ++i)
+        if (obj.symName[i] == "_start" && obj.symSection[i] == x86::Section::Text)
+            entry = addr[SEC_TEXT] + obj.symOffset[i];
+
+    std::vector<std::uint8_t> out;
+    auto eh = header(ET_EXEC);
+    eh.entry = entry;
+    eh.phoff = sizeof(Ehdr);
+    eh.phentsize = sizeof(Phdr);
+    eh.phnum = obj.rodata.empty() ? 2 : 3;
+    append(out, eh);
+
+    Phdr textSeg{PT_LOAD, PF_R | PF_X, textOff, addr[SEC_TEXT], addr[SEC_TEXT], text.size(), text.size(), kPage};
+    Phdr rodataSeg{
+        PT_LOAD, PF_R, rodataOff, addr[SEC_RODATA], addr[SEC_RODATA], obj.rodata.size(), obj.rodata.size(), kPage
+    };
+    const auto memEnd = addr[SEC_BSS] + obj.bssSize;
+    Phdr dataSeg{
+        PT_LOAD, PF_R | PF_W, dataOff, addr[SEC_DATA], addr[SEC_DATA], obj.data.size(), memEnd - addr[SEC_DATA], kPage
+    };
+    append(out, textSeg);
+    if (!obj.rodata.empty())
+        append(out, rodataSeg);
+    append(out, dataSeg);
+
+    Shdr shdrs[SEC_COUNT] = {};
+    pad_to(out, textOff);
+    shdrs[SEC_TEXT] = section(0, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, addr[SEC_TEXT], textOff, text.size(),
+                              kSectionAlign);
+    out.insert(out.end(), text.begin(), text.end());
+
+    pad_to(out, rodataOff);
+    shdrs[SEC_RODATA] = section(0, SHT_PROGBITS, SHF_ALLOC, addr[SEC_RODATA], rodataOff, obj.rodata.size(),
+                                kDataAlign);
+    out.insert(out.end(), obj.rodata.begin(), obj.rodata.end());
+
+    pad_to(out, dataOff);
+    shdrs[SEC_DATA] = section(0, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, addr[SEC_DATA], dataOff, obj.data.size(),
+                              kDataAlign);
+    out.insert(out.end(), obj.data.begin(), obj.data.end());
+    shdrs[SEC_BSS] = section(0, SHT_NOBITS, SHF_ALLOC | SHF_WRITE, addr[SEC_BSS], out.size(), obj.bssSize,
+                             kDataAlign);
+
+    // 保留符号表，方便 gdb / perf 显示标签名
+    const SymbolTable st(obj, addr);
+    if (obj.lines.empty()) {
+        write_tail(out, shdrs, st, {});
+    } else {
+        const Dwarf debug(obj, addr[SEC_TEXT]);
+        write_tail(out, shdrs, st, {}, &debug);
+    }
+    return out;
+}
+
+} // namespace elf
@@ -0,0 +1,673 @@
+#include "x86.hpp"
+
+#include <stdexcept>
+
+// x86-64 编码器。编码选择与 nasm -f elf64 的默认优化（-Ox）保持一致，
+// 这样同一个 Module 走 NASM 和走内置编码器得到的 .text 字节完全相同。
+namespace x86 {
+namespace {
+
+struct Fixup {
+    std::uint32_t offset; // 相对所在片段起点
+    RelocKind kind;
+    SymbolId sym;
+    std::int64_t addend;
+};
+
+// 一条指令编码后的片段。跳转的长度要等标签位置确定后才能选，单独处理
+struct Fragment {
+    enum class Kind : std::uint8_t { Bytes, Label, Branch, Align, Line };
+
+    Kind kind{Kind::Bytes};
+    std::vector<std::uint8_t> bytes;
+    std::vector<Fixup> fixups;
+    const Instr *ins{nullptr};
+    bool isLong{false}; // Branch: rel32 还是 rel8
+    std::uint64_t offset{0};
+};
+
+bool fits8(const std::int64_t v) { return v >= -128 && v <= 127; }
+bool fits32(const std::int64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+
+int code(const Reg r) { return static_cast<int>(r); }
+
+void put32(std::vector<std::uint8_t> &b, const std::int64_t v) {
+    for (int i = 0; i < 4; ++i) b.push_back(static_cast<std::uint8_t>(v >> (8 * i)));
+}
+
+void put64(std::vector<std::uint8_t> &b, const std::int64_t v) {
+    for (int i = 0; i < 8; ++i) b.push_back(static_cast<std::uint8_t>(v >> (8 * i)));
+}
+
+std::uint8_t scale_bits(const std::uint8_t s) {
+    switch (s) {
+        case 1: return 0;
+        case 2: return 1;
+        case 4: return 2;
+        case 8: return 3;
+        default: throw std::runtime_error("invalid scale " + std::to_string(s));
+    }
+}
+
+class Emitter {
+public:
+    explicit Emitter(Fragment &f) : f(f) {
+    }
+
+    // [REX] opcode ModRM [SIB] [disp]，regField 是 ModRM.reg（寄存器编号或 /digit）
+    void op_rm(const bool w, const std::initializer_list<std::uint8_t> opcode, const int regField, const Operand &rm) {
+        std::uint8_t rex = 0x40;
+        if (w) rex |= 0x08;
+        if (regField & 8) rex |= 0x04;
+        bool forceRex = false;
+        if (rm.kind == Operand::Kind::Reg) {
+            if (code(rm.reg) & 8) rex |= 0x01;
+            if (rm.width == Width::Byte && code(rm.reg) >= 4 && code(rm.reg) < 8) forceRex = true;
+        } else {
+            if (rm.index != Reg::None && (code(rm.index) & 8)) rex |= 0x02;
+            if (rm.reg != Reg::None && (code(rm.reg) & 8)) rex |= 0x01;
+        }
+        if (byteRegField && regField >= 4 && regField < 8) forceRex = true;
+        if (rex != 0x40 || forceRex) f.bytes.push_back(rex);
+        for (const auto op: opcode) f.bytes.push_back(op);
+        modrm(regField & 7, rm);
+    }
+
+    // VEX 前缀 + opcode ModRM [SIB] [disp]。map: 1 = 0F，2 = 0F38；pp: 1 = 66，2 = F3；
+    // vvvv 是第二个源寄存器，不用时为 -1。能用两字节的 C5 形式时就用（与 NASM 相同）
+    void vex_rm(const bool l256, const int pp, const int map, const bool w, const int vvvv, const std::uint8_t opcode,
+                const int regField, const Operand &rm) {
+        const bool r = regField & 8;
+        bool x = false, b = false;
+        if (rm.kind == Operand::Kind::Reg) {
+            b = code(rm.reg) & 8;
+        } else {
+            x = rm.index != Reg::None && (code(rm.index) & 8);
+            b = rm.reg != Reg::None && (code(rm.reg) & 8);
+        }
+        const auto tail = static_cast<std::uint8_t>((~(vvvv < 0 ? 0 : vvvv) & 0xF) << 3 | (l256 ? 4 : 0) | pp);
+        if (map == 1 && !x && !b && !w) {
+            f.bytes.push_back(0xC5);
+            f.bytes.push_back(static_cast<std::uint8_t>((r ? 0 : 0x80) | tail));
+        } else {
+            f.bytes.push_back(0xC4);
+            f.bytes.push_back(static_cast<std::uint8_t>((r ? 0 : 0x80) | (x ? 0 : 0x40) | (b ? 0 : 0x20) | map));
+            f.bytes.push_back(static_cast<std::uint8_t>((w ? 0x80 : 0) | tail));
+        }
+        f.bytes.push_back(opcode);
+        modrm(regField & 7, rm);
+    }
+
+    // ModRM.reg 是否是 8 位寄存器（spl/bpl/sil/dil 需要 REX）
+    bool byteRegField{false};
+
+    void imm8(const std::int64_t v) { f.bytes.push_back(static_cast<std::uint8_t>(v)); }
+    void imm32(const std::int64_t v) { put32(f.bytes, v); }
+    void imm64(const std::int64_t v) { put64(f.bytes, v); }
+
+    void addr64(const Operand &o) {
+        f.fixups.push_back({static_cast<std::uint32_t>(f.bytes.size()), RelocKind::Abs64, o.sym, o.value});
+        put64(f.bytes, 0);
+    }
+
+    void addr32(const Operand &o) {
+        f.fixups.push_back({static_cast<std::uint32_t>(f.bytes.size()), RelocKind::Abs32S, o.sym, o.value});
+        put32(f.bytes, 0);
+    }
+
+    void byte(const std::uint8_t b) { f.bytes.push_back(b); }
+
+private:
+    void disp32(const Operand &m) {
+        if (m.sym != NoSymbol) {
+            f.fixups.push_back({static_cast<std::uint32_t>(f.bytes.size()), RelocKind::Abs32S, m.sym, m.value});
+            put32(f.bytes, 0);
+        } else {
+            put32(f.bytes, m.value);
+        }
+    }
+
+    void modrm(const int r, const Operand &rm) {
+        if (rm.kind == Operand::Kind::Reg) {
+            f.bytes.push_back(static_cast<std::uint8_t>(0xC0 | r << 3 | (code(rm.reg) & 7)));
+            return;
+        }
+        if (rm.kind != Operand::Kind::Mem)
+            throw std::runtime_error("encoder: expected register or memory operand");
+
+        const bool hasIndex = rm.index != Reg::None;
+        if (hasIndex && (code(rm.index) & 7) == 4 && !(code(rm.index) & 8))
+            throw std::runtime_error("encoder: rsp cannot be an index register");
+        const int idx = hasIndex ? (code(rm.index) & 7) : 4;
+        const std::uint8_t ss = hasIndex ? scale_bits(rm.scale) : 0;
+
+        if (rm.reg == Reg::None) {
+            // 绝对地址：64 位下 mod=00 rm=101 是 RIP 相对，所以用 SIB 形式（与 NASM 相同）
+            f.bytes.push_back(static_cast<std::uint8_t>(0x04 | r << 3));
+            f.bytes.push_back(static_cast<std::uint8_t>(ss << 6 | idx << 3 | 5));
+            disp32(rm);
+            return;
+        }
+
+        const int base = code(rm.reg) & 7;
+        int mod;
+        if (rm.sym != NoSymbol || !fits8(rm.value)) mod = 2;
+        else if (rm.value == 0 && base != 5) mod = 0;
+        else mod = 1;
+
+        if (hasIndex || base == 4) {
+            f.bytes.push_back(static_cast<std::uint8_t>(mod << 6 | r << 3 | 4));
+            f.bytes.push_back(static_cast<std::uint8_t>(ss << 6 | idx << 3 | base));
+        } else {
+            f.bytes.push_back(static_cast<std::uint8_t>(mod << 6 | r << 3 | base));
+        }
+        if (mod == 1) imm8(rm.value);
+        else if (mod == 2) disp32(rm);
+    }
+
+    Fragment &f;
+};
+
+bool is(const Operand &o, const Operand::Kind k) { return o.kind == k; }
+
+// add/or/and/sub/xor/cmp 共用的 /digit 编号
+int alu_digit(const Op op) {
+    switch (op) {
+        case Op::Add: return 0;
+        case Op::Or: return 1;
+        case Op::And: return 4;
+        case Op::Sub: return 5;
+        case Op::Xor: return 6;
+        case Op::Cmp: return 7;
+        default: return -1;
+    }
+}
+
+[[noreturn]] void unsupported(const Instr &i) {
+    throw std::runtime_error("encoder: unsupported operand combination for opcode " +
+                             std::to_string(static_cast<int>(i.op)));
+}
+
+void encode_mov(Emitter &e, const Instr &i) {
+    const auto &d = i.dst;
+    const auto &s = i.src;
+    const bool w = d.width == Width::Qword;
+
+    if (is(d, Operand::Kind::Reg) && is(s, Operand::Kind::Imm)) {
+        const int r = code(d.reg);
+        if (d.width == Width::Byte) {
+            if (r & 8) e.byte(0x41);
+            e.byte(static_cast<std::uint8_t>(0xB0 + (r & 7)));
+            e.imm8(s.value);
+        } else if (!w || (s.value >= 0 && s.value <= 0xFFFFFFFFLL)) {
+            // mov r64, imm32 -> mov r32, imm32（高 32 位自动清零）
+            if (r & 8) e.byte(0x41);
+            e.byte(static_cast<std::uint8_t>(0xB8 + (r & 7)));
+            e.imm32(s.value);
+        } else if (w && fits32(s.value)) {
+            e.op_rm(true, {0xC7}, 0, d);
+            e.imm32(s.value);
+        } else {
+            e.byte(static_cast<std::uint8_t>(0x48 | ((r & 8) ? 1 : 0)));
+            e.byte(static_cast<std::uint8_t>(0xB8 + (r & 7)));
+            e.imm64(s.value);
+        }
+        return;
+    }
+    if (is(d, Operand::Kind::Reg) && is(s, Operand::Kind::Addr)) {
+        const int r = code(d.reg);
+        e.byte(static_cast<std::uint8_t>(0x48 | ((r & 8) ? 1 : 0)));
+        e.byte(static_cast<std::uint8_t>(0xB8 + (r & 7)));
+        e.addr64(s);
+        return;
+    }
+    if (is(d, Operand::Kind::Reg) && is(s, Operand::Kind::Mem)) {
+        e.byteRegField = d.width == Width::Byte;
+        e.op_rm(w, {static_cast<std::uint8_t>(d.width == Width::Byte ? 0x8A : 0x8B)}, code(d.reg), s);
+        return;
+    }
+    if ((is(d, Operand::Kind::Mem) || is(d, Operand::Kind::Reg)) && is(s, Operand::Kind::Reg)) {
+        e.byteRegField = s.width == Width::Byte;
+        e.op_rm(s.width == Width::Qword, {static_cast<std::uint8_t>(s.width == Width::Byte ? 0x88 : 0x89)},
+                code(s.reg), d);
+        return;
+    }
+    if (is(d, Operand::Kind::Mem) && is(s, Operand::Kind::Imm)) {
+        if (d.width == Width::Byte) {
+            e.op_rm(false, {0xC6}, 0, d);
+            e.imm8(s.value);
+        } else {
+            if (!fits32(s.value)) unsupported(i);
+            e.op_rm(w, {0xC7}, 0, d);
+            e.imm32(s.value);
+        }
+        return;
+    }
+    if (is(d, Operand::Kind::Mem) && is(s, Operand::Kind::Addr)) {
+        e.op_rm(true, {0xC7}, 0, d);
+        e.addr32(s);
+        return;
+    }
+    unsupported(i);
+}
+
+void encode_alu(Emitter &e, const Instr &i) {
+    const int n = alu_digit(i.op);
+    const auto &d = i.dst;
+    const auto &s = i.src;
+    const bool w = d.width == Width::Qword;
+    const bool b = d.width == Width::Byte;
+
+    if (is(s, Operand::Kind::Imm)) {
+        if (b) {
+            if (is(d, Operand::Kind::Reg) && d.reg == Reg::RAX) {
+                e.byte(static_cast<std::uint8_t>(n * 8 + 4));
+            } else {
+                e.op_rm(false, {0x80}, n, d);
+            }
+            e.imm8(s.value);
+        } else if (fits8(s.value)) {
+            e.op_rm(w, {0x83}, n, d);
+            e.imm8(s.value);
+        } else {
+            if (!fits32(s.value)) unsupported(i);
+            if (is(d, Operand::Kind::Reg) && d.reg == Reg::RAX) {
+                if (w) e.byte(0x48);
+                e.byte(static_cast<std::uint8_t>(n * 8 + 5));
+            } else {
+                e.op_rm(w, {0x81}, n, d);
+            }
+            e.imm32(s.value);
+        }
+        return;
+    }
+    if (is(d, Operand::Kind::Reg) && is(s, Operand::Kind::Mem)) {
+        e.byteRegField = b;
+        e.op_rm(w, {static_cast<std::uint8_t>(n * 8 + (b ? 2 : 3))}, code(d.reg), s);
+        return;
+    }
+    if (is(s, Operand::Kind::Reg)) {
+        e.byteRegField = b;
+        e.op_rm(w, {static_cast<std::uint8_t>(n * 8 + (b ? 0 : 1))}, code(s.reg), d);
+        return;
+    }
+    unsupported(i);
+}
+
+void encode_unary(Emitter &e, const Instr &i, const std::uint8_t opByte, const std::uint8_t opQword, const int digit) {
+    const bool b = i.dst.width == Width::Byte;
+    e.op_rm(i.dst.width == Width::Qword, {b ? opByte : opQword}, digit, i.dst);
+}
+
+bool ymm(const Operand &o) { return is(o, Operand::Kind::Reg) && o.width == Width::Ymm; }
+
+// 向量指令：寄存器操作数是 Ymm 时用 VEX.256（AVX2），否则是 66 / F3 前缀的 SSE2 编码
+void encode_vector(Emitter &e, const Instr &i) {
+    const auto &d = i.dst;
+    const auto &s = i.src;
+    const bool v = ymm(d) || ymm(s);
+    // 前缀（1 = 66，2 = F3）+ 0F opcode，ModRM.reg 为寄存器 r，ModRM.rm 为 rm；vvvv 只有 VEX 的运算指令用
+    auto sse = [&](const int pp, const std::uint8_t op, const Reg r, const Operand &rm, const int vvvv = -1) {
+        if (v) {
+            e.vex_rm(true, pp, 1, false, vvvv, op, code(r), rm);
+            return;
+        }
+        e.byte(pp == 1 ? 0x66 : 0xF3);
+        e.op_rm(false, {0x0F, op}, code(r), rm);
+    };
+    switch (i.op) {
+        case Op::Movdqu:
+            if (is(d, Operand::Kind::Reg) && is(s, Operand::Kind::Mem))
+                sse(2, 0x6F, d.reg, s);
+            else if (is(d, Operand::Kind::Mem) && is(s, Operand::Kind::Reg))
+                sse(2, 0x7F, s.reg, d);
+            else
+                unsupported(i);
+            return;
+        case Op::Movdqa:
+            if (!is(d, Operand::Kind::Reg) || !is(s, Operand::Kind::Reg)) unsupported(i);
+            sse(1, 0x6F, d.reg, s);
+            return;
+        case Op::Paddq:
+        case Op::Psubq:
+        case Op::Pxor: {
+            if (!is(d, Operand::Kind::Reg) || is(s, Operand::Kind::Imm)) unsupported(i);
+            const std::uint8_t op = i.op == Op::Paddq ? 0xD4 : i.op == Op::Psubq ? 0xFB : 0xEF;
+            sse(1, op, d.reg, s, code(d.reg));
+            return;
+        }
+        case Op::Punpcklqdq:
+            if (v || !is(d, Operand::Kind::Reg)) unsupported(i);
+            sse(1, 0x6C, d.reg, s);
+            return;
+        case Op::Movq:
+            if (v) unsupported(i);
+            if (is(d, Operand::Kind::Reg) && d.width == Width::Xmm && is(s, Operand::Kind::Mem)) {
+                // movq xmm, m64
+                e.byte(0xF3);
+                e.op_rm(false, {0x0F, 0x7E}, code(d.reg), s);
+            } else if (is(d, Operand::Kind::Reg) && d.width == Width::Xmm && is(s, Operand::Kind::Reg)) {
+                e.byte(0x66);
+                e.op_rm(true, {0x0F, 0x6E}, code(d.reg), s);
+            } else if (is(s, Operand::Kind::Reg) && s.width == Width::Xmm && is(d, Operand::Kind::Reg)) {
+                e.byte(0x66);
+                e.op_rm(true, {0x0F, 0x7E}, code(s.reg), d);
+            } else {
+                unsupported(i);
+            }
+            return;
+        case Op::Vpbroadcastq:
+            if (!ymm(d)) unsupported(i);
+            e.vex_rm(true, 1, 2, false, -1, 0x59, code(d.reg), s);
+            return;
+        case Op::Vzeroupper:
+            e.byte(0xC5);
+            e.byte(0xF8);
+            e.byte(0x77);
+            return;
+        default:
+            unsupported(i);
+    }
+}
+
+void encode_fixed(Fragment &f, const Instr &i) {
+    Emitter e(f);
+    switch (i.op) {
+        case Op::Mov:
+            encode_mov(e, i);
+            return;
+        case Op::Add:
+        case Op::Sub:
+        case Op::And:
+        case Op::Or:
+        case Op::Xor:
+        case Op::Cmp:
+            encode_alu(e, i);
+            return;
+        case Op::Test:
+            if (!is(i.src, Operand::Kind::Reg)) unsupported(i);
+            e.byteRegField = i.src.width == Width::Byte;
+            e.op_rm(i.src.width == Width::Qword, {static_cast<std::uint8_t>(i.src.width == Width::Byte ? 0x84 : 0x85)},
+                    code(i.src.reg), i.dst);
+            return;
+        case Op::Imul:
+            if (!is(i.dst, Operand::Kind::Reg)) unsupported(i);
+            if (is(i.src, Operand::Kind::Imm)) {
+                // imul r, imm == imul r, r, imm
+                if (fits8(i.src.value)) {
+                    e.op_rm(true, {0x6B}, code(i.dst.reg), i.dst);
+                    e.imm8(i.src.value);
+                } else {
+                    if (!fits32(i.src.value)) unsupported(i);
+                    e.op_rm(true, {0x69}, code(i.dst.reg), i.dst);
+                    e.imm32(i.src.value);
+                }
+            } else {
+                e.op_rm(true, {0x0F, 0xAF}, code(i.dst.reg), i.src);
+            }
+            return;
+        case Op::Idiv:
+            encode_unary(e, i, 0xF6, 0xF7, 7);
+            return;
+        case Op::Div:
+            encode_unary(e, i, 0xF6, 0xF7, 6);
+            return;
+        case Op::Neg:
+            encode_unary(e, i, 0xF6, 0xF7, 3);
+            return;
+        case Op::Inc:
+            encode_unary(e, i, 0xFE, 0xFF, 0);
+            return;
+        case Op::Dec:
+            encode_unary(e, i, 0xFE, 0xFF, 1);
+            return;
+        case Op::Cqo:
+            e.byte(0x48);
+            e.byte(0x99);
+            return;
+        case Op::Lea:
+            if (!is(i.dst, Operand::Kind::Reg) || !is(i.src, Operand::Kind::Mem)) unsupported(i);
+            e.op_rm(i.dst.width == Width::Qword, {0x8D}, code(i.dst.reg), i.src);
+            return;
+        case Op::Cmov:
+            if (!is(i.dst, Operand::Kind::Reg) || is(i.src, Operand::Kind::Imm)) unsupported(i);
+            e.op_rm(true, {0x0F, static_cast<std::uint8_t>(0x40 + static_cast<int>(i.cond))}, code(i.dst.reg), i.src);
+            return;
+        case Op::Push:
+            if (is(i.dst, Operand::Kind::Reg)) {
+                if (code(i.dst.reg) & 8) e.byte(0x41);
+                e.byte(static_cast<std::uint8_t>(0x50 + (code(i.dst.reg) & 7)));
+            } else if (is(i.dst, Operand::Kind::Imm) && fits8(i.dst.value)) {
+                e.byte(0x6A);
+                e.imm8(i.dst.value);
+            } else if (is(i.dst, Operand::Kind::Imm) && fits32(i.dst.value)) {
+                e.byte(0x68);
+                e.imm32(i.dst.value);
+            } else {
+                unsupported(i);
+            }
+            return;
+        case Op::Pop:
+            if (!is(i.dst, Operand::Kind::Reg)) unsupported(i);
+            if (code(i.dst.reg) & 8) e.byte(0x41);
+            e.byte(static_cast<std::uint8_t>(0x58 + (code(i.dst.reg) & 7)));
+            return;
+        case Op::Pushf:
+            e.byte(0x9C);
+            return;
+        case Op::Popf:
+            e.byte(0x9D);
+            return;
+        case Op::Ret:
+            e.byte(0xC3);
+            return;
+        case Op::Syscall:
+            e.byte(0x0F);
+            e.byte(0x05);
+            return;
+        case Op::Cpuid:
+            e.byte(0x0F);
+            e.byte(0xA2);
+            return;
+        case Op::Xgetbv:
+            e.byte(0x0F);
+            e.byte(0x01);
+            e.byte(0xD0);
+            return;
+        case Op::Movdqu:
+        case Op::Movdqa:
+        case Op::Movq:
+        case Op::Paddq:
+        case Op::Psubq:
+        case Op::Pxor:
+        case Op::Punpcklqdq:
+        case Op::Vpbroadcastq:
+        case Op::Vzeroupper:
+            encode_vector(e, i);
+            return;
+        default:
+            unsupported(i);
+    }
+}
+
+std::uint64_t branch_size(const Fragment &f) {
+    if (f.ins->op == Op::Call) return 5;
+    if (!f.isLong) return 2;
+    return f.ins->op == Op::Jmp ? 5 : 6;
+}
+
+} // namespace
+
+Object encode(const Module &m) {
+    const auto nsym = m.symbolCount();
+    Object obj;
+    obj.symName.resize(nsym);
+    obj.symSection.assign(nsym, Section::Undef);
+    obj.symOffset.assign(nsym, 0);
+    obj.symGlobal.assign(nsym, false);
+
+    for (std::size_t i = 0; i < nsym; ++i)
+        obj.symName[i] = m.name(static_cast<SymbolId>(i));
+    obj.sourceName = m.sourceName;
+    for (const auto g: m.globals)
+        obj.symGlobal[g] = true;
+
+    // ---- .bss / .data / .rodata ----
+    for (auto &b: m.bss) {
+        if (b.align)
+            obj.bssSize = (obj.bssSize + b.align - 1) / b.align * b.align;
+        obj.symSection[b.sym] = Section::Bss;
+        obj.symOffset[b.sym] = obj.bssSize;
+        obj.bssSize += b.size;
+    }
+    auto place = [&obj](const std::vector<DataItem> &items, const Section section, std::vector<std::uint8_t> &out) {
+        for (auto &d: items) {
+            if (d.align)
+                out.resize((out.size() + d.align - 1) / d.align * d.align, 0);
+            obj.symSection[d.sym] = section;
+            obj.symOffset[d.sym] = out.size();
+            out.insert(out.end(), d.bytes.begin(), d.bytes.end());
+        }
+    };
+    place(m.data, Section::Data, obj.data);
+    place(m.rodata, Section::Rodata, obj.rodata);
+
+    // ---- .text: 先把定长指令编码好 ----
+    std::vector<Fragment> frags;
+    frags.reserve(m.text.size());
+    std::string scope; // 最近的非局部标签，用来给 .local 标签加前缀（与 NASM 相同）
+    for (auto &ins: m.text) {
+        Fragment f;
+        f.ins = &ins;
+        switch (ins.op) {
+            case Op::Label: {
+                f.kind = Fragment::Kind::Label;
+                const auto &n = m.name(ins.target);
+                if (!n.empty() && n[0] == '.') obj.symName[ins.target] = scope + n;
+                else scope = n;
+                break;
+            }
+            case Op::Jmp:
+            case Op::Jcc:
+            case Op::Call:
+                f.kind = Fragment::Kind::Branch;
+                break;
+            case Op::Align:
+                f.kind = Fragment::Kind::Align;
+                break;
+            case Op::Line:
+                f.kind = Fragment::Kind::Line;
+                break;
+            default:
+                encode_fixed(f, ins);
+        }
+        frags.push_back(std::move(f));
+    }
+
+    // ---- 分支松弛：先全部假设短跳转，放不下的改成长跳转，直到不再变化 ----
+    auto layout = [&] {
+        std::uint64_t off = 0;
+        for (auto &f: frags) {
+            f.offset = off;
+            switch (f.kind) {
+                case Fragment::Kind::Bytes:
+                    off += f.bytes.size();
+                    break;
+                case Fragment::Kind::Label:
+                    obj.symSection[f.ins->target] = Section::Text;
+                    obj.symOffset[f.ins->target] = off;
+                    break;
+                case Fragment::Kind::Line:
+                    break;
+                case Fragment::Kind::Branch:
+                    off += branch_size(f);
+                    break;
+                case Fragment::Kind::Align: {
+                    const std::uint64_t a = f.ins->align;
+                    off += (a - off % a) % a;
+                    break;
+                }
+            }
+        }
+        return off;
+    };
+
+    for (bool changed = true; changed;) {
+        changed = false;
+        layout();
+        for (auto &f: frags) {
+            if (f.kind != Fragment::Kind::Branch || f.isLong || f.ins->op == Op::Call)
+                continue;
+            const auto t = f.ins->target;
+            if (obj.symSection[t] != Section::Text)
+                throw std::runtime_error("encoder: undefined label " + m.name(t));
+            const auto disp = static_cast<std::int64_t>(obj.symOffset[t]) -
+                              static_cast<std::int64_t>(f.offset + 2);
+            if (!fits8(disp)) {
+                f.isLong = true;
+                changed = true;
+            }
+        }
+    }
+    const auto textSize = layout();
+
+    // ---- 输出 ----
+    obj.text.reserve(textSize);
+    for (auto &f: frags) {
+        switch (f.kind) {
+            case Fragment::Kind::Bytes:
+                for (auto &fx: f.fixups)
+                    obj.relocs.push_back({f.offset + fx.offset, fx.kind, fx.sym, fx.addend});
+                obj.text.insert(obj.text.end(), f.bytes.begin(), f.bytes.end());
+                break;
+            case Fragment::Kind::Label:
+                break;
+            case Fragment::Kind::Line:
+                // 同一个偏移上的几行（中间没有生成指令）只留最后一行
+                if (!obj.lines.empty() && obj.lines.back().offset == f.offset)
+                    obj.lines.pop_back();
+                obj.lines.push_back({f.offset, f.ins->line});
+                break;
+            case Fragment::Kind::Align:
+                while (obj.text.size() % f.ins->align) obj.text.push_back(0x90);
+                break;
+            case Fragment::Kind::Branch: {
+                const auto t = f.ins->target;
+                if (obj.symSection[t] != Section::Text)
+                    throw std::runtime_error("encoder: undefined label " + m.name(t));
+                const auto size = branch_size(f);
+                const auto disp = static_cast<std::int64_t>(obj.symOffset[t]) -
+                                  static_cast<std::int64_t>(f.offset + size);
+                if (f.ins->op == Op::Call) {
+                    obj.text.push_back(0xE8);
+                    put32(obj.text, disp);
+                } else if (f.ins->op == Op::Jmp) {
+                    obj.text.push_back(f.isLong ? 0xE9 : 0xEB);
+                    if (f.isLong) put32(obj.text, disp);
+                    else obj.text.push_back(static_cast<std::uint8_t>(disp));
+                } else {
+                    const auto cc = static_cast<std::uint8_t>(f.ins->cond);
+                    if (f.isLong) {
+                        obj.text.push_back(0x0F);
+                        obj.text.push_back(static_cast<std::uint8_t>(0x80 | cc));
+                        put32(obj.text, disp);
+                    } else {
+                        obj.text.push_back(static_cast<std::uint8_t>(0x70 | cc));
+                        obj.text.push_back(static_cast<std::uint8_t>(disp));
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+    return obj;
+}
+
+std::size_t encoded_size(const Instr &i) {
+    Fragment f;
+    encode_fixed(f, i);
+    return f.bytes.size();
+}
+
+} // namespace x86
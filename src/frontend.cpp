@@ -0,0 +1,97 @@
+#include "frontend.hpp"
+#include "parser.tab.hpp"
+
+// Flex (%option reentrant) API; the generated scanner.cpp defines these.
+struct yy_buffer_state;
+using YYBufferState = yy_buffer_state *;
+
+int yylex_init_extra(ScanContext *extra, yyscan_t *scanner);
+int yylex(YYSTYPE *yylval_param, yyscan_t yyscanner);
+int yylex_destroy(yyscan_t scanner);
+void yyset_lineno(int line_number, yyscan_t scanner);
+YYBufferState yy_scan_buffer(char *base, std::size_t size, yyscan_t scanner);
+void yy_delete_buffer(YYBufferState b, yyscan_t scanner);
+
+namespace {
+
+// 一个扫描器实例 + 它的输入缓冲区
+class Scanner {
+public:
+    Scanner(SourceInput &input, StringPool &strings) : ctx_{&input, &strings} {
+        yylex_init_extra(&ctx_, &scanner_);
+        // 有完整缓冲区时原地扫描；流式输入不设置缓冲区，由 YY_INPUT 按需读取
+        if (!input.streaming())
+            buf_ = yy_scan_buffer(input.buffer(), input.size() + 2, scanner_);
+    }
+
+    Scanner(const Scanner &) = delete;
+
+    Scanner &operator=(const Scanner &) = delete;
+
+    ~Scanner() {
+        if (buf_)
+            yy_delete_buffer(buf_, scanner_);
+        yylex_destroy(scanner_);
+    }
+
+    [[nodiscard]] yyscan_t get() const { return scanner_; }
+
+    [[nodiscard]] ScanContext &context() { return ctx_; }
+
+private:
+    ScanContext ctx_;
+    yyscan_t scanner_{nullptr};
+    YYBufferState buf_{nullptr};
+};
+
+} // namespace
+
+ParsedProgram parse_program(SourceInput &input, const bool timeScanner) {
+    auto strings = std::make_shared<StringPool>();
+    Scanner scanner(input, *strings);
+    ParseContext ctx;
+    ctx.timeScanner = timeScanner;
+    if (yyparse(scanner.get(), ctx) != 0)
+        throw std::runtime_error("Parsing failed.");
+    return {ctx.root, std::move(strings), ctx.tokens, ctx.scanSeconds};
+}
+
+ParsedProgram parse_statements(SourceInput &input, const StatementHandler &onStatement, const bool timeScanner) {
+    auto strings = std::make_shared<StringPool>();
+    Scanner scanner(input, *strings);
+    ParseContext ctx;
+    ctx.timeScanner = timeScanner;
+    ctx.onStatement = onStatement;
+    ctx.strings = strings.get();
+    if (yyparse(scanner.get(), ctx) != 0)
+        throw std::runtime_error("Parsing failed.");
+    return {nullptr, std::move(strings), ctx.tokens, ctx.scanSeconds};
+}
+
+ParsedProgram parse_program(const std::string_view source) {
+    auto input = SourceInput::from_string(source);
+    return parse_program(input);
+}
+
+ParsedStatements parse_top_level(const std::string_view text, const int firstLine) {
+    auto input = SourceInput::from_string(text);
+    ParsedStatements parsed{{}, std::make_shared<StringPool>()};
+    Scanner scanner(input, *parsed.strings);
+    yyset_lineno(firstLine, scanner.get());
+    ParseContext ctx;
+    ctx.statements = &parsed.statements;
+    ctx.scan = &scanner.context();
+    if (yyparse(scanner.get(), ctx) != 0)
+        throw std::runtime_error("Parsing failed.");
+    return parsed;
+}
+
+std::size_t count_tokens(SourceInput &input) {
+    StringPool strings;
+    Scanner scanner(input, strings);
+    YYSTYPE value;
+    std::size_t n = 0;
+    while (yylex(&value, scanner.get()) != 0)
+        ++n;
+    return n;
+}
@@ -0,0 +1,551 @@
+#include "inline.hpp"
+#include "blocks.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
+// 速度优先时不看调用位置就内联的过程大小（IR 指令数）
+constexpr std::size_t kAlwaysInline = 8;
+// 速度优先时循环里的调用点可以内联的过程大小
+constexpr std::size_t kLoopInline = 40;
+// 速度优先时一段代码因内联最多增长多少条指令：取它原来的大小与这个数中较大的一个
+constexpr std::size_t kMinGrowth = 64;
+
+static bool is_int_literal(const std::string &s) {
+    if (s.empty()) return false;
+    std::size_t i = s[0] == '-' ? 1 : 0;
+    if (i == s.size()) return false;
+    for (; i < s.size(); ++i) if (s[i] < '0' || s[i] > '9') return false;
+    return true;
+}
+
+static bool is_temp(const std::string &s) { return s.size() > 1 && s[0] == 'T'; }
+// 过程的参数和局部变量：V<过程名>.<变量名>
+static bool is_local(const std::string &s) { return s.size() > 1 && s[0] == 'V' && s.find('.') != std::string::npos; }
+static bool is_global(const std::string &s) { return s.size() > 1 && s[0] == 'V' && s.find('.') == std::string::npos; }
+
+static std::shared_ptr<AssignmentCode> make_copy(const std::string &var, const std::string &value, const int line) {
+    auto a = std::make_shared<AssignmentCode>();
+    a->var = var;
+    a->left = value;
+    a->line = line;
+    return a;
+}
+
+static std::shared_ptr<JumpCode> make_jump(const std::string &d, const int line) {
+    auto j = std::make_shared<JumpCode>();
+    j->dist = d;
+    j->line = line;
+    return j;
+}
+
+static std::shared_ptr<LabelCode> make_label(const std::string &l, const int line) {
+    auto x = std::make_shared<LabelCode>();
+    x->label = l;
+    x->line = line;
+    return x;
+}
+
+// 代价模型里的大小：IR 指令数，标签不算，VectorLoop 算上它的循环体
+static std::size_t ir_size(const InterCodeArray &code) {
+    std::size_t n = 0;
+    for (auto &ins: code.code) {
+        if (ins->kind() == IRKind::VectorLoop)
+            n += 1 + static_cast<const VectorLoopCode &>(*ins).body.size();
+        else if (ins->kind() != IRKind::Label && ins->kind() != IRKind::Procedure)
+            ++n;
+    }
+    return n;
+}
+
+// 调用本身的大小：每个实参一条传参，call，有返回值时再取一次
+static std::size_t call_size(const CallCode &c) { return c.args.size() + (c.var.empty() ? 1 : 2); }
+
+// 指令写入的变量，不写时为空
+static std::string defined_var(const IRInstr &ins) {
+    switch (ins.kind()) {
+        case IRKind::Assignment: return static_cast<const AssignmentCode &>(ins).var;
+        case IRKind::Select: return static_cast<const SelectCode &>(ins).var;
+        case IRKind::Load: return static_cast<const LoadCode &>(ins).var;
+        case IRKind::Call: return static_cast<const CallCode &>(ins).var;
+        case IRKind::VectorLoop: return static_cast<const VectorLoopCode &>(ins).index;
+        default: return "";
+    }
+}
+
+// ins 的拷贝：读写的名字换成 name(x)，标签换成 label(l)
+template<class Name, class Label>
+static std::shared_ptr<IRInstr> rewrite(const std::shared_ptr<IRInstr> &ins, const Name &name, const Label &label) {
+    switch (ins->kind()) {
+        case IRKind::Assignment: {
+            auto a = std::make_shared<AssignmentCode>(static_cast<const AssignmentCode &>(*ins));
+            a->var = name(a->var);
+            a->left = name(a->left);
+            a->right = name(a->right);
+            return a;
+        }
+        case IRKind::Jump: {
+            auto j = std::make_shared<JumpCode>(static_cast<const JumpCode &>(*ins));
+            j->dist = label(j->dist);
+            return j;
+        }
+        case IRKind::Label: {
+            auto l = std::make_shared<LabelCode>(static_cast<const LabelCode &>(*ins));
+            l->label = label(l->label);
+            return l;
+        }
+        case IRKind::Compare: {
+            auto c = std::make_shared<CompareCodeIR>(static_cast<const CompareCodeIR &>(*ins));
+            c->left = name(c->left);
+            c->right = name(c->right);
+            c->jump = label(c->jump);
+            return c;
+        }
+        case IRKind::Print: {
+            auto p = std::make_shared<PrintCodeIR>(static_cast<const PrintCodeIR &>(*ins));
+            p->value = name(p->value);
+            return p;
+        }
+        case IRKind::Select: {
+            auto s = std::make_shared<SelectCode>(static_cast<const SelectCode &>(*ins));
+            s->var = name(s->var);
+            s->left = name(s->left);
+            s->right = name(s->right);
+            s->ifTrue = name(s->ifTrue);
+            s->ifFalse = name(s->ifFalse);
+            return s;
+        }
+        case IRKind::Write: {
+            auto w = std::make_shared<WriteCode>(static_cast<const WriteCode &>(*ins));
+            for (auto &piece: w->pieces)
+                piece.value = name(piece.value);
+            return w;
+        }
+        case IRKind::Load: {
+            auto l = std::make_shared<LoadCode>(static_cast<const LoadCode &>(*ins));
+            l->var = name(l->var);
+            l->index = name(l->index);
+            return l;
+        }
+        case IRKind::Store: {
+            auto s = std::make_shared<StoreCode>(static_cast<const StoreCode &>(*ins));
+            s->index = name(s->index);
+            s->value = name(s->value);
+            return s;
+        }
+        case IRKind::VectorLoop: {
+            auto v = std::make_shared<VectorLoopCode>(static_cast<const VectorLoopCode &>(*ins));
+            v->label = label(v->label);
+            v->index = name(v->index);
+            v->bound = name(v->bound);
+            for (auto &b: v->body)
+                b = rewrite(b, name, label);
+            return v;
+        }
+        case IRKind::Call: {
+            auto c = std::make_shared<CallCode>(static_cast<const CallCode &>(*ins));
+            c->var = name(c->var);
+            for (auto &a: c->args)
+                a = name(a);
+            return c;
+        }
+        case IRKind::Return: {
+            auto r = std::make_shared<ReturnCode>(static_cast<const ReturnCode &>(*ins));
+            r->value = name(r->value);
+            return r;
+        }
+        case IRKind::Procedure:
+            break;
+    }
+    return ins;
+}
+
+// a op b，只在不溢出、结果在 32 位范围内（其它 pass 按 int 解析字面量）时成功
+static bool fold_literal(const std::string &op, const std::int64_t a, const std::int64_t b, std::int64_t &r) {
+    if (op == "+") {
+        if (__builtin_add_overflow(a, b, &r)) return false;
+    } else if (op == "-") {
+        if (__builtin_sub_overflow(a, b, &r)) return false;
+    } else if (op == "*") {
+        if (__builtin_mul_overflow(a, b, &r)) return false;
+    } else if (op == "/") {
+        if (b == 0) return false;
+        r = a / b;
+    } else {
+        return false;
+    }
+    return r >= std::numeric_limits<std::int32_t>::min() && r <= std::numeric_limits<std::int32_t>::max();
+}
+
+// 两边都是字面量的运算算出结果；只赋值一次、值是字面量的临时变量换成这个字面量
+static InterCodeArray propagate_literals(const InterCodeArray &in) {
+    InterCodeArray folded;
+    std::unordered_map<std::string, std::size_t> defs;
+    for (auto &ins: in.code) {
+        auto out = ins;
+        if (ins->kind() == IRKind::Assignment) {
+            const auto &a = static_cast<const AssignmentCode &>(*ins);
+            std::int64_t r;
+            if (!a.op.empty() && is_int_literal(a.left) && is_int_literal(a.right) &&
+                fold_literal(a.op, std::stoll(a.left), std::stoll(a.right), r))
+                out = make_copy(a.var, std::to_string(r), a.line);
+        }
+        if (const auto d = defined_var(*out); !d.empty())
+            ++defs[d];
+        folded.append(out);
+    }
+
+    std::unordered_map<std::string, std::string> known;
+    for (auto &ins: folded.code)
+        if (ins->kind() == IRKind::Assignment) {
+            const auto &a = static_cast<const AssignmentCode &>(*ins);
+            if (is_temp(a.var) && a.op.empty() && is_int_literal(a.left) && defs[a.var] == 1)
+                known[a.var] = a.left;
+        }
+    if (known.empty())
+        return folded;
+
+    auto name = [&known](const std::string &s) {
+        const auto it = known.find(s);
+        return it == known.end() ? s : it->second;
+    };
+    auto label = [](const std::string &l) { return l; };
+    InterCodeArray out;
+    for (auto &ins: folded.code) {
+        if (known.count(defined_var(*ins)) && ins->kind() == IRKind::Assignment)
+            continue;
+        out.append(rewrite(ins, name, label));
+    }
+    return out;
+}
+
+// 特化后的过程体：反复折叠常量、删掉走不到的分支，直到不再变小
+static InterCodeArray simplify(InterCodeArray code) {
+    for (std::size_t before = std::numeric_limits<std::size_t>::max(); ir_size(code) < before;) {
+        before = ir_size(code);
+        code = propagate_literals(code);
+        code = fold_const_conditions(code);
+        code = eliminate_unreachable_blocks(code);
+        code = remove_trivial_jumps(code);
+        code = cleanup_labels(code);
+    }
+    return code;
+}
+
+namespace {
+class Inliner {
+public:
+    explicit Inliner(const bool optimizeSize) : optimizeSize(optimizeSize) {
+    }
+
+    InterCodeArray run(const InterCodeArray &code);
+
+private:
+    struct Procedure {
+        std::shared_ptr<const ProcedureCode> code;
+        bool recursive{false};
+        std::vector<std::string> clones; // 由它特化出的过程，按创建顺序
+    };
+
+    // 一段代码（过程体或顶层）里的调用点逐个按代价模型内联或特化；self 是这段代码所在的过程
+    InterCodeArray expand(const InterCodeArray &code, const std::string &self);
+
+    bool should_inline(const CallCode &call, bool inLoop, std::size_t grown, std::size_t budget) const;
+
+    // 把 call 换成 callee 的过程体追加到 out
+    void inline_call(const CallCode &call, const ProcedureCode &callee, InterCodeArray &out);
+
+    // call 的字面量实参对应的特化版本，没有（不划算）时返回空；args 换成特化版本的实参
+    std::string specialize(const CallCode &call, std::vector<std::string> &args);
+
+    void count_calls(const InterCodeArray &code);
+
+    bool optimizeSize;
+    std::unordered_map<std::string, Procedure> procs;
+    std::unordered_map<std::string, std::size_t> calls; // 过程 -> 现在还有几个调用点
+    std::unordered_map<std::string, std::string> specialized; // 过程和字面量实参 -> 特化版本（空表示不划算）
+    std::size_t inlined{0};
+    std::size_t clones{0};
+};
+}
+
+void Inliner::count_calls(const InterCodeArray &code) {
+    for (auto &ins: code.code)
+        if (ins->kind() == IRKind::Call)
+            ++calls[static_cast<const CallCode &>(*ins).proc];
+}
+
+bool Inliner::should_inline(const CallCode &call, const bool inLoop, const std::size_t grown,
+                            const std::size_t budget) const {
+    const auto it = procs.find(call.proc);
+    if (it == procs.end() || it->second.recursive)
+        return false;
+    const auto size = ir_size(it->second.code->body);
+    // 最后一个调用点：内联之后过程本身被删除，总长度不会增加
+    const bool last = calls.at(call.proc) == 1;
+    if (optimizeSize)
+        return last || size <= call_size(call);
+    if (last)
+        return true;
+    if (size > kAlwaysInline && !(inLoop && size <= kLoopInline))
+        return false;
+    return grown + size <= budget;
+}
+
+InterCodeArray Inliner::expand(const InterCodeArray &code, const std::string &self) {
+    if (std::none_of(code.code.begin(), code.code.end(),
+                     [](const std::shared_ptr<IRInstr> &ins) { return ins->kind() == IRKind::Call; }))
+        return code;
+
+    // 调用点是否在循环里：在加了块标签的拷贝上找循环，再对应回原来的指令
+    const auto labeled = label_blocks(code);
+    const auto loops = find_loops(split_blocks(labeled));
+    std::vector<bool> inLoop(code.code.size(), false);
+    std::size_t block = 0;
+    for (std::size_t i = 0, j = 0; i < labeled.code.size() && j < code.code.size(); ++i) {
+        if (labeled.code[i]->kind() == IRKind::Label && i > 0)
+            ++block;
+        if (labeled.code[i] == code.code[j])
+            inLoop[j++] = loops.depth[block] > 0;
+    }
+
+    const auto budget = optimizeSize ? 0 : std::max(ir_size(code), kMinGrowth);
+    std::size_t grown = 0;
+    bool changed = false;
+    InterCodeArray out;
+    for (std::size_t i = 0; i < code.code.size(); ++i) {
+        const auto &ins = code.code[i];
+        if (ins->kind() != IRKind::Call || static_cast<const CallCode &>(*ins).proc == self) {
+            out.append(ins);
+            continue;
+        }
+        auto call = std::make_shared<CallCode>(static_cast<const CallCode &>(*ins));
+        if (!should_inline(*call, inLoop[i], grown, budget)) {
+            const auto clone = specialize(*call, call->args);
+            if (clone.empty()) {
+                out.append(ins);
+                continue;
+            }
+            --calls[call->proc];
+            ++calls[clone];
+            call->proc = clone;
+            if (!should_inline(*call, inLoop[i], grown, budget)) {
+                out.append(call);
+                continue;
+            }
+        }
+        const auto &callee = *procs.at(call->proc).code;
+        if (calls[call->proc] > 1)
+            grown += ir_size(callee.body);
+        inline_call(*call, callee, out);
+        changed = true;
+    }
+    // 字面量实参代入之后出现的常量运算，一层层算到底
+    for (std::size_t before = changed ? ir_size(out) + 1 : 0; ir_size(out) < before;) {
+        before = ir_size(out);
+        out = propagate_literals(out);
+    }
+    return out;
+}
+
+void Inliner::inline_call(const CallCode &call, const ProcedureCode &callee, InterCodeArray &out) {
+    const auto suffix = "_i" + std::to_string(++inlined);
+    const auto &body = callee.body.code;
+    --calls[call.proc];
+    count_calls(callee.body);
+
+    std::unordered_set<std::string> assigned;
+    bool hasCalls = false;
+    for (auto &ins: body) {
+        if (const auto d = defined_var(*ins); !d.empty())
+            assigned.insert(d);
+        hasCalls = hasCalls || ins->kind() == IRKind::Call;
+    }
+
+    // 临时变量和局部变量都换成这一份自己的名字：同一个过程的两份内联（例如特化版本里
+    // 又内联了一层）在调用方里同时存活时不会互相覆盖
+    std::unordered_map<std::string, std::string> subst;
+    auto name = [&subst, &suffix](const std::string &s) {
+        if (const auto it = subst.find(s); it != subst.end())
+            return it->second;
+        return is_temp(s) || is_local(s) ? s + suffix : s;
+    };
+
+    // 没有被赋值的参数直接换成实参：字面量、调用方的临时变量和局部变量在过程体里都不会变，
+    // 全局变量要求过程体里既不写它、也没有可能写它的调用
+    for (std::size_t k = 0; k < callee.params.size(); ++k) {
+        const auto &param = callee.params[k];
+        const auto &arg = call.args[k];
+        if (!assigned.count(param) && (is_int_literal(arg) || is_temp(arg) || is_local(arg) ||
+                                       (is_global(arg) && !hasCalls && !assigned.count(arg))))
+            subst[param] = arg;
+        else
+            out.append(make_copy(name(param), arg, call.line));
+    }
+
+    auto label = [&suffix](const std::string &l) { return l + suffix; };
+
+    // 中间的 RETURN 跳到末尾的 Lret；最后一条 RETURN 直接落到后面
+    const auto end = "Lret" + suffix;
+    bool jumpsToEnd = false;
+    for (std::size_t k = 0; k < body.size(); ++k) {
+        if (body[k]->kind() != IRKind::Return) {
+            out.append(rewrite(body[k], name, label));
+            continue;
+        }
+        const auto &r = static_cast<const ReturnCode &>(*body[k]);
+        if (!call.var.empty())
+            out.append(make_copy(call.var, name(r.value), r.line));
+        if (k + 1 < body.size()) {
+            out.append(make_jump(end, r.line));
+            jumpsToEnd = true;
+        }
+    }
+    if ((body.empty() || body.back()->kind() != IRKind::Return) && !call.var.empty())
+        out.append(make_copy(call.var, "0", call.line));
+    if (jumpsToEnd)
+        out.append(make_label(end, call.line));
+}
+
+std::string Inliner::specialize(const CallCode &call, std::vector<std::string> &args) {
+    const auto it = procs.find(call.proc);
+    if (it == procs.end())
+        return "";
+    const auto &proc = *it->second.code;
+    std::unordered_set<std::string> assigned;
+    for (auto &ins: proc.body.code)
+        if (const auto d = defined_var(*ins); !d.empty())
+            assigned.insert(d);
+
+    std::unordered_map<std::string, std::string> subst;
+    std::string key = call.proc;
+    for (std::size_t k = 0; k < proc.params.size(); ++k)
+        if (is_int_literal(args[k]) && !assigned.count(proc.params[k])) {
+            subst[proc.params[k]] = args[k];
+            key += " " + std::to_string(k) + "=" + args[k];
+        }
+    if (subst.empty())
+        return "";
+
+    auto cached = specialized.find(key);
+    if (cached == specialized.end()) {
+        auto name = [&subst](const std::string &s) {
+            const auto found = subst.find(s);
+            return found == subst.end() ? s : found->second;
+        };
+        auto label = [](const std::string &l) { return l; };
+        InterCodeArray body;
+        for (auto &ins: proc.body.code)
+            body.append(rewrite(ins, name, label));
+        body = simplify(std::move(body));
+
+        std::string clone;
+        if (ir_size(body) < ir_size(proc.body)) {
+            do
+                clone = call.proc + ".s" + std::to_string(++clones);
+            while (procs.count(clone));
+            auto p = std::make_shared<ProcedureCode>();
+            p->name = clone;
+            p->line = proc.line;
+            for (auto &param: proc.params)
+                if (!subst.count(param))
+                    p->params.push_back(param);
+            p->body = std::move(body);
+            count_calls(p->body);
+            it->second.clones.push_back(clone);
+            procs[clone] = Procedure{p, false, {}};
+        }
+        cached = specialized.emplace(key, clone).first;
+    }
+    if (!cached->second.empty()) {
+        std::vector<std::string> rest;
+        for (std::size_t k = 0; k < proc.params.size(); ++k)
+            if (!subst.count(proc.params[k]))
+                rest.push_back(args[k]);
+        args = std::move(rest);
+    }
+    return cached->second;
+}
+
+InterCodeArray Inliner::run(const InterCodeArray &code) {
+    std::vector<std::string> order;
+    for (auto &ins: code.code)
+        if (ins->kind() == IRKind::Procedure) {
+            const auto p = std::static_pointer_cast<const ProcedureCode>(ins);
+            Procedure proc{p, false, {}};
+            for (auto &b: p->body.code)
+                proc.recursive = proc.recursive || (b->kind() == IRKind::Call &&
+                                                    static_cast<const CallCode &>(*b).proc == p->name);
+            if (procs.emplace(p->name, std::move(proc)).second)
+                order.push_back(p->name);
+            count_calls(p->body);
+        }
+    if (order.empty())
+        return code;
+    count_calls(code);
+
+    // 输入可能已经内联过（--opt 读入的 .ir）：后缀的编号接着其中最大的 _i<k> 往下排
+    auto seen = [this](const std::string &s) {
+        const auto at = s.rfind("_i");
+        if (at != std::string::npos && s.size() - at > 2 && s.size() - at <= 11 &&
+            std::all_of(s.begin() + at + 2, s.end(), [](const char c) { return c >= '0' && c <= '9'; }))
+            inlined = std::max<std::size_t>(inlined, std::stoull(s.substr(at + 2)));
+        return s;
+    };
+    for (auto &ins: code.code)
+        if (ins->kind() != IRKind::Procedure)
+            rewrite(ins, seen, seen);
+        else
+            for (auto &b: static_cast<const ProcedureCode &>(*ins).body.code)
+                rewrite(b, seen, seen);
+
+    // 被调用的过程都定义在前面，按定义的顺序处理就是自底向上
+    for (auto &name: order) {
+        auto p = std::make_shared<ProcedureCode>(*procs.at(name).code);
+        p->body = expand(p->body, name);
+        procs.at(name).code = p;
+    }
+    const auto top = expand(code, "");
+
+    // 从顶层的调用出发，找出还会被调用的过程
+    std::unordered_set<std::string> live;
+    std::vector<std::string> work;
+    auto visit = [&live, &work](const InterCodeArray &c) {
+        for (auto &ins: c.code)
+            if (ins->kind() == IRKind::Call) {
+                const auto &proc = static_cast<const CallCode &>(*ins).proc;
+                if (live.insert(proc).second)
+                    work.push_back(proc);
+            }
+    };
+    visit(top);
+    while (!work.empty()) {
+        const auto name = work.back();
+        work.pop_back();
+        if (const auto it = procs.find(name); it != procs.end())
+            visit(it->second.code->body);
+    }
+
+    // 过程留在原来定义的位置，特化版本紧跟在后面
+    InterCodeArray out;
+    for (auto &ins: top.code) {
+        if (ins->kind() != IRKind::Procedure) {
+            out.append(ins);
+            continue;
+        }
+        const auto &proc = procs.at(static_cast<const ProcedureCode &>(*ins).name);
+        if (live.count(proc.code->name))
+            out.append(std::const_pointer_cast<ProcedureCode>(proc.code));
+        for (auto &clone: proc.clones)
+            if (live.count(clone))
+                out.append(std::const_pointer_cast<ProcedureCode>(procs.at(clone).code));
+    }
+    return out;
+}
+
+InterCodeArray inline_procedures(const InterCodeArray &code, const bool optimizeSize) {
+    return Inliner(optimizeSize).run(code);
+}
@@ -1,5 +1,9 @@
 #include "ir.hpp"
+#include "blocks.hpp"
+#include "inline.hpp"
+#include "vectorize.hpp"
 
+#include <algorithm>
 #include <cstdint>
 #include <queue>
 #include <unordered_set>
@@ -76,6 +80,22 @@ static std::shared_ptr<CompareCodeIR> make_compare(const std::string &l, const s
     return c;
 }
 
+static std::shared_ptr<LoadCode> make_load(const std::string &v, const std::string &a, const std::string &i) {
+    auto l = std::make_shared<LoadCode>();
+    l->var = v;
+    l->array = a;
+    l->index = i;
+    return l;
+}
+
+static std::shared_ptr<StoreCode> make_store(const std::string &a, const std::string &i, const std::string &v) {
+    auto s = std::make_shared<StoreCode>();
+    s->array = a;
+    s->index = i;
+    s->value = v;
+    return s;
+}
+
 static std::shared_ptr<PrintCodeIR> make_print(PrintKind k, const std::string &v, bool nl) {
     auto p = std::make_shared<PrintCodeIR>();
     p->printKind = k;
@@ -88,6 +108,53 @@ IntermediateCodeGen::IntermediateCodeGen(const std::shared_ptr<Node> &root) : ro
     exec_statement(root);
 }
 
+IntermediateCodeGen::IntermediateCodeGen(const std::vector<std::shared_ptr<Node> > &statements,
+                                         std::unordered_map<std::string, std::string> identifiers,
+                                         std::string prefix)
+    : identifiers(std::move(identifiers)), prefix(std::move(prefix)) {
+    for (auto &s: statements)
+        exec_statement(s);
+}
+
+std::int64_t array_length(const std::string &type) {
+    if (type.size() < 6 || type.compare(0, 4, "int[") != 0 || type.back() != ']')
+        return 0;
+    return std::stoll(type.substr(4, type.size() - 5));
+}
+
+int procedure_arity(const std::string &type) {
+    if (type.size() < 7 || type.compare(0, 5, "proc(") != 0 || type.back() != ')')
+        return -1;
+    return std::stoi(type.substr(5, type.size() - 6));
+}
+
+// 声明在 identifiers 里记下的类型："int"、"string" 或 "int[N]"
+static std::string declared_type(const Declaration &d) {
+    std::string type(d.declaration_type.value);
+    if (d.length > 0)
+        type += "[" + std::to_string(d.length) + "]";
+    return type;
+}
+
+void record_declarations(const std::shared_ptr<Node> &n, std::unordered_map<std::string, std::string> &identifiers) {
+    if (!n)
+        return;
+    if (dynamic_cast<const Statement *>(n.get())) {
+        for (const auto &s: statement_list(n))
+            record_declarations(s, identifiers);
+    } else if (const auto is = std::dynamic_pointer_cast<IfStatement>(n)) {
+        record_declarations(is->if_body, identifiers);
+        record_declarations(is->else_body, identifiers);
+    } else if (const auto wh = std::dynamic_pointer_cast<WhileStatement>(n)) {
+        record_declarations(wh->body, identifiers);
+    } else if (const auto de = std::dynamic_pointer_cast<Declaration>(n)) {
+        for (const auto &i: de->identifiers)
+            identifiers[std::string(i.value)] = declared_type(*de);
+    } else if (const auto pr = std::dynamic_pointer_cast<ProcedureNode>(n)) {
+        identifiers["F" + std::string(pr->name.value.substr(1))] = "proc(" + std::to_string(pr->params.size()) + ")";
+    }
+}
+
 static bool eval_cmp_int(const int a, const std::string &op, const int b) {
     if (op == "==") return a == b;
     if (op == "!=") return a != b;
@@ -110,7 +177,9 @@ InterCodeArray fold_const_conditions(const InterCodeArray &in) {
 
                 // 你的 IR 模式：CMP ... goto L_then;  下一条通常是 JMP L_else
                 if (const int b = std::stoi(c->right); eval_cmp_int(a, c->operation, b)) {
-                    out.append(make_jump(c->jump)); // 直接跳 then
+                    const auto j = make_jump(c->jump); // 直接跳 then
+                    j->line = c->line;
+                    out.append(j);
                     // 顺手跳过紧跟的 JMP L_else（如果存在）
                     if (i + 1 < in.code.size() && in.code[i + 1]->kind() == IRKind::Jump) i++;
                 } else {
@@ -129,6 +198,8 @@ InterCodeArray fold_const_conditions(const InterCodeArray &in) {
 InterCodeArray eliminate_unreachable_blocks(const InterCodeArray &in) {
     const auto &code = in.code;
     const int n = static_cast<int>(code.size());
+    if (n == 0)
+        return in; // 空程序（例如空的输入文件）
 
     // ---- 1. label -> index ----
     std::unordered_map<std::string, int> labelIndex;
@@ -171,15 +242,18 @@ InterCodeArray eliminate_unreachable_blocks(const InterCodeArray &in) {
                 push(labelIndex[c->jump]); // taken branch
                 break;
             }
+            case IRKind::Return:
+                break; // 没有后继
             default:
                 push(i + 1);
         }
     }
 
     // ---- 3. filter ----
+    // 过程定义不是顶层控制流的一部分，在哪里都保留
     InterCodeArray out;
     for (int i = 0; i < n; ++i) {
-        if (visited[i])
+        if (visited[i] || code[i]->kind() == IRKind::Procedure)
             out.append(code[i]);
     }
 
@@ -219,7 +293,9 @@ InterCodeArray inline_temp_expr(const InterCodeArray &in) {
         }
 
         // ✅ inline:  X = (A op B)
-        out.append(make_assign(use->var, def->left, def->op, def->right));
+        const auto merged = make_assign(use->var, def->left, def->op, def->right);
+        merged->line = use->line;
+        out.append(merged);
 
         i++; // skip the next instruction (X = T)
     }
@@ -227,10 +303,8 @@ InterCodeArray inline_temp_expr(const InterCodeArray &in) {
     return out;
 }
 
-InterCodeArray remove_dead_assignments(const InterCodeArray &in) {
-    std::unordered_set<std::string> read; // variables that are used (read)
-
-    // -------- pass 1: collect reads --------
+// 过程体里也可能读全局变量：先收集整个程序（顶层和所有过程体）的读取，再分别过滤
+void collect_reads(const InterCodeArray &in, std::unordered_set<std::string> &read) {
     for (auto &ins: in.code) {
         if (const auto a = dynamic_cast<AssignmentCode *>(ins.get())) {
             // RHS reads
@@ -241,10 +315,34 @@ InterCodeArray remove_dead_assignments(const InterCodeArray &in) {
             read.insert(c->right);
         } else if (const auto p = dynamic_cast<PrintCodeIR *>(ins.get())) {
             read.insert(p->value);
+        } else if (const auto sel = dynamic_cast<SelectCode *>(ins.get())) {
+            read.insert(sel->left);
+            read.insert(sel->right);
+            read.insert(sel->ifTrue);
+            read.insert(sel->ifFalse);
+        } else if (const auto w = dynamic_cast<WriteCode *>(ins.get())) {
+            for (auto &piece: w->pieces)
+                read.insert(piece.value);
+        } else if (const auto l = dynamic_cast<LoadCode *>(ins.get())) {
+            read.insert(l->index);
+        } else if (const auto st = dynamic_cast<StoreCode *>(ins.get())) {
+            read.insert(st->index);
+            read.insert(st->value);
+        } else if (const auto v = dynamic_cast<VectorLoopCode *>(ins.get())) {
+            // 循环体与后面的标量循环共用，里面的读取在标量循环中也会被收集到
+            read.insert(v->index);
+            read.insert(v->bound);
+        } else if (const auto call = dynamic_cast<CallCode *>(ins.get())) {
+            read.insert(call->args.begin(), call->args.end());
+        } else if (const auto r = dynamic_cast<ReturnCode *>(ins.get())) {
+            read.insert(r->value);
+        } else if (const auto pr = dynamic_cast<ProcedureCode *>(ins.get())) {
+            collect_reads(pr->body, read);
         }
     }
+}
 
-    // -------- pass 2: filter assignments --------
+InterCodeArray drop_dead_assignments(const InterCodeArray &in, const std::unordered_set<std::string> &read) {
     InterCodeArray out;
     for (auto &ins: in.code) {
         if (const auto a = dynamic_cast<AssignmentCode *>(ins.get())) {
@@ -252,13 +350,37 @@ InterCodeArray remove_dead_assignments(const InterCodeArray &in) {
             // (safe for your language because assignment has no side effects)
             if (!a->var.empty() && read.find(a->var) == read.end())
                 continue;
+        } else if (const auto sel = dynamic_cast<SelectCode *>(ins.get())) {
+            if (read.find(sel->var) == read.end())
+                continue;
+        } else if (const auto l = dynamic_cast<LoadCode *>(ins.get())) {
+            if (read.find(l->var) == read.end())
+                continue;
+        } else if (const auto call = dynamic_cast<CallCode *>(ins.get())) {
+            // 调用本身可能有副作用，只去掉没人读的返回值
+            if (!call->var.empty() && read.find(call->var) == read.end()) {
+                auto c = std::make_shared<CallCode>(*call);
+                c->var.clear();
+                out.append(c);
+                continue;
+            }
+        } else if (const auto pr = dynamic_cast<ProcedureCode *>(ins.get())) {
+            auto p = std::make_shared<ProcedureCode>(*pr);
+            p->body = drop_dead_assignments(pr->body, read);
+            out.append(p);
+            continue;
         }
         out.append(ins);
     }
-
     return out;
 }
 
+InterCodeArray remove_dead_assignments(const InterCodeArray &in) {
+    std::unordered_set<std::string> read; // variables that are used (read)
+    collect_reads(in, read);
+    return drop_dead_assignments(in, read);
+}
+
 InterCodeArray remove_trivial_jumps(const InterCodeArray &in) {
     InterCodeArray out;
     const auto &code = in.code;
@@ -303,33 +425,262 @@ InterCodeArray cleanup_labels(const InterCodeArray &in) {
 }
 
 
-GeneratedIR IntermediateCodeGen::get() const {
-    GeneratedIR g{arr, identifiers, constants};
-    g.code = fold_const_conditions(g.code);
-    g.code = eliminate_unreachable_blocks(g.code);
-    g.code = inline_temp_expr(g.code); // 你已经做到
-    g.code = remove_dead_assignments(g.code); // ⭐ 删 Vdead
-    g.code = remove_trivial_jumps(g.code); // ⭐ 删 JMP L12
-    g.code = cleanup_labels(g.code);
-    g.code = eliminate_unreachable_blocks(g.code); // 可选：再跑一次收尾
+// 对顶层代码和每个过程体分别运行 Pass：过程体与顶层之间没有跳转，各自是一段完整的控制流
+template<InterCodeArray (*Pass)(const InterCodeArray &)>
+static InterCodeArray each_procedure(const InterCodeArray &in) {
+    auto out = Pass(in);
+    for (auto &ins: out.code)
+        if (ins->kind() == IRKind::Procedure) {
+            auto p = std::make_shared<ProcedureCode>(static_cast<const ProcedureCode &>(*ins));
+            p->body = Pass(p->body);
+            ins = p;
+        }
+    return out;
+}
+
+static InterCodeArray inline_for_speed(const InterCodeArray &in) { return inline_procedures(in, false); }
+
+const std::vector<IRPass> &optimization_passes() {
+    static const std::vector<IRPass> passes = {
+        {"inline_procedures", inline_for_speed}, // 按代价模型内联、按常量实参特化（inline.hpp）
+        {"fold_const_conditions", each_procedure<fold_const_conditions>},
+        {"eliminate_unreachable_blocks", each_procedure<eliminate_unreachable_blocks>},
+        {"inline_temp_expr", each_procedure<inline_temp_expr>}, // 你已经做到
+        {"vectorize_loops", each_procedure<vectorize_loops>}, // 数组上的计数循环前加一段 SIMD 版本（vectorize.hpp）
+        {"remove_dead_assignments", remove_dead_assignments}, // ⭐ 删 Vdead
+        {"remove_trivial_jumps", each_procedure<remove_trivial_jumps>}, // ⭐ 删 JMP L12
+        {"cleanup_labels", each_procedure<cleanup_labels>},
+        {"eliminate_unreachable_blocks", each_procedure<eliminate_unreachable_blocks>}, // 可选：再跑一次收尾
+        {"layout_blocks", each_procedure<static_block_layout>}, // 热块连成顺序执行，冷块放到最后（blocks.hpp）
+    };
+    return passes;
+}
+
+const std::vector<IRPass> &local_passes() {
+    // remove_dead_assignments 需要看到变量之后的所有读取，layout_blocks 会给整段程序加出口标签，
+    // 内联需要看到被调用的过程，都不是局部的
+    static const std::vector<IRPass> passes = {
+        {"fold_const_conditions", each_procedure<fold_const_conditions>},
+        {"eliminate_unreachable_blocks", each_procedure<eliminate_unreachable_blocks>},
+        {"inline_temp_expr", each_procedure<inline_temp_expr>},
+        {"vectorize_loops", each_procedure<vectorize_loops>},
+        {"remove_trivial_jumps", each_procedure<remove_trivial_jumps>},
+        {"cleanup_labels", each_procedure<cleanup_labels>},
+        {"eliminate_unreachable_blocks", each_procedure<eliminate_unreachable_blocks>},
+    };
+    return passes;
+}
+
+// -------------------- fuse_prints --------------------
+
+// 一条 WriteCode 最多这么多段（iovec），远小于 IOV_MAX
+constexpr std::size_t kMaxWritePieces = 64;
+
+// 过程体里的赋值：过程可能在任何位置被调用，它赋值的全局变量在顶层不算值已知
+static void count_assignments(const InterCodeArray &body, std::unordered_map<std::string, std::size_t> &assigned) {
+    for (auto &ins: body.code)
+        switch (ins->kind()) {
+            case IRKind::Assignment:
+                ++assigned[static_cast<const AssignmentCode &>(*ins).var];
+                break;
+            case IRKind::Select:
+                ++assigned[static_cast<const SelectCode &>(*ins).var];
+                break;
+            case IRKind::Load:
+                ++assigned[static_cast<const LoadCode &>(*ins).var];
+                break;
+            case IRKind::Call:
+                ++assigned[static_cast<const CallCode &>(*ins).var];
+                break;
+            case IRKind::VectorLoop:
+                ++assigned[static_cast<const VectorLoopCode &>(*ins).index];
+                break;
+            default:
+                break;
+        }
+}
+
+void fuse_prints(GeneratedIR &ir) {
+    const auto &code = ir.code.code;
+
+    // 值在编译期已知的变量：整个程序只赋值一次，且是在开头的直线代码中赋常量，
+    // 那么这条赋值之后读到的总是这个常量；从未赋值的 int 变量总是 0（.bss 清零）
+    std::unordered_map<std::string, std::size_t> assigned;
+    std::unordered_map<std::string, std::pair<std::size_t, std::string> > known; // 变量 -> (赋值的位置, 常量)
+    bool prefix = true;
+    for (std::size_t i = 0; i < code.size(); ++i) {
+        const auto kind = code[i]->kind();
+        if (kind == IRKind::Label || kind == IRKind::Jump || kind == IRKind::Compare)
+            prefix = false;
+        if (kind == IRKind::Assignment) {
+            const auto &a = static_cast<const AssignmentCode &>(*code[i]);
+            ++assigned[a.var];
+            if (prefix && a.op.empty() && (is_int_literal(a.left) || ir.constants.count(a.left)))
+                known[a.var] = {i, a.left};
+        } else if (kind == IRKind::Select) {
+            ++assigned[static_cast<const SelectCode &>(*code[i]).var];
+        } else if (kind == IRKind::Load) {
+            ++assigned[static_cast<const LoadCode &>(*code[i]).var];
+        } else if (kind == IRKind::VectorLoop) {
+            const auto &v = static_cast<const VectorLoopCode &>(*code[i]);
+            ++assigned[v.index];
+            for (auto &ins: v.body)
+                if (ins->kind() == IRKind::Assignment)
+                    ++assigned[static_cast<const AssignmentCode &>(*ins).var];
+        } else if (kind == IRKind::Call) {
+            ++assigned[static_cast<const CallCode &>(*code[i]).var];
+        } else if (kind == IRKind::Procedure) {
+            count_assignments(static_cast<const ProcedureCode &>(*code[i]).body, assigned);
+        }
+    }
+    auto value_at = [&](const std::string &v, const std::size_t at) -> std::string {
+        if (is_int_literal(v) || ir.constants.count(v))
+            return v;
+        if (const auto it = known.find(v); it != known.end() && assigned[v] == 1 && at > it->second.first)
+            return it->second.second;
+        if (const auto it = ir.identifiers.find(v); it != ir.identifiers.end() && it->second == "int" &&
+                                                    !assigned.count(v))
+            return "0";
+        return "";
+    };
+
+    // 新的字符串常量接着已有的 S<n> 编号，相同的文本只占一个
+    int nextString = 0;
+    for (auto &[sym, text]: ir.constants)
+        if (sym.size() > 1 && sym[0] == 'S' && is_int_literal(sym.substr(1)))
+            nextString = std::max(nextString, std::stoi(sym.substr(1)) + 1);
+    std::unordered_map<std::string, std::string> interned;
+    auto intern = [&](const std::string &text) {
+        auto [it, inserted] = interned.emplace(text, "");
+        if (inserted) {
+            it->second = "S" + std::to_string(nextString++);
+            ir.constants[it->second] = text;
+        }
+        return it->second;
+    };
+
+    InterCodeArray out;
+    for (std::size_t i = 0; i < code.size();) {
+        if (code[i]->kind() != IRKind::Print) {
+            out.append(code[i++]);
+            continue;
+        }
+        auto end = i;
+        while (end < code.size() && code[end]->kind() == IRKind::Print)
+            ++end;
+        // 单独一条运行时整数的输出保持原样：_print_num 本来就只有一次 write
+        if (const auto &p = static_cast<const PrintCodeIR &>(*code[i]);
+            end == i + 1 && p.printKind == PrintKind::Int && !is_int_literal(value_at(p.value, i))) {
+            out.append(code[i++]);
+            continue;
+        }
 
+        auto w = std::make_shared<WriteCode>();
+        w->line = code[i]->line;
+        std::string text;
+        auto flush_text = [&] {
+            if (!text.empty())
+                w->pieces.push_back({PrintKind::String, intern(text)});
+            text.clear();
+        };
+        for (; i < end; ++i) {
+            const auto &p = static_cast<const PrintCodeIR &>(*code[i]);
+            const auto v = value_at(p.value, i);
+            if (p.printKind == PrintKind::Int) {
+                if (is_int_literal(v)) {
+                    text += std::to_string(std::stoll(v));
+                } else {
+                    flush_text();
+                    w->pieces.push_back({PrintKind::Int, p.value});
+                }
+                text += '\n'; // 与 _print_num 一致，整数后面总是换行
+            } else {
+                if (const auto c = ir.constants.find(v); c != ir.constants.end()) {
+                    text += c->second;
+                } else {
+                    flush_text();
+                    w->pieces.push_back({PrintKind::String, p.value});
+                }
+                if (p.newline)
+                    text += '\n';
+            }
+            if (w->pieces.size() + 2 >= kMaxWritePieces) {
+                flush_text();
+                out.append(w);
+                w = std::make_shared<WriteCode>();
+                w->line = code[i]->line;
+            }
+        }
+        flush_text();
+        if (!w->pieces.empty())
+            out.append(w);
+    }
+    // 被折叠进常量的变量（例如 msg = "..."）可能不再被读取
+    ir.code = remove_dead_assignments(out);
+}
+
+GeneratedIR IntermediateCodeGen::raw() const {
+    return GeneratedIR{arr, identifiers, constants, arrays};
+}
+
+GeneratedIR IntermediateCodeGen::get() const {
+    GeneratedIR g = raw();
+    for (auto &pass: optimization_passes())
+        g.code = pass.run(g.code);
+    fuse_prints(g);
+    return g;
+}
 
+GeneratedIR IntermediateCodeGen::take_statement(const std::shared_ptr<Node> &statement) {
+    const int firstTemp = tCounter;
+    exec_statement(statement);
+    GeneratedIR g{std::move(arr), {}, std::move(constants), std::move(arrays)};
+    arr = InterCodeArray();
+    constants.clear();
+    arrays.clear();
+    for (int t = firstTemp; t < tCounter; ++t)
+        identifiers.erase("T" + prefix + std::to_string(t));
     return g;
 }
 
-std::string IntermediateCodeGen::nextTemp() { return "T" + std::to_string(tCounter++); }
-std::string IntermediateCodeGen::nextLabel() { return "L" + std::to_string(lCounter++); }
+void IntermediateCodeGen::declare(const std::unordered_map<std::string, std::string> &declarations) {
+    for (auto &[name, type]: declarations)
+        identifiers[name] = type;
+}
+
+std::string IntermediateCodeGen::nextTemp() { return "T" + prefix + std::to_string(tCounter++); }
+std::string IntermediateCodeGen::nextLabel() { return "L" + prefix + std::to_string(lCounter++); }
 std::string IntermediateCodeGen::currentLabel() const // NOLINT
-{ return "L" + std::to_string(lCounter); }
-std::string IntermediateCodeGen::nextStringSym() { return "S" + std::to_string(sCounter++); }
+{ return "L" + prefix + std::to_string(lCounter); }
+std::string IntermediateCodeGen::nextStringSym() { return "S" + prefix + std::to_string(sCounter++); }
+
+void IntermediateCodeGen::emit(std::shared_ptr<IRInstr> ins) {
+    ins->line = line;
+    arr.append(ins);
+}
 
 std::string IntermediateCodeGen::exec_expr(const std::shared_ptr<Node> &n) {
     if (!n)
         throw std::runtime_error("Null expression in IR generation");
 
     // --- Identifier ---
-    if (const auto id = std::dynamic_pointer_cast<IdentifierNode>(n))
-        return id->getValue();
+    if (const auto id = std::dynamic_pointer_cast<IdentifierNode>(n)) {
+        auto name = resolve(id->getValue());
+        if (array_of(name))
+            throw std::runtime_error("array " + name.substr(1) + " used without an index at line " +
+                                     std::to_string(id->tok.line));
+        return name;
+    }
+
+    // --- a[i] ---
+    if (const auto idx = std::dynamic_pointer_cast<IndexNode>(n)) {
+        const auto array = resolve(std::string(idx->array.value));
+        const auto index = exec_index(array, idx->index, idx->array.line);
+        auto t = nextTemp();
+        identifiers[t] = "int";
+        emit(make_load(t, array, index));
+        return t;
+    }
 
     // --- Integer literal ---
     if (const auto num = std::dynamic_pointer_cast<NumberNode>(n))
@@ -347,38 +698,79 @@ std::string IntermediateCodeGen::exec_expr(const std::shared_ptr<Node> &n) {
     if (const auto bin = std::dynamic_pointer_cast<BinOpNode>(n)) {
         const auto left = exec_expr(bin->left);
         const auto right = exec_expr(bin->right);
-        const std::string &op = bin->op_tok.value;
-
-        // ===== Constant Folding (INT only) =====
-        if (is_int_literal(left) && is_int_literal(right)) {
-            const int a = std::stoi(left);
-            const int b = std::stoi(right);
-            int r = 0;
-
-            if (op == "+") r = a + b;
-            else if (op == "-") r = a - b;
-            else if (op == "*") r = a * b;
-            else if (op == "/") r = a / b; // assume b != 0
-            else
-                goto NO_FOLD;
-
-            return std::to_string(r); // ★ 不生成 IR
-        }
-
-    NO_FOLD:
-        auto t = nextTemp();
-        identifiers[t] = "int";
-        arr.append(make_assign(t, left, op, right));
-        return t;
+        return exec_binary(left, std::string(bin->op_tok.value), right);
     }
 
+    // --- f(args) ---
+    if (const auto call = std::dynamic_pointer_cast<CallNode>(n))
+        return exec_call(call, true);
+
     throw std::runtime_error("Unsupported expression node in IR generation");
 }
 
 
+std::string IntermediateCodeGen::exec_binary(const std::string &left, const std::string &op, const std::string &right) {
+    // ===== Constant Folding (INT only) =====
+    if (is_int_literal(left) && is_int_literal(right)) {
+        const int a = std::stoi(left);
+        const int b = std::stoi(right);
+        int r = 0;
+
+        if (op == "+") r = a + b;
+        else if (op == "-") r = a - b;
+        else if (op == "*") r = a * b;
+        else if (op == "/") r = a / b; // assume b != 0
+        else
+            goto NO_FOLD;
+
+        return std::to_string(r); // ★ 不生成 IR
+    }
+
+NO_FOLD:
+    auto t = nextTemp();
+    identifiers[t] = "int";
+    emit(make_assign(t, left, op, right));
+    return t;
+}
+
+
 void IntermediateCodeGen::exec_assignment(const std::shared_ptr<Assignment> &a) {
+    line = a->identifier.line;
+    const auto var = resolve(std::string(a->identifier.value));
+    if (a->index) {
+        // 先算下标再算右边，与读取 a[i] 时的顺序一致
+        const auto index = exec_index(var, a->index, line);
+        const auto value = exec_expr(a->expression);
+        if (isStringValue(value, identifiers, constants))
+            throw std::runtime_error("cannot store a string in int array " + var.substr(1) + " at line " +
+                                     std::to_string(line));
+        emit(make_store(var, index, value));
+        return;
+    }
+    if (array_of(var))
+        throw std::runtime_error("cannot assign to array " + var.substr(1) + " at line " + std::to_string(line));
     const auto right = exec_expr(a->expression);
-    arr.append(make_assign(a->identifier.value, right, "", ""));
+    emit(make_assign(var, right, "", ""));
+}
+
+std::int64_t IntermediateCodeGen::array_of(const std::string &name) const {
+    const auto it = identifiers.find(name);
+    return it == identifiers.end() ? 0 : array_length(it->second);
+}
+
+std::string IntermediateCodeGen::exec_index(const std::string &array, const std::shared_ptr<Node> &index,
+                                            const int at) {
+    const auto length = array_of(array);
+    if (length == 0)
+        throw std::runtime_error(array.substr(1) + " is not an array at line " + std::to_string(at));
+    auto i = exec_expr(index);
+    if (isStringValue(i, identifiers, constants))
+        throw std::runtime_error("array index must be an int at line " + std::to_string(at));
+    // 运行时的下标不检查（与 C 相同），字面量下标在这里就能确定是否越界
+    if (is_int_literal(i) && (i[0] == '-' || i.size() > 18 || std::stoll(i) >= length))
+        throw std::runtime_error("index " + i + " is out of bounds for " + array.substr(1) + "[" +
+                                 std::to_string(length) + "] at line " + std::to_string(at));
+    return i;
 }
 
 void IntermediateCodeGen::exec_condition(const std::shared_ptr<Condition> &c) {
@@ -386,56 +778,96 @@ void IntermediateCodeGen::exec_condition(const std::shared_ptr<Condition> &c) {
     const auto right = exec_expr(c->right_expression);
     // Compare should jump to the label of the next emitted label (body)
     const auto body = currentLabel();
-    arr.append(make_compare(left, c->comparison.value, right, body));
+    emit(make_compare(left, std::string(c->comparison.value), right, body));
+}
+
+void IntermediateCodeGen::exec_branch(const std::shared_ptr<Condition> &c, const std::string &ifTrue,
+                                      const std::string &ifFalse) {
+    if (!c->lhs) {
+        const auto left = exec_expr(c->left_expression);
+        const auto right = exec_expr(c->right_expression);
+        emit(make_compare(left, std::string(c->comparison.value), right, ifTrue));
+        emit(make_jump(ifFalse));
+        return;
+    }
+    const std::string op(c->comparison.value);
+    if (op == "!") {
+        // 取反的比较直接跳到 ifTrue，不用先跳 ifFalse 再跳回来
+        exec_jump_if(c->lhs, false, ifTrue);
+        emit(make_jump(ifFalse));
+    } else if (op == "&&") {
+        // 左边不成立就不再求右边
+        exec_jump_if(c->lhs, false, ifFalse);
+        exec_branch(c->rhs, ifTrue, ifFalse);
+    } else {
+        exec_jump_if(c->lhs, true, ifTrue);
+        exec_branch(c->rhs, ifTrue, ifFalse);
+    }
+}
+
+void IntermediateCodeGen::exec_jump_if(const std::shared_ptr<Condition> &c, const bool sense,
+                                       const std::string &target) {
+    if (!c->lhs) {
+        const auto left = exec_expr(c->left_expression);
+        const auto right = exec_expr(c->right_expression);
+        const std::string op(c->comparison.value);
+        emit(make_compare(left, sense ? op : negate_comparison(op), right, target));
+        return;
+    }
+    const std::string op(c->comparison.value);
+    if (op == "!") {
+        exec_jump_if(c->lhs, !sense, target);
+        return;
+    }
+    // a && b 为假、a || b 为真时，左边一项就能决定结果，直接跳到 target；
+    // 另外两种情况左边要先决定是否继续看右边，不继续时越过右边的测试
+    const bool conjunction = op == "&&";
+    if (sense != conjunction) {
+        exec_jump_if(c->lhs, sense, target);
+        exec_jump_if(c->rhs, sense, target);
+        return;
+    }
+    const auto skip = nextLabel();
+    exec_jump_if(c->lhs, !sense, skip);
+    exec_jump_if(c->rhs, sense, target);
+    emit(make_label(skip));
 }
 
 void IntermediateCodeGen::exec_if(const std::shared_ptr<IfStatement> &i) {
+    const int at = i->if_condition->comparison.line;
+    line = at;
     if (i->else_body) {
         const auto L_then = nextLabel();
         const auto L_else = nextLabel();
         const auto L_end = nextLabel();
 
-        const auto left = exec_expr(i->if_condition->left_expression);
-        const auto right = exec_expr(i->if_condition->right_expression);
-
-        // 条件成立 -> 进入 then
-        arr.append(make_compare(left,
-                                i->if_condition->comparison.value,
-                                right,
-                                L_then));
-
-        // 条件不成立 -> 直接跳 else
-        arr.append(make_jump(L_else));
+        // 条件成立 -> 进入 then，不成立 -> 直接跳 else
+        exec_branch(i->if_condition, L_then, L_else);
 
         // then 部分
-        arr.append(make_label(L_then));
+        emit(make_label(L_then));
         exec_statement(i->if_body);
-        arr.append(make_jump(L_end));
+        line = at;
+        emit(make_jump(L_end));
 
         // else 部分
-        arr.append(make_label(L_else));
+        emit(make_label(L_else));
         exec_statement(i->else_body);
 
         // if 结束
-        arr.append(make_label(L_end));
+        line = at;
+        emit(make_label(L_end));
     } else {
         const auto L_then = nextLabel();
         const auto L_end = nextLabel();
 
-        const auto left = exec_expr(i->if_condition->left_expression);
-        const auto right = exec_expr(i->if_condition->right_expression);
-
-        arr.append(make_compare(left,
-                                i->if_condition->comparison.value,
-                                right,
-                                L_then));
+        exec_branch(i->if_condition, L_then, L_end);
 
-        arr.append(make_jump(L_end));
-
-        arr.append(make_label(L_then));
+        emit(make_label(L_then));
         exec_statement(i->if_body);
 
-        arr.append(make_label(L_end));
+        line = at;
+        emit(make_label(L_end));
     }
 }
 
@@ -444,35 +876,30 @@ void IntermediateCodeGen::exec_while(const std::shared_ptr<WhileStatement> &w) {
     const auto L_start = nextLabel();
     const auto L_body = nextLabel();
     const auto L_end = nextLabel();
+    const int at = w->condition->comparison.line;
+    line = at;
 
-    arr.append(make_label(L_start));
-
-    const auto left = exec_expr(w->condition->left_expression);
-    const auto right = exec_expr(w->condition->right_expression);
-
-    // 条件成立 -> 进入循环体
-    arr.append(make_compare(left,
-                            w->condition->comparison.value,
-                            right,
-                            L_body));
+    emit(make_label(L_start));
 
-    // 条件不成立 -> 跳出循环
-    arr.append(make_jump(L_end));
+    // 条件成立 -> 进入循环体，不成立 -> 跳出循环
+    exec_branch(w->condition, L_body, L_end);
 
-    arr.append(make_label(L_body));
+    emit(make_label(L_body));
     exec_statement(w->body);
-    arr.append(make_jump(L_start));
+    line = at; // 回边和出口算作 while 所在的行
+    emit(make_jump(L_start));
 
-    arr.append(make_label(L_end));
+    emit(make_label(L_end));
 }
 
 
 void IntermediateCodeGen::exec_print(const std::shared_ptr<PrintStatement> &p) {
+    line = p->line;
     // prints("...") —— 直接输出字符串字面量并换行
     if (p->type == "string") {
         const auto sym = nextStringSym();
         constants[sym] = p->strValue;
-        arr.append(make_print(PrintKind::String, sym, true));
+        emit(make_print(PrintKind::String, sym, true));
         return;
     }
 
@@ -486,43 +913,80 @@ void IntermediateCodeGen::exec_print(const std::shared_ptr<PrintStatement> &p) {
         // string + int
         if (isStringValue(left, identifiers, constants) &&
             isIntValue(right, identifiers, constants)) {
-            arr.append(make_print(PrintKind::String, left, false));
-            arr.append(make_print(PrintKind::Int, right, true));
+            emit(make_print(PrintKind::String, left, false));
+            emit(make_print(PrintKind::Int, right, true));
             return;
         }
 
         // int + string
         if (isIntValue(left, identifiers, constants) &&
             isStringValue(right, identifiers, constants)) {
-            arr.append(make_print(PrintKind::Int, left, true));
-            arr.append(make_print(PrintKind::String, right, true));
+            emit(make_print(PrintKind::Int, left, true));
+            emit(make_print(PrintKind::String, right, true));
             return;
         }
+
+        // 两边已经求过值（可能调用了过程），不能再求一次
+        emit(make_print(PrintKind::Int, exec_binary(left, std::string(bin->op_tok.value), right), true));
+        return;
     }
 
     // fallback：普通 int
     const auto v = exec_expr(expr);
 
     if (const auto it = identifiers.find(v); it != identifiers.end() && it->second == "string") {
-        arr.append(make_print(PrintKind::String, v, true));
+        emit(make_print(PrintKind::String, v, true));
         return;
     }
 
-    arr.append(make_print(PrintKind::Int, v, true));
+    emit(make_print(PrintKind::Int, v, true));
 }
 
 
 void IntermediateCodeGen::exec_declaration(const std::shared_ptr<Declaration> &d) {
-    for (const auto &i: d->identifiers)
-        identifiers[i.value] = d->declaration_type.value;
+    const auto type = declared_type(*d);
+    if (!procedure.empty()) {
+        // 局部变量每次调用都从 0 开始（全局变量在 .bss 里，本来就是 0）
+        for (const auto &i: d->identifiers) {
+            const std::string source(i.value);
+            if (d->length > 0)
+                throw std::runtime_error("array " + source.substr(1) + " must be declared outside of procedures at line " +
+                                         std::to_string(i.line));
+            if (const auto it = locals.find(source); it != locals.end() && it->second)
+                throw std::runtime_error(source.substr(1) + " is already a parameter of " + procedure + " at line " +
+                                         std::to_string(i.line));
+            locals.emplace(source, false);
+            const auto name = resolve(source);
+            if (const auto it = identifiers.find(name); it != identifiers.end() && it->second != type)
+                throw std::runtime_error("conflicting declaration of " + source.substr(1) + " at line " +
+                                         std::to_string(i.line));
+            identifiers[name] = type;
+            if (!d->initialized) {
+                line = i.line;
+                emit(make_assign(name, "0", "", ""));
+            }
+        }
+        return;
+    }
+    for (const auto &i: d->identifiers) {
+        std::string name(i.value);
+        // 数组与标量共用名字会让两种用法指向不同的存储，不允许；同样大小的数组可以重复声明
+        if (const auto it = identifiers.find(name);
+            it != identifiers.end() && it->second != type && (d->length > 0 || array_length(it->second) > 0))
+            throw std::runtime_error("conflicting declaration of " + name.substr(1) + " at line " +
+                                     std::to_string(i.line));
+        if (d->length > 0)
+            arrays[name] = d->length;
+        identifiers[std::move(name)] = type;
+    }
 }
 
 void IntermediateCodeGen::exec_statement(const std::shared_ptr<Node> &n) {
     if (!n)
         return;
-    if (const auto st = std::dynamic_pointer_cast<Statement>(n)) {
-        exec_statement(st->left);
-        exec_statement(st->right);
+    if (dynamic_cast<const Statement *>(n.get())) {
+        for (const auto &s: statement_list(n))
+            exec_statement(s);
         return;
     }
     if (const auto is = std::dynamic_pointer_cast<IfStatement>(n)) {
@@ -545,4 +1009,99 @@ void IntermediateCodeGen::exec_statement(const std::shared_ptr<Node> &n) {
         exec_assignment(asg);
         return;
     }
+    if (const auto call = std::dynamic_pointer_cast<CallNode>(n)) {
+        line = call->name.line;
+        exec_call(call, false);
+        return;
+    }
+    if (const auto ret = std::dynamic_pointer_cast<ReturnStatement>(n)) {
+        exec_return(ret);
+        return;
+    }
+    if (const auto proc = std::dynamic_pointer_cast<ProcedureNode>(n)) {
+        exec_procedure(proc);
+        return;
+    }
+}
+
+std::string IntermediateCodeGen::resolve(const std::string &name) const {
+    if (procedure.empty() || !locals.count(name))
+        return name;
+    return "V" + procedure + "." + name.substr(1);
+}
+
+void IntermediateCodeGen::exec_procedure(const std::shared_ptr<ProcedureNode> &p) {
+    line = p->name.line;
+    const auto name = std::string(p->name.value.substr(1));
+    const auto symbol = "F" + name;
+    if (identifiers.count(symbol))
+        throw std::runtime_error("procedure " + name + " is already defined at line " + std::to_string(line));
+    if (p->params.size() > kMaxParams)
+        throw std::runtime_error("procedure " + name + " has more than " + std::to_string(kMaxParams) +
+                                 " parameters at line " + std::to_string(line));
+    // 先记下签名，过程体里可以递归调用自己
+    identifiers[symbol] = "proc(" + std::to_string(p->params.size()) + ")";
+
+    auto proc = std::make_shared<ProcedureCode>();
+    proc->name = symbol;
+    procedure = name;
+    for (const auto &param: p->params) {
+        const std::string source(param.value);
+        if (!locals.emplace(source, true).second)
+            throw std::runtime_error("duplicate parameter " + source.substr(1) + " of " + name + " at line " +
+                                     std::to_string(param.line));
+        proc->params.push_back(resolve(source));
+        identifiers[proc->params.back()] = "int";
+    }
+
+    // 过程体单独收集，外面的 arr 先放到一边
+    auto outer = std::move(arr);
+    arr = InterCodeArray();
+    exec_statement(p->body);
+    proc->body = std::move(arr);
+    arr = std::move(outer);
+    procedure.clear();
+    locals.clear();
+
+    line = p->name.line;
+    emit(proc);
+}
+
+std::string IntermediateCodeGen::exec_call(const std::shared_ptr<CallNode> &c, const bool value) {
+    const int at = c->name.line;
+    const auto name = std::string(c->name.value.substr(1));
+    const auto it = identifiers.find("F" + name);
+    if (it == identifiers.end() || procedure_arity(it->second) < 0)
+        throw std::runtime_error("undefined procedure " + name + " at line " + std::to_string(at));
+    if (const auto arity = procedure_arity(it->second); static_cast<std::size_t>(arity) != c->args.size())
+        throw std::runtime_error("procedure " + name + " takes " + std::to_string(arity) + " arguments but " +
+                                 std::to_string(c->args.size()) + " were given at line " + std::to_string(at));
+
+    auto call = std::make_shared<CallCode>();
+    call->proc = it->first;
+    for (const auto &a: c->args) {
+        auto v = exec_expr(a);
+        if (isStringValue(v, identifiers, constants))
+            throw std::runtime_error("arguments of " + name + " must be ints at line " + std::to_string(at));
+        call->args.push_back(std::move(v));
+    }
+    if (value) {
+        call->var = nextTemp();
+        identifiers[call->var] = "int";
+    }
+    line = at;
+    emit(call);
+    return call->var;
+}
+
+void IntermediateCodeGen::exec_return(const std::shared_ptr<ReturnStatement> &r) {
+    line = r->line;
+    if (procedure.empty())
+        throw std::runtime_error("return outside of a procedure at line " + std::to_string(line));
+    auto ret = std::make_shared<ReturnCode>();
+    ret->value = r->value ? exec_expr(r->value) : "0";
+    if (isStringValue(ret->value, identifiers, constants))
+        throw std::runtime_error("procedure " + procedure + " must return an int at line " + std::to_string(line));
+    line = r->line;
+    emit(ret);
 }
@@ -0,0 +1,490 @@
+#include "irfile.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace irfile {
+
+// -------------------- 写 --------------------
+
+namespace {
+// 字符串去重，下标按第一次出现的顺序分配
+class StringTable {
+public:
+    std::uint32_t intern(const std::string &s) {
+        auto [it, inserted] = index_.emplace(s, static_cast<std::uint32_t>(refs_.size()));
+        if (inserted) {
+            if (data_.size() + s.size() + 1 > UINT32_MAX)
+                throw std::runtime_error("IR string data exceeds 4 GiB");
+            refs_.push_back(StringRef{static_cast<std::uint32_t>(data_.size()), static_cast<std::uint32_t>(s.size())});
+            data_ += s;
+            data_ += '\0';
+        }
+        return it->second;
+    }
+
+    const std::vector<StringRef> &refs() const { return refs_; }
+
+    const std::string &data() const { return data_; }
+
+private:
+    std::unordered_map<std::string, std::uint32_t> index_;
+    std::vector<StringRef> refs_;
+    std::string data_;
+};
+
+std::uint64_t align8(const std::uint64_t n) { return (n + 7) & ~std::uint64_t{7}; }
+
+template<typename T>
+void put(std::vector<std::uint8_t> &out, const std::uint64_t offset, const std::vector<T> &items) {
+    if (!items.empty())
+        std::memcpy(out.data() + offset, items.data(), items.size() * sizeof(T));
+}
+}
+
+// unordered_map 的遍历顺序不确定，按名字排序后写出
+static std::vector<Pair> sorted_pairs(const std::unordered_map<std::string, std::string> &m, StringTable &strings) {
+    const std::map<std::string, std::string> ordered(m.begin(), m.end());
+    std::vector<Pair> pairs;
+    for (auto &[k, v]: ordered) {
+        const auto key = strings.intern(k);
+        pairs.push_back(Pair{key, strings.intern(v)});
+    }
+    return pairs;
+}
+
+// VectorLoop 的循环体、Procedure 的过程体紧跟在它自己的记录后面；
+// records 记下每个 Procedure 的过程体展开后有几条记录
+static void flatten(const InterCodeArray &code, std::vector<const IRInstr *> &flat,
+                    std::unordered_map<const IRInstr *, std::uint32_t> &records) {
+    for (auto &ins: code.code) {
+        flat.push_back(ins.get());
+        if (ins->kind() == IRKind::VectorLoop) {
+            for (auto &b: static_cast<const VectorLoopCode &>(*ins).body)
+                flat.push_back(b.get());
+        } else if (ins->kind() == IRKind::Procedure) {
+            const auto first = flat.size();
+            flatten(static_cast<const ProcedureCode &>(*ins).body, flat, records);
+            records[ins.get()] = static_cast<std::uint32_t>(flat.size() - first);
+        }
+    }
+}
+
+std::vector<std::uint8_t> serialize(const GeneratedIR &ir) {
+    StringTable strings;
+    std::vector<Instr> instrs;
+    std::vector<Piece> pieces;
+    std::vector<const IRInstr *> flat;
+    std::unordered_map<const IRInstr *, std::uint32_t> records;
+    flat.reserve(ir.code.code.size());
+    flatten(ir.code, flat, records);
+    instrs.reserve(flat.size());
+
+    // 实参 / 参数列表放在 Piece 表里（kind 不用），返回起始下标
+    auto names = [&pieces, &strings](const std::vector<std::string> &list) {
+        const auto first = static_cast<std::uint32_t>(pieces.size());
+        for (auto &name: list)
+            pieces.push_back(Piece{0, strings.intern(name)});
+        return first;
+    };
+
+    for (const auto *ins: flat) {
+        Instr r{};
+        r.kind = static_cast<std::uint8_t>(ins->kind());
+        r.line = static_cast<std::uint32_t>(ins->line);
+        auto ops = [&](std::initializer_list<const std::string *> fields) {
+            unsigned k = 0;
+            for (const auto *f: fields)
+                r.ops[k++] = strings.intern(*f);
+        };
+        switch (ins->kind()) {
+            case IRKind::Assignment: {
+                const auto &a = static_cast<const AssignmentCode &>(*ins);
+                ops({&a.var, &a.left, &a.op, &a.right});
+                break;
+            }
+            case IRKind::Jump:
+                ops({&static_cast<const JumpCode &>(*ins).dist});
+                break;
+            case IRKind::Label:
+                ops({&static_cast<const LabelCode &>(*ins).label});
+                break;
+            case IRKind::Compare: {
+                const auto &c = static_cast<const CompareCodeIR &>(*ins);
+                ops({&c.left, &c.operation, &c.right, &c.jump});
+                break;
+            }
+            case IRKind::Print: {
+                const auto &p = static_cast<const PrintCodeIR &>(*ins);
+                r.printKind = static_cast<std::uint8_t>(p.printKind);
+                r.newline = p.newline;
+                ops({&p.value});
+                break;
+            }
+            case IRKind::Select: {
+                const auto &s = static_cast<const SelectCode &>(*ins);
+                ops({&s.var, &s.left, &s.operation, &s.right, &s.ifTrue, &s.ifFalse});
+                break;
+            }
+            case IRKind::Write: {
+                const auto &w = static_cast<const WriteCode &>(*ins);
+                r.ops[0] = static_cast<std::uint32_t>(pieces.size());
+                r.ops[1] = static_cast<std::uint32_t>(w.pieces.size());
+                for (auto &piece: w.pieces)
+                    pieces.push_back(Piece{static_cast<std::uint32_t>(piece.kind), strings.intern(piece.value)});
+                break;
+            }
+            case IRKind::Load: {
+                const auto &l = static_cast<const LoadCode &>(*ins);
+                ops({&l.var, &l.array, &l.index});
+                break;
+            }
+            case IRKind::Store: {
+                const auto &st = static_cast<const StoreCode &>(*ins);
+                ops({&st.array, &st.index, &st.value});
+                break;
+            }
+            case IRKind::VectorLoop: {
+                const auto &v = static_cast<const VectorLoopCode &>(*ins);
+                ops({&v.label, &v.index, &v.operation, &v.bound});
+                r.ops[4] = static_cast<std::uint32_t>(v.body.size());
+                break;
+            }
+            case IRKind::Call: {
+                const auto &c = static_cast<const CallCode &>(*ins);
+                ops({&c.var, &c.proc});
+                r.ops[2] = names(c.args);
+                r.ops[3] = static_cast<std::uint32_t>(c.args.size());
+                break;
+            }
+            case IRKind::Return:
+                ops({&static_cast<const ReturnCode &>(*ins).value});
+                break;
+            case IRKind::Procedure: {
+                const auto &p = static_cast<const ProcedureCode &>(*ins);
+                ops({&p.name});
+                r.ops[1] = names(p.params);
+                r.ops[2] = static_cast<std::uint32_t>(p.params.size());
+                r.ops[3] = records.at(ins);
+                break;
+            }
+        }
+        instrs.push_back(r);
+    }
+    const auto idents = sorted_pairs(ir.identifiers, strings);
+    const auto consts = sorted_pairs(ir.constants, strings);
+
+    Header h{};
+    std::memcpy(h.magic, kMagic, sizeof kMagic);
+    h.version = kVersion;
+    h.instrSize = sizeof(Instr);
+    std::uint64_t offset = sizeof(Header);
+    auto section = [&offset](std::uint64_t &countField, std::uint64_t &offsetField,
+                             const std::uint64_t count, const std::uint64_t size) {
+        countField = count;
+        offsetField = offset;
+        offset = align8(offset + count * size);
+    };
+    section(h.instrCount, h.instrOffset, instrs.size(), sizeof(Instr));
+    section(h.pieceCount, h.pieceOffset, pieces.size(), sizeof(Piece));
+    section(h.stringCount, h.stringOffset, strings.refs().size(), sizeof(StringRef));
+    section(h.identCount, h.identOffset, idents.size(), sizeof(Pair));
+    section(h.constCount, h.constOffset, consts.size(), sizeof(Pair));
+    section(h.dataSize, h.dataOffset, strings.data().size(), 1);
+    h.fileSize = offset;
+
+    std::vector<std::uint8_t> out(offset, 0);
+    std::memcpy(out.data(), &h, sizeof h);
+    put(out, h.instrOffset, instrs);
+    put(out, h.pieceOffset, pieces);
+    put(out, h.stringOffset, strings.refs());
+    put(out, h.identOffset, idents);
+    put(out, h.constOffset, consts);
+    std::memcpy(out.data() + h.dataOffset, strings.data().data(), strings.data().size());
+    return out;
+}
+
+// -------------------- 读 --------------------
+
+File File::open(const std::string &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        throw std::runtime_error(path + ": not a regular file");
+    }
+    const auto size = static_cast<std::size_t>(st.st_size);
+    if (size < sizeof(Header)) {
+        close(fd);
+        throw std::runtime_error(path + ": not an IR file");
+    }
+    void *base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        throw std::runtime_error("Cannot map " + path + ": " + std::strerror(errno));
+
+    File f;
+    f.data_ = static_cast<const std::uint8_t *>(base);
+    f.size_ = size;
+    f.mapped_ = size;
+    f.validate(path);
+    return f;
+}
+
+File File::from_bytes(std::vector<std::uint8_t> bytes) {
+    File f;
+    f.owned_ = std::move(bytes);
+    f.data_ = f.owned_.data();
+    f.size_ = f.owned_.size();
+    f.validate("IR buffer");
+    return f;
+}
+
+File::File(File &&other) noexcept { *this = std::move(other); }
+
+File &File::operator=(File &&other) noexcept {
+    if (this != &other) {
+        release();
+        owned_ = std::move(other.owned_);
+        data_ = other.mapped_ ? other.data_ : owned_.data();
+        size_ = other.size_;
+        mapped_ = other.mapped_;
+        other.data_ = nullptr;
+        other.size_ = other.mapped_ = 0;
+    }
+    return *this;
+}
+
+File::~File() { release(); }
+
+void File::release() {
+    if (mapped_)
+        munmap(const_cast<std::uint8_t *>(data_), mapped_);
+    data_ = nullptr;
+    size_ = mapped_ = 0;
+    owned_.clear();
+}
+
+void File::validate(const std::string &name) const {
+    if (size_ < sizeof(Header) || std::memcmp(header().magic, kMagic, sizeof kMagic) != 0)
+        throw std::runtime_error(name + ": not an IR file");
+    const auto &h = header();
+    if (h.version != kVersion || h.instrSize != sizeof(Instr))
+        throw std::runtime_error(name + ": unsupported IR version " + std::to_string(h.version));
+    if (h.fileSize != size_)
+        throw std::runtime_error(name + ": truncated IR file");
+    // 每张表都必须落在文件内、8 字节对齐（计数先除再比较，避免乘法溢出）
+    auto fits = [this](const std::uint64_t offset, const std::uint64_t count, const std::uint64_t size) {
+        return offset % 8 == 0 && offset <= size_ && count <= (size_ - offset) / size;
+    };
+    if (!fits(h.instrOffset, h.instrCount, sizeof(Instr)) || !fits(h.pieceOffset, h.pieceCount, sizeof(Piece)) ||
+        !fits(h.stringOffset, h.stringCount, sizeof(StringRef)) || !fits(h.identOffset, h.identCount, sizeof(Pair)) ||
+        !fits(h.constOffset, h.constCount, sizeof(Pair)) || !fits(h.dataOffset, h.dataSize, 1))
+        throw std::runtime_error(name + ": corrupt IR file");
+}
+
+const Instr &File::instr(const std::size_t i) const {
+    if (i >= header().instrCount)
+        throw std::runtime_error("IR instruction index out of range");
+    return table<Instr>(header().instrOffset)[i];
+}
+
+std::string_view File::string(const std::uint32_t id) const {
+    const auto &h = header();
+    if (id >= h.stringCount)
+        throw std::runtime_error("IR string index out of range");
+    const auto &ref = table<StringRef>(h.stringOffset)[id];
+    if (ref.offset > h.dataSize || ref.size > h.dataSize - ref.offset)
+        throw std::runtime_error("corrupt IR string table");
+    return {reinterpret_cast<const char *>(data_ + h.dataOffset + ref.offset), ref.size};
+}
+
+// flat[i, end) 收成代码：VectorLoop 收下紧跟着的循环体，Procedure 收下紧跟着的过程体（过程体里不再有过程）
+static void regroup(const InterCodeArray &flat, const std::vector<std::uint32_t> &records, std::size_t &i,
+                    const std::size_t end, const bool inProcedure, InterCodeArray &out) {
+    while (i < end) {
+        const auto &ins = flat.code[i];
+        const auto size = records[i++];
+        out.append(ins);
+        if (ins->kind() == IRKind::VectorLoop) {
+            for (auto &b: static_cast<VectorLoopCode &>(*ins).body) {
+                if (i >= end)
+                    throw std::runtime_error("corrupt IR vector loop");
+                b = flat.code[i++];
+                if (b->kind() == IRKind::VectorLoop || b->kind() == IRKind::Procedure)
+                    throw std::runtime_error("corrupt IR vector loop");
+            }
+        } else if (ins->kind() == IRKind::Procedure) {
+            if (inProcedure || size > end - i)
+                throw std::runtime_error("corrupt IR procedure");
+            const auto stop = i + size;
+            regroup(flat, records, i, stop, true, static_cast<ProcedureCode &>(*ins).body);
+        }
+    }
+}
+
+GeneratedIR File::to_ir() const {
+    const auto &h = header();
+    GeneratedIR ir;
+    InterCodeArray flat;
+    std::vector<std::uint32_t> records(h.instrCount, 0); // Procedure：过程体的记录数
+    flat.code.reserve(h.instrCount);
+    for (std::size_t i = 0; i < h.instrCount; ++i) {
+        const auto &r = instr(i);
+        auto op = [&](const unsigned k) { return std::string(string(r.ops[k])); };
+        // Piece 表里的一串名字（实参 / 参数）
+        auto names = [&](const std::uint32_t first, const std::uint32_t count) {
+            if (first > h.pieceCount || count > h.pieceCount - first || count > kMaxParams)
+                throw std::runtime_error("corrupt IR name list");
+            std::vector<std::string> list;
+            const auto *pieces = table<Piece>(h.pieceOffset) + first;
+            for (std::uint32_t k = 0; k < count; ++k)
+                list.emplace_back(string(pieces[k].value));
+            return list;
+        };
+        switch (static_cast<IRKind>(r.kind)) {
+            case IRKind::Assignment: {
+                auto a = std::make_shared<AssignmentCode>();
+                a->var = op(0);
+                a->left = op(1);
+                a->op = op(2);
+                a->right = op(3);
+                flat.append(a);
+                break;
+            }
+            case IRKind::Jump: {
+                auto j = std::make_shared<JumpCode>();
+                j->dist = op(0);
+                flat.append(j);
+                break;
+            }
+            case IRKind::Label: {
+                auto l = std::make_shared<LabelCode>();
+                l->label = op(0);
+                flat.append(l);
+                break;
+            }
+            case IRKind::Compare: {
+                auto c = std::make_shared<CompareCodeIR>();
+                c->left = op(0);
+                c->operation = op(1);
+                c->right = op(2);
+                c->jump = op(3);
+                flat.append(c);
+                break;
+            }
+            case IRKind::Print: {
+                auto p = std::make_shared<PrintCodeIR>();
+                p->printKind = static_cast<PrintKind>(r.printKind);
+                p->value = op(0);
+                p->newline = r.newline != 0;
+                flat.append(p);
+                break;
+            }
+            case IRKind::Select: {
+                auto s = std::make_shared<SelectCode>();
+                s->var = op(0);
+                s->left = op(1);
+                s->operation = op(2);
+                s->right = op(3);
+                s->ifTrue = op(4);
+                s->ifFalse = op(5);
+                flat.append(s);
+                break;
+            }
+            case IRKind::Write: {
+                if (r.ops[0] > h.pieceCount || r.ops[1] > h.pieceCount - r.ops[0])
+                    throw std::runtime_error("corrupt IR write pieces");
+                auto w = std::make_shared<WriteCode>();
+                const auto *pieces = table<Piece>(h.pieceOffset) + r.ops[0];
+                for (std::uint32_t k = 0; k < r.ops[1]; ++k)
+                    w->pieces.push_back(WritePiece{static_cast<PrintKind>(pieces[k].kind),
+                                                   std::string(string(pieces[k].value))});
+                flat.append(w);
+                break;
+            }
+            case IRKind::Load: {
+                auto l = std::make_shared<LoadCode>();
+                l->var = op(0);
+                l->array = op(1);
+                l->index = op(2);
+                flat.append(l);
+                break;
+            }
+            case IRKind::Store: {
+                auto st = std::make_shared<StoreCode>();
+                st->array = op(0);
+                st->index = op(1);
+                st->value = op(2);
+                flat.append(st);
+                break;
+            }
+            case IRKind::VectorLoop: {
+                if (r.ops[4] > h.instrCount - i - 1)
+                    throw std::runtime_error("corrupt IR vector loop");
+                auto v = std::make_shared<VectorLoopCode>();
+                v->label = op(0);
+                v->index = op(1);
+                v->operation = op(2);
+                v->bound = op(3);
+                v->body.resize(r.ops[4]); // 由下面紧跟着的记录填上
+                flat.append(v);
+                break;
+            }
+            case IRKind::Call: {
+                auto c = std::make_shared<CallCode>();
+                c->var = op(0);
+                c->proc = op(1);
+                c->args = names(r.ops[2], r.ops[3]);
+                flat.append(c);
+                break;
+            }
+            case IRKind::Return: {
+                auto ret = std::make_shared<ReturnCode>();
+                ret->value = op(0);
+                flat.append(ret);
+                break;
+            }
+            case IRKind::Procedure: {
+                if (r.ops[3] > h.instrCount - i - 1)
+                    throw std::runtime_error("corrupt IR procedure");
+                auto p = std::make_shared<ProcedureCode>();
+                p->name = op(0);
+                p->params = names(r.ops[1], r.ops[2]);
+                records[i] = r.ops[3];
+                flat.append(p);
+                break;
+            }
+            default:
+                throw std::runtime_error("unknown IR instruction kind " + std::to_string(r.kind));
+        }
+        flat.code.back()->line = static_cast<int>(r.line);
+    }
+    std::size_t next = 0;
+    regroup(flat, records, next, flat.code.size(), false, ir.code);
+    auto load = [this](const std::uint64_t offset, const std::uint64_t count,
+                       std::unordered_map<std::string, std::string> &out) {
+        const auto *pairs = table<Pair>(offset);
+        for (std::size_t i = 0; i < count; ++i)
+            out.emplace(string(pairs[i].key), string(pairs[i].value));
+    };
+    load(h.identOffset, h.identCount, ir.identifiers);
+    load(h.constOffset, h.constCount, ir.constants);
+    for (auto &[name, type]: ir.identifiers)
+        if (const auto length = array_length(type); length > 0)
+            ir.arrays[name] = length;
+    return ir;
+}
+
+} // namespace irfile
@@ -0,0 +1,588 @@
+#include "isel.hpp"
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+
+using x86::Cond;
+using x86::Op;
+using x86::Operand;
+using x86::Reg;
+using x86::Width;
+using x86::mem;
+using x86::reg;
+
+namespace isel {
+
+static bool is(const Operand &o, const Operand::Kind k) { return o.kind == k; }
+
+static bool fits32(const std::int64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+
+// 可以直接作为 ALU 指令的源操作数（寄存器、内存或 imm32）
+static bool direct_source(const Operand &o) {
+    return is(o, Operand::Kind::Mem) || is(o, Operand::Kind::Reg) || (is(o, Operand::Kind::Imm) && fits32(o.value));
+}
+
+static bool memory(const Operand &o) { return is(o, Operand::Kind::Mem); }
+
+// 同一个内存位置（宽度不论）
+static bool same_memory(const Operand &a, const Operand &b) {
+    return memory(a) && memory(b) && a.sym == b.sym && a.reg == b.reg && a.index == b.index &&
+           (a.index == Reg::None || a.scale == b.scale) && a.value == b.value;
+}
+
+// 典型的延迟（周期），取近几代 Intel / AMD 核心的量级：读 L1 算 4 个周期，
+// 读-改-写再加上运算和写回；xor r32, r32 是清零惯用法，在寄存器重命名阶段就完成
+static unsigned latency(const x86::Instr &i) {
+    const bool m = memory(i.dst) || memory(i.src);
+    switch (i.op) {
+        case Op::Mov:
+            return memory(i.src) ? 4 : 1;
+        case Op::Xor:
+            if (is(i.dst, Operand::Kind::Reg) && is(i.src, Operand::Kind::Reg) && i.dst.reg == i.src.reg)
+                return 0;
+            [[fallthrough]];
+        case Op::Add:
+        case Op::Sub:
+        case Op::And:
+        case Op::Or:
+            return memory(i.dst) ? 6 : m ? 5 : 1;
+        case Op::Cmp:
+        case Op::Test:
+            return m ? 5 : 1;
+        case Op::Inc:
+        case Op::Dec:
+        case Op::Neg:
+            return m ? 6 : 1;
+        case Op::Imul:
+            return m ? 7 : 3;
+        case Op::Pop:
+            return 4; // 读栈，经过存储转发
+        case Op::Idiv:
+        case Op::Div:
+            return m ? 44 : 40;
+        case Op::Lea: {
+            // 基址 + 变址 + 偏移三个分量的 lea 要 3 个周期
+            const auto &a = i.src;
+            return a.reg != Reg::None && a.index != Reg::None && (a.value != 0 || a.sym != x86::NoSymbol) ? 3 : 1;
+        }
+        default:
+            return 1;
+    }
+}
+
+Cost cost(const x86::Instr &i) {
+    return {latency(i), static_cast<unsigned>(x86::encoded_size(i)), 1};
+}
+
+unsigned score(const std::vector<x86::Instr> &seq, const Goal goal) {
+    unsigned total = 0;
+    for (auto &i: seq) {
+        const auto c = cost(i);
+        total += goal == Goal::Size ? 64 * c.bytes + 8 * c.insns + c.latency : 8 * c.latency + 4 * c.insns + c.bytes;
+    }
+    return total;
+}
+
+static bool is_temp(const std::string &name) { return !name.empty() && name[0] == 'T'; }
+
+std::unordered_set<std::string> fold_temps(const InterCodeArray &code) {
+    std::unordered_map<std::string, std::size_t> uses, defs;
+    for (auto &ins: code.code) {
+        switch (ins->kind()) {
+            case IRKind::Assignment: {
+                const auto &a = static_cast<const AssignmentCode &>(*ins);
+                ++defs[a.var];
+                ++uses[a.left];
+                ++uses[a.right];
+                break;
+            }
+            case IRKind::Compare: {
+                const auto &c = static_cast<const CompareCodeIR &>(*ins);
+                ++uses[c.left];
+                ++uses[c.right];
+                break;
+            }
+            case IRKind::Print:
+                ++uses[static_cast<const PrintCodeIR &>(*ins).value];
+                break;
+            case IRKind::Select: {
+                const auto &s = static_cast<const SelectCode &>(*ins);
+                ++defs[s.var];
+                for (const auto *v: {&s.left, &s.right, &s.ifTrue, &s.ifFalse})
+                    ++uses[*v];
+                break;
+            }
+            case IRKind::Write:
+                for (auto &piece: static_cast<const WriteCode &>(*ins).pieces)
+                    ++uses[piece.value];
+                break;
+            case IRKind::Load: {
+                const auto &l = static_cast<const LoadCode &>(*ins);
+                ++defs[l.var];
+                ++uses[l.index];
+                break;
+            }
+            case IRKind::Store: {
+                const auto &s = static_cast<const StoreCode &>(*ins);
+                ++uses[s.index];
+                ++uses[s.value];
+                break;
+            }
+            case IRKind::VectorLoop: {
+                // 循环体与后面的标量循环共用，只算一次
+                const auto &v = static_cast<const VectorLoopCode &>(*ins);
+                ++uses[v.index];
+                ++uses[v.bound];
+                break;
+            }
+            case IRKind::Call: {
+                // 实参依次装进 rdi、rsi ……，树只能求值到 rax，所以调用不并进临时变量
+                const auto &c = static_cast<const CallCode &>(*ins);
+                ++defs[c.var];
+                for (auto &a: c.args)
+                    ++uses[a];
+                break;
+            }
+            case IRKind::Return:
+                ++uses[static_cast<const ReturnCode &>(*ins).value];
+                break;
+            default:
+                break;
+        }
+    }
+
+    // 下一条 IR 是赋值、比较、打印整数、取数组元素（作下标）、写数组元素（作值）或返回，并且用到了它
+    auto consumes = [](const IRInstr &next, const std::string &t) {
+        switch (next.kind()) {
+            case IRKind::Assignment: {
+                const auto &a = static_cast<const AssignmentCode &>(next);
+                return a.left == t || a.right == t;
+            }
+            case IRKind::Compare: {
+                const auto &c = static_cast<const CompareCodeIR &>(next);
+                return c.left == t || c.right == t;
+            }
+            case IRKind::Print: {
+                const auto &p = static_cast<const PrintCodeIR &>(next);
+                return p.printKind == PrintKind::Int && p.value == t;
+            }
+            case IRKind::Load:
+                return static_cast<const LoadCode &>(next).index == t;
+            case IRKind::Store:
+                return static_cast<const StoreCode &>(next).value == t;
+            case IRKind::Return:
+                return static_cast<const ReturnCode &>(next).value == t;
+            default:
+                return false;
+        }
+    };
+
+    std::unordered_set<std::string> folded;
+    for (std::size_t i = 0; i + 1 < code.code.size(); ++i) {
+        const auto kind = code.code[i]->kind();
+        if (kind != IRKind::Assignment && kind != IRKind::Load)
+            continue;
+        const auto &t = kind == IRKind::Assignment ? static_cast<const AssignmentCode &>(*code.code[i]).var
+                                                   : static_cast<const LoadCode &>(*code.code[i]).var;
+        if (is_temp(t) && defs[t] == 1 && uses[t] == 1 && consumes(*code.code[i + 1], t))
+            folded.insert(t);
+    }
+    return folded;
+}
+
+static x86::Instr make(const Op op, const Operand &dst = {}, const Operand &src = {}) {
+    x86::Instr i;
+    i.op = op;
+    i.dst = dst;
+    i.src = src;
+    return i;
+}
+
+static Cond swapped(const Cond c) {
+    switch (c) {
+        case Cond::L: return Cond::G;
+        case Cond::LE: return Cond::GE;
+        case Cond::G: return Cond::L;
+        case Cond::GE: return Cond::LE;
+        default: return c;
+    }
+}
+
+static bool commutative(const Op op) {
+    return op == Op::Add || op == Op::Imul || op == Op::And || op == Op::Or || op == Op::Xor;
+}
+
+// 最后一条指令已经按 rax 的值设置了 ZF
+static bool zf_from_rax(const std::vector<x86::Instr> &seq) {
+    if (seq.empty())
+        return false;
+    const auto &i = seq.back();
+    switch (i.op) {
+        case Op::Add:
+        case Op::Sub:
+        case Op::And:
+        case Op::Or:
+        case Op::Xor:
+        case Op::Neg:
+        case Op::Inc:
+        case Op::Dec:
+            return is(i.dst, Operand::Kind::Reg) && i.dst.reg == Reg::RAX && i.dst.width == Width::Qword;
+        default:
+            return false;
+    }
+}
+
+Selector::Selector(x86::Module &mod, Resolve resolve, const Goal goal)
+    : mod_(mod), resolve_(std::move(resolve)), goal_(goal) {
+}
+
+// 保留代价较小的一个，相同时保留先列出的
+void Selector::keep(Seq &best, bool &have, Seq candidate) const {
+    if (!have || score(candidate, goal_) < score(best, goal_)) {
+        best = std::move(candidate);
+        have = true;
+    }
+}
+
+void Selector::load_into(Seq &seq, const Reg r, const Operand &value) const {
+    if (is(value, Operand::Kind::Imm) && value.value == 0) {
+        seq.push_back(make(Op::Xor, reg(r, Width::Dword), reg(r, Width::Dword)));
+        return;
+    }
+    Seq best = {make(Op::Mov, reg(r), value)};
+    bool have = true;
+    if (is(value, Operand::Kind::Imm) && value.value >= -128 && value.value <= 127)
+        keep(best, have, {make(Op::Push, value), make(Op::Pop, reg(r))});
+    if (is(value, Operand::Kind::Addr)) {
+        // 地址和 [Vx] 一样按 32 位符号扩展的绝对地址编码，lea r32 比 mov r64, imm64 短 3 字节
+        auto address = mem(value.sym, value.value);
+        keep(best, have, {make(Op::Lea, reg(r, Width::Dword), address)});
+    }
+    seq.insert(seq.end(), best.begin(), best.end());
+}
+
+// rax = rax op src；除法和放不进 imm32 的源操作数经过 rcx
+void Selector::apply(Seq &seq, const Op op, const Operand &src) const {
+    if (op == Op::Idiv) {
+        seq.push_back(make(Op::Cqo));
+        if (memory(src) || is(src, Operand::Kind::Reg)) {
+            seq.push_back(make(Op::Idiv, src));
+        } else {
+            load_into(seq, Reg::RCX, src);
+            seq.push_back(make(Op::Idiv, reg(Reg::RCX)));
+        }
+        return;
+    }
+    if (direct_source(src)) {
+        seq.push_back(make(op, reg(Reg::RAX), src));
+    } else {
+        load_into(seq, Reg::RCX, src);
+        seq.push_back(make(op, reg(Reg::RAX), reg(Reg::RCX)));
+    }
+}
+
+void Selector::reset(std::unordered_set<std::string> folded) {
+    folded_ = std::move(folded);
+    nodes_.clear();
+    pending_ = -1;
+    pendingName_.clear();
+}
+
+int Selector::node(const std::string &name) {
+    if (pending_ >= 0 && name == pendingName_) {
+        const int n = pending_;
+        pending_ = -1;
+        pendingName_.clear();
+        return n;
+    }
+    Node leaf;
+    leaf.leaf = resolve_(name);
+    nodes_.push_back(leaf);
+    return static_cast<int>(nodes_.size() - 1);
+}
+
+int Selector::tree(const AssignmentCode &a) {
+    const int left = node(a.left);
+    if (a.op.empty())
+        return left;
+    const int right = node(a.right);
+    Node n;
+    if (a.op == "+") n.op = Op::Add;
+    else if (a.op == "-") n.op = Op::Sub;
+    else if (a.op == "*") n.op = Op::Imul;
+    else if (a.op == "/") n.op = Op::Idiv;
+    else if (a.op == "&") n.op = Op::And;
+    else if (a.op == "|") n.op = Op::Or;
+    else if (a.op == "^") n.op = Op::Xor;
+    else throw std::runtime_error("unsupported operator: " + a.op);
+    n.left = left;
+    n.right = right;
+    nodes_.push_back(n);
+    return static_cast<int>(nodes_.size() - 1);
+}
+
+// rax = 节点 n 的值。每个节点至多有一棵子树（只有紧挨着的上一条 IR 会被并进来），
+// 所以只用 rax 和 rcx（除法另占 rdx）就够了
+Selector::Seq Selector::eval(const int n) const {
+    const Node &x = nodes_[n];
+    Seq best;
+    if (is_leaf(n)) {
+        load_into(best, Reg::RAX, x.leaf);
+        return best;
+    }
+    if (x.array != x86::NoSymbol) {
+        // 下标算进 rax，再 mov rax, [array + rax*8]
+        best = eval(x.left);
+        best.push_back(make(Op::Mov, reg(Reg::RAX), mem(x.array, Reg::RAX, 8)));
+        return best;
+    }
+    bool have = false;
+    const auto op = x.op;
+    const int l = x.left, r = x.right;
+
+    if (is_leaf(r)) {
+        // 左边算进 rax，op rax, 右边
+        auto s = eval(l);
+        apply(s, op, nodes_[r].leaf);
+        keep(best, have, std::move(s));
+    }
+    if (!is_leaf(r) && is_leaf(l)) {
+        auto s = eval(r);
+        if (commutative(op)) {
+            // 交换两边
+            apply(s, op, nodes_[l].leaf);
+            keep(best, have, std::move(s));
+        } else if (op == Op::Sub) {
+            // l - rax == -rax + l
+            s.push_back(make(Op::Neg, reg(Reg::RAX)));
+            apply(s, Op::Add, nodes_[l].leaf);
+            keep(best, have, std::move(s));
+        } else {
+            // 右边先算，挪到 rcx
+            s.push_back(make(Op::Mov, reg(Reg::RCX), reg(Reg::RAX)));
+            load_into(s, Reg::RAX, nodes_[l].leaf);
+            apply(s, op, reg(Reg::RCX));
+            keep(best, have, std::move(s));
+        }
+    }
+
+    // 乘以小常数：add rax, rax / lea rax, [rax+rax*k] / lea rax, [rax*k]
+    if (op == Op::Imul) {
+        for (const auto &[value, other]: {std::make_pair(r, l), std::make_pair(l, r)}) {
+            if (!is_leaf(value) || !is(nodes_[value].leaf, Operand::Kind::Imm))
+                continue;
+            const auto k = nodes_[value].leaf.value;
+            auto s = eval(other);
+            if (k == 2) {
+                s.push_back(make(Op::Add, reg(Reg::RAX), reg(Reg::RAX)));
+            } else if (k == 3 || k == 5 || k == 9) {
+                s.push_back(make(Op::Lea, reg(Reg::RAX), mem(Reg::RAX, Reg::RAX, static_cast<std::uint8_t>(k - 1))));
+            } else if (k == 4 || k == 8) {
+                s.push_back(make(Op::Lea, reg(Reg::RAX), mem(Reg::None, Reg::RAX, static_cast<std::uint8_t>(k))));
+            } else {
+                continue;
+            }
+            keep(best, have, std::move(s));
+        }
+    }
+
+    // x + y*scale：lea rax, [rcx+rax*scale]
+    if (op == Op::Add) {
+        for (const auto &[product, addend]: {std::make_pair(r, l), std::make_pair(l, r)}) {
+            if (is_leaf(product) || !is_leaf(addend) || nodes_[product].op != Op::Imul)
+                continue;
+            const auto &p = nodes_[product];
+            for (const auto &[value, other]: {std::make_pair(p.right, p.left), std::make_pair(p.left, p.right)}) {
+                if (!is_leaf(value) || !is(nodes_[value].leaf, Operand::Kind::Imm))
+                    continue;
+                const auto k = nodes_[value].leaf.value;
+                if (k != 2 && k != 4 && k != 8)
+                    continue;
+                auto s = eval(other);
+                load_into(s, Reg::RCX, nodes_[addend].leaf);
+                s.push_back(make(Op::Lea, reg(Reg::RAX), mem(Reg::RCX, Reg::RAX, static_cast<std::uint8_t>(k))));
+                keep(best, have, std::move(s));
+            }
+        }
+    }
+
+    if (!have)
+        throw std::runtime_error("isel: expression tree with two subtrees");
+    return best;
+}
+
+void Selector::emit(const Seq &seq) {
+    mod_.text.insert(mod_.text.end(), seq.begin(), seq.end());
+    // 树已经全部生成，节点可以丢掉了
+    if (pending_ < 0)
+        nodes_.clear();
+}
+
+void Selector::assign(const AssignmentCode &a) {
+    const int t = tree(a);
+    if (folded(a.var)) {
+        pending_ = t;
+        pendingName_ = a.var;
+        return;
+    }
+    store_tree(resolve_(a.var), t);
+}
+
+bool Selector::reads(const int n, const Operand &dst, const Operand &index) const {
+    const Node &x = nodes_[n];
+    if (is_leaf(n))
+        return index.kind == Operand::Kind::None && same_memory(x.leaf, dst);
+    // a[i]：下标是同一个叶子
+    return x.op == Op::Mov && x.array == dst.sym && index.kind != Operand::Kind::None && is_leaf(x.left) &&
+           nodes_[x.left].leaf == index;
+}
+
+void Selector::store_tree(const Operand &dst, const int t, const Seq &address, const Operand &index) {
+    const Node &x = nodes_[t];
+    // 候选 = 求值 + 装入变址寄存器 + 写入
+    auto finish = [&address](Seq seq, std::initializer_list<x86::Instr> store) {
+        seq.insert(seq.end(), address.begin(), address.end());
+        seq.insert(seq.end(), store);
+        return seq;
+    };
+
+    // 通用写法：算进 rax 再存回去
+    auto best = finish(eval(t), {make(Op::Mov, dst, reg(Reg::RAX))});
+    bool have = true;
+
+    // 常量和字符串地址直接存：mov qword [x], imm32
+    if (is_leaf(t) && ((is(x.leaf, Operand::Kind::Imm) && fits32(x.leaf.value)) || is(x.leaf, Operand::Kind::Addr)))
+        keep(best, have, finish({}, {make(Op::Mov, dst, x.leaf)}));
+
+    // x = 0 - x => neg qword [x]
+    if (!is_leaf(t) && x.op == Op::Sub && is_leaf(x.left)) {
+        const auto &zero = nodes_[x.left].leaf;
+        if (is(zero, Operand::Kind::Imm) && zero.value == 0 && reads(x.right, dst, index))
+            keep(best, have, finish({}, {make(Op::Neg, dst)}));
+    }
+
+    // 读-改-写：x = x op y => op qword [x], y；加减 1 用 inc / dec
+    if (!is_leaf(t) && (x.op == Op::Add || x.op == Op::Sub || x.op == Op::And || x.op == Op::Or || x.op == Op::Xor)) {
+        for (const auto &[self, other]: {std::make_pair(x.left, x.right), std::make_pair(x.right, x.left)}) {
+            if (self == x.right && !commutative(x.op))
+                continue;
+            if (!reads(self, dst, index))
+                continue;
+            const auto &y = nodes_[other].leaf;
+            if (is_leaf(other) && is(y, Operand::Kind::Imm) && fits32(y.value)) {
+                keep(best, have, finish({}, {make(x.op, dst, y)}));
+                const auto step = x.op == Op::Add ? y.value : x.op == Op::Sub ? -y.value : 0;
+                if (step == 1 || step == -1)
+                    keep(best, have, finish({}, {make(step == 1 ? Op::Inc : Op::Dec, dst)}));
+            } else {
+                keep(best, have, finish(eval(other), {make(x.op, dst, reg(Reg::RAX))}));
+            }
+        }
+    }
+    emit(best);
+}
+
+void Selector::load_element(const LoadCode &l) {
+    const auto array = mod_.symbol(l.array);
+    const int index = node(l.index);
+    if (is_leaf(index) && is(nodes_[index].leaf, Operand::Kind::Imm)) {
+        // 字面量下标：[array + 8k]
+        Node leaf;
+        leaf.leaf = mem(array, 8 * nodes_[index].leaf.value);
+        nodes_.push_back(leaf);
+    } else {
+        Node element;
+        element.array = array;
+        element.left = index;
+        nodes_.push_back(element);
+    }
+    const int t = static_cast<int>(nodes_.size() - 1);
+    if (folded(l.var)) {
+        pending_ = t;
+        pendingName_ = l.var;
+        return;
+    }
+    auto seq = eval(t);
+    seq.push_back(make(Op::Mov, resolve_(l.var), reg(Reg::RAX)));
+    emit(seq);
+}
+
+void Selector::store_element(const StoreCode &s) {
+    const auto array = mod_.symbol(s.array);
+    // 下标不会是并进来的树（fold_temps() 只把值并进 Store）
+    const auto index = resolve_(s.index);
+    const int t = node(s.value);
+    if (is(index, Operand::Kind::Imm)) {
+        store_tree(mem(array, 8 * index.value), t);
+        return;
+    }
+    // 值算进 rax 时可能用到 rcx，下标最后再装进 rcx
+    Seq address;
+    load_into(address, Reg::RCX, index);
+    store_tree(mem(array, Reg::RCX, 8), t, address, index);
+}
+
+Cond Selector::compare(const std::string &left, const std::string &right, const Cond cond) {
+    const int l = node(left), r = node(right);
+
+    // 每个候选连同它的条件一起比较
+    struct Candidate {
+        Seq seq;
+        Cond cond;
+    };
+    std::vector<Candidate> candidates;
+
+    for (const auto &[lhs, rhs, c]: {std::make_tuple(l, r, cond), std::make_tuple(r, l, swapped(cond))}) {
+        if (!is_leaf(rhs))
+            continue;
+        const auto &y = nodes_[rhs].leaf;
+        // mov rax, lhs; cmp rax, rhs
+        auto seq = eval(lhs);
+        if (direct_source(y)) {
+            seq.push_back(make(Op::Cmp, reg(Reg::RAX), y));
+        } else {
+            seq.push_back(make(Op::Mov, reg(Reg::RCX), y));
+            seq.push_back(make(Op::Cmp, reg(Reg::RAX), reg(Reg::RCX)));
+        }
+        candidates.push_back({seq, c});
+
+        if (is(y, Operand::Kind::Imm) && y.value == 0) {
+            // 与 0 比较：test rax, rax；相等 / 不等时若上一条运算已经按结果设置了 ZF，连 test 都不用
+            auto value = eval(lhs);
+            if ((c == Cond::E || c == Cond::NE) && zf_from_rax(value))
+                candidates.push_back({value, c});
+            value.push_back(make(Op::Test, reg(Reg::RAX), reg(Reg::RAX)));
+            candidates.push_back({std::move(value), c});
+        }
+        // cmp qword [x], imm32
+        if (is_leaf(lhs) && memory(nodes_[lhs].leaf) && is(y, Operand::Kind::Imm) && fits32(y.value))
+            candidates.push_back({{make(Op::Cmp, nodes_[lhs].leaf, y)}, c});
+    }
+    if (candidates.empty())
+        throw std::runtime_error("isel: comparison of two subtrees");
+
+    std::size_t pick = 0;
+    for (std::size_t k = 1; k < candidates.size(); ++k)
+        if (score(candidates[k].seq, goal_) < score(candidates[pick].seq, goal_))
+            pick = k;
+    emit(candidates[pick].seq);
+    return candidates[pick].cond;
+}
+
+void Selector::load(const Reg r, const std::string &value) {
+    if (pending_ >= 0 && value == pendingName_) {
+        if (r != Reg::RAX)
+            throw std::runtime_error("isel: expression trees are evaluated into rax");
+        emit(eval(node(value)));
+        return;
+    }
+    load(r, resolve_(value));
+}
+
+void Selector::load(const Reg r, const Operand &value) {
+    Seq seq;
+    load_into(seq, r, value);
+    emit(seq);
+}
+
+} // namespace isel
@@ -1,3 +1,4 @@
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -5,7 +6,15 @@
 #include "tokens.hpp"
 #include "ast.hpp"
 #include "ir.hpp"
-#include "codegen.hpp"
+#include "batch.hpp"
+#include "compiler.hpp"
+#include "cache.hpp"
+#include "irfile.hpp"
+#include "watch.hpp"
+#include <iomanip>
+#include <limits>
+#include <optional>
+#include <sys/stat.h>
 
 void flatten_statement(
     const std::shared_ptr<Node>& node,
@@ -13,10 +22,10 @@ void flatten_statement(
 {
     if (!node) return;
 
-    if (auto st = std::dynamic_pointer_cast<Statement>(node))
+    if (std::dynamic_pointer_cast<Statement>(node))
     {
-        flatten_statement(st->left, out);
-        flatten_statement(st->right, out);
+        for (auto &s : statement_list(node))
+            flatten_statement(s, out);
     }
     else
     {
@@ -54,6 +63,14 @@ void print_ast(const std::shared_ptr<Node>& node, const std::string& prefix = ""
         return;
     }
 
+    // ---- Array element ----
+    if (auto n = std::dynamic_pointer_cast<IndexNode>(node))
+    {
+        std::cout << "Index(" << n->array.value << ")\n";
+        print_ast(n->index, prefix + (isLast ? "    " : "│   "), true);
+        return;
+    }
+
     // ---- Binary Operation ----
     if (auto n = std::dynamic_pointer_cast<BinOpNode>(node))
     {
@@ -67,7 +84,8 @@ void print_ast(const std::shared_ptr<Node>& node, const std::string& prefix = ""
     // ---- Assignment ----
     if (auto n = std::dynamic_pointer_cast<Assignment>(node))
     {
-        std::cout << "Assignment(" << n->identifier.value << ")\n";
+        std::cout << "Assignment(" << n->identifier.value << (n->index ? "[]" : "") << ")\n";
+        print_ast(n->index, prefix + (isLast ? "    " : "│   "), false);
         print_ast(n->expression, prefix + (isLast ? "    " : "│   "), true);
         return;
     }
@@ -75,7 +93,10 @@ void print_ast(const std::shared_ptr<Node>& node, const std::string& prefix = ""
     // ---- Declaration ----
     if (auto n = std::dynamic_pointer_cast<Declaration>(node))
     {
-        std::cout << "Declaration(type=" << n->declaration_type.value << ")\n";
+        std::cout << "Declaration(type=" << n->declaration_type.value;
+        if (n->length > 0)
+            std::cout << "[" << n->length << "]";
+        std::cout << ")\n";
 
         for (size_t i = 0; i < n->identifiers.size(); i++)
         {
@@ -111,6 +132,14 @@ void print_ast(const std::shared_ptr<Node>& node, const std::string& prefix = ""
     {
         std::cout << "Condition(" << n->comparison.value << ")\n";
 
+        // && / || / !
+        if (n->lhs)
+        {
+            print_ast(n->lhs, prefix + (isLast ? "    " : "│   "), !n->rhs);
+            print_ast(n->rhs, prefix + (isLast ? "    " : "│   "), true);
+            return;
+        }
+
         print_ast(n->left_expression,
                   prefix + (isLast ? "    " : "│   "), false);
 
@@ -166,6 +195,42 @@ void print_ast(const std::shared_ptr<Node>& node, const std::string& prefix = ""
         return;
     }
 
+    // ---- Call ----
+    if (auto n = std::dynamic_pointer_cast<CallNode>(node))
+    {
+        std::cout << "Call(" << n->name.value << ")\n";
+
+        for (size_t i = 0; i < n->args.size(); i++)
+            print_ast(n->args[i], prefix + (isLast ? "    " : "│   "), i + 1 == n->args.size());
+        return;
+    }
+
+    // ---- Return ----
+    if (auto n = std::dynamic_pointer_cast<ReturnStatement>(node))
+    {
+        std::cout << "Return\n";
+        print_ast(n->value, prefix + (isLast ? "    " : "│   "), true);
+        return;
+    }
+
+    // ---- Procedure ----
+    if (auto n = std::dynamic_pointer_cast<ProcedureNode>(node))
+    {
+        std::cout << "Procedure(" << n->name.value << ")\n";
+
+        for (size_t i = 0; i < n->params.size(); i++)
+        {
+            bool last = (i + 1 == n->params.size() && !n->body);
+
+            std::cout << prefix + (isLast ? "    " : "│   ");
+            std::cout << (last ? "└── " : "├── ");
+            std::cout << "Param(" << n->params[i].value << ")\n";
+        }
+
+        print_ast(n->body, prefix + (isLast ? "    " : "│   "), true);
+        return;
+    }
+
     // ---- Statement list ----
     if (auto n = std::dynamic_pointer_cast<Statement>(node))
     {
@@ -187,12 +252,13 @@ void print_ast(const std::shared_ptr<Node>& node, const std::string& prefix = ""
 }
 
 
-void print_ir(const GeneratedIR& ir)
+// 过程体缩进一层，夹在 PROC 与 END 之间
+void print_code(const InterCodeArray& code, const std::string& indent)
 {
-    std::cout << "\n===== IR CODE =====\n";
-
-    for (auto &instr : ir.code.code)
+    for (auto &instr : code.code)
     {
+        std::cout << indent;
+
         switch (instr->kind())
         {
             case IRKind::Assignment:
@@ -216,6 +282,15 @@ void print_ir(const GeneratedIR& ir)
                 break;
             }
 
+            case IRKind::Select:
+            {
+                auto *sel = dynamic_cast<SelectCode*>(instr.get());
+                std::cout << sel->var << " = " << sel->left << " "
+                          << sel->operation << " " << sel->right << " ? "
+                          << sel->ifTrue << " : " << sel->ifFalse << "\n";
+                break;
+            }
+
             case IRKind::Jump:
             {
                 auto *j = dynamic_cast<JumpCode*>(instr.get());
@@ -250,12 +325,96 @@ void print_ir(const GeneratedIR& ir)
                 break;
             }
 
+            case IRKind::Write:
+            {
+                auto *w = dynamic_cast<WriteCode*>(instr.get());
+                std::cout << "WRITE";
+                for (std::size_t i = 0; i < w->pieces.size(); ++i)
+                {
+                    std::cout << (i ? ", " : " ")
+                              << (w->pieces[i].kind == PrintKind::String ? "string " : "int ")
+                              << w->pieces[i].value;
+                }
+                std::cout << "\n";
+                break;
+            }
+
+            case IRKind::Load:
+            {
+                auto *l = dynamic_cast<LoadCode*>(instr.get());
+                std::cout << l->var << " = " << l->array << "[" << l->index << "]\n";
+                break;
+            }
+
+            case IRKind::Store:
+            {
+                auto *st = dynamic_cast<StoreCode*>(instr.get());
+                std::cout << st->array << "[" << st->index << "] = " << st->value << "\n";
+                break;
+            }
+
+            case IRKind::VectorLoop:
+            {
+                auto *v = dynamic_cast<VectorLoopCode*>(instr.get());
+                std::cout << "VLOOP " << v->label << " while " << v->index << " "
+                          << v->operation << " " << v->bound << " ("
+                          << v->body.size() << " instructions per lane)\n";
+                break;
+            }
+
+            case IRKind::Call:
+            {
+                auto *c = dynamic_cast<CallCode*>(instr.get());
+                if (!c->var.empty())
+                    std::cout << c->var << " = ";
+                std::cout << "CALL " << c->proc << "(";
+                for (std::size_t i = 0; i < c->args.size(); ++i)
+                    std::cout << (i ? ", " : "") << c->args[i];
+                std::cout << ")\n";
+                break;
+            }
+
+            case IRKind::Return:
+            {
+                auto *r = dynamic_cast<ReturnCode*>(instr.get());
+                std::cout << "RET " << r->value << "\n";
+                break;
+            }
+
+            case IRKind::Procedure:
+            {
+                auto *p = dynamic_cast<ProcedureCode*>(instr.get());
+                std::cout << "PROC " << p->name << "(";
+                for (std::size_t i = 0; i < p->params.size(); ++i)
+                    std::cout << (i ? ", " : "") << p->params[i];
+                std::cout << ")\n";
+                print_code(p->body, indent + "    ");
+                std::cout << indent << "END " << p->name << "\n";
+                break;
+            }
         }
     }
+}
+
+
+void print_ir(const GeneratedIR& ir)
+{
+    std::cout << "\n===== IR CODE =====\n";
+    print_code(ir.code, "");
 
     std::cout << "\n===== CONSTANTS =====\n";
     for (auto &kv : ir.constants)
-        std::cout << kv.first << " = \"" << kv.second << "\"\n";
+    {
+        std::cout << kv.first << " = \"";
+        for (const char ch : kv.second)
+        {
+            if (ch == '\n')
+                std::cout << "\\n";
+            else
+                std::cout << ch;
+        }
+        std::cout << "\"\n";
+    }
 
     std::cout << "\n===== IDENTIFIERS =====\n";
     for (auto &kv : ir.identifiers)
@@ -263,99 +422,426 @@ void print_ir(const GeneratedIR& ir)
 }
 
 
-// If Flex's buffer type isn't visible, declare it.
-struct yy_buffer_state;
+// --cache-size：字节数，可以带 K / M / G 后缀
+static std::uint64_t parse_size(const std::string &text)
+{
+    std::size_t end = 0;
+    std::uint64_t value = std::stoull(text, &end);
+    const std::string suffix = text.substr(end);
+    if (suffix == "K" || suffix == "k")
+        value <<= 10;
+    else if (suffix == "M" || suffix == "m")
+        value <<= 20;
+    else if (suffix == "G" || suffix == "g")
+        value <<= 30;
+    else if (!suffix.empty())
+        throw std::invalid_argument("bad size " + text);
+    return value;
+}
+
+// -j N：只接受十进制的非负整数，0 表示使用全部硬件线程
+static unsigned parse_jobs(const std::string &text)
+{
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos)
+        throw std::invalid_argument("bad job count " + text);
+    const auto value = std::stoull(text);
+    if (value > std::numeric_limits<unsigned>::max())
+        throw std::out_of_range("job count out of range " + text);
+    return static_cast<unsigned>(value);
+}
+
+// --stats / --stats=json：报告写到 stderr，或者 --stats-file 指定的文件
+struct StatsReport
+{
+    bool json = false;
+    std::string file;
+};
 
-using YYBufferState = yy_buffer_state *;
+static void report_stats(const CompileStats &stats, const StatsReport &report)
+{
+    const auto text = report.json ? stats_json(stats) : stats_table(stats);
+    if (report.file.empty())
+    {
+        std::cerr << text;
+        return;
+    }
+    std::ofstream out(report.file);
+    out << text;
+    if (!out)
+        std::cerr << "Cannot write " << report.file << "\n";
+}
 
-YYBufferState yy_scan_string(const char *str);
-void yy_delete_buffer(YYBufferState b);
+static bool write_result(const std::string &path, const Result &result, EmitKind emit)
+{
+    std::ofstream out(path, std::ios::binary);
+    if (emit == EmitKind::Asm)
+        out << result.assembly;
+    else
+        out.write(reinterpret_cast<const char *>(result.binary.data()),
+                  static_cast<std::streamsize>(result.binary.size()));
+    out.close();
+    if (emit == EmitKind::Executable)
+        chmod(path.c_str(), 0755);
+    return static_cast<bool>(out);
+}
 
-// Provided by Bison (parser.yy)
-extern int yyparse();
-extern std::shared_ptr<Node> g_ast_root; // The global AST root
+// --passes=a,b,c；空列表表示不运行任何 pass
+static std::vector<std::string> split_passes(const std::string &list)
+{
+    std::vector<std::string> names;
+    std::istringstream in(list);
+    std::string name;
+    while (std::getline(in, name, ','))
+        if (!name.empty())
+            names.push_back(name);
+    return names;
+}
 
-class FlexBuffer {
-public:
-    explicit FlexBuffer(const std::string &input)
-            : buf_(yy_scan_string(input.c_str())) {}
+// opt 模式：读入 --emit=ir 生成的 .ir 文件（mmap），运行 pass 列表，输出 IR 或机器码
+static int run_opt(const std::vector<std::string> &inputs, const std::string &output, Options options,
+                   const std::optional<std::vector<std::string>> &passes, bool dumpIr, const StatsReport &report)
+{
+    if (inputs.size() != 1)
+    {
+        std::cerr << "--opt takes exactly one .ir input\n";
+        return 1;
+    }
+    const auto &input = inputs[0];
+    const auto path = output.empty() ? default_output(input, options.emit, "") : output;
+    if (path == input)
+    {
+        std::cerr << "Output " << path << " would overwrite the input (use -o)\n";
+        return 1;
+    }
 
-    FlexBuffer(const FlexBuffer &) = delete;
+    GeneratedIR ir;
+    try
+    {
+        ir = irfile::File::open(input).to_ir();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
 
-    FlexBuffer &operator=(const FlexBuffer &) = delete;
+    options.keepIr = dumpIr;
+    options.sourceName = input;
+    const auto result = compile_ir(std::move(ir), passes ? *passes : pass_pipeline(options.optLevel), options);
+    if (!result.ok)
+    {
+        std::cerr << input << ": " << result.error << "\n";
+        return 1;
+    }
 
-    FlexBuffer(FlexBuffer &&other) noexcept: buf_(other.buf_) {
-        other.buf_ = nullptr;
+    if (dumpIr)
+        print_ir(result.ir);
+    if (!write_result(path, result, options.emit))
+    {
+        std::cerr << "Cannot write " << path << "\n";
+        return 1;
     }
+    if (options.stats)
+        report_stats(result.stats, report);
+    return 0;
+}
 
-    ~FlexBuffer() {
-        if (buf_)
-            yy_delete_buffer(buf_);
+// 批量模式：所有输入在线程池上并行编译，错误按输入顺序报告
+static int run_batch(const std::vector<std::string> &inputs, const std::string &manifest,
+                     const std::string &output, const std::string &outDir,
+                     const Options &options, unsigned threads, const StatsReport &report)
+{
+    std::vector<BatchJob> jobs;
+    BatchSummary summary;
+    try
+    {
+        if (!manifest.empty())
+            jobs = read_manifest(manifest, options.emit, outDir);
+        for (auto &in : inputs)
+            jobs.push_back(BatchJob{in, default_output(in, options.emit, outDir)});
+        for (auto &job : jobs)
+            if (job.input == "-" && output.empty())
+                throw std::runtime_error("-o is required when reading from standard input");
+        if (!output.empty())
+        {
+            if (jobs.size() != 1)
+                throw std::runtime_error("-o requires exactly one input (use --out-dir for several)");
+            jobs[0].output = output;
+        }
+        summary = compile_batch(jobs, options, threads);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
     }
 
-private:
-    YYBufferState buf_;
-};
+    for (size_t i = 0; i < jobs.size(); ++i)
+        if (!summary.files[i].ok)
+            std::cerr << jobs[i].input << ": " << summary.files[i].error << "\n";
+
+    const double secs = summary.seconds > 0 ? summary.seconds : 1e-9;
+    std::cout << "Compiled " << jobs.size() << " file(s), " << summary.failed << " failed, "
+              << summary.lines << " lines, " << summary.bytes << " bytes in "
+              << std::fixed << std::setprecision(3) << summary.seconds << " s\n"
+              << std::setprecision(1)
+              << "Throughput: " << jobs.size() / secs << " files/s, "
+              << summary.lines / secs << " lines/s\n";
+    if (options.stats)
+        report_stats(summary.stats, report);
+    return summary.failed == 0 ? 0 : 1;
+}
 
-int main(int argc, char** argv)
+// 没有给出输入文件时（编译 ../read.txt）的输出文件
+static std::string dev_output(EmitKind emit)
 {
-    bool once = false;
+    return emit == EmitKind::Asm    ? "../output.asm"
+         : emit == EmitKind::Object ? "../output.o"
+         : emit == EmitKind::IR     ? "../output.ir"
+                                    : "../program";
+}
 
-    if (argc > 1 && std::string(argv[1]) == "--once")
-        once = true;
+// --watch：先完整编译一次，之后文件每保存一次就增量地重新编译（见 watch.hpp），直到被中断
+static int run_watch(const std::string &path, const std::string &output, const Options &options)
+{
+    std::optional<FileWatcher> watcher;
+    try { watcher.emplace(path); }
+    catch (const std::exception &e) { std::cerr << e.what() << "\n"; return 1; }
 
-    do
+    IncrementalCompiler compiler(options);
+    std::cout << "Watching " << path << " (Ctrl-C to stop)\n";
+    for (;;)
     {
-        std::ifstream fin("../read.txt");
-        if (!fin) { std::cerr << "Cannot open read.txt\n"; return 1; }
-
-        std::stringstream buffer;
-        buffer << fin.rdbuf();
-        std::string input = buffer.str();
+        std::optional<SourceInput> input;
+        try { input.emplace(SourceInput::open(path)); }
+        catch (const std::exception &) { std::cerr << "Cannot open " << path << "\n"; }
 
-        try
+        if (input)
         {
-            FlexBuffer f_buffer(input);
-
-            if (int parse_result = yyparse(); parse_result == 0)
-            {
-                std::cout << "Parsing successful!\n";
-                std::cout << "[Root]\n";
-                print_ast(g_ast_root);
-                auto root = g_ast_root;
-                IntermediateCodeGen irgen(root);
-                auto gen = irgen.get();
-                print_ir(gen);
-
-                // ===== 新增：生成 asm =====
-                CodeGenerator codegen(
-                    gen.code,
-                    gen.identifiers,
-                    gen.constants,
-                    {}               // tempmap，你现在 IR 已经是最终名，可以先传空
-                );
-
-                codegen.writeAsm("../output.asm");
-                std::cout << "[OK] output.asm generated.\n";
-            }
+            const auto result = compiler.update(std::string(input->text()));
+            input.reset();
+            const auto &stats = compiler.stats();
+            if (!result.ok)
+                std::cerr << path << ": " << result.error << "\n";
+            else if (!write_result(output, result, options.emit))
+                std::cerr << "Cannot write " << output << "\n";
             else
             {
-                std::cerr << "Parsing failed.\n";
+                std::cout << "[OK] " << output << " generated in " << std::fixed << std::setprecision(1)
+                          << stats.seconds * 1e3 << " ms (" << stats.statements << " statements: "
+                          << stats.reparsed << " reparsed, " << stats.regenerated << " regenerated, "
+                          << stats.recompiled << " recompiled"
+                          << (stats.fullParse ? ", full parse" : "")
+                          << (stats.wholeProgram ? ", whole program" : "") << ")\n";
             }
         }
-        catch (const std::exception &e)
+        std::cout << "------------------------------" << std::endl;
+        watcher->wait();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bool watch = false;
+    Options options;
+    std::string output;
+    std::string outDir;
+    std::string manifest;
+    std::vector<std::string> inputs;
+    unsigned threads = 0;
+    bool dumpAst = false;
+    bool dumpIr = false;
+    StatsReport report;
+    std::string cacheDir;
+    bool opt = false;
+    std::optional<std::vector<std::string>> passes;
+    std::uint64_t cacheSize = CompileCache::kDefaultMaxBytes;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--once")
+            ; // 默认就只编译一次，保留这个选项给原来的脚本
+        else if (arg == "--watch")
+            watch = true;
+        else if (arg == "--emit=asm")
+            options.emit = EmitKind::Asm;
+        else if (arg == "--emit=obj")
+            options.emit = EmitKind::Object;
+        else if (arg == "--emit=exe")
+            options.emit = EmitKind::Executable;
+        else if (arg == "--emit=ir")
+            options.emit = EmitKind::IR;
+        else if (arg == "--opt")
+            opt = true;
+        else if (arg == "--stream")
+            options.stream = true;
+        else if (arg == "--regions")
+            options.regions = true;
+        else if (arg.rfind("--passes=", 0) == 0)
+            passes = split_passes(arg.substr(9));
+        else if (arg == "--list-passes")
+        {
+            for (auto &name : pass_names())
+                std::cout << name << "\n";
+            return 0;
+        }
+        else if (arg == "-O0" || arg == "-O1")
+        {
+            options.optLevel = arg[2] - '0';
+            options.optimizeSize = false;
+        }
+        else if (arg == "-Os")
         {
-            std::cerr << e.what() << "\n";
+            options.optLevel = 1;
+            options.optimizeSize = true;
         }
-        std::cout << "------------------------------\n";
+        else if (arg == "--count-insns")
+            options.countInstructions = true;
+        else if (arg == "-g")
+            options.debugInfo = true;
+        else if (arg == "--simd=auto")
+            options.simd = Simd::Auto;
+        else if (arg == "--simd=sse2")
+            options.simd = Simd::Sse2;
+        else if (arg == "--simd=avx2")
+            options.simd = Simd::Avx2;
+        else if (arg == "--simd=off")
+            options.simd = Simd::Off;
+        else if (arg == "--instrument")
+            options.instrument = "default.prof";
+        else if (arg.rfind("--instrument=", 0) == 0)
+            options.instrument = arg.substr(13);
+        else if (arg == "--profile-use" && i + 1 < argc)
+            options.profileUse.emplace_back(argv[++i]);
+        else if (arg == "--dump-ast")
+            dumpAst = true;
+        else if (arg == "--dump-ir")
+            dumpIr = true;
+        else if (arg == "--stats" || arg == "--stats=table")
+            options.stats = true;
+        else if (arg == "--stats=json")
+            options.stats = report.json = true;
+        else if (arg == "--stats-file" && i + 1 < argc)
+            report.file = argv[++i];
+        else if (arg == "--cache-dir" && i + 1 < argc)
+            cacheDir = argv[++i];
+        else if (arg == "--cache-size" && i + 1 < argc)
+        {
+            try { cacheSize = parse_size(argv[++i]); }
+            catch (const std::exception &) { std::cerr << "Bad --cache-size: " << argv[i] << "\n"; return 1; }
+        }
+        else if (arg == "-o" && i + 1 < argc)
+            output = argv[++i];
+        else if (arg == "--out-dir" && i + 1 < argc)
+            outDir = argv[++i];
+        else if (arg == "--manifest" && i + 1 < argc)
+            manifest = argv[++i];
+        else if (arg.rfind("-j", 0) == 0 && (arg.size() > 2 || i + 1 < argc))
+        {
+            const std::string count = arg.size() > 2 ? arg.substr(2) : argv[++i];
+            try { threads = parse_jobs(count); }
+            catch (const std::exception &) { std::cerr << "Bad -j: " << count << "\n"; return 1; }
+        }
+        else if (arg == "-" || (!arg.empty() && arg[0] != '-'))
+            inputs.push_back(arg);
+        else
+        {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    if (!cacheDir.empty())
+    {
+        try { options.cache = std::make_shared<CompileCache>(cacheDir, cacheSize); }
+        catch (const std::exception &e) { std::cerr << e.what() << "\n"; return 1; }
+    }
 
-        if (!once)
+    if (options.stream && options.regions)
+    {
+        std::cerr << "--stream and --regions cannot be combined\n";
+        return 1;
+    }
+
+    if (opt)
+        return run_opt(inputs, output, options, passes, dumpIr, report);
+    if (passes)
+    {
+        std::cerr << "--passes is only available with --opt\n";
+        return 1;
+    }
+
+    if (watch)
+    {
+        if (inputs.size() > 1 || !manifest.empty() || inputs == std::vector<std::string>{"-"})
+        {
+            std::cerr << "--watch takes at most one input file\n";
+            return 1;
+        }
+        if (options.stream || options.regions || options.cache || dumpAst || dumpIr)
+        {
+            std::cerr << "--watch cannot be combined with --stream, --regions, --cache-dir or --dump-*\n";
+            return 1;
+        }
+        const std::string path = inputs.empty() ? "../read.txt" : inputs[0];
+        options.sourceName = path;
+        if (output.empty())
+            output = inputs.empty() ? dev_output(options.emit) : default_output(path, options.emit, outDir);
+        return run_watch(path, output, options);
+    }
+
+    if (!inputs.empty() || !manifest.empty())
+    {
+        if (dumpAst || dumpIr)
         {
-            std::string dummy;
-            std::getline(std::cin, dummy);
+            std::cerr << "--dump-ast / --dump-ir are only available without input files\n";
+            return 1;
         }
+        return run_batch(inputs, manifest, output, outDir, options, threads, report);
+    }
+
+    // 没有给出输入文件：编译一次 ../read.txt（开发时的模式，改一次编译一次用 --watch）
+    // AST / IR 只在要求时保留并打印，大输入上打印本身就是主要开销
+    options.keepAst = dumpAst;
+    options.keepIr = dumpIr;
+    options.threads = threads;
+    options.sourceName = "../read.txt";
+    if (output.empty())
+        output = dev_output(options.emit);
+
+    std::optional<SourceInput> input;
+    try { input.emplace(SourceInput::open("../read.txt")); }
+    catch (const std::exception &) { std::cerr << "Cannot open read.txt\n"; return 1; }
+
+    auto result = compile(*input, options);
+    if (!result.ok)
+    {
+        std::cerr << result.error << "\n";
+        return 1;
+    }
+    std::cout << "Parsing successful!\n";
+    if (dumpAst)
+    {
+        std::cout << "[Root]\n";
+        print_ast(result.ast);
+    }
+    if (dumpIr)
+        print_ir(result.ir);
 
-    } while (!once);
+    const auto writeStart = std::chrono::steady_clock::now();
+    if (!write_result(output, result, options.emit))
+    {
+        std::cerr << "Cannot write " << output << "\n";
+        return 1;
+    }
+    std::cout << "[OK] " << output << " generated.\n";
 
+    if (options.stats)
+    {
+        result.stats.add_phase("write", std::chrono::duration<double>(
+                                   std::chrono::steady_clock::now() - writeStart).count());
+        report_stats(result.stats, report);
+    }
     return 0;
 }
\ No newline at end of file
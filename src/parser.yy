@@ -1,5 +1,6 @@
 /* 1. PREAMBLE */
 %{
+#include <chrono>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -7,20 +8,15 @@
 #include "ast.hpp"     // Your AST node definitions
 #include "tokens.hpp"  // Your Token struct and TokenType enum
 
-// Forward declare the scanner function (defined in Flex)
-extern int yylex();
-extern int yylineno;
+// 语义值不是平凡类型，yacc.c 扩栈时的 memcpy 搬移会让 shared_ptr 被释放两次。
+// 初始栈直接开到最大深度，永远不搬移；嵌套超过上限时报告 "memory exhausted"。
+#define YYINITDEPTH 10000
+#define YYMAXDEPTH YYINITDEPTH
 
-// Forward declare the error function
-void yyerror(const char *s);
-
-// This will hold the final, complete AST
-std::shared_ptr<Node> g_ast_root;
-
-static int node_line(const std::shared_ptr<Node> &node)
+static int node_line(const std::shared_ptr<Node> &node, const int fallback)
 {
     if (!node)
-        return yylineno;
+        return fallback;
     if (auto num = std::dynamic_pointer_cast<NumberNode>(node))
         return num->tok.line;
     if (auto id = std::dynamic_pointer_cast<IdentifierNode>(node))
@@ -29,7 +25,11 @@ static int node_line(const std::shared_ptr<Node> &node)
         return bin->op_tok.line;
     if (auto assign = std::dynamic_pointer_cast<Assignment>(node))
         return assign->identifier.line;
-    return yylineno;
+    if (auto idx = std::dynamic_pointer_cast<IndexNode>(node))
+        return idx->array.line;
+    if (auto call = std::dynamic_pointer_cast<CallNode>(node))
+        return call->name.line;
+    return fallback;
 }
 %}
 
@@ -39,26 +39,91 @@ static int node_line(const std::shared_ptr<Node> &node)
 // associated with a token (terminal) or a grammar rule (non-terminal).
 %code requires {
     #include <memory>
+    #include <variant>
     #include <vector>
     #include "ast.hpp"
+    #include "frontend.hpp"
     #include "tokens.hpp"
 
-    struct SemanticValue {
-        std::shared_ptr<Node> node;
-        std::shared_ptr<Condition> condition;
-        std::vector<Token> token_list;
-        Token token;
-    };
+    // Flex 的可重入扫描器句柄（与 scanner.cpp 中的 typedef 相同）
+    typedef void *yyscan_t;
+
+    // 语法符号的语义值，每个符号只占用其中一种：
+    // 终结符为 Token，表达式 / 语句为 AST 结点，condition 为 Condition，
+    // identifier_list / 形参表为 Token 数组，实参表为表达式数组
+    using SemanticValue = std::variant<std::monostate,
+                                       Token,
+                                       std::shared_ptr<Node>,
+                                       std::shared_ptr<Condition>,
+                                       std::vector<Token>,
+                                       std::vector<std::shared_ptr<Node>>>;
 }
 
 %define api.value.type {SemanticValue}
 
-// Tokens that carry additional data use yylval.token from the scanner.
+// 可重入：没有全局的 yylval / yylineno / g_ast_root，
+// 扫描器句柄和本次编译的上下文都通过参数传入
+%define api.pure full
+%parse-param {yyscan_t scanner} {ParseContext &ctx}
+%lex-param {yyscan_t scanner}
+
+%code {
+    // Provided by Flex (scanner.l, %option reentrant bison-bridge)
+    int yylex(YYSTYPE *yylval_param, yyscan_t yyscanner);
+    int yyget_lineno(yyscan_t yyscanner);
+
+    // Bison calls this function on a syntax error.
+    void yyerror(yyscan_t scanner, ParseContext &ctx, const char *s);
+
+    // 语法分析器取 token 的入口：计数，--stats 时顺便给扫描器计时
+    // 收集顶层语句的范围时（ctx.statements），记下每个 token 的位置
+    static int lex_token(YYSTYPE *value, yyscan_t scanner, ParseContext &ctx)
+    {
+        int t;
+        if (!ctx.timeScanner) {
+            t = yylex(value, scanner);
+        } else {
+            const auto start = std::chrono::steady_clock::now();
+            t = yylex(value, scanner);
+            ctx.scanSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        ctx.tokens += t != 0;
+        if (ctx.scan) {
+            ctx.previousEnd = ctx.tokenEnd;
+            ctx.tokenBegin = t != 0 ? ctx.scan->tokenStart : ctx.scan->offset;
+            ctx.tokenEnd = ctx.scan->offset;
+            if (ctx.statementBegin == static_cast<std::size_t>(-1))
+                ctx.statementBegin = ctx.tokenBegin;
+        }
+        return t;
+    }
+    #define yylex(value, scanner) lex_token(value, scanner, ctx)
+
+    // 按符号的种类取出语义值
+    static Token &token(SemanticValue &v) { return std::get<Token>(v); }
+    static std::shared_ptr<Node> &node(SemanticValue &v) { return std::get<std::shared_ptr<Node>>(v); }
+    static std::shared_ptr<Condition> &condition(SemanticValue &v) { return std::get<std::shared_ptr<Condition>>(v); }
+    static std::vector<Token> &tokens(SemanticValue &v) { return std::get<std::vector<Token>>(v); }
+    static std::vector<std::shared_ptr<Node>> &nodes(SemanticValue &v) { return std::get<std::vector<std::shared_ptr<Node>>>(v); }
+
+    // 复合条件 lhs op rhs（"!" 时 rhs 为空），行号取 lhs 的
+    static std::shared_ptr<Condition> logical(const char *op, std::shared_ptr<Condition> lhs, std::shared_ptr<Condition> rhs)
+    {
+        auto cond = std::make_shared<Condition>();
+        cond->comparison = Token{TokenType::Comparison, op, lhs->comparison.line};
+        cond->lhs = std::move(lhs);
+        cond->rhs = std::move(rhs);
+        return cond;
+    }
+}
+
+// Tokens that carry additional data store a Token in *yylval from the scanner.
 %token T_INTLIT T_VAR T_COMPARISON T_STRING
 
 // Define simple tokens (keywords, punctuation) that don't carry data
-%token T_IF T_ELSE T_WHILE T_INT T_STRINGKW T_PRINT T_PRINTS
+%token T_IF T_ELSE T_WHILE T_INT T_STRINGKW T_PRINT T_PRINTS T_RETURN
 %token T_ASSIGN
+%token T_AND T_OR T_NOT
 %token T_LPAREN T_RPAREN T_LBRACE T_RBRACE T_SEMICOLON T_END
 
 // Define operator precedence (lowest to highest) and associativity.
@@ -75,40 +140,84 @@ static int node_line(const std::shared_ptr<Node> &node)
 // The 'program' rule waits for all statements and an END token or EOF.
 // $1 refers to the value of 'statements'. $$ is the value of 'program'.
 program
-    : statements T_END
+    : top_statements T_END
     {
-        g_ast_root = $1.node; // Save the completed AST
+        ctx.root = node($1); // Save the completed AST
     }
-    | statements
+    | top_statements
     {
-        g_ast_root = $1.node; // Save the completed AST (EOF case)
+        ctx.root = node($1); // Save the completed AST (EOF case)
     }
     ;
 
+// 与 statements 相同，另外可以定义过程；流式解析（ctx.onStatement）时每条语句归约后立即交出去，
+// 收集范围（ctx.statements）时放进列表，都不再连成链
+top_statements
+    : /* empty */
+    {
+        $$ = std::shared_ptr<Node>();
+    }
+    | top_statements top_statement
+    {
+        if (ctx.statements) {
+            // 已经读入了向前看 token 时，这条语句在它前面那个 token 处结束，下一条从向前看 token 开始
+            const bool lookahead = yychar != YYEMPTY;
+            ctx.statements->push_back({node($2), ctx.statementBegin, lookahead ? ctx.previousEnd : ctx.tokenEnd});
+            ctx.statementBegin = lookahead ? ctx.tokenBegin : static_cast<std::size_t>(-1);
+            $$ = std::shared_ptr<Node>();
+        } else if (!ctx.onStatement) {
+            auto st = std::make_shared<Statement>();
+            st->left = node($1);
+            st->right = node($2);
+            $$ = st;
+        } else {
+            ctx.onStatement(node($2));
+            node($2).reset();
+            $$ = std::shared_ptr<Node>();
+            // 这条语句的 AST 已经释放，字符串池可以清空；
+            // 已经读入的向前看 token（yylval）还指向池里的文本，清空后重新放回去
+            if (ctx.strings) {
+                Token *t = yychar != YYEMPTY ? std::get_if<Token>(&yylval) : nullptr;
+                const std::string lookahead = t ? std::string(t->value) : std::string();
+                ctx.strings->clear();
+                if (t)
+                    t->value = ctx.strings->intern(lookahead);
+            }
+        }
+    }
+    ;
+
+top_statement
+    : statement { $$ = node($1); }
+    | procedure { $$ = node($1); }
+    ;
+
 // This rule translates your `statements()` logic [cite: 2]
 statements
     : /* empty */
     {
-        $$.node = nullptr; // Base case: no statements
+        $$ = std::shared_ptr<Node>(); // Base case: no statements
     }
     | statements statement
     {
         auto st = std::make_shared<Statement>();
-        st->left = $1.node;  // The previous statements
-        st->right = $2.node; // The new statement
-        $$.node = st;        // Pass the combined list up
+        st->left = node($1);  // The previous statements
+        st->right = node($2); // The new statement
+        $$ = st;        // Pass the combined list up
     }
     ;
 
 statement
-    : if_statement    { $$.node = $1.node; }
-    | while_statement { $$.node = $1.node; }
-    | declarations    { $$.node = $1.node; }
-    | assignment      { $$.node = $1.node; }
-    | printing        { $$.node = $1.node; }
+    : if_statement    { $$ = node($1); }
+    | while_statement { $$ = node($1); }
+    | declarations    { $$ = node($1); }
+    | assignment      { $$ = node($1); }
+    | printing        { $$ = node($1); }
+    | call T_SEMICOLON { $$ = node($1); }
+    | return_statement { $$ = node($1); }
     | T_LBRACE statements T_RBRACE // For nested blocks
     {
-        $$.node = $2.node;
+        $$ = node($2);
     }
     ;
 
@@ -118,66 +227,77 @@ statement
 expr
     : term
     {
-        $$.node = $1.node;
+        $$ = node($1);
     }
     | expr '+' term  // $1 is 'expr', $2 is '+', $3 is 'term'
     {
         auto bin = std::make_shared<BinOpNode>();
-        bin->left = $1.node;
-        bin->op_tok = Token{TokenType::Arth, "+", node_line($1.node)};
-        bin->right = $3.node;
-        $$.node = bin; // $$ is the new 'expr' node
+        bin->left = node($1);
+        bin->op_tok = Token{TokenType::Arth, "+", node_line(node($1), yyget_lineno(scanner))};
+        bin->right = node($3);
+        $$ = bin; // $$ is the new 'expr' node
     }
     | expr '-' term
     {
         auto bin  = std::make_shared<BinOpNode>();
-        bin->left = $1.node;
-        bin->op_tok = Token{TokenType::Arth, "-", node_line($1.node)};
-        bin->right  = $3.node;
-        $$.node     = bin;
+        bin->left = node($1);
+        bin->op_tok = Token{TokenType::Arth, "-", node_line(node($1), yyget_lineno(scanner))};
+        bin->right  = node($3);
+        $$ = bin;
     }
     ; 
 
 term
     : factor
     {
-        $$.node = $1.node;
+        $$ = node($1);
     }
     | term '*' factor
     {
         auto bin  = std::make_shared<BinOpNode>();
-        bin->left = $1.node;
-        bin->op_tok = Token{TokenType::Arth, "*", node_line($1.node)};
-        bin->right  = $3.node;
-        $$.node     = bin;
+        bin->left = node($1);
+        bin->op_tok = Token{TokenType::Arth, "*", node_line(node($1), yyget_lineno(scanner))};
+        bin->right  = node($3);
+        $$ = bin;
     }
     | term '/' factor
     {
         auto bin  = std::make_shared<BinOpNode>();
-        bin->left = $1.node;
-        bin->op_tok = Token{TokenType::Arth, "/", node_line($1.node)};
-        bin->right  = $3.node;
-        $$.node     = bin;
+        bin->left = node($1);
+        bin->op_tok = Token{TokenType::Arth, "/", node_line(node($1), yyget_lineno(scanner))};
+        bin->right  = node($3);
+        $$ = bin;
     }
     ;
 
 factor
     : T_INTLIT
     {
-        // $1 is the Token from the scanner (via %union.token)
-        $$.node = std::make_shared<NumberNode>($1.token);
+        // $1 is the Token from the scanner
+        $$ = std::make_shared<NumberNode>(token($1));
     }
     | T_VAR
     {
-        $$.node = std::make_shared<IdentifierNode>($1.token);
+        $$ = std::make_shared<IdentifierNode>(token($1));
+    }
+    | T_VAR '[' expr ']'
+    {
+        auto idx = std::make_shared<IndexNode>();
+        idx->array = token($1);
+        idx->index = node($3);
+        $$ = idx;
     }
     | T_STRING
     {
-        $$.node = std::make_shared<StringNode>($1.token);
+        $$ = std::make_shared<StringNode>(token($1));
+    }
+    | call
+    {
+        $$ = node($1);
     }
     | T_LPAREN expr T_RPAREN
     {
-        $$.node = $2.node; // Pass the inner expression's node up
+        $$ = node($2); // Pass the inner expression's node up
     }
     ;
 
@@ -187,9 +307,17 @@ assignment
     : T_VAR T_ASSIGN expr T_SEMICOLON
     {
         auto asg = std::make_shared<Assignment>();
-        asg->identifier = $1.token;
-        asg->expression = $3.node;
-        $$.node = asg;
+        asg->identifier = token($1);
+        asg->expression = node($3);
+        $$ = asg;
+    }
+    | T_VAR '[' expr ']' T_ASSIGN expr T_SEMICOLON
+    {
+        auto asg = std::make_shared<Assignment>();
+        asg->identifier = token($1);
+        asg->index = node($3);
+        asg->expression = node($6);
+        $$ = asg;
     }
     ;
 
@@ -199,29 +327,60 @@ if_statement
     : T_IF T_LPAREN condition T_RPAREN T_LBRACE statements T_RBRACE
     {
         auto ifs = std::make_shared<IfStatement>();
-        ifs->if_condition = $3.condition;
-        ifs->if_body = $6.node;
+        ifs->if_condition = condition($3);
+        ifs->if_body = node($6);
         ifs->else_body = nullptr;
-        $$.node = ifs;
+        $$ = ifs;
     }
     | T_IF T_LPAREN condition T_RPAREN T_LBRACE statements T_RBRACE T_ELSE T_LBRACE statements T_RBRACE
     {
         auto ifs = std::make_shared<IfStatement>();
-        ifs->if_condition = $3.condition;
-        ifs->if_body      = $6.node;
-        ifs->else_body    = $10.node;
-        $$.node           = ifs;
+        ifs->if_condition = condition($3);
+        ifs->if_body      = node($6);
+        ifs->else_body    = node($10);
+        $$ = ifs;
     }
     ;
 
+// || 的优先级低于 &&，! 最高，都只作用于比较，不产生整数值；括号可以改变结合
 condition
+    : and_condition
+    {
+        $$ = std::move($1);
+    }
+    | condition T_OR and_condition
+    {
+        $$ = logical("||", condition($1), condition($3));
+    }
+    ;
+
+and_condition
+    : not_condition
+    {
+        $$ = std::move($1);
+    }
+    | and_condition T_AND not_condition
+    {
+        $$ = logical("&&", condition($1), condition($3));
+    }
+    ;
+
+not_condition
     : expr T_COMPARISON expr
     {
         auto cond = std::make_shared<Condition>();
-        cond->left_expression  = $1.node;
-        cond->comparison       = $2.token;   // 包含 "==", "<", ">" 等
-        cond->right_expression = $3.node;
-        $$.condition = cond;
+        cond->left_expression  = node($1);
+        cond->comparison       = token($2);   // 包含 "==", "<", ">" 等
+        cond->right_expression = node($3);
+        $$ = cond;
+    }
+    | T_NOT not_condition
+    {
+        $$ = logical("!", condition($2), nullptr);
+    }
+    | T_LPAREN condition T_RPAREN
+    {
+        $$ = std::move($2);
     }
     ;
 
@@ -229,9 +388,94 @@ while_statement
     : T_WHILE T_LPAREN condition T_RPAREN T_LBRACE statements T_RBRACE
     {
         auto w = std::make_shared<WhileStatement>();
-        w->condition = $3.condition;
-        w->body = $6.node;
-        $$.node = w;
+        w->condition = condition($3);
+        w->body = node($6);
+        $$ = w;
+    }
+    ;
+
+// --------- 过程 ---------
+
+procedure
+    : T_INT T_VAR T_LPAREN parameters T_RPAREN T_LBRACE statements T_RBRACE
+    {
+        auto proc = std::make_shared<ProcedureNode>();
+        proc->name   = token($2);
+        proc->params = std::move(tokens($4));
+        proc->body   = node($7);
+        $$ = proc;
+    }
+    ;
+
+parameters
+    : /* empty */
+    {
+        $$ = std::vector<Token>{};
+    }
+    | parameter_list
+    {
+        $$ = std::move($1);
+    }
+    ;
+
+parameter_list
+    : T_INT T_VAR
+    {
+        $$ = std::vector<Token>{ token($2) };
+    }
+    | parameter_list ',' T_INT T_VAR
+    {
+        tokens($1).push_back(token($4));
+        $$ = std::move($1);
+    }
+    ;
+
+call
+    : T_VAR T_LPAREN arguments T_RPAREN
+    {
+        auto call = std::make_shared<CallNode>();
+        call->name = token($1);
+        call->args = std::move(nodes($3));
+        $$ = call;
+    }
+    ;
+
+arguments
+    : /* empty */
+    {
+        $$ = std::vector<std::shared_ptr<Node>>{};
+    }
+    | argument_list
+    {
+        $$ = std::move($1);
+    }
+    ;
+
+argument_list
+    : expr
+    {
+        $$ = std::vector<std::shared_ptr<Node>>{ node($1) };
+    }
+    | argument_list ',' expr
+    {
+        nodes($1).push_back(node($3));
+        $$ = std::move($1);
+    }
+    ;
+
+return_statement
+    : T_RETURN expr T_SEMICOLON
+    {
+        auto ret = std::make_shared<ReturnStatement>();
+        ret->value = node($2);
+        ret->line  = node_line(ret->value, yyget_lineno(scanner));
+        $$ = ret;
+    }
+    | T_RETURN T_SEMICOLON
+    {
+        auto ret = std::make_shared<ReturnStatement>();
+        ret->line = yyget_lineno(scanner);
+        $$ = ret;
     }
     ;
 
@@ -242,15 +486,17 @@ printing
     {
         auto p = std::make_shared<PrintStatement>();
         p->type = "int";
-        p->intExpr = $3.node;
-        $$.node = p;
+        p->intExpr = node($3);
+        p->line = node_line(p->intExpr, yyget_lineno(scanner));
+        $$ = p;
     }
     | T_PRINTS T_LPAREN T_STRING T_RPAREN T_SEMICOLON
     {
         auto p  = std::make_shared<PrintStatement>();
         p->type     = "string";
-        p->strValue = $3.token.value;  // 字符串字面量内容
-        $$.node     = p;
+        p->strValue = token($3).value;  // 字符串字面量内容
+        p->line     = token($3).line;
+        $$ = p;
     }
     ;
 
@@ -260,62 +506,79 @@ declarations
     : T_INT identifier_list T_SEMICOLON
     {
         auto decl = std::make_shared<Declaration>();
-        decl->declaration_type = Token{TokenType::Int, "int", yylineno};
-        decl->identifiers      = $2.token_list;
-        $$.node = decl;
+        decl->declaration_type = Token{TokenType::Int, "int", yyget_lineno(scanner)};
+        decl->identifiers      = std::move(tokens($2));
+        $$ = decl;
+    }
+    | T_INT T_VAR '[' T_INTLIT ']' T_SEMICOLON
+    {
+        // int a[N];：N 个 int，放在 .bss 里，按 64 字节对齐
+        const auto &len = token($4);
+        std::int64_t n = 0;
+        for (const char c : len.value)
+            n = n > (1 << 24) ? n : n * 10 + (c - '0');
+        if (n < 1 || n > (1 << 24))
+            throw std::runtime_error("invalid array length " + std::string(len.value) + " at line " +
+                                     std::to_string(len.line));
+        auto decl = std::make_shared<Declaration>();
+        decl->declaration_type = Token{TokenType::Int, "int", yyget_lineno(scanner)};
+        decl->identifiers      = std::vector<Token>{ token($2) };
+        decl->length           = n;
+        $$ = decl;
     }
     | T_INT T_VAR T_ASSIGN expr T_SEMICOLON
     {
         // int x = expr; 视为「声明 + 赋值」组合成一个 Statement
         auto decl = std::make_shared<Declaration>();
-        decl->declaration_type = Token{TokenType::Int, "int", yylineno};
-        decl->identifiers      = std::vector<Token>{ $2.token };
+        decl->declaration_type = Token{TokenType::Int, "int", yyget_lineno(scanner)};
+        decl->identifiers      = std::vector<Token>{ token($2) };
+        decl->initialized      = true;
 
         auto asg = std::make_shared<Assignment>();
-        asg->identifier = $2.token;
-        asg->expression = $4.node;
+        asg->identifier = token($2);
+        asg->expression = node($4);
 
         auto st  = std::make_shared<Statement>();
         st->left  = decl;
         st->right = asg;
 
-        $$.node = st;
+        $$ = st;
     }
     | T_STRINGKW identifier_list T_SEMICOLON
     {
         auto decl = std::make_shared<Declaration>();
-        decl->declaration_type = Token{TokenType::StringKw, "string", yylineno};
-        decl->identifiers      = $2.token_list;
-        $$.node = decl;
+        decl->declaration_type = Token{TokenType::StringKw, "string", yyget_lineno(scanner)};
+        decl->identifiers      = std::move(tokens($2));
+        $$ = decl;
     }
    | T_STRINGKW T_VAR T_ASSIGN T_STRING T_SEMICOLON
    {
        auto decl = std::make_shared<Declaration>();
-       decl->declaration_type = Token{TokenType::StringKw, "string", yylineno};
-       decl->identifiers = { $2.token };
+       decl->declaration_type = Token{TokenType::StringKw, "string", yyget_lineno(scanner)};
+       decl->identifiers = { token($2) };
+       decl->initialized = true;
 
        auto asg = std::make_shared<Assignment>();
-       asg->identifier = $2.token;
-       asg->expression = std::make_shared<StringNode>($4.token);
+       asg->identifier = token($2);
+       asg->expression = std::make_shared<StringNode>(token($4));
 
        auto st = std::make_shared<Statement>();
        st->left = decl;
        st->right = asg;
 
-       $$.node = st;
+       $$ = st;
    }
     ;
 
 identifier_list
     : T_VAR
     {
-        $$.token_list = std::vector<Token>{ $1.token };
+        $$ = std::vector<Token>{ token($1) };
     }
     | identifier_list ',' T_VAR
     {
-        auto list = $1.token_list;
-        list.push_back($3.token);
-        $$.token_list = list;
+        tokens($1).push_back(token($3));
+        $$ = std::move($1);
     }
     ;
 
@@ -323,7 +586,7 @@ identifier_list
 /* 4. EPILOGUE */
 
 // Bison calls this function on a syntax error.
-void yyerror(const char *s) {
-    std::string error_msg = std::string(s) + " at line " + std::to_string(yylineno);
+void yyerror(yyscan_t scanner, ParseContext &, const char *s) {
+    std::string error_msg = std::string(s) + " at line " + std::to_string(yyget_lineno(scanner));
     throw std::runtime_error(error_msg);
-}
\ No newline at end of file
+}
@@ -0,0 +1,453 @@
+#include "pgo.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_set>
+
+// -------------------- 计数器文件 --------------------
+
+static const char kMagic[8] = {'N', 'A', 'S', 'M', 'P', 'R', 'O', 'F'};
+
+static void put64(std::string &out, std::uint64_t v) {
+    for (int i = 0; i < 8; ++i, v >>= 8)
+        out.push_back(static_cast<char>(v & 0xFF));
+}
+
+static std::uint64_t get64(const std::string &in, const std::size_t at) {
+    std::uint64_t v = 0;
+    for (int i = 7; i >= 0; --i)
+        v = v << 8 | static_cast<unsigned char>(in[at + static_cast<std::size_t>(i)]);
+    return v;
+}
+
+namespace {
+struct Fnv1a {
+    std::uint64_t h{1469598103934665603ULL};
+
+    void add(const std::string &s) {
+        for (const unsigned char c: s)
+            byte(c);
+        byte(0xFF); // 字段分隔
+    }
+
+    void byte(const unsigned char c) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+};
+}
+
+static void add_code(Fnv1a &f, const InterCodeArray &code) {
+    for (auto &ins: code.code) {
+        f.byte(static_cast<unsigned char>(ins->kind()));
+        switch (ins->kind()) {
+            case IRKind::Assignment: {
+                const auto &a = static_cast<const AssignmentCode &>(*ins);
+                f.add(a.var);
+                f.add(a.left);
+                f.add(a.op);
+                f.add(a.right);
+                break;
+            }
+            case IRKind::Jump:
+                f.add(static_cast<const JumpCode &>(*ins).dist);
+                break;
+            case IRKind::Label:
+                f.add(static_cast<const LabelCode &>(*ins).label);
+                break;
+            case IRKind::Compare: {
+                const auto &c = static_cast<const CompareCodeIR &>(*ins);
+                f.add(c.left);
+                f.add(c.operation);
+                f.add(c.right);
+                f.add(c.jump);
+                break;
+            }
+            case IRKind::Print: {
+                const auto &p = static_cast<const PrintCodeIR &>(*ins);
+                f.byte(static_cast<unsigned char>(p.printKind));
+                f.byte(p.newline);
+                f.add(p.value);
+                break;
+            }
+            case IRKind::Select: {
+                const auto &s = static_cast<const SelectCode &>(*ins);
+                f.add(s.var);
+                f.add(s.left);
+                f.add(s.operation);
+                f.add(s.right);
+                f.add(s.ifTrue);
+                f.add(s.ifFalse);
+                break;
+            }
+            case IRKind::Write:
+                for (auto &piece: static_cast<const WriteCode &>(*ins).pieces) {
+                    f.byte(static_cast<unsigned char>(piece.kind));
+                    f.add(piece.value);
+                }
+                break;
+            case IRKind::Load: {
+                const auto &l = static_cast<const LoadCode &>(*ins);
+                f.add(l.var);
+                f.add(l.array);
+                f.add(l.index);
+                break;
+            }
+            case IRKind::Store: {
+                const auto &st = static_cast<const StoreCode &>(*ins);
+                f.add(st.array);
+                f.add(st.index);
+                f.add(st.value);
+                break;
+            }
+            case IRKind::VectorLoop: {
+                // 循环体与后面的标量循环是同样的几条，已经计入
+                const auto &v = static_cast<const VectorLoopCode &>(*ins);
+                f.add(v.label);
+                f.add(v.index);
+                f.add(v.operation);
+                f.add(v.bound);
+                f.byte(static_cast<unsigned char>(v.body.size()));
+                break;
+            }
+            case IRKind::Call: {
+                const auto &c = static_cast<const CallCode &>(*ins);
+                f.add(c.var);
+                f.add(c.proc);
+                for (auto &a: c.args)
+                    f.add(a);
+                break;
+            }
+            case IRKind::Return:
+                f.add(static_cast<const ReturnCode &>(*ins).value);
+                break;
+            case IRKind::Procedure: {
+                const auto &p = static_cast<const ProcedureCode &>(*ins);
+                f.add(p.name);
+                for (auto &param: p.params)
+                    f.add(param);
+                add_code(f, p.body);
+                f.byte(static_cast<unsigned char>(IRKind::Procedure)); // 过程体结束
+                break;
+            }
+        }
+    }
+}
+
+std::uint64_t ir_checksum(const InterCodeArray &code) {
+    Fnv1a f;
+    add_code(f, code);
+    return f.h;
+}
+
+std::size_t profile_counter_count(const InterCodeArray &code) {
+    std::size_t n = 0;
+    for (auto &ins: code.code)
+        n += ins->kind() == IRKind::Label ? 1 : ins->kind() == IRKind::Compare ? 2 : 0;
+    return n;
+}
+
+std::string profile_header(const std::uint64_t checksum, const std::size_t counters) {
+    std::string h(kMagic, sizeof kMagic);
+    put64(h, kProfileVersion);
+    put64(h, checksum);
+    put64(h, counters);
+    return h;
+}
+
+Profile load_profile(const std::vector<std::string> &paths, const InterCodeArray &code) {
+    const auto checksum = ir_checksum(code);
+    const auto n = profile_counter_count(code);
+    std::vector<std::uint64_t> counters(n, 0);
+
+    for (auto &path: paths) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            throw std::runtime_error("Cannot open profile " + path);
+        const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (data.size() < kProfileHeaderSize || std::memcmp(data.data(), kMagic, sizeof kMagic) != 0)
+            throw std::runtime_error(path + ": not a profile file");
+        if (get64(data, 8) != kProfileVersion)
+            throw std::runtime_error(path + ": unsupported profile version " + std::to_string(get64(data, 8)));
+        if (get64(data, 16) != checksum || get64(data, 24) != n)
+            throw std::runtime_error(path + ": profile does not match this program "
+                                     "(recompile it with --instrument at the same optimization level)");
+        if (data.size() != kProfileHeaderSize + 8 * n)
+            throw std::runtime_error(path + ": truncated profile");
+        for (std::size_t i = 0; i < n; ++i)
+            counters[i] += get64(data, kProfileHeaderSize + 8 * i);
+    }
+
+    // 与 CodeGenerator 相同的编号：IR 顺序中的每个标签、每条条件跳转
+    Profile profile;
+    std::size_t next = 0;
+    std::string block;
+    for (auto &ins: code.code) {
+        if (ins->kind() == IRKind::Label) {
+            block = static_cast<const LabelCode &>(*ins).label;
+            profile.count[block] += counters[next++];
+        } else if (ins->kind() == IRKind::Compare) {
+            profile.taken[block] += counters[next++];
+            profile.flips[block] += counters[next++];
+        }
+    }
+    return profile;
+}
+
+// -------------------- 变换 --------------------
+
+static std::uint64_t lookup(const std::unordered_map<std::string, std::uint64_t> &m, const std::string &key) {
+    const auto it = m.find(key);
+    return it == m.end() ? 0 : it->second;
+}
+
+// 每个标签被多少条边（JMP / 顺序执行 / 条件跳转）引用
+static std::unordered_map<std::string, int> predecessors(const std::vector<IRBlock> &blocks) {
+    std::unordered_map<std::string, int> preds;
+    for (auto &b: blocks) {
+        if (!b.next.empty())
+            ++preds[b.next];
+        if (b.branch)
+            ++preds[b.branch->jump];
+    }
+    return preds;
+}
+
+static std::unordered_map<std::string, std::size_t> block_index(const std::vector<IRBlock> &blocks) {
+    std::unordered_map<std::string, std::size_t> index;
+    for (std::size_t i = 0; i < blocks.size(); ++i)
+        index[blocks[i].label] = i;
+    return index;
+}
+
+static std::shared_ptr<AssignmentCode> make_assign(const std::string &v, const std::string &l, const std::string &op,
+                                                   const std::string &r) {
+    auto a = std::make_shared<AssignmentCode>();
+    a->var = v;
+    a->left = l;
+    a->op = op;
+    a->right = r;
+    return a;
+}
+
+// ---- if-conversion ----
+
+// 方向改变的次数超过执行次数的 kUnpredictable 时，分支预测器大约每几次就猜错一次，
+// 两边都算再用 cmov 选择更便宜；偏向一边、或者有规律（例如先一直成立再一直不成立）的分支保持不变
+constexpr double kUnpredictable = 0.15;
+constexpr std::size_t kMaxArm = 4; // 每一边最多几条赋值
+
+// 能无条件执行的一边：只有赋值，除最后一条外都写临时变量，没有除法（除零会陷入）
+static bool convertible_arm(const IRBlock &b, const int preds) {
+    if (b.branch || preds != 1 || b.body.empty() || b.body.size() > kMaxArm)
+        return false;
+    for (std::size_t i = 0; i < b.body.size(); ++i) {
+        const auto *a = dynamic_cast<const AssignmentCode *>(b.body[i].get());
+        if (!a || a->op == "/" || a->var.empty())
+            return false;
+        if (i + 1 < b.body.size() && a->var[0] != 'T')
+            return false;
+    }
+    return true;
+}
+
+static const std::string &arm_target(const IRBlock &b) {
+    return static_cast<const AssignmentCode &>(*b.body.back()).var;
+}
+
+// 菱形 if (c) { x = e1; } else { x = e2; } 与三角形 if (c) { x = e1; }：
+// 两边都只写同一个变量 x 时改写成
+//   <then 的临时计算> Tt = e1   <else 的临时计算> Tf = e2   x = c ? Tt : Tf
+// 两边的临时变量只在各自的语句内使用（IR 生成的约定），提前计算不影响其他代码。
+static void if_convert(std::vector<IRBlock> &blocks, Profile &profile,
+                       std::unordered_map<std::string, std::string> &identifiers) {
+    auto preds = predecessors(blocks);
+    auto index = block_index(blocks);
+    int nextTemp = 0;
+    for (auto &[name, type]: identifiers)
+        if (name.size() > 1 && name[0] == 'T' && name.find_first_not_of("0123456789", 1) == std::string::npos)
+            nextTemp = std::max(nextTemp, std::stoi(name.substr(1)) + 1);
+
+    std::unordered_set<std::string> removed;
+    for (auto &a: blocks) {
+        if (!a.branch || removed.count(a.label))
+            continue;
+        const auto n = lookup(profile.count, a.label);
+        if (n == 0 || lookup(profile.flips, a.label) < n * kUnpredictable || a.branch->jump == a.next)
+            continue;
+
+        auto arm = [&](const std::string &label) -> IRBlock * {
+            const auto it = index.find(label);
+            if (it == index.end() || label == a.label || removed.count(label))
+                return nullptr;
+            auto &b = blocks[it->second];
+            return convertible_arm(b, preds[label]) ? &b : nullptr;
+        };
+        IRBlock *thenArm = arm(a.branch->jump);
+        IRBlock *elseArm = arm(a.next);
+        std::string join;
+        if (thenArm && elseArm && thenArm->next == elseArm->next && arm_target(*thenArm) == arm_target(*elseArm))
+            join = thenArm->next;
+        else if (thenArm && thenArm->next == a.next)
+            join = a.next, elseArm = nullptr;
+        else if (elseArm && elseArm->next == a.branch->jump)
+            join = a.branch->jump, thenArm = nullptr;
+        else
+            continue;
+
+        const auto x = arm_target(thenArm ? *thenArm : *elseArm);
+        // 一边的计算搬进 a，返回这一边给 x 的值
+        auto hoist = [&](const IRBlock *b) -> std::string {
+            if (!b)
+                return x;
+            for (std::size_t i = 0; i + 1 < b->body.size(); ++i)
+                a.body.push_back(b->body[i]);
+            const auto &last = static_cast<const AssignmentCode &>(*b->body.back());
+            if (last.op.empty())
+                return last.left;
+            auto temp = "T" + std::to_string(nextTemp++);
+            const auto type = identifiers.find(x);
+            identifiers[temp] = type != identifiers.end() ? type->second : "int";
+            a.body.push_back(make_assign(temp, last.left, last.op, last.right));
+            a.body.back()->line = last.line;
+            return temp;
+        };
+        const auto ifTrue = hoist(thenArm);
+        const auto ifFalse = hoist(elseArm);
+
+        auto sel = std::make_shared<SelectCode>();
+        sel->var = x;
+        sel->left = a.branch->left;
+        sel->operation = a.branch->operation;
+        sel->right = a.branch->right;
+        sel->ifTrue = ifTrue;
+        sel->ifFalse = ifFalse;
+        sel->line = a.branch->line;
+        a.body.push_back(sel);
+        a.branch.reset();
+        a.next = join;
+        profile.taken.erase(a.label);
+        profile.flips.erase(a.label);
+        for (const auto *b: {thenArm, elseArm})
+            if (b)
+                removed.insert(b->label);
+    }
+
+    if (removed.empty())
+        return;
+    blocks.erase(std::remove_if(blocks.begin(), blocks.end(),
+                                [&removed](const IRBlock &b) { return removed.count(b.label) > 0; }),
+                 blocks.end());
+}
+
+// ---- 循环展开 ----
+
+// 只展开最内层、循环体是单个基本块的 while 循环：
+//   H: <条件计算> CMP -> B   (不成立 -> E)
+//   B: <循环体> JMP H
+// 展开 k 次后每份循环体后面跟一份条件判断，只有最后一份跳回 H，每 k 次迭代省 k - 1 次跳转。
+// 平均迭代次数来自 profile：B 的执行次数 / 从 H 离开的次数。
+static unsigned unroll_factor(const std::uint64_t trips, const std::size_t size) {
+    if (trips >= 64 && size <= 12)
+        return 4;
+    if (trips >= 8 && size <= 24)
+        return 2;
+    return 1;
+}
+
+static void unroll_loops(std::vector<IRBlock> &blocks, Profile &profile,
+                         std::unordered_map<std::string, std::string> &) {
+    auto preds = predecessors(blocks);
+    auto index = block_index(blocks);
+
+    std::vector<IRBlock> out;
+    out.reserve(blocks.size());
+    std::unordered_map<std::string, std::vector<IRBlock> > copies; // 循环体标签 -> 展开出的块
+    for (auto &h: blocks) {
+        if (!h.branch)
+            continue;
+        // 循环体可能在条件成立的一边（IR 生成的形状），也可能在顺序执行的一边
+        const bool bodyOnTaken = index.count(h.branch->jump) > 0 && blocks[index[h.branch->jump]].next == h.label;
+        const auto &bodyLabel = bodyOnTaken ? h.branch->jump : h.next;
+        const auto it = index.find(bodyLabel);
+        if (it == index.end() || bodyLabel == h.label || copies.count(bodyLabel))
+            continue;
+        auto &b = blocks[it->second];
+        if (b.branch || b.next != h.label || preds[b.label] != 1)
+            continue;
+
+        const auto nh = lookup(profile.count, h.label);
+        const auto nb = lookup(profile.count, b.label);
+        if (nh <= nb)
+            continue; // 没有观察到循环结束
+        const auto exits = nh - nb;
+        const auto factor = unroll_factor(nb / exits, b.body.size() + h.body.size() + 1);
+        if (factor == 1)
+            continue;
+
+        const auto exit = bodyOnTaken ? h.next : h.branch->jump;
+        std::vector<IRBlock> unrolled;
+        for (unsigned k = 0; k < factor; ++k) {
+            IRBlock copy;
+            copy.label = k == 0 ? b.label : b.label + "_u" + std::to_string(k);
+            copy.body = b.body;
+            if (k + 1 == factor) {
+                copy.next = h.label;
+            } else {
+                const auto cont = b.label + "_u" + std::to_string(k + 1);
+                copy.body.insert(copy.body.end(), h.body.begin(), h.body.end());
+                copy.branch = std::make_shared<CompareCodeIR>(*h.branch);
+                copy.branch->jump = bodyOnTaken ? cont : exit;
+                copy.next = bodyOnTaken ? exit : cont;
+                profile.taken[copy.label] = bodyOnTaken ? nb / factor : exits / factor;
+            }
+            profile.count[copy.label] = nb / factor;
+            unrolled.push_back(std::move(copy));
+        }
+        profile.count[h.label] = exits + nb / factor;
+        profile.taken[h.label] = bodyOnTaken ? nb / factor : exits;
+        copies[bodyLabel] = std::move(unrolled);
+    }
+    if (copies.empty())
+        return;
+
+    for (auto &b: blocks) {
+        if (const auto it = copies.find(b.label); it != copies.end())
+            for (auto &c: it->second)
+                out.push_back(std::move(c));
+        else
+            out.push_back(std::move(b));
+    }
+    blocks = std::move(out);
+}
+
+// ---- 块布局 ----
+
+static void layout_by_profile(std::vector<IRBlock> &blocks, Profile &profile,
+                              std::unordered_map<std::string, std::string> &) {
+    BlockWeights weights;
+    for (auto &b: blocks) {
+        weights.count.push_back(lookup(profile.count, b.label));
+        weights.taken.push_back(lookup(profile.taken, b.label));
+        weights.cold.push_back(weights.count.back() == 0);
+    }
+    blocks = layout_blocks(blocks, weights);
+}
+
+const std::vector<ProfilePass> &profile_passes() {
+    static const std::vector<ProfilePass> passes = {
+        {
+            "thread_jumps",
+            [](std::vector<IRBlock> &blocks, Profile &, std::unordered_map<std::string, std::string> &) {
+                thread_jumps(blocks);
+            }
+        },
+        {"if_convert", if_convert},
+        {"unroll_loops", unroll_loops},
+        {"layout_blocks", layout_by_profile},
+    };
+    return passes;
+}
@@ -0,0 +1,140 @@
+#include "source.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// yy_scan_buffer() 要求缓冲区以两个 YY_END_OF_BUFFER_CHAR ('\0') 结尾
+static constexpr std::size_t kSentinels = 2;
+
+SourceInput SourceInput::open(const std::string &path) {
+    SourceInput in;
+    if (path == "-") {
+        in.fd_ = STDIN_FILENO;
+        return in;
+    }
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        // FIFO、字符设备等：流式读取
+        in.fd_ = fd;
+        in.ownsFd_ = true;
+        return in;
+    }
+
+    // 先保留 size + 2 字节（按页取整）的匿名零页，再把文件覆盖映射到开头。
+    // 哨兵要么落在文件最后一页 EOF 之后的部分（内核保证为 0），要么落在匿名页里，
+    // 文件大小恰好是页大小整数倍时也不会越过映射访问到 SIGBUS。
+    const auto size = static_cast<std::size_t>(st.st_size);
+    const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const auto length = (size + kSentinels + page - 1) / page * page;
+
+    void *base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Cannot map " + path + ": " + std::strerror(errno));
+    }
+    if (size > 0 && mmap(base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        const int err = errno;
+        munmap(base, length);
+        close(fd);
+        throw std::runtime_error("Cannot map " + path + ": " + std::strerror(err));
+    }
+    close(fd);
+    if (size > 0)
+        madvise(base, size, MADV_SEQUENTIAL);
+
+    in.data_ = static_cast<char *>(base);
+    in.size_ = size;
+    in.mapped_ = length;
+    return in;
+}
+
+SourceInput SourceInput::open_streaming(const std::string &path) {
+    if (path == "-")
+        return open(path);
+    SourceInput in;
+    in.fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in.fd_ < 0)
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+    in.ownsFd_ = true;
+    posix_fadvise(in.fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return in;
+}
+
+SourceInput SourceInput::from_string(const std::string_view text) {
+    SourceInput in;
+    in.owned_ = std::make_unique<char[]>(text.size() + kSentinels);
+    std::memcpy(in.owned_.get(), text.data(), text.size());
+    in.owned_[text.size()] = '\0';
+    in.owned_[text.size() + 1] = '\0';
+    in.data_ = in.owned_.get();
+    in.size_ = text.size();
+    return in;
+}
+
+SourceInput::SourceInput(SourceInput &&other) noexcept {
+    *this = std::move(other);
+}
+
+SourceInput &SourceInput::operator=(SourceInput &&other) noexcept {
+    if (this != &other) {
+        release();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        mapped_ = std::exchange(other.mapped_, 0);
+        owned_ = std::move(other.owned_);
+        fd_ = std::exchange(other.fd_, -1);
+        ownsFd_ = std::exchange(other.ownsFd_, false);
+        streamedLines_ = std::exchange(other.streamedLines_, 0);
+    }
+    return *this;
+}
+
+SourceInput::~SourceInput() {
+    release();
+}
+
+void SourceInput::release() {
+    if (mapped_ != 0)
+        munmap(data_, mapped_);
+    if (ownsFd_)
+        close(fd_);
+    data_ = nullptr;
+    mapped_ = 0;
+    owned_.reset();
+    fd_ = -1;
+    ownsFd_ = false;
+}
+
+std::size_t SourceInput::lines() const {
+    if (streaming())
+        return streamedLines_;
+    return static_cast<std::size_t>(std::count(data_, data_ + size_, '\n'));
+}
+
+std::size_t SourceInput::read(char *buf, const std::size_t max) {
+    if (fd_ < 0)
+        return 0;
+    for (;;) {
+        const auto n = ::read(fd_, buf, max);
+        if (n >= 0) {
+            size_ += static_cast<std::size_t>(n);
+            streamedLines_ += static_cast<std::size_t>(std::count(buf, buf + n, '\n'));
+            return static_cast<std::size_t>(n);
+        }
+        if (errno != EINTR)
+            throw std::runtime_error(std::string("Read error: ") + std::strerror(errno));
+    }
+}
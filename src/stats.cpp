@@ -0,0 +1,150 @@
+#include "stats.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+
+#include <sys/resource.h>
+
+// -------------------- 分配计数 --------------------
+// 替换全局 operator new / delete，按线程计数（批量模式下每个文件在一个线程上编译）。
+// new[] 与 nothrow 版本的默认实现都会转调这里。
+
+namespace {
+thread_local std::uint64_t tl_allocs = 0;
+thread_local std::uint64_t tl_bytes = 0;
+}
+
+void *operator new(const std::size_t size) {
+    ++tl_allocs;
+    tl_bytes += size;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+AllocCounters thread_alloc_counters() {
+    return {tl_allocs, tl_bytes};
+}
+
+long peak_rss_kb() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss; // Linux 上单位为 KB
+}
+
+// -------------------- CompileStats --------------------
+
+void CompileStats::add_phase(const std::string &name, const double seconds) {
+    for (auto &[n, s]: phases)
+        if (n == name) {
+            s += seconds;
+            return;
+        }
+    phases.emplace_back(name, seconds);
+}
+
+void CompileStats::merge(const CompileStats &other) {
+    for (auto &[n, s]: other.phases)
+        add_phase(n, s);
+    files += other.files;
+    tokens += other.tokens;
+    astNodes += other.astNodes;
+    irBefore += other.irBefore;
+    irAfter += other.irAfter;
+    machineInstrs += other.machineInstrs;
+    textBytes += other.textBytes;
+    dataBytes += other.dataBytes;
+    bssBytes += other.bssBytes;
+    allocations += other.allocations;
+    allocatedBytes += other.allocatedBytes;
+    cacheHits += other.cacheHits;
+    cacheMisses += other.cacheMisses;
+    if (other.peakRssKb > peakRssKb)
+        peakRssKb = other.peakRssKb;
+}
+
+// -------------------- 输出 --------------------
+
+static double total_seconds(const CompileStats &s) {
+    double t = 0;
+    for (auto &p: s.phases)
+        t += p.second;
+    return t;
+}
+
+std::string stats_table(const CompileStats &s) {
+    const double total = total_seconds(s);
+    std::ostringstream out;
+    char line[128];
+
+    out << "===== Compile statistics (" << s.files << " file(s)) =====\n";
+    std::snprintf(line, sizeof line, "  %-36s %12s %8s\n", "Phase", "Wall (ms)", "%");
+    out << line;
+    for (auto &[name, secs]: s.phases) {
+        std::snprintf(line, sizeof line, "  %-36s %12.3f %7.1f%%\n",
+                      name.c_str(), secs * 1e3, total > 0 ? 100.0 * secs / total : 0.0);
+        out << line;
+    }
+    std::snprintf(line, sizeof line, "  %-36s %12.3f\n", "Total", total * 1e3);
+    out << line;
+
+    auto row = [&](const char *name, const unsigned long long v) {
+        std::snprintf(line, sizeof line, "  %-36s %12llu\n", name, v);
+        out << line;
+    };
+    out << "\n";
+    row("Tokens", s.tokens);
+    row("AST nodes", s.astNodes);
+    row("IR instructions (before opt)", s.irBefore);
+    row("IR instructions (after opt)", s.irAfter);
+    row("Machine instructions", s.machineInstrs);
+    if (s.textBytes > 0) {
+        row(".text bytes", s.textBytes);
+        row(".data bytes (.rodata + .data)", s.dataBytes);
+        row(".bss bytes", s.bssBytes);
+    }
+    row("Allocations", s.allocations);
+    row("Allocated bytes", s.allocatedBytes);
+    row("Peak RSS (KB)", static_cast<unsigned long long>(s.peakRssKb));
+    if (s.cacheHits + s.cacheMisses > 0) {
+        row("Cache hits", s.cacheHits);
+        row("Cache misses", s.cacheMisses);
+    }
+    return out.str();
+}
+
+std::string stats_json(const CompileStats &s) {
+    std::ostringstream out;
+    out.precision(9);
+    out << "{\n  \"files\": " << s.files << ",\n  \"phases\": [";
+    for (std::size_t i = 0; i < s.phases.size(); ++i)
+        out << (i ? "," : "") << "\n    {\"name\": \"" << s.phases[i].first
+            << "\", \"seconds\": " << s.phases[i].second << "}";
+    out << "\n  ],\n"
+        << "  \"total_seconds\": " << total_seconds(s) << ",\n"
+        << "  \"tokens\": " << s.tokens << ",\n"
+        << "  \"ast_nodes\": " << s.astNodes << ",\n"
+        << "  \"ir_before\": " << s.irBefore << ",\n"
+        << "  \"ir_after\": " << s.irAfter << ",\n"
+        << "  \"machine_instructions\": " << s.machineInstrs << ",\n"
+        << "  \"text_bytes\": " << s.textBytes << ",\n"
+        << "  \"data_bytes\": " << s.dataBytes << ",\n"
+        << "  \"bss_bytes\": " << s.bssBytes << ",\n"
+        << "  \"allocations\": " << s.allocations << ",\n"
+        << "  \"allocated_bytes\": " << s.allocatedBytes << ",\n"
+        << "  \"peak_rss_kb\": " << s.peakRssKb << ",\n"
+        << "  \"cache_hits\": " << s.cacheHits << ",\n"
+        << "  \"cache_misses\": " << s.cacheMisses << "\n"
+        << "}\n";
+    return out.str();
+}
@@ -0,0 +1,133 @@
+#include "thread_pool.hpp"
+
+#include <stdexcept>
+
+namespace {
+// 当前线程所属的线程池及其队列编号（非工作线程为 nullptr）
+thread_local const ThreadPool *tl_pool = nullptr;
+thread_local unsigned tl_index = 0;
+}
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+
+    for (unsigned i = 0; i < threads; ++i)
+        queues.push_back(std::make_unique<Queue>());
+    for (unsigned i = 0; i < threads; ++i)
+        workers.emplace_back([this, i] { run(i); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &t: workers)
+        t.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    // 工作线程提交的子任务放进自己的队列（局部性好），外部提交的轮流分配
+    const unsigned target = tl_pool == this
+                                ? tl_index
+                                : nextQueue.fetch_add(1, std::memory_order_relaxed) % size();
+    pending.fetch_add(1);
+    {
+        auto &q = *queues[target];
+        std::lock_guard<std::mutex> lock(q.m);
+        q.tasks.push_back(std::move(task));
+    }
+    queued.fetch_add(1);
+    {
+        // 在锁内“经过”一次，保证等待中的线程不会错过这次通知
+        std::lock_guard<std::mutex> lock(m);
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::take(const unsigned self, Task &task) {
+    const auto n = size();
+    // 自己的队列：从队尾取（后进先出）
+    if (self < n) {
+        auto &q = *queues[self];
+        std::lock_guard<std::mutex> lock(q.m);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            queued.fetch_sub(1);
+            return true;
+        }
+    }
+    // 窃取：从其他队列的队头取（最早提交、通常也是最大的任务）
+    for (unsigned k = 1; k <= n; ++k) {
+        auto &q = *queues[(self + k) % n];
+        std::lock_guard<std::mutex> lock(q.m);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            queued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::execute(Task &task) {
+    try {
+        task();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(m);
+        if (!error)
+            error = std::current_exception();
+    }
+    task = nullptr;
+    if (pending.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(m);
+        idle.notify_all();
+    }
+}
+
+void ThreadPool::run(const unsigned index) {
+    tl_pool = this;
+    tl_index = index;
+    Task task;
+    for (;;) {
+        if (take(index, task)) {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m);
+        wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+        if (stopping && queued.load() == 0)
+            return;
+    }
+}
+
+void ThreadPool::wait() {
+    // 任务内部等待会把自己也算进 pending，永远等不到 0
+    if (tl_pool == this)
+        throw std::logic_error("ThreadPool::wait() called from one of its own tasks");
+
+    Task task;
+    const unsigned self = size(); // 不对应任何队列，只窃取
+    while (pending.load() > 0) {
+        if (take(self, task)) {
+            execute(task);
+            continue;
+        }
+        // 剩下的任务都在别的线程上执行，等它们结束
+        std::unique_lock<std::mutex> lock(m);
+        idle.wait(lock, [this] { return pending.load() == 0 || queued.load() > 0; });
+    }
+
+    std::lock_guard<std::mutex> lock(m);
+    if (error) {
+        auto e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
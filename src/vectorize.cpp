@@ -0,0 +1,216 @@
+#include "vectorize.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+// 同时占用的向量寄存器上限：xmm0..xmm15 / ymm0..ymm15
+constexpr std::size_t kVectorRegisters = 16;
+
+static bool is_int_literal(const std::string &s) {
+    if (s.empty()) return false;
+    std::size_t i = s[0] == '-' ? 1 : 0;
+    if (i == s.size()) return false;
+    for (; i < s.size(); ++i) if (s[i] < '0' || s[i] > '9') return false;
+    return true;
+}
+
+static bool is_var(const std::string &s) { return s.size() > 1 && s[0] == 'V'; }
+static bool is_temp(const std::string &s) { return s.size() > 1 && s[0] == 'T'; }
+
+// i = i + 1 或 i = 1 + i
+static bool is_increment(const IRInstr &ins, const std::string &i) {
+    const auto *a = dynamic_cast<const AssignmentCode *>(&ins);
+    return a && a->var == i && a->op == "+" &&
+           ((a->left == i && a->right == "1") || (a->left == "1" && a->right == i));
+}
+
+// s = s + x / s = x + s / s = s - x 中的 x；不是这种形式时返回空
+static std::string reduction_operand(const AssignmentCode &a) {
+    if (a.op == "+" && a.left == a.var && a.right != a.var)
+        return a.right;
+    if (a.op == "+" && a.right == a.var && a.left != a.var)
+        return a.left;
+    if (a.op == "-" && a.left == a.var && a.right != a.var)
+        return a.right;
+    return "";
+}
+
+// 循环体里同时占用寄存器的临时变量最多有几个：每条指令的结果先占一个新寄存器，
+// 之后再归还最后一次在这里使用的临时变量
+static std::size_t peak_temps(const std::vector<std::shared_ptr<IRInstr> > &body) {
+    std::unordered_map<std::string, std::size_t> last;
+    auto uses = [](const IRInstr &ins) -> std::vector<std::string> {
+        if (ins.kind() == IRKind::Store)
+            return {static_cast<const StoreCode &>(ins).value};
+        if (ins.kind() == IRKind::Assignment)
+            return {static_cast<const AssignmentCode &>(ins).left, static_cast<const AssignmentCode &>(ins).right};
+        return {};
+    };
+    auto def = [](const IRInstr &ins) -> std::string {
+        if (ins.kind() == IRKind::Load)
+            return static_cast<const LoadCode &>(ins).var;
+        if (ins.kind() == IRKind::Assignment && is_temp(static_cast<const AssignmentCode &>(ins).var))
+            return static_cast<const AssignmentCode &>(ins).var;
+        return "";
+    };
+    for (std::size_t k = 0; k < body.size(); ++k) {
+        if (const auto d = def(*body[k]); !d.empty())
+            last[d] = k;
+        for (auto &u: uses(*body[k]))
+            if (is_temp(u))
+                last[u] = k;
+    }
+    std::size_t live = 0, peak = 0;
+    for (std::size_t k = 0; k < body.size(); ++k) {
+        if (!def(*body[k]).empty())
+            peak = std::max(peak, ++live);
+        std::unordered_set<std::string> done;
+        for (auto &u: uses(*body[k]))
+            if (is_temp(u) && last[u] == k && done.insert(u).second)
+                --live;
+        if (const auto d = def(*body[k]); !d.empty() && last[d] == k && done.insert(d).second)
+            --live;
+    }
+    return peak;
+}
+
+// 循环体能否按 i 的若干个连续值同时执行
+static bool vectorizable(const std::vector<std::shared_ptr<IRInstr> > &body, const std::string &i,
+                         const std::string &bound) {
+    // 先找出归约变量，它们在别处被读取时不能向量化
+    std::unordered_set<std::string> reductions;
+    for (auto &ins: body)
+        if (const auto *a = dynamic_cast<const AssignmentCode *>(ins.get()); a && is_var(a->var))
+            reductions.insert(a->var);
+    if (reductions.count(i) || reductions.count(bound))
+        return false;
+
+    std::unordered_set<std::string> temps, invariants;
+    bool indexValue = false, memory = false;
+    // 值：字面量 / 循环不变的变量（广播），i（下标向量），循环体里算好的临时变量
+    auto value = [&](const std::string &v) {
+        if (v == i) {
+            indexValue = true;
+            return true;
+        }
+        if (is_int_literal(v) || (is_var(v) && !reductions.count(v))) {
+            invariants.insert(v);
+            return true;
+        }
+        return is_temp(v) && temps.count(v) > 0;
+    };
+    for (auto &ins: body) {
+        switch (ins->kind()) {
+            case IRKind::Load: {
+                const auto &l = static_cast<const LoadCode &>(*ins);
+                if (l.index != i || !is_temp(l.var))
+                    return false;
+                temps.insert(l.var);
+                memory = true;
+                break;
+            }
+            case IRKind::Store: {
+                const auto &s = static_cast<const StoreCode &>(*ins);
+                if (s.index != i || !value(s.value))
+                    return false;
+                memory = true;
+                break;
+            }
+            case IRKind::Assignment: {
+                const auto &a = static_cast<const AssignmentCode &>(*ins);
+                if (is_temp(a.var)) {
+                    if (!value(a.left) || !(a.op.empty() || ((a.op == "+" || a.op == "-") && value(a.right))))
+                        return false;
+                    temps.insert(a.var);
+                } else {
+                    const auto x = reduction_operand(a);
+                    if (x.empty() || reductions.count(x) || !value(x))
+                        return false;
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return memory && invariants.size() + reductions.size() + peak_temps(body) + indexValue <=
+                     kVectorRegisters;
+}
+
+InterCodeArray vectorize_loops(const InterCodeArray &in) {
+    const auto &code = in.code;
+    std::unordered_map<std::string, std::size_t> refs; // 标签 -> 引用它的跳转条数
+    for (auto &ins: code) {
+        if (const auto *j = dynamic_cast<const JumpCode *>(ins.get()))
+            ++refs[j->dist];
+        else if (const auto *c = dynamic_cast<const CompareCodeIR *>(ins.get()))
+            ++refs[c->jump];
+    }
+
+    InterCodeArray out;
+    for (std::size_t p = 0; p < code.size(); ++p) {
+        const auto emit_scalar = [&] { out.append(code[p]); };
+        const auto *start = dynamic_cast<const LabelCode *>(code[p].get());
+        if (!start || p + 4 >= code.size() || refs[start->label] != 1) {
+            emit_scalar();
+            continue;
+        }
+        // 只从上面顺序进入；已经向量化过的循环不再处理
+        if (p > 0 && (code[p - 1]->kind() == IRKind::Jump || code[p - 1]->kind() == IRKind::VectorLoop)) {
+            emit_scalar();
+            continue;
+        }
+        const auto *cmp = dynamic_cast<const CompareCodeIR *>(code[p + 1].get());
+        const auto *exit = dynamic_cast<const JumpCode *>(code[p + 2].get());
+        const auto *bodyLabel = dynamic_cast<const LabelCode *>(code[p + 3].get());
+        if (!cmp || !exit || !bodyLabel || cmp->jump != bodyLabel->label || refs[bodyLabel->label] != 1) {
+            emit_scalar();
+            continue;
+        }
+
+        // 归一化成 i < B / i <= B
+        std::string index, bound, op;
+        if ((cmp->operation == "<" || cmp->operation == "<=") && is_var(cmp->left)) {
+            index = cmp->left;
+            bound = cmp->right;
+            op = cmp->operation;
+        } else if ((cmp->operation == ">" || cmp->operation == ">=") && is_var(cmp->right)) {
+            index = cmp->right;
+            bound = cmp->left;
+            op = cmp->operation == ">" ? "<" : "<=";
+        }
+        if (index.empty() || index == bound || !(is_int_literal(bound) || is_var(bound))) {
+            emit_scalar();
+            continue;
+        }
+
+        // 循环体到回边为止都是直线代码，最后一条是 i = i + 1
+        auto back = p + 4;
+        while (back < code.size() && (code[back]->kind() == IRKind::Assignment || code[back]->kind() == IRKind::Load ||
+                                      code[back]->kind() == IRKind::Store))
+            ++back;
+        const auto *jump = back < code.size() ? dynamic_cast<const JumpCode *>(code[back].get()) : nullptr;
+        if (!jump || jump->dist != start->label || back == p + 4 || !is_increment(*code[back - 1], index)) {
+            emit_scalar();
+            continue;
+        }
+        std::vector<std::shared_ptr<IRInstr> > body(code.begin() + static_cast<std::ptrdiff_t>(p + 4),
+                                                    code.begin() + static_cast<std::ptrdiff_t>(back - 1));
+        if (!vectorizable(body, index, bound)) {
+            emit_scalar();
+            continue;
+        }
+
+        auto v = std::make_shared<VectorLoopCode>();
+        v->label = start->label;
+        v->index = index;
+        v->operation = op;
+        v->bound = bound;
+        v->body = std::move(body);
+        v->line = cmp->line;
+        out.append(v);
+        emit_scalar();
+    }
+    return out;
+}
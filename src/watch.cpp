@@ -0,0 +1,554 @@
+#include "watch.hpp"
+#include "codegen.hpp"
+#include "frontend.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+struct IncrementalCompiler::Segment {
+    std::shared_ptr<Node> node;
+    std::shared_ptr<StringPool> strings; // node 中 Token 文本的存储
+    std::size_t begin = 0; // 在源码中的字节范围 [begin, end)
+    std::size_t end = 0;
+    int line = 1; // 第一个 token 现在所在的行
+    int parsedLine = 1; // 解析时第一个 token 所在的行，AST 里的行号以它为准
+    int irLine = 1; // 生成 IR 时第一个 token 所在的行
+    bool fresh = true; // 新解析出来，还没有生成过 IR
+    bool procedure = false;
+    std::unordered_map<std::string, std::string> declarations; // record_declarations() 的结果
+
+    std::string error; // IR 生成或代码生成的错误
+    GeneratedIR ir; // -O1 时已经过 local_passes()
+    std::vector<std::string> names; // IR 用到的变量、过程和数组，以及这一段声明的名字
+    std::vector<std::string> reads; // IR 读到的变量，-O1 时计入 readers_
+    std::vector<std::string> writes; // IR 写入的变量
+    bool counted = false; // reads 已经计入 readers_
+
+    bool compiled = false;
+    std::string text; // stream_chunk() 生成的 NASM 文本
+    std::vector<std::string> variables; // 留给 stream_end() 分配槽位的变量，已经计入 users_
+    CodeGenerator::StreamState state;
+};
+
+IncrementalCompiler::IncrementalCompiler(Options options) : options_(std::move(options)) {
+}
+
+IncrementalCompiler::~IncrementalCompiler() = default;
+
+static int count_lines(const std::string &text, const std::size_t from, const std::size_t to) {
+    return static_cast<int>(std::count(text.begin() + static_cast<std::ptrdiff_t>(from),
+                                       text.begin() + static_cast<std::ptrdiff_t>(to), '\n'));
+}
+
+// [from, to) 单独扫描时结尾的状态与在整个文件里相同：最后一个非空白字符是换行
+// （行注释已经结束，token 不会与后面的粘在一起），或者这一段只有空白
+static bool clean_end(const std::string &text, const std::size_t from, std::size_t to) {
+    while (to > from && (text[to - 1] == ' ' || text[to - 1] == '\t' || text[to - 1] == '\r' || text[to - 1] == '\f'))
+        --to;
+    return to == from || text[to - 1] == '\n';
+}
+
+// 变量、过程和数组的名字（V / F 开头），不含临时变量、标签、字符串常量和字面量
+static void add_name(const std::string &name, std::vector<std::string> &names) {
+    if (!name.empty() && (name[0] == 'V' || name[0] == 'F'))
+        names.push_back(name);
+}
+
+// 未经优化的 IR 里出现的名字。它们的声明变了，这一段就要重新生成
+static void collect_names(const InterCodeArray &code, std::vector<std::string> &names) {
+    for (auto &ins: code.code) {
+        switch (ins->kind()) {
+            case IRKind::Assignment: {
+                const auto &a = static_cast<const AssignmentCode &>(*ins);
+                add_name(a.var, names);
+                add_name(a.left, names);
+                add_name(a.right, names);
+                break;
+            }
+            case IRKind::Compare: {
+                const auto &c = static_cast<const CompareCodeIR &>(*ins);
+                add_name(c.left, names);
+                add_name(c.right, names);
+                break;
+            }
+            case IRKind::Print:
+                add_name(static_cast<const PrintCodeIR &>(*ins).value, names);
+                break;
+            case IRKind::Load: {
+                const auto &l = static_cast<const LoadCode &>(*ins);
+                add_name(l.var, names);
+                add_name(l.array, names);
+                add_name(l.index, names);
+                break;
+            }
+            case IRKind::Store: {
+                const auto &s = static_cast<const StoreCode &>(*ins);
+                add_name(s.array, names);
+                add_name(s.index, names);
+                add_name(s.value, names);
+                break;
+            }
+            case IRKind::Call: {
+                const auto &c = static_cast<const CallCode &>(*ins);
+                add_name(c.var, names);
+                add_name(c.proc, names);
+                for (auto &arg: c.args)
+                    add_name(arg, names);
+                break;
+            }
+            case IRKind::Return:
+                add_name(static_cast<const ReturnCode &>(*ins).value, names);
+                break;
+            case IRKind::Procedure: {
+                const auto &p = static_cast<const ProcedureCode &>(*ins);
+                add_name(p.name, names);
+                collect_names(p.body, names);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+// 赋值、选择、取值和调用写入的变量（包括过程体里的）
+static void collect_writes(const InterCodeArray &code, std::vector<std::string> &writes) {
+    for (auto &ins: code.code) {
+        if (ins->kind() == IRKind::Assignment)
+            add_name(static_cast<const AssignmentCode &>(*ins).var, writes);
+        else if (ins->kind() == IRKind::Select)
+            add_name(static_cast<const SelectCode &>(*ins).var, writes);
+        else if (ins->kind() == IRKind::Load)
+            add_name(static_cast<const LoadCode &>(*ins).var, writes);
+        else if (ins->kind() == IRKind::Call)
+            add_name(static_cast<const CallCode &>(*ins).var, writes);
+        else if (ins->kind() == IRKind::Procedure)
+            collect_writes(static_cast<const ProcedureCode &>(*ins).body, writes);
+    }
+}
+
+static void sort_unique(std::vector<std::string> &names) {
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+}
+
+// 解析结果变成段，offset 是 parsed 中的范围相对源码的起点，那里是第 line 行
+template<typename Segment>
+static std::vector<Segment> make_segments(ParsedStatements &parsed, const std::string &text,
+                                          const std::size_t offset, int line) {
+    std::vector<Segment> segments(parsed.statements.size());
+    std::size_t at = offset;
+    for (std::size_t i = 0; i < segments.size(); ++i) {
+        auto &st = parsed.statements[i];
+        auto &seg = segments[i];
+        seg.node = std::move(st.node);
+        seg.strings = parsed.strings;
+        seg.begin = offset + st.begin;
+        seg.end = offset + st.end;
+        line += count_lines(text, at, seg.begin);
+        at = seg.begin;
+        seg.line = seg.parsedLine = seg.irLine = line;
+        seg.procedure = std::dynamic_pointer_cast<ProcedureNode>(seg.node) != nullptr;
+        record_declarations(seg.node, seg.declarations);
+    }
+    return segments;
+}
+
+std::vector<IncrementalCompiler::Segment> IncrementalCompiler::reparse(const std::string &source) {
+    const std::string &old = source_;
+    std::vector<Segment> removed;
+
+    // 与上一份源码相同的前缀、后缀之外就是改动的范围：旧的 [prefix, oldEnd)，新的 [prefix, newEnd)
+    const auto limit = std::min(old.size(), source.size());
+    const auto prefix = static_cast<std::size_t>(
+        std::mismatch(old.begin(), old.begin() + static_cast<std::ptrdiff_t>(limit), source.begin()).first -
+        old.begin());
+    std::size_t suffix = 0;
+    while (suffix < limit - prefix && old[old.size() - 1 - suffix] == source[source.size() - 1 - suffix])
+        ++suffix;
+    const auto oldEnd = old.size() - suffix, newEnd = source.size() - suffix;
+    const auto delta = source.size() - old.size(); // 无符号回绕，加到后面的位置上仍然正确
+    const int lineDelta = count_lines(source, prefix, newEnd) - count_lines(old, prefix, oldEnd);
+    changeAt_ = 0;
+    if (parsed_ && prefix == old.size() && prefix == source.size())
+        return removed;
+
+    if (parsed_) {
+        // 与改动相交（首尾相接也算）的段 [a, b)，以及只需要重新解析的 [from, to)：
+        // 从前一段的结尾到后一段的开头
+        const auto n = segments_.size();
+        const auto a = static_cast<std::size_t>(
+            std::partition_point(segments_.begin(), segments_.end(),
+                                 [prefix](const Segment &s) { return s.end < prefix; }) - segments_.begin());
+        auto b = static_cast<std::size_t>(
+            std::partition_point(segments_.begin() + static_cast<std::ptrdiff_t>(a), segments_.end(),
+                                 [oldEnd](const Segment &s) { return s.begin <= oldEnd; }) - segments_.begin());
+        const auto from = a ? segments_[a - 1].end : 0;
+        const int line = a ? segments_[a - 1].line + count_lines(old, segments_[a - 1].begin, from) : 1;
+        auto until = [&](const std::size_t i) { return i < n ? segments_[i].begin + delta : source.size(); };
+        while (b < n && !clean_end(source, from, until(b)))
+            ++b;
+        const auto to = until(b);
+
+        std::vector<Segment> fresh;
+        bool bounded = false; // 单独解析不了时下面整个文件重新解析
+        try {
+            auto parsed = parse_top_level(std::string_view(source).substr(from, to - from), line);
+            fresh = make_segments<Segment>(parsed, source, from, line);
+            bounded = true;
+        } catch (const std::exception &) {
+        }
+        if (bounded) {
+            stats_.reparsed = fresh.size();
+            removed.assign(std::make_move_iterator(segments_.begin() + static_cast<std::ptrdiff_t>(a)),
+                           std::make_move_iterator(segments_.begin() + static_cast<std::ptrdiff_t>(b)));
+            for (auto i = b; i < n; ++i) {
+                segments_[i].begin += delta;
+                segments_[i].end += delta;
+                segments_[i].line += lineDelta;
+            }
+            segments_.erase(segments_.begin() + static_cast<std::ptrdiff_t>(a),
+                            segments_.begin() + static_cast<std::ptrdiff_t>(b));
+            segments_.insert(segments_.begin() + static_cast<std::ptrdiff_t>(a),
+                             std::make_move_iterator(fresh.begin()), std::make_move_iterator(fresh.end()));
+            changeAt_ = a;
+            return removed;
+        }
+    }
+
+    // 整个文件重新解析；语法错误在这里抛出，旧的段原封不动
+    auto parsed = parse_top_level(source, 1);
+    auto fresh = make_segments<Segment>(parsed, source, 0, 1);
+    stats_.reparsed = fresh.size();
+    stats_.fullParse = parsed_;
+    if (parsed_) {
+        // 在改动之外、字节范围也没变的段，扫描和解析的结果都与上一次相同，沿用上一次的 IR 和代码
+        std::unordered_map<std::size_t, std::size_t> moved; // 新的开头 -> 旧段
+        for (std::size_t i = 0; i < segments_.size(); ++i) {
+            const auto &s = segments_[i];
+            if (s.end <= prefix)
+                moved.emplace(s.begin, i);
+            else if (s.begin >= oldEnd)
+                moved.emplace(s.begin + delta, i);
+        }
+        std::vector<bool> reused(segments_.size());
+        for (auto &seg: fresh) {
+            const auto it = moved.find(seg.begin);
+            if (it == moved.end())
+                continue;
+            auto &s = segments_[it->second];
+            if (s.end + (s.begin >= oldEnd ? delta : 0) != seg.end)
+                continue;
+            reused[it->second] = true;
+            const auto begin = seg.begin, end = seg.end;
+            const int line = seg.line;
+            seg = std::move(s);
+            seg.begin = begin;
+            seg.end = end;
+            seg.line = line;
+        }
+        for (std::size_t i = 0; i < segments_.size(); ++i)
+            if (!reused[i])
+                removed.push_back(std::move(segments_[i]));
+    }
+    segments_ = std::move(fresh);
+    return removed;
+}
+
+void IncrementalCompiler::count_reads(Segment &segment, const int sign) {
+    if (options_.optLevel == 0 || segment.counted == (sign > 0))
+        return;
+    segment.counted = sign > 0;
+    for (auto &name: segment.reads) {
+        auto &n = readers_[name];
+        if (n == 0 || (n == 1 && sign < 0))
+            flipped_.insert(name);
+        n += sign;
+        if (n == 0)
+            readers_.erase(name);
+    }
+}
+
+void IncrementalCompiler::count_variables(const Segment &segment, const int sign) {
+    for (auto &name: segment.variables) {
+        auto &n = users_[name];
+        if (n == 0)
+            variables_.push_back(name);
+        n += sign;
+        if (n == 0) {
+            users_.erase(name);
+            unusedVariables_ = true;
+        }
+    }
+}
+
+void IncrementalCompiler::generate(const std::vector<Segment> &removed) {
+    // 后面的段看到的声明有变化的名字。替换是连续的一段时，比较新旧两段各自合并之后的声明就够了；
+    // 整个文件重新解析时，被替换和新解析的段声明过的名字都算变了
+    std::unordered_set<std::string> changed;
+    std::unordered_map<std::string, std::string> before, after;
+    for (auto &seg: removed)
+        for (auto &[name, type]: seg.declarations)
+            before[name] = type;
+    for (auto &seg: segments_)
+        if (seg.fresh)
+            for (auto &[name, type]: seg.declarations)
+                after[name] = type;
+    for (auto &[name, type]: before)
+        if (stats_.fullParse || !after.count(name) || after[name] != type)
+            changed.insert(name);
+    for (auto &[name, type]: after)
+        if (stats_.fullParse || !before.count(name))
+            changed.insert(name);
+
+    // 需要重新生成的段共用一个 IntermediateCodeGen：沿用的段只把声明交给它，
+    // 出错之后它的状态不再可靠，换一个新的
+    std::unique_ptr<IntermediateCodeGen> irgen;
+    declared_.clear();
+    procedures_ = 0;
+    for (std::size_t i = 0; i < segments_.size(); ++i) {
+        auto &seg = segments_[i];
+        const bool affected = i >= changeAt_ && !changed.empty();
+        const bool dirty = seg.fresh || (!seg.error.empty() && (affected || seg.line != seg.parsedLine)) ||
+                           (options_.debugInfo && seg.line != seg.irLine) ||
+                           (affected && std::any_of(seg.names.begin(), seg.names.end(),
+                                                    [&changed](const std::string &x) { return changed.count(x) > 0; }));
+        if (!dirty) {
+            if (irgen)
+                irgen->declare(seg.declarations);
+        } else {
+            if (seg.line != seg.parsedLine) {
+                // 行号变了：单独重新解析这一条，AST 里的行号才对
+                auto parsed = parse_top_level(std::string_view(source_).substr(seg.begin, seg.end - seg.begin),
+                                              seg.line);
+                if (parsed.statements.size() != 1)
+                    throw std::runtime_error("statement at line " + std::to_string(seg.line) + " changed while reparsing");
+                seg.node = std::move(parsed.statements[0].node);
+                seg.strings = std::move(parsed.strings);
+                seg.parsedLine = seg.line;
+                ++stats_.reparsed;
+            }
+            count_reads(seg, -1);
+            if (seg.compiled)
+                count_variables(seg, -1);
+            seg.irLine = seg.line;
+            seg.fresh = false;
+            seg.error.clear();
+            seg.ir = GeneratedIR();
+            seg.names.clear();
+            seg.reads.clear();
+            seg.writes.clear();
+            seg.compiled = false;
+            seg.text.clear();
+            seg.variables.clear();
+            if (!irgen)
+                irgen = std::make_unique<IntermediateCodeGen>(std::vector<std::shared_ptr<Node> >(), declared_,
+                                                              "w" + std::to_string(generators_++) + "_");
+            try {
+                seg.ir = irgen->take_statement(seg.node);
+                collect_names(seg.ir.code, seg.names);
+                for (auto &[name, type]: seg.declarations)
+                    seg.names.push_back(name);
+                sort_unique(seg.names);
+                if (options_.optLevel > 0) {
+                    for (auto &pass: local_passes())
+                        seg.ir.code = pass.run(seg.ir.code);
+                    std::unordered_set<std::string> read;
+                    collect_reads(seg.ir.code, read);
+                    for (auto &name: read)
+                        if (name[0] == 'V')
+                            seg.reads.push_back(name);
+                    collect_writes(seg.ir.code, seg.writes);
+                    sort_unique(seg.writes);
+                    count_reads(seg, 1);
+                }
+            } catch (const std::exception &e) {
+                seg.error = e.what();
+                irgen.reset();
+            }
+            ++stats_.regenerated;
+        }
+        for (auto &[name, type]: seg.declarations)
+            declared_[name] = type;
+        procedures_ += seg.procedure;
+    }
+}
+
+void IncrementalCompiler::compile_segment(Segment &segment, const CodegenOptions &cgOptions) {
+    if (segment.compiled)
+        count_variables(segment, -1);
+    segment.compiled = false;
+    segment.text.clear();
+    segment.variables.clear();
+    // 逐段的 remove_dead_assignments：这一段自己读的，加上别的段还在读的
+    InterCodeArray code;
+    if (options_.optLevel > 0) {
+        std::unordered_set<std::string> read;
+        collect_reads(segment.ir.code, read);
+        for (auto &name: segment.writes)
+            if (readers_.count(name))
+                read.insert(name);
+        code = drop_dead_assignments(segment.ir.code, read);
+    } else {
+        code = segment.ir.code;
+    }
+    try {
+        CodeGenerator codegen(cgOptions);
+        x86::NasmWriter out([&segment](const std::string_view text) { segment.text.append(text); });
+        codegen.stream_chunk(code, segment.ir.constants, segment.ir.arrays, out, &segment.variables);
+        out.flush();
+        segment.state = codegen.stream_state();
+    } catch (const std::exception &e) {
+        segment.error = e.what();
+        segment.variables.clear();
+        return;
+    }
+    segment.compiled = true;
+    count_variables(segment, 1);
+    ++stats_.recompiled;
+}
+
+bool IncrementalCompiler::whole_program() const {
+    return options_.emit != EmitKind::Asm || options_.debugInfo || options_.countInstructions ||
+           !options_.instrument.empty() || !options_.profileUse.empty() ||
+           (options_.optLevel > 0 && procedures_ > 0);
+}
+
+void IncrementalCompiler::assemble(Result &result) {
+    const auto cgOptions = codegen_options(options_);
+    std::size_t bytes = 0;
+    for (auto &seg: segments_) {
+        if (!seg.error.empty())
+            throw std::runtime_error(seg.error);
+        // 写入的变量从有人读变成没人读（或者反过来）时，删不删这些赋值的结论变了
+        if (!seg.compiled || std::any_of(seg.writes.begin(), seg.writes.end(),
+                                         [this](const std::string &x) { return flipped_.count(x) > 0; }))
+            compile_segment(seg, cgOptions);
+        if (!seg.error.empty())
+            throw std::runtime_error(seg.error);
+        bytes += seg.text.size();
+    }
+    if (unusedVariables_) {
+        variables_.erase(std::remove_if(variables_.begin(), variables_.end(),
+                                        [this](const std::string &x) { return !users_.count(x); }),
+                         variables_.end());
+        unusedVariables_ = false;
+    }
+
+    result.assembly.reserve(bytes + 4096);
+    x86::NasmWriter out([&result](const std::string_view text) { result.assembly.append(text); });
+    CodeGenerator codegen(cgOptions);
+    codegen.stream_begin(out);
+    for (auto &seg: segments_) {
+        codegen.merge(seg.state);
+        out.append(seg.text);
+    }
+    codegen.stream_end(out, variables_);
+    out.flush();
+}
+
+void IncrementalCompiler::compile_whole(Result &result) {
+    GeneratedIR ir;
+    ir.identifiers = declared_;
+    for (auto &seg: segments_) {
+        if (!seg.error.empty())
+            throw std::runtime_error(seg.error);
+        ir.code.code.insert(ir.code.code.end(), seg.ir.code.code.begin(), seg.ir.code.code.end());
+        ir.constants.insert(seg.ir.constants.begin(), seg.ir.constants.end());
+        ir.arrays.insert(seg.ir.arrays.begin(), seg.ir.arrays.end());
+    }
+    result = compile_ir(std::move(ir), pass_pipeline(options_.optLevel), options_);
+    stats_.wholeProgram = true;
+    // 这期间读者数的变化不会再逐段检查，回到逐段拼接时所有段都重新生成代码
+    for (auto &seg: segments_) {
+        if (seg.compiled)
+            count_variables(seg, -1);
+        seg.compiled = false;
+        std::string().swap(seg.text);
+        seg.variables.clear();
+    }
+}
+
+Result IncrementalCompiler::update(std::string source) {
+    const auto start = Clock::now();
+    stats_ = Stats();
+    flipped_.clear();
+    Result result;
+    try {
+        auto removed = reparse(source);
+        source_ = std::move(source);
+        parsed_ = true;
+        for (auto &seg: removed) {
+            count_reads(seg, -1);
+            if (seg.compiled)
+                count_variables(seg, -1);
+        }
+        generate(removed);
+        if (whole_program()) {
+            compile_whole(result);
+        } else {
+            assemble(result);
+            result.ok = true;
+        }
+    } catch (const std::exception &e) {
+        result.ok = false;
+        result.error = e.what();
+    }
+    stats_.statements = segments_.size();
+    stats_.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return result;
+}
+
+FileWatcher::FileWatcher(const std::string &path) {
+    const auto slash = path.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    name_ = slash == std::string::npos ? path : path.substr(slash + 1);
+    fd_ = inotify_init1(IN_CLOEXEC);
+    if (fd_ < 0)
+        throw std::runtime_error(std::string("inotify_init1: ") + std::strerror(errno));
+    if (inotify_add_watch(fd_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        const int err = errno;
+        close(fd_);
+        throw std::runtime_error("cannot watch " + dir + ": " + std::strerror(err));
+    }
+}
+
+FileWatcher::~FileWatcher() {
+    close(fd_);
+}
+
+bool FileWatcher::drain() {
+    alignas(inotify_event) char buffer[16 * 1024];
+    const auto n = read(fd_, buffer, sizeof buffer);
+    if (n < 0) {
+        if (errno == EINTR)
+            return false;
+        throw std::runtime_error(std::string("inotify read: ") + std::strerror(errno));
+    }
+    bool hit = false;
+    for (ssize_t at = 0; at < n;) {
+        const auto *event = reinterpret_cast<const inotify_event *>(buffer + at);
+        if (event->len > 0 && name_ == event->name)
+            hit = true;
+        at += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+    }
+    return hit;
+}
+
+void FileWatcher::wait(const int debounceMs) {
+    while (!drain()) {
+    }
+    // 编辑器保存一次可能产生好几个事件（截断、写入、改名），等它们都到齐
+    pollfd p{fd_, POLLIN, 0};
+    while (poll(&p, 1, debounceMs) > 0)
+        drain();
+}
@@ -0,0 +1,419 @@
+#include "x86.hpp"
+
+namespace x86 {
+
+SymbolId Module::symbol(const std::string &name) {
+    if (const auto it = ids.find(name); it != ids.end())
+        return it->second;
+    const auto id = static_cast<SymbolId>(names.size());
+    names.push_back(name);
+    ids.emplace(name, id);
+    return id;
+}
+
+void Module::ins(const Op op, const Operand &dst, const Operand &src) {
+    Instr i;
+    i.op = op;
+    i.dst = dst;
+    i.src = src;
+    text.push_back(i);
+}
+
+void Module::jmp(const SymbolId target) {
+    Instr i;
+    i.op = Op::Jmp;
+    i.target = target;
+    text.push_back(i);
+}
+
+void Module::jcc(const Cond c, const SymbolId target) {
+    Instr i;
+    i.op = Op::Jcc;
+    i.cond = c;
+    i.target = target;
+    text.push_back(i);
+}
+
+void Module::cmov(const Cond c, const Operand &dst, const Operand &src) {
+    Instr i;
+    i.op = Op::Cmov;
+    i.cond = c;
+    i.dst = dst;
+    i.src = src;
+    text.push_back(i);
+}
+
+void Module::call(const SymbolId target) {
+    Instr i;
+    i.op = Op::Call;
+    i.target = target;
+    text.push_back(i);
+}
+
+void Module::label(const SymbolId s) {
+    Instr i;
+    i.op = Op::Label;
+    i.target = s;
+    text.push_back(i);
+}
+
+void Module::line(const std::uint32_t n) {
+    Instr i;
+    i.op = Op::Line;
+    i.line = n;
+    text.push_back(i);
+}
+
+// -------------------- NASM printer --------------------
+
+static const char *reg_name(const Reg r, const Width w) {
+    static const char *q[] = {
+        "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+    };
+    static const char *d[] = {
+        "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+        "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"
+    };
+    static const char *b[] = {
+        "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+        "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"
+    };
+    static const char *x[] = {
+        "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+        "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15"
+    };
+    static const char *y[] = {
+        "ymm0", "ymm1", "ymm2", "ymm3", "ymm4", "ymm5", "ymm6", "ymm7",
+        "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15"
+    };
+    const auto i = static_cast<int>(r);
+    if (w == Width::Xmm) return x[i];
+    if (w == Width::Ymm) return y[i];
+    if (w == Width::Byte) return b[i];
+    if (w == Width::Dword) return d[i];
+    return q[i];
+}
+
+static const char *op_name(const Op op) {
+    switch (op) {
+        case Op::Mov: return "mov";
+        case Op::Add: return "add";
+        case Op::Sub: return "sub";
+        case Op::And: return "and";
+        case Op::Or: return "or";
+        case Op::Xor: return "xor";
+        case Op::Cmp: return "cmp";
+        case Op::Test: return "test";
+        case Op::Imul: return "imul";
+        case Op::Idiv: return "idiv";
+        case Op::Div: return "div";
+        case Op::Cqo: return "cqo";
+        case Op::Neg: return "neg";
+        case Op::Inc: return "inc";
+        case Op::Dec: return "dec";
+        case Op::Lea: return "lea";
+        case Op::Cmov: return "cmov";
+        case Op::Push: return "push";
+        case Op::Pop: return "pop";
+        case Op::Pushf: return "pushfq";
+        case Op::Popf: return "popfq";
+        case Op::Jmp: return "jmp";
+        case Op::Call: return "call";
+        case Op::Ret: return "ret";
+        case Op::Syscall: return "syscall";
+        case Op::Movdqu: return "movdqu";
+        case Op::Movdqa: return "movdqa";
+        case Op::Movq: return "movq";
+        case Op::Paddq: return "paddq";
+        case Op::Psubq: return "psubq";
+        case Op::Pxor: return "pxor";
+        case Op::Punpcklqdq: return "punpcklqdq";
+        case Op::Vpbroadcastq: return "vpbroadcastq";
+        case Op::Vzeroupper: return "vzeroupper";
+        case Op::Cpuid: return "cpuid";
+        case Op::Xgetbv: return "xgetbv";
+        default: return "";
+    }
+}
+
+// 256 位的向量指令：助记符前加 v，运算指令写成三操作数
+static bool vex256(const Instr &i) {
+    return (i.dst.kind == Operand::Kind::Reg && i.dst.width == Width::Ymm) ||
+           (i.src.kind == Operand::Kind::Reg && i.src.width == Width::Ymm);
+}
+
+static bool vector_alu(const Op op) { return op == Op::Paddq || op == Op::Psubq || op == Op::Pxor; }
+
+static const char *cond_name(const Cond c) {
+    static const char *names[] = {
+        "o", "no", "b", "ae", "e", "ne", "be", "a",
+        "s", "ns", "p", "np", "l", "ge", "le", "g"
+    };
+    return names[static_cast<int>(c)];
+}
+
+NasmWriter::NasmWriter(Sink sink) : sink_(std::move(sink)) {
+    buf_.reserve(kFlushBytes + 256);
+}
+
+void NasmWriter::flush() {
+    if (!buf_.empty())
+        sink_(buf_);
+    buf_.clear();
+}
+
+void NasmWriter::append(const std::string_view text) {
+    if (buf_.size() + text.size() < kFlushBytes) {
+        buf_.append(text.data(), text.size());
+        return;
+    }
+    flush();
+    sink_(text);
+}
+
+// 一行结束；缓冲区满了就整块交出去（clear() 保留容量，之后不再分配）
+void NasmWriter::end_line() {
+    buf_.push_back('\n');
+    if (buf_.size() >= kFlushBytes)
+        flush();
+}
+
+void NasmWriter::put_int(const std::int64_t v) {
+    char digits[20];
+    char *p = digits + sizeof digits;
+    // 取绝对值时先转成无符号，INT64_MIN 也不会溢出
+    std::uint64_t u = v < 0 ? 0 - static_cast<std::uint64_t>(v) : static_cast<std::uint64_t>(v);
+    do {
+        *--p = static_cast<char>('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    if (v < 0)
+        put('-');
+    buf_.append(p, digits + sizeof digits - p);
+}
+
+std::string_view NasmWriter::mem_spelling(const Module &m, const SymbolId id) {
+    auto &[offset, size] = spelling_[id];
+    if (size == 0) {
+        offset = static_cast<std::uint32_t>(spellings_.size());
+        spellings_.push_back('[');
+        spellings_.append(m.name(id));
+        spellings_.push_back(']');
+        size = static_cast<std::uint32_t>(spellings_.size() - offset);
+    }
+    return std::string_view(spellings_).substr(offset, size);
+}
+
+void NasmWriter::put_operand(const Module &m, const Operand &o, const bool sized) {
+    switch (o.kind) {
+        case Operand::Kind::Reg:
+            put(reg_name(o.reg, o.width));
+            return;
+        case Operand::Kind::Imm:
+            put_int(o.value);
+            return;
+        case Operand::Kind::Addr:
+            put(m.name(o.sym));
+            return;
+        case Operand::Kind::Mem:
+            break;
+        case Operand::Kind::None:
+            return;
+    }
+    if (sized)
+        put(o.width == Width::Byte ? "byte " : o.width == Width::Dword ? "dword " : "qword ");
+    // 最常见的 [name]
+    if (o.reg == Reg::None && o.index == Reg::None && o.sym != NoSymbol && o.value == 0) {
+        put(mem_spelling(m, o.sym));
+        return;
+    }
+    put('[');
+    bool first = true;
+    if (o.reg != Reg::None) {
+        put(reg_name(o.reg, Width::Qword));
+        first = false;
+    }
+    if (o.index != Reg::None) {
+        if (!first) put('+');
+        put(reg_name(o.index, Width::Qword));
+        if (o.scale != 1) {
+            put('*');
+            put_int(o.scale);
+        }
+        first = false;
+    }
+    if (o.sym != NoSymbol) {
+        if (!first) put('+');
+        put(m.name(o.sym));
+        first = false;
+    }
+    if (o.value > 0 || (first && o.value == 0)) {
+        if (!first) put('+');
+        put_int(o.value);
+    } else if (o.value < 0) {
+        put_int(o.value);
+    }
+    put(']');
+}
+
+// db 的参数：可打印字符放进引号，其余写成数字，末尾不自动补 0
+void NasmWriter::put_db(const std::string &bytes) {
+    bool inQuote = false, first = true;
+    for (const char ch: bytes) {
+        const auto c = static_cast<unsigned char>(ch);
+        if (c >= 0x20 && c < 0x7f && c != '"') {
+            if (!inQuote) {
+                if (!first) put(", ");
+                put('"');
+                inQuote = true;
+            }
+            put(ch);
+        } else {
+            if (inQuote) {
+                put('"');
+                inQuote = false;
+            }
+            if (!first) put(", ");
+            put_int(c);
+        }
+        first = false;
+    }
+    if (inQuote) put('"');
+}
+
+void NasmWriter::write(const Module &m, const bool fragment) {
+    // 缓存只对这一个 Module 有效（流式输出的每一段都是新的 Module）
+    spellings_.clear();
+    spelling_.assign(m.symbolCount(), {0, 0});
+
+    auto section = [&](const char *name) {
+        put("section ");
+        put(name);
+        if (!fragment) {
+            put(" align=");
+            put_int(kDataSectionAlign);
+        }
+        end_line();
+    };
+    if (!fragment || !m.bss.empty())
+        section(".bss");
+    for (auto &b: m.bss) {
+        if (b.align) {
+            put("\talignb ");
+            put_int(b.align);
+            end_line();
+        }
+        put('\t');
+        put(m.name(b.sym));
+        put(" resb ");
+        put_int(b.size);
+        end_line();
+    }
+
+    // align 默认用 nop 填充，数据里补 0
+    for (const auto &[name, items]: {std::make_pair(".rodata", &m.rodata), std::make_pair(".data", &m.data)}) {
+        if (fragment && items->empty())
+            continue;
+        section(name);
+        for (auto &d: *items) {
+            if (d.align) {
+                put("\talign ");
+                put_int(d.align);
+                put(", db 0");
+                end_line();
+            }
+            put('\t');
+            put(m.name(d.sym));
+            put(" db ");
+            put_db(d.bytes);
+            end_line();
+        }
+    }
+
+    if (!fragment || !m.text.empty()) {
+        put("section .text");
+        end_line();
+    }
+    for (const auto g: m.globals) {
+        put("\tglobal ");
+        put(m.name(g));
+        end_line();
+    }
+
+    for (auto &i: m.text) {
+        switch (i.op) {
+            case Op::Label: {
+                const auto &n = m.name(i.target);
+                if (n[0] != '.' && n[0] != 'L') end_line();
+                put(n);
+                put(':');
+                break;
+            }
+            case Op::Align:
+                put("\talign ");
+                put_int(i.align);
+                break;
+            case Op::Line:
+                // +0：直到下一条 %line，之后的每一行都算作这一行（nasm -g -F dwarf 时写进行号表）
+                put("%line ");
+                put_int(i.line);
+                put("+0 ");
+                put(m.sourceName);
+                break;
+            case Op::Jmp:
+            case Op::Call:
+                put('\t');
+                put(op_name(i.op));
+                put(' ');
+                put(m.name(i.target));
+                break;
+            case Op::Jcc:
+                put("\tj");
+                put(cond_name(i.cond));
+                put(' ');
+                put(m.name(i.target));
+                break;
+            default: {
+                put('\t');
+                const bool vex = vex256(i) && i.op != Op::Vpbroadcastq;
+                if (vex)
+                    put('v');
+                put(op_name(i.op));
+                if (i.op == Op::Cmov)
+                    put(cond_name(i.cond));
+                if (vex && vector_alu(i.op)) {
+                    put(' ');
+                    put_operand(m, i.dst, false);
+                    put(", ");
+                    put_operand(m, i.dst, false);
+                    put(", ");
+                    put_operand(m, i.src, false);
+                    break;
+                }
+                // 没有寄存器操作数时，内存操作数需要写明宽度
+                const bool sized = i.op != Op::Lea &&
+                                   i.dst.kind != Operand::Kind::Reg && i.src.kind != Operand::Kind::Reg;
+                if (i.dst.kind != Operand::Kind::None) {
+                    put(' ');
+                    put_operand(m, i.dst, sized);
+                }
+                if (i.src.kind != Operand::Kind::None) {
+                    put(", ");
+                    put_operand(m, i.src, sized);
+                }
+            }
+        }
+        end_line();
+    }
+}
+
+std::string to_nasm(const Module &m) {
+    std::string out;
+    NasmWriter writer([&out](const std::string_view text) { out.append(text); });
+    writer.write(m);
+    writer.flush();
+    return out;
+}
+
+} // namespace x86